@@ -0,0 +1,509 @@
+//
+//  FeatureTrack.cpp
+//  libprojectM
+//
+//
+
+#include "FeatureTrack.hpp"
+#include "BeatDetect.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool readFile(const std::string &path, std::vector<char> &contents)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0)
+    {
+        fclose(f);
+        return false;
+    }
+    contents.resize(size);
+    bool ok = size == 0 || fread(contents.data(), size, 1, f) == 1;
+    fclose(f);
+    return ok;
+}
+
+uint32_t readLE32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+uint16_t readLE16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+// locate the sample data of a RIFF WAVE file and describe it
+bool parseWav(const std::vector<char> &file, FeatureTrack::RawFormat &format,
+              size_t &dataOffset, size_t &dataSize, std::string &error)
+{
+    if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) || memcmp(file.data() + 8, "WAVE", 4))
+    {
+        error = "not a RIFF WAVE file";
+        return false;
+    }
+
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= file.size())
+    {
+        const char *chunk = file.data() + pos;
+        size_t size = readLE32(chunk + 4);
+        size_t body = pos + 8;
+        size = std::min(size, file.size() - body);
+
+        if (!memcmp(chunk, "fmt ", 4) && size >= 16)
+        {
+            uint16_t tag = readLE16(chunk + 8);
+            format.channels = readLE16(chunk + 10);
+            format.sampleRate = readLE32(chunk + 12);
+            uint16_t bits = readLE16(chunk + 22);
+            if (tag == 0xFFFE && size >= 26)   // WAVE_FORMAT_EXTENSIBLE, sub format tag leads the GUID
+                tag = readLE16(chunk + 32);
+
+            if (tag == 3 && bits == 32)
+                format.format = PCM_FORMAT_FLOAT;
+            else if (tag == 1 && bits == 16)
+                format.format = PCM_FORMAT_INT16;
+            else if (tag == 1 && bits == 32)
+                format.format = PCM_FORMAT_INT32;
+            else if (tag == 1 && bits == 8)
+                format.format = PCM_FORMAT_UINT8;
+            else
+            {
+                error = "unsupported WAV sample format";
+                return false;
+            }
+            haveFormat = true;
+        }
+        else if (!memcmp(chunk, "data", 4))
+        {
+            if (!haveFormat)
+            {
+                error = "WAV data chunk before fmt chunk";
+                return false;
+            }
+            dataOffset = body;
+            dataSize = size;
+            return true;
+        }
+        pos = body + size + (size & 1);
+    }
+
+    error = "WAV file has no data chunk";
+    return false;
+}
+
+size_t bytesPerSample(PCM_FORMAT format)
+{
+    switch (format)
+    {
+        case PCM_FORMAT_INT16: return 2;
+        case PCM_FORMAT_UINT8: return 1;
+        case PCM_FORMAT_INT32:
+        case PCM_FORMAT_FLOAT:
+        default: return 4;
+    }
+}
+
+// append the samples the PCM received since 'written' to audio, oldest first
+void appendNormalized(PCM &pcm, size_t &written, std::vector<int16_t> &audio)
+{
+    float left[PCM::maxsamples];
+    float right[PCM::maxsamples];
+    size_t count = pcm.sampleCount() - written;
+    written = pcm.sampleCount();
+    if (count == 0)
+        return;
+
+    pcm.getPCM(left, CHANNEL_0, count, 0);
+    pcm.getPCM(right, CHANNEL_1, count, 0);
+    for (size_t i = count; i-- > 0;)
+    {
+        audio.push_back((int16_t)std::max(-32768.0f, std::min(32767.0f, roundf(left[i] * 16384))));
+        audio.push_back((int16_t)std::max(-32768.0f, std::min(32767.0f, roundf(right[i] * 16384))));
+    }
+}
+
+}
+
+
+FeatureTrack::FeatureTrack() : _header(nullptr), _frames(nullptr), _audio(nullptr), _mapping(nullptr), _mappingSize(0) {}
+
+FeatureTrack::~FeatureTrack()
+{
+    close();
+}
+
+void FeatureTrack::close()
+{
+#ifndef WIN32
+    if (_mapping)
+        munmap(_mapping, _mappingSize);
+#endif
+    _mapping = nullptr;
+    _mappingSize = 0;
+    _buffer.clear();
+    _header = nullptr;
+    _frames = nullptr;
+    _audio = nullptr;
+}
+
+bool FeatureTrack::open(const std::string &path)
+{
+    close();
+
+    const char *data = nullptr;
+    size_t size = 0;
+#ifndef WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            _mapping = mapping;
+            _mappingSize = st.st_size;
+            data = (const char *)mapping;
+            size = _mappingSize;
+        }
+    }
+    ::close(fd);
+#else
+    if (readFile(path, _buffer))
+    {
+        data = _buffer.data();
+        size = _buffer.size();
+    }
+#endif
+    if (data == nullptr || size < sizeof(FeatureTrackHeader))
+    {
+        close();
+        return false;
+    }
+
+    const FeatureTrackHeader *header = (const FeatureTrackHeader *)data;
+    if (header->magic != FEATURE_TRACK_MAGIC || header->version != FEATURE_TRACK_VERSION ||
+        header->bands != SPECTRUM_BANDS || header->fps == 0 ||
+        header->framesOffset + (uint64_t)header->frameCount * sizeof(FeatureTrackFrame) > size ||
+        header->audioOffset + header->audioFrames * 2 * sizeof(int16_t) > size)
+    {
+        std::cerr << "[FeatureTrack] " << path << " is not a valid feature track" << std::endl;
+        close();
+        return false;
+    }
+
+    // replay reads each frame's audio straight from the mapping
+    const FeatureTrackFrame *frames = (const FeatureTrackFrame *)(data + header->framesOffset);
+    uint32_t audioEnd = 0;
+    for (size_t i = 0; i < header->frameCount; i++)
+    {
+        if (frames[i].audioEnd < audioEnd || frames[i].audioEnd > header->audioFrames)
+        {
+            std::cerr << "[FeatureTrack] " << path << " has frames outside its audio" << std::endl;
+            close();
+            return false;
+        }
+        audioEnd = frames[i].audioEnd;
+    }
+
+    _header = header;
+    _frames = frames;
+    _audio = (const int16_t *)(data + header->audioOffset);
+    return true;
+}
+
+void FeatureTrack::feedAudio(size_t index, PCM &pcm, size_t &audioEnd) const
+{
+    size_t end = _frames[index].audioEnd;
+    if (end <= audioEnd)
+        return;
+    pcm.addPCMNormalized(_audio + 2 * audioEnd, end - audioEnd);
+    audioEnd = end;
+}
+
+bool FeatureTrack::analyze(const std::string &audioPath, const std::string &trackPath, unsigned fps,
+                           std::string &error, const RawFormat *raw)
+{
+    if (fps == 0)
+    {
+        error = "fps must be positive";
+        return false;
+    }
+
+    std::vector<char> file;
+    if (!readFile(audioPath, file))
+    {
+        error = "cannot read " + audioPath;
+        return false;
+    }
+
+    RawFormat format;
+    size_t dataOffset = 0, dataSize = file.size();
+    if (raw)
+        format = *raw;
+    else if (!parseWav(file, format, dataOffset, dataSize, error))
+        return false;
+    if (format.channels == 0 || format.sampleRate == 0)
+    {
+        error = "invalid channel count or sample rate";
+        return false;
+    }
+
+    const char *samples = file.data() + dataOffset;
+    const size_t frameBytes = bytesPerSample(format.format) * format.channels;
+    const size_t inputFrames = dataSize / frameBytes;
+    const double inputPerVideoFrame = (double)format.sampleRate / fps;
+    // keep each chunk well inside what getPCM() can hand back
+    const size_t chunk = std::max<size_t>(1, (size_t)512 * format.sampleRate / PCM::analysisRate);
+
+    PCM pcm;
+    BeatDetect beatDetect(&pcm);
+    std::vector<FeatureTrackFrame> frames;
+    std::vector<int16_t> audio;
+    size_t consumed = 0, written = 0;
+
+    for (size_t index = 0;; index++)
+    {
+        size_t target = (size_t)((index + 1) * inputPerVideoFrame + 0.5);
+        if (target > inputFrames)
+            break;
+        while (consumed < target)
+        {
+            size_t count = std::min(chunk, target - consumed);
+            pcm.addPCM(samples + consumed * frameBytes, format.format, format.channels, count, format.sampleRate);
+            consumed += count;
+            appendNormalized(pcm, written, audio);
+        }
+
+        beatDetect.detectFromSamples();
+
+        FeatureTrackFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.bass = beatDetect.bass;
+        frame.mid = beatDetect.mid;
+        frame.treb = beatDetect.treb;
+        frame.vol = beatDetect.vol;
+        frame.bass_att = beatDetect.bass_att;
+        frame.mid_att = beatDetect.mid_att;
+        frame.treb_att = beatDetect.treb_att;
+        frame.vol_att = beatDetect.vol_att;
+        frame.onset = beatDetect.onset;
+        frame.audioEnd = audio.size() / 2;
+
+        float spectrum[FFT_LENGTH];
+        pcm.getSpectrum(spectrum, CHANNEL_0, FFT_LENGTH, 0);
+        PCM::spectrumBands(spectrum, frame.bandsL);
+        pcm.getSpectrum(spectrum, CHANNEL_1, FFT_LENGTH, 0);
+        PCM::spectrumBands(spectrum, frame.bandsR);
+
+        frames.push_back(frame);
+    }
+
+    FeatureTrackHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FEATURE_TRACK_MAGIC;
+    header.version = FEATURE_TRACK_VERSION;
+    header.fps = fps;
+    header.sampleRate = PCM::analysisRate;
+    header.frameCount = frames.size();
+    header.bands = SPECTRUM_BANDS;
+    header.audioFrames = audio.size() / 2;
+    header.framesOffset = (sizeof(header) + 7) & ~(uint64_t)7;
+    header.audioOffset = (header.framesOffset + frames.size() * sizeof(FeatureTrackFrame) + 7) & ~(uint64_t)7;
+
+    FILE *out = fopen(trackPath.c_str(), "wb");
+    if (out == nullptr)
+    {
+        error = "cannot write " + trackPath;
+        return false;
+    }
+    static const char padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(padding, header.framesOffset - sizeof(header), 1, out) <= 1;
+    ok = ok && (frames.empty() || fwrite(frames.data(), sizeof(FeatureTrackFrame), frames.size(), out) == frames.size());
+    ok = ok && fwrite(padding, header.audioOffset - header.framesOffset - frames.size() * sizeof(FeatureTrackFrame), 1, out) <= 1;
+    ok = ok && (audio.empty() || fwrite(audio.data(), sizeof(int16_t), audio.size(), out) == audio.size());
+    ok = (fclose(out) == 0) && ok;
+    if (!ok)
+        error = "error writing " + trackPath;
+    return ok;
+}
+
+
+
+// TESTS
+
+
+#include "TestRunner.hpp"
+
+#ifndef NDEBUG
+
+#include <cstdlib>
+
+#define TEST(cond) if (!verify(__FILE__ ": " #cond,cond)) return false
+
+struct FeatureTrackTest : public Test
+{
+    FeatureTrackTest() : Test("FeatureTrackTest")
+    {}
+
+public:
+
+    static std::string temporaryPath(const char *name)
+    {
+        const char *dir = getenv("TMPDIR");
+        if (dir == nullptr || *dir == 0)
+            dir = getenv("TEMP");
+        return std::string(dir && *dir ? dir : ".") + "/" + name;
+    }
+
+    static bool writeFile(const std::string &path, const void *data, size_t size)
+    {
+        FILE *f = fopen(path.c_str(), "wb");
+        if (f == nullptr)
+            return false;
+        bool ok = fwrite(data, size, 1, f) == 1;
+        return fclose(f) == 0 && ok;
+    }
+
+    // the track of two seconds of beeps, recorded and then replayed the way projectM does
+    bool test_roundtrip(const std::string &audioPath, const std::string &trackPath)
+    {
+        const unsigned rate = 48000;
+        std::vector<float> samples(2 * rate * 2);
+        for (size_t i = 0; i < samples.size() / 2; i++)
+        {
+            float beep = (i / (rate / 4)) % 2 ? 0.0f : 0.5f;
+            samples[2 * i] = beep * sinf(i * 0.05f);
+            samples[2 * i + 1] = beep * sinf(i * 0.07f);
+        }
+        TEST(writeFile(audioPath, samples.data(), samples.size() * sizeof(float)));
+
+        FeatureTrack::RawFormat raw;
+        raw.sampleRate = rate;
+        std::string error;
+        TEST(FeatureTrack::analyze(audioPath, trackPath, 30, error, &raw));
+
+        FeatureTrack track;
+        TEST(track.open(trackPath));
+        TEST(track.fps() == 30);
+        TEST(track.frameCount() == 60);
+        TEST(track.frame(track.frameCount() - 1).audioEnd == track.audioFrames());
+
+        // every frame adds just its own hop, the PCM ends up holding the recorded audio
+        PCM pcm;
+        size_t audioEnd = 0;
+        for (size_t i = 0; i < track.frameCount(); i++)
+        {
+            track.feedAudio(i, pcm, audioEnd);
+            TEST(audioEnd == track.frame(i).audioEnd);
+            TEST(pcm.sampleCount() == audioEnd);
+        }
+        track.feedAudio(track.frameCount() - 1, pcm, audioEnd);
+        TEST(pcm.sampleCount() == track.audioFrames());
+
+        // a beep starts at 0.5s, its onset stands out from the held tone of the frames after it
+        const FeatureTrackFrame &start = track.frame(15), &held = track.frame(20);
+        TEST(start.onset > held.onset);
+        TEST(start.bandsL[SPECTRUM_BANDS - 1] >= 0 && held.bandsR[0] >= 0);
+
+        // with the bands set getSpectrum() serves the track's spectrum, not the FFT of the audio
+        const FeatureTrackFrame &last = track.frame(track.frameCount() - 1);
+        float spectrum[FFT_LENGTH];
+        pcm.setSpectrumBands(last.bandsL, last.bandsR);
+        pcm.getSpectrum(spectrum, CHANNEL_0, FFT_LENGTH, 0);
+        TEST(spectrum[0] == last.bandsL[0]);
+        TEST(spectrum[FFT_LENGTH - 1] == last.bandsL[SPECTRUM_BANDS - 1]);
+        pcm.getSpectrum(spectrum, CHANNEL_1, FFT_LENGTH, 0);
+        float bands[SPECTRUM_BANDS];
+        PCM::spectrumBands(spectrum, bands);
+        for (int band = 0; band < SPECTRUM_BANDS; band++)
+            TEST(fabsf(bands[band] - last.bandsR[band]) <= 1e-6f * fabsf(last.bandsR[band]));
+        pcm.clearSpectrumBands();
+
+        float left[64], right[64];
+        pcm.getPCM(left, CHANNEL_0, 64, 0);
+        pcm.getPCM(right, CHANNEL_1, 64, 0);
+        for (size_t i = 0; i < 64; i++)
+        {
+            const int16_t *frame = track.audio() + 2 * (track.audioFrames() - 1 - i);
+            TEST(fabsf(left[i] - frame[0] / 16384.0f) < 1e-6f);
+            TEST(fabsf(right[i] - frame[1] / 16384.0f) < 1e-6f);
+        }
+        return true;
+    }
+
+    // frames whose audio lies outside the file are rejected before replay reads it
+    bool test_corrupt(const std::string &trackPath, const std::string &corruptPath)
+    {
+        std::vector<char> file;
+        TEST(readFile(trackPath, file));
+        const FeatureTrackHeader *header = (const FeatureTrackHeader *)file.data();
+        FeatureTrackFrame *frames = (FeatureTrackFrame *)(file.data() + header->framesOffset);
+
+        FeatureTrack track;
+        uint32_t audioEnd = frames[10].audioEnd;
+        frames[10].audioEnd = (uint32_t)header->audioFrames + 1;
+        TEST(writeFile(corruptPath, file.data(), file.size()));
+        TEST(!track.open(corruptPath));
+
+        frames[10].audioEnd = frames[9].audioEnd - 1;
+        TEST(writeFile(corruptPath, file.data(), file.size()));
+        TEST(!track.open(corruptPath));
+
+        frames[10].audioEnd = audioEnd;
+        TEST(writeFile(corruptPath, file.data(), file.size()));
+        TEST(track.open(corruptPath));
+        return true;
+    }
+
+    bool test() override
+    {
+        std::string audioPath = temporaryPath("projectM-FeatureTrackTest.raw");
+        std::string trackPath = temporaryPath("projectM-FeatureTrackTest.track");
+        std::string corruptPath = temporaryPath("projectM-FeatureTrackTest-corrupt.track");
+        bool ok = test_roundtrip(audioPath, trackPath) && test_corrupt(trackPath, corruptPath);
+        remove(audioPath.c_str());
+        remove(trackPath.c_str());
+        remove(corruptPath.c_str());
+        return ok;
+    }
+};
+
+Test* FeatureTrack::test()
+{
+    return new FeatureTrackTest();
+}
+
+#else
+
+Test* FeatureTrack::test()
+{
+    return nullptr;
+}
+
+#endif
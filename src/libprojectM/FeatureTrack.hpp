@@ -0,0 +1,112 @@
+//
+//  FeatureTrack.hpp
+//  libprojectM
+//
+//  Precomputed audio analysis. FeatureTrack::analyze() runs the PCM + BeatDetect
+//  pipeline over an audio file once and writes one record per video frame (spectrum
+//  bands, beat values, onset) plus the level-normalized audio. projectM::loadFeatureTrack()
+//  replays it in place of live analysis, so repeated renders of the same track skip the
+//  FFT and are reproducible. The audio is only fed for the waveforms.
+//
+//  File layout (native endian, every section 8 byte aligned):
+//    FeatureTrackHeader
+//    FeatureTrackFrame[frameCount]
+//    int16_t audio[audioFrames][2]    interleaved stereo, 1.0 == 16384
+//
+
+#ifndef FeatureTrack_hpp
+#define FeatureTrack_hpp
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "PCM.hpp"
+
+class Test;
+
+#define FEATURE_TRACK_MAGIC 0x54464d50   // "PMFT"
+#define FEATURE_TRACK_VERSION 3
+
+struct FeatureTrackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fps;
+    uint32_t sampleRate;
+    uint32_t frameCount;
+    uint32_t bands;   // SPECTRUM_BANDS
+    uint64_t audioFrames;
+    uint64_t framesOffset;
+    uint64_t audioOffset;
+};
+
+struct FeatureTrackFrame
+{
+    float bass, mid, treb, vol;
+    float bass_att, mid_att, treb_att, vol_att;
+    float onset;
+    // audio frame index just past the newest sample of this video frame, never decreasing
+    uint32_t audioEnd;
+    // PCM::spectrumBands() of each channel's spectrum
+    float bandsL[SPECTRUM_BANDS];
+    float bandsR[SPECTRUM_BANDS];
+};
+
+class FeatureTrack
+{
+public:
+    /// Layout of headerless input files
+    struct RawFormat
+    {
+        PCM_FORMAT format;
+        unsigned channels;
+        unsigned sampleRate;
+
+        RawFormat() : format(PCM_FORMAT_FLOAT), channels(2), sampleRate(PCM::analysisRate) {}
+    };
+
+    FeatureTrack();
+    ~FeatureTrack();
+
+    /// Memory-maps a track written by analyze(). Returns false if it is missing or malformed,
+    /// including frames whose audio runs past the end of the file.
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return _header != nullptr; }
+
+    unsigned fps() const { return _header->fps; }
+    size_t frameCount() const { return _header->frameCount; }
+    const FeatureTrackFrame &frame(size_t index) const { return _frames[index]; }
+
+    /// Interleaved stereo audio, audioFrames() frames
+    const int16_t *audio() const { return _audio; }
+    size_t audioFrames() const { return _header->audioFrames; }
+
+    /**
+     * Adds the audio of frame index that is not in pcm yet. audioEnd is where the frames
+     * fed before ended and is moved to the end of this one, so every sample goes in once.
+     */
+    void feedAudio(size_t index, PCM &pcm, size_t &audioEnd) const;
+
+    /**
+     * Analyses audioPath (RIFF WAV, or headerless samples described by raw when raw != nullptr)
+     * at fps analysis frames per second and writes the track to trackPath.
+     * On failure returns false and sets error.
+     */
+    static bool analyze(const std::string &audioPath, const std::string &trackPath, unsigned fps,
+                        std::string &error, const RawFormat *raw = nullptr);
+
+    static Test* test();
+
+private:
+    const FeatureTrackHeader *_header;
+    const FeatureTrackFrame *_frames;
+    const int16_t *_audio;
+
+    void *_mapping;
+    size_t _mappingSize;
+    std::vector<char> _buffer;   // used where mmap is unavailable
+};
+
+#endif /* FeatureTrack_hpp */
@@ -5,21 +5,192 @@
 //
 
 #include "FileScanner.hpp"
+#include "FileSystem.hpp"
+#include "PackFile.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <sys/stat.h>
+
+#ifdef USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#ifdef HAVE_FTS_H
+namespace {
+
+// a listed directory stays open while its subdirectories wait to be opened relative to it
+struct Descriptor
+{
+    int fd;
+
+    explicit Descriptor(int _fd) : fd(_fd) {}
+    ~Descriptor() { close(fd); }
+};
+
+}
+#endif
+
+struct FileScanner::Pending
+{
+    std::string path;
+    bool root;
+    // the directories above this one, a symlink back to one of them is a loop
+    std::vector<std::pair<uint64_t, uint64_t> > ancestors;
+#ifdef HAVE_FTS_H
+    std::shared_ptr<Descriptor> parent;    // NULL for the roots
+    std::string name;
+#endif
+};
+
 
 FileScanner::FileScanner() {}
 
-FileScanner::FileScanner(std::vector<std::string> &rootDirs, std::vector<std::string> &extensions) : _rootDirs(rootDirs), _extensions(extensions) {}
+FileScanner::FileScanner(std::vector<std::string> &rootDirs, std::vector<std::string> &extensions) : _rootDirs(rootDirs), _extensions(extensions)
+{
+    // matched against file names without copying them to lower case
+    for (size_t i = 0; i < _extensions.size(); i++)
+        std::transform(_extensions[i].begin(), _extensions[i].end(), _extensions[i].begin(), tolower);
+}
 
 void FileScanner::scan(ScanCallback cb) {
-#ifdef HAVE_FTS_H
-	scanPosix(cb);
+    std::map<std::string, Directory> directories;
+    scanDirectories([&directories](std::vector<Directory> &batch) {
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            Directory &directory = directories[batch[i].path];
+            directory.path.swap(batch[i].path);
+            directory.mtime = batch[i].mtime;
+            directory.entries.swap(batch[i].entries);
+        }
+    });
+
+    // the order the fts walk with fts_compare used to give
+    for (size_t i = 0; i < _rootDirs.size(); i++)
+        report(directories, _rootDirs[i], cb);
+}
+
+void FileScanner::report(const std::map<std::string, Directory> &directories, const std::string &path, ScanCallback &cb) const
+{
+    std::map<std::string, Directory>::const_iterator it = directories.find(path);
+    if (it == directories.end())
+        return;
+
+    // no doubled separator after a root given with a trailing one, like fts_path
+    std::string prefix = path;
+    if (prefix.empty() || (prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != PATH_SEPARATOR))
+        prefix += PATH_SEPARATOR;
+
+    const std::vector<Directory::Entry> &entries = it->second.entries;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        std::string childPath = prefix + entries[i].name;
+        if (entries[i].directory)
+        {
+            report(directories, childPath, cb);
+            continue;
+        }
+
+        // members of a pack are listed with their directories in the name
+        std::string name = entries[i].name.substr(entries[i].name.find_last_of('/') + 1);
+        std::string nameMatched = extensionMatches(name);
+        cb(childPath, nameMatched);
+    }
+}
+
+void FileScanner::scanDirectories(BatchCallback cb)
+{
+    // depth first, fewer parent descriptors are held open than breadth first
+    std::vector<Pending> stack;
+    for (size_t i = _rootDirs.size(); i-- > 0;)
+    {
+        Pending root;
+        root.path = _rootDirs[i];
+        root.root = true;
+        stack.push_back(root);
+    }
+
+    std::vector<Directory> finished;
+
+#ifdef USE_THREADS
+    std::mutex mutex;
+    std::condition_variable wake;
+    size_t busy = 0;
+
+    auto work = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [&] { return !stack.empty() || busy == 0; });
+            if (stack.empty())
+                return;
+
+            Pending pending = stack.back();
+            stack.pop_back();
+            busy++;
+            lock.unlock();
+
+            Directory directory;
+            std::vector<Pending> subdirectories;
+            bool listed = listDirectory(pending, directory, subdirectories);
+            pending = Pending();
+
+            lock.lock();
+            busy--;
+            if (listed)
+                finished.push_back(std::move(directory));
+            stack.insert(stack.end(), subdirectories.rbegin(), subdirectories.rend());
+            subdirectories.clear();
+            wake.notify_all();
+        }
+    };
+
+    // listing waits on the disk or the network far more than on a core
+    unsigned int count = std::thread::hardware_concurrency() * 2;
+    count = std::max(2u, std::min(8u, count));
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < count; i++)
+        threads.push_back(std::thread(work));
+
+    // hand over what has been listed while the pool keeps going
+    std::vector<Directory> batch;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wake.wait(lock, [&] { return !finished.empty() || (stack.empty() && busy == 0); });
+            if (finished.empty())
+                break;
+            batch.swap(finished);
+            lock.unlock();
+            cb(batch);
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
 #else
-	for (auto dir : _rootDirs)
-		scanGeneric(cb, dir.c_str());
+    while (!stack.empty())
+    {
+        Pending pending = stack.back();
+        stack.pop_back();
+
+        Directory directory;
+        std::vector<Pending> subdirectories;
+        if (listDirectory(pending, directory, subdirectories))
+            finished.push_back(std::move(directory));
+        stack.insert(stack.end(), subdirectories.rbegin(), subdirectories.rend());
+    }
+    if (!finished.empty())
+        cb(finished);
 #endif
 }
 
-void FileScanner::handleDirectoryError(std::string dir) {
+void FileScanner::handleDirectoryError(const std::string &dir) const {
 #ifndef HAVE_FTS_H
 	  std::cerr << "[PresetLoader] warning: errno unsupported on win32, etc platforms. fix me" << std::endl;
 #else
@@ -52,21 +223,18 @@ void FileScanner::handleDirectoryError(std::string dir) {
 #endif
 }
 
-std::string FileScanner::extensionMatches(std::string &filename) {
+std::string FileScanner::extensionMatches(const std::string &filename) const {
     // returns file name without extension
-    // TODO: optimize me
-
-    std::string lowerCaseFileName(filename);
-    std::transform(lowerCaseFileName.begin(), lowerCaseFileName.end(), lowerCaseFileName.begin(), tolower);
 
-    // Remove extension
-    for (auto ext : _extensions)
+    for (size_t e = 0; e < _extensions.size(); e++)
     {
-        size_t found = lowerCaseFileName.find(ext);
-        if (found != std::string::npos)
+        const std::string &ext = _extensions[e];
+        std::string::const_iterator found = std::search(filename.begin(), filename.end(), ext.begin(), ext.end(),
+            [](char a, char b) { return tolower(a) == b; });
+        if (found != filename.end())
         {
             std::string name = filename;
-            name.replace(int(found), ext.size(), "");
+            name.erase(found - filename.begin(), ext.size());
             return name;
         }
     }
@@ -74,115 +242,163 @@ std::string FileScanner::extensionMatches(std::string &filename) {
     return {};
 }
 
-bool FileScanner::isValidFilename(std::string &filename) {
+bool FileScanner::isValidFilename(const std::string &filename) const {
     if (filename.find("__MACOSX") != std::string::npos) return false;
     return true;
 }
 
-// generic implementation using dirent
-void FileScanner::scanGeneric(ScanCallback cb, const char *currentDir) {
-    DIR * m_dir;
+bool FileScanner::list(const std::string &path, Directory &directory) const
+{
+    Pending pending;
+    pending.path = path;
+    pending.root = false;
+    std::vector<Pending> subdirectories;
+    return listDirectory(pending, directory, subdirectories);
+}
 
-    // Allocate a new a stream given the current directory name
-    if ((m_dir = opendir(currentDir)) == NULL)
+bool FileScanner::listDirectory(Pending &pending, Directory &directory, std::vector<Pending> &subdirectories) const
+{
+    if (PackFile::isPackName(pending.path))
     {
-        return; // no files found in here
+        std::shared_ptr<const PackFile> pack = FileSystem::pack(pending.path, true);
+        if (pack)
+            return listPack(*pack, directory);
     }
 
-    struct dirent * dir_entry;
+    DIR *dir;
+    struct stat info;
 
-    while ((dir_entry = readdir(m_dir)) != NULL)
+#ifdef HAVE_FTS_H
+    int fd = pending.parent ? openat(pending.parent->fd, pending.name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                            : open(pending.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    // out of descriptors, resolve the whole path instead
+    if (fd < 0 && pending.parent && (errno == EMFILE || errno == ENFILE))
     {
-        // Convert char * to friendly string
-        std::string filename(dir_entry->d_name);
-
-        // Some sanity checks
-        if (! isValidFilename(filename)) continue;
-        if (filename.length() > 0 && filename[0] == '.')
-            continue;
+        pending.parent.reset();
+        fd = open(pending.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        if (pending.root)
+            handleDirectoryError(pending.path);
+        return false;
+    }
+    std::shared_ptr<Descriptor> self;
+    int listFd = fstat(fd, &info) == 0 ? dup(fd) : -1;
+    if (listFd < 0 || (dir = fdopendir(listFd)) == NULL)
+    {
+        if (listFd >= 0)
+            close(listFd);
+        close(fd);
+        return false;
+    }
+    self = std::make_shared<Descriptor>(fd);
+#else
+    if (stat(pending.path.c_str(), &info) != 0 || (dir = opendir(pending.path.c_str())) == NULL)
+    {
+        if (pending.root)
+            handleDirectoryError(pending.path);
+        return false;
+    }
+#endif
 
-        std::string fullPath = std::string(currentDir) + PATH_SEPARATOR + filename;
+    // a loop through a symlink, fts skipped these as FTS_DC
+    std::pair<uint64_t, uint64_t> identity((uint64_t) info.st_dev, (uint64_t) info.st_ino);
+    if (identity.second != 0 && std::find(pending.ancestors.begin(), pending.ancestors.end(), identity) != pending.ancestors.end())
+    {
+        closedir(dir);
+        return false;
+    }
 
-        if (dir_entry->d_type == DT_DIR) {
-            // recurse into dir
-            scanGeneric(cb, fullPath.c_str());
-            continue;
-        } else if (dir_entry->d_type != DT_REG && dir_entry->d_type != DT_LNK) {
-            // not regular file/link
-            continue;
-        }
+    directory.path = pending.path;
+    directory.mtime = (int64_t) info.st_mtime;
 
-        auto nameMatched = extensionMatches(filename);
-        if (! nameMatched.empty())
-           cb(fullPath, nameMatched);
-    }
+    std::string prefix = pending.path;
+    if (prefix.empty() || (prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != PATH_SEPARATOR))
+        prefix += PATH_SEPARATOR;
 
-    if (m_dir)
+    struct dirent *dirEntry;
+    while ((dirEntry = readdir(dir)) != NULL)
     {
-        closedir(m_dir);
-        m_dir = 0;
-    }
-}
+        const char *name = dirEntry->d_name;
+        if (name[0] == '.' || strstr(name, "__MACOSX") != NULL)
+            continue;
 
+        bool isDirectory;
+        if (dirEntry->d_type == DT_DIR)
+            isDirectory = true;
+        else if (dirEntry->d_type == DT_REG)
+            isDirectory = false;
+        else
+        {
+            // symlinks and file systems without d_type, followed like FTS_LOGICAL did
+            struct stat child;
 #ifdef HAVE_FTS_H
-// more optimized posix "fts" directory traversal
-int fts_compare(const FTSENT** one, const FTSENT** two) {
-    return (strcmp((*one)->fts_name, (*two)->fts_name));
-}
+            if (fstatat(self->fd, name, &child, 0) != 0)
+                continue;
+#else
+            if (stat((prefix + name).c_str(), &child) != 0)
+                continue;
 #endif
+            if (S_ISDIR(child.st_mode))
+                isDirectory = true;
+            else if (S_ISREG(child.st_mode))
+                isDirectory = false;
+            else
+                continue;
+        }
 
-void FileScanner::scanPosix(ScanCallback cb) {
-#ifdef HAVE_FTS_H
-
-    // efficient directory traversal
-    FTS* fileSystem = NULL;
-    FTSENT *node    = NULL;
-
-    // list of directories to scan
-    auto rootDirCount = _rootDirs.size();
-    char **dirList = (char **)malloc(sizeof(char*) * (rootDirCount + 1));
-    for (unsigned long i = 0; i < rootDirCount; i++) {
-        dirList[i] = (char *) _rootDirs[i].c_str();
-    }
-    dirList[rootDirCount] = NULL;
+        // packs are walked like the directories they stand in for
+        if (!isDirectory && PackFile::isPackName(name))
+            isDirectory = true;
 
-    // initialize file hierarchy traversal
-    fileSystem = fts_open(dirList, FTS_LOGICAL|FTS_NOCHDIR|FTS_NOSTAT, &fts_compare);
-    if (fileSystem == NULL) {
-        std::string s;
-        for (std::size_t i = 0; i < _rootDirs.size(); i++)
-            s += _rootDirs[i] + ' ';
-        handleDirectoryError(s);
+        Directory::Entry entry;
+        entry.name = name;
+        entry.directory = isDirectory;
+        if (!isDirectory && extensionMatches(entry.name).empty())
+            continue;
+        directory.entries.push_back(entry);
 
-        free(dirList);
-        return;
+        if (isDirectory)
+        {
+            Pending subdirectory;
+            subdirectory.path = prefix + entry.name;
+            subdirectory.root = false;
+            subdirectory.ancestors = pending.ancestors;
+            subdirectory.ancestors.push_back(identity);
+#ifdef HAVE_FTS_H
+            subdirectory.parent = self;
+            subdirectory.name = entry.name;
+#endif
+            subdirectories.push_back(subdirectory);
+        }
     }
+    closedir(dir);
 
-    std::string path, name, nameMatched;
+    std::sort(directory.entries.begin(), directory.entries.end(),
+              [](const Directory::Entry &a, const Directory::Entry &b) { return strcmp(a.name.c_str(), b.name.c_str()) < 0; });
+    return true;
+}
 
-    // traverse dirList
-    while( (node = fts_read(fileSystem)) != NULL) {
-        switch (node->fts_info) {
-            case FTS_F:
-            case FTS_SL:
-            case FTS_NSOK:
-                // found a file
-                path = std::string(node->fts_path);
-                name = std::string(node->fts_name);
+bool FileScanner::listPack(const PackFile &pack, Directory &directory) const
+{
+    directory.path = pack.path();
+    directory.mtime = pack.fileMtime();
 
-                if (!isValidFilename(path) || !isValidFilename(name)) break;
+    // every member in one listing, already sorted by name
+    const std::vector<PackFile::Entry> &entries = pack.entries();
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const std::string &name = entries[i].name;
+        size_t slash = name.find_last_of('/');
+        size_t base = slash == std::string::npos ? 0 : slash + 1;
+        if (name[base] == '.' || !isValidFilename(name) || extensionMatches(name.substr(base)).empty())
+            continue;
 
-                // check extension
-                nameMatched = extensionMatches(name);
-                if (! nameMatched.empty())
-                   cb(path, nameMatched);
-                break;
-            default:
-                break;
-        }
+        Directory::Entry entry;
+        entry.name = name;
+        entry.directory = false;
+        directory.entries.push_back(entry);
     }
-    fts_close(fileSystem);
-    free(dirList);
-
-#endif
+    return true;
 }
@@ -3,6 +3,14 @@
 //  libprojectM
 //
 //  Cross-platform directory traversal with filtering by extension
+//
+//  Directories are listed by a small pool of threads, on network shares the time goes
+//  into round trips and several directories can be waiting on the server at once.
+//  Subdirectories are opened relative to their parent's descriptor where the platform
+//  has openat, so the server does not resolve the whole path again for every one.
+//
+//  A .zip pack is walked as if it were a directory, its files are listed in one go with
+//  their path inside the pack as the name.
 
 #ifndef FileScanner_hpp
 #define FileScanner_hpp
@@ -11,39 +19,72 @@
 #include <vector>
 #include <iostream>
 #include <functional>
+#include <map>
+#include <stdint.h>
 #include "Common.hpp"
 #include <string.h>
 
 #ifdef HAVE_FTS_H
-#include <fts.h>
 extern "C"
 {
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 }
 #else
 #include "dirent.h"
 #endif
 
+class PackFile;
+
 typedef std::function<void(std::string &path, std::string &name)> ScanCallback;
 
 class FileScanner
 {
 public:
+	/// A directory's subdirectories and the files with a matching extension, sorted by name
+	struct Directory
+	{
+		struct Entry
+		{
+			std::string name;
+			bool directory;
+		};
+
+		std::string path;
+		int64_t mtime;
+		std::vector<Entry> entries;
+	};
+
+	/// Receives the directories listed since the last call, in no particular order
+	typedef std::function<void(std::vector<Directory> &batch)> BatchCallback;
+
 	FileScanner();
 	FileScanner(std::vector<std::string> &rootDirs, std::vector<std::string> &extensions);
 
+	/// Calls cb for every matching file, in name order and depth first
 	void scan(ScanCallback cb);
-	std::string extensionMatches(std::string &filename);
+
+	/// Lists every directory under the roots in parallel. cb runs on the calling thread.
+	void scanDirectories(BatchCallback cb);
+
+	/// Lists just the directory at path, without going into its subdirectories
+	bool list(const std::string &path, Directory &directory) const;
+
+	std::string extensionMatches(const std::string &filename) const;
+	bool isValidFilename(const std::string &filename) const;
 
 private:
 	std::vector<std::string> _rootDirs;
 	std::vector<std::string> _extensions;
 
-	void scanGeneric(ScanCallback cb, const char *dir);
-	void scanPosix(ScanCallback cb);
-	void handleDirectoryError(std::string dir);
-	bool isValidFilename(std::string &filename);
+	struct Pending;
+
+	bool listDirectory(Pending &pending, Directory &directory, std::vector<Pending> &subdirectories) const;
+	bool listPack(const PackFile &pack, Directory &directory) const;
+	void report(const std::map<std::string, Directory> &directories, const std::string &path, ScanCallback &cb) const;
+	void handleDirectoryError(const std::string &dir) const;
 };
 
 #endif /* FileScanner_hpp */
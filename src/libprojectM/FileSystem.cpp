@@ -0,0 +1,140 @@
+//
+//  FileSystem.cpp
+//  libprojectM
+//
+
+#include "FileSystem.hpp"
+#include "PackFile.hpp"
+
+#include <fstream>
+#include <map>
+#include <sys/stat.h>
+
+#ifdef USE_THREADS
+#include <mutex>
+#endif
+
+namespace {
+
+std::map<std::string, std::shared_ptr<const PackFile> > packs;
+#ifdef USE_THREADS
+std::mutex packsMutex;
+#endif
+
+bool isSeparator(char c)
+{
+    return c == '/' || c == '\\';
+}
+
+}
+
+
+bool FileSystem::split(const std::string &path, std::string &packPath, std::string &member)
+{
+    // the first directory named like a pack, a plain directory of that name is not opened
+    // as one and the path is read as it is
+    for (size_t at = path.find_first_of("/\\", 1); at != std::string::npos; at = path.find_first_of("/\\", at + 1))
+    {
+        if (!PackFile::isPackName(path.substr(0, at)))
+            continue;
+        packPath = path.substr(0, at);
+        member = path.substr(at + 1);
+        while (!member.empty() && isSeparator(member[0]))
+            member.erase(0, 1);
+        return !member.empty();
+    }
+    return false;
+}
+
+std::shared_ptr<const PackFile> FileSystem::pack(const std::string &path, bool check)
+{
+    if (!PackFile::isPackName(path))
+        return std::shared_ptr<const PackFile>();
+
+#ifdef USE_THREADS
+    std::lock_guard<std::mutex> lock(packsMutex);
+#endif
+    std::map<std::string, std::shared_ptr<const PackFile> >::iterator it = packs.find(path);
+    if (it != packs.end() && !check)
+        return it->second;
+
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        return std::shared_ptr<const PackFile>();
+    if (it != packs.end() && it->second->fileSize() == (uint64_t) info.st_size
+        && it->second->fileMtime() == (int64_t) info.st_mtime)
+        return it->second;
+
+    // whoever still reads the old one keeps it mapped until they are done
+    std::shared_ptr<PackFile> opened = std::make_shared<PackFile>();
+    if (!opened->open(path))
+        return std::shared_ptr<const PackFile>();
+    packs[path] = opened;
+    return opened;
+}
+
+bool FileSystem::read(const std::string &path, Contents &contents)
+{
+    contents = Contents();
+
+    std::string packPath, member;
+    if (split(path, packPath, member))
+    {
+        std::shared_ptr<const PackFile> pack = FileSystem::pack(packPath);
+        if (pack)
+        {
+            const PackFile::Entry *entry = pack->find(member);
+            if (entry == NULL || !pack->read(*entry, contents._data, contents._size, contents._buffer))
+                return false;
+            contents._pack = pack;
+            return true;
+        }
+    }
+
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+        return false;
+    in.seekg(0, std::ios::end);
+    std::streamoff size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if (size < 0)
+        return false;
+    contents._buffer.resize((size_t) size);
+    if (size > 0 && !in.read(&contents._buffer[0], size))
+        return false;
+    contents._data = contents._buffer.empty() ? NULL : &contents._buffer[0];
+    contents._size = contents._buffer.size();
+    return true;
+}
+
+bool FileSystem::exists(const std::string &path)
+{
+    uint64_t size;
+    int64_t mtime;
+    return FileSystem::stat(path, size, mtime);
+}
+
+bool FileSystem::stat(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+    std::string packPath, member;
+    if (split(path, packPath, member))
+    {
+        std::shared_ptr<const PackFile> pack = FileSystem::pack(packPath);
+        if (pack)
+        {
+            const PackFile::Entry *entry = pack->find(member);
+            if (entry == NULL)
+                return false;
+            size = entry->size;
+            mtime = entry->mtime;
+            return true;
+        }
+    }
+
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        return false;
+    size = (uint64_t) info.st_size;
+    mtime = (int64_t) info.st_mtime;
+    return true;
+}
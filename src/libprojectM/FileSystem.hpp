@@ -0,0 +1,81 @@
+//
+//  FileSystem.hpp
+//  libprojectM
+//
+//  Reads files whether they sit in a directory or in a pack. A path runs through a pack
+//  when one of its directories is a .zip file, the rest of the path names the member,
+//  so "/usr/share/projectM/presets.zip/Geiss/x.milk" is x.milk in presets.zip. Packs are
+//  opened once and stay mapped, reading a member from a thread is safe.
+//
+
+#ifndef FileSystem_hpp
+#define FileSystem_hpp
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class PackFile;
+
+class FileSystem
+{
+public:
+    /// A file's bytes, in place in a pack or read into memory, valid while this lives.
+    /// Move-only, data() may point into the object's own buffer.
+    class Contents
+    {
+    public:
+        Contents() : _data(NULL), _size(0) {}
+        Contents(const Contents &) = delete;
+        Contents &operator=(const Contents &) = delete;
+
+        // a moved vector keeps its storage, so _data stays valid in the new owner
+        Contents(Contents &&other)
+            : _pack(std::move(other._pack)), _buffer(std::move(other._buffer)), _data(other._data), _size(other._size)
+        {
+            other._data = NULL;
+            other._size = 0;
+        }
+
+        Contents &operator=(Contents &&other)
+        {
+            if (this != &other)
+            {
+                _pack = std::move(other._pack);
+                _buffer = std::move(other._buffer);
+                _data = other._data;
+                _size = other._size;
+                other._data = NULL;
+                other._size = 0;
+            }
+            return *this;
+        }
+
+        const char *data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        friend class FileSystem;
+
+        std::shared_ptr<const PackFile> _pack;
+        std::vector<char> _buffer;
+        const char *_data;
+        size_t _size;
+    };
+
+    static bool read(const std::string &path, Contents &contents);
+    static bool exists(const std::string &path);
+
+    /// Like stat(), members have their uncompressed size and the time stored in the pack
+    static bool stat(const std::string &path, uint64_t &size, int64_t &mtime);
+
+    /// The pack at path, NULL if it is no pack. With check the file is stat()ed and
+    /// opened again if it changed since, a rescan passes it to pick up a new pack.
+    static std::shared_ptr<const PackFile> pack(const std::string &path, bool check = false);
+
+    /// Splits a path running through a pack into the pack and the member
+    static bool split(const std::string &path, std::string &packPath, std::string &member);
+};
+
+#endif /* FileSystem_hpp */
@@ -0,0 +1,328 @@
+//
+//  HeadlessContext.cpp
+//  libprojectM
+//
+
+#include "HeadlessContext.hpp"
+#include "projectM-opengl.h"
+#include <cstring>
+
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#if defined(USE_OSMESA) && !defined(USE_GLES)
+#include <GL/osmesa.h>
+#define HEADLESS_OSMESA
+#endif
+
+
+namespace {
+
+#ifdef USE_EGL
+bool hasExtension(const char *extensions, const char *name)
+{
+    if (extensions == NULL)
+        return false;
+
+    size_t length = strlen(name);
+    for (const char *match = extensions; (match = strstr(match, name)) != NULL; match += length)
+    {
+        if ((match == extensions || match[-1] == ' ') && (match[length] == ' ' || match[length] == '\0'))
+            return true;
+    }
+    return false;
+}
+#endif
+
+}
+
+
+HeadlessContext::HeadlessContext(int width, int height, Backend backend)
+    : _backend(BACKEND_NONE), _width(width), _height(height),
+      _eglDisplay(NULL), _eglContext(NULL), _eglSurface(NULL), _osmesaContext(NULL),
+      _framebuffer(0), _renderbuffer(0)
+{
+    if (width <= 0 || height <= 0)
+    {
+        _error = "invalid size";
+        return;
+    }
+
+    if (backend == BACKEND_AUTO || backend == BACKEND_EGL)
+    {
+        if (createEGL())
+        {
+            _backend = BACKEND_EGL;
+            return;
+        }
+        destroy();
+    }
+
+    if (backend == BACKEND_AUTO || backend == BACKEND_OSMESA)
+    {
+        std::string eglError = _error;
+        if (createOSMesa())
+        {
+            _backend = BACKEND_OSMESA;
+            _error.clear();
+            return;
+        }
+        destroy();
+        if (!eglError.empty())
+            _error = eglError + ", " + _error;
+    }
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    destroy();
+}
+
+bool HeadlessContext::createEGL()
+{
+#ifdef USE_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    // Mesa's surfaceless platform needs neither X11 nor Wayland nor a DRM device
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (hasExtension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless"))
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != NULL)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+#endif
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+    {
+        _error = "EGL: no display";
+        return false;
+    }
+    _eglDisplay = display;
+
+#ifdef USE_GLES
+    const EGLint renderableType = EGL_OPENGL_ES3_BIT_KHR;
+    const EGLenum api = EGL_OPENGL_ES_API;
+#else
+    const EGLint renderableType = EGL_OPENGL_BIT;
+    const EGLenum api = EGL_OPENGL_API;
+#endif
+    if (!eglBindAPI(api))
+    {
+        _error = "EGL: OpenGL API not supported";
+        return false;
+    }
+
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, renderableType,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    bool pbuffer = eglChooseConfig(display, configAttributes, &config, 1, &count) && count > 0;
+    if (!pbuffer)
+    {
+        if (!hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"))
+        {
+            _error = "EGL: no pbuffer or surfaceless support";
+            return false;
+        }
+        configAttributes[1] = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &count) || count == 0)
+        {
+            _error = "EGL: no RGBA8 config";
+            return false;
+        }
+    }
+
+#ifdef USE_GLES
+    const EGLint contextAttributes[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+#else
+    // a 3.3 core profile gets the GLSL 3.30 shaders, any version will do otherwise
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3, EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT)
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+#endif
+    if (context == EGL_NO_CONTEXT)
+    {
+        _error = "EGL: cannot create context";
+        return false;
+    }
+    _eglContext = context;
+
+    if (pbuffer)
+    {
+        const EGLint surfaceAttributes[] = { EGL_WIDTH, _width, EGL_HEIGHT, _height, EGL_NONE };
+        EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        if (surface == EGL_NO_SURFACE)
+        {
+            _error = "EGL: cannot create pbuffer";
+            return false;
+        }
+        _eglSurface = surface;
+    }
+
+    if (!eglMakeCurrent(display, (EGLSurface) _eglSurface, (EGLSurface) _eglSurface, context))
+    {
+        _error = "EGL: cannot make context current";
+        return false;
+    }
+
+    return pbuffer || createFramebuffer();
+#else
+    _error = "EGL: not built in";
+    return false;
+#endif
+}
+
+bool HeadlessContext::createOSMesa()
+{
+#ifdef HEADLESS_OSMESA
+    OSMesaContext context = NULL;
+#ifdef OSMESA_CONTEXT_MAJOR_VERSION
+    const int attributes[] = {
+        OSMESA_FORMAT, OSMESA_RGBA,
+        OSMESA_DEPTH_BITS, 0,
+        OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, 3,
+        OSMESA_CONTEXT_MINOR_VERSION, 3,
+        0
+    };
+    context = OSMesaCreateContextAttribs(attributes, NULL);
+#endif
+    if (context == NULL)
+        context = OSMesaCreateContextExt(OSMESA_RGBA, 0, 0, 0, NULL);
+    if (context == NULL)
+    {
+        _error = "OSMesa: cannot create context";
+        return false;
+    }
+    _osmesaContext = context;
+
+    _osmesaBuffer.resize((size_t) _width * _height * 4);
+    if (!OSMesaMakeCurrent(context, &_osmesaBuffer[0], GL_UNSIGNED_BYTE, _width, _height))
+    {
+        _error = "OSMesa: cannot make context current";
+        return false;
+    }
+    return true;
+#else
+    _error = "OSMesa: not built in";
+    return false;
+#endif
+}
+
+bool HeadlessContext::createFramebuffer()
+{
+    glGenRenderbuffers(1, &_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, _width, _height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _renderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        _error = "EGL: surfaceless framebuffer incomplete";
+        return false;
+    }
+    glViewport(0, 0, _width, _height);
+    return true;
+}
+
+void HeadlessContext::destroy()
+{
+    // the framebuffer goes with the context
+    _framebuffer = 0;
+    _renderbuffer = 0;
+
+#ifdef USE_EGL
+    if (_eglDisplay != NULL)
+    {
+        EGLDisplay display = (EGLDisplay) _eglDisplay;
+        if (_eglContext != NULL && eglGetCurrentContext() == (EGLContext) _eglContext)
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_eglSurface != NULL)
+            eglDestroySurface(display, (EGLSurface) _eglSurface);
+        if (_eglContext != NULL)
+            eglDestroyContext(display, (EGLContext) _eglContext);
+        // the display is shared by every context of the process, it is not terminated
+    }
+#endif
+    _eglDisplay = _eglContext = _eglSurface = NULL;
+
+#ifdef HEADLESS_OSMESA
+    if (_osmesaContext != NULL)
+        OSMesaDestroyContext((OSMesaContext) _osmesaContext);
+#endif
+    _osmesaContext = NULL;
+    _osmesaBuffer.clear();
+
+    _backend = BACKEND_NONE;
+}
+
+bool HeadlessContext::makeCurrent()
+{
+    switch (_backend)
+    {
+#ifdef USE_EGL
+    case BACKEND_EGL:
+        if (!eglMakeCurrent((EGLDisplay) _eglDisplay, (EGLSurface) _eglSurface, (EGLSurface) _eglSurface,
+                            (EGLContext) _eglContext))
+            return false;
+        break;
+#endif
+#ifdef HEADLESS_OSMESA
+    case BACKEND_OSMESA:
+        if (!OSMesaMakeCurrent((OSMesaContext) _osmesaContext, &_osmesaBuffer[0], GL_UNSIGNED_BYTE, _width, _height))
+            return false;
+        break;
+#endif
+    default:
+        return false;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+    return true;
+}
+
+bool HeadlessContext::readPixels(unsigned char *rgba)
+{
+    if (!isValid())
+        return false;
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, _width, _height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+    // GL rows run bottom up
+    size_t stride = (size_t) _width * 4;
+    _row.resize(stride);
+    for (int top = 0, bottom = _height - 1; top < bottom; top++, bottom--)
+    {
+        memcpy(&_row[0], rgba + top * stride, stride);
+        memcpy(rgba + top * stride, rgba + bottom * stride, stride);
+        memcpy(rgba + bottom * stride, &_row[0], stride);
+    }
+    return true;
+}
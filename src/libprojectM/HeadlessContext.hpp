@@ -0,0 +1,86 @@
+//
+//  HeadlessContext.hpp
+//  libprojectM
+//
+//  An OpenGL context without a window, for rendering on servers with no display
+//  (and, through Mesa llvmpipe, no GPU). EGL is tried first, with a pbuffer surface
+//  or, where the driver has none, a surfaceless context drawing into a framebuffer
+//  object. OSMesa is the fallback. Create it before projectM and keep it current on
+//  the rendering thread:
+//
+//    HeadlessContext context(1280, 720);
+//    projectM pm(settings);              // windowWidth/windowHeight 1280x720
+//    pm.renderFrame();
+//    context.readPixels(rgba);           // 1280 * 720 * 4 bytes
+//
+//  Which backends exist depends on the build (--enable-egl, --enable-osmesa).
+//
+
+#ifndef HeadlessContext_hpp
+#define HeadlessContext_hpp
+
+#include <string>
+#include <vector>
+#include "dlldefs.h"
+
+class DLLEXPORT HeadlessContext
+{
+public:
+    enum Backend
+    {
+        BACKEND_NONE,
+        BACKEND_AUTO,
+        BACKEND_EGL,
+        BACKEND_OSMESA
+    };
+
+    /// Creates a context with a width x height RGBA drawable and makes it current.
+    /// Check isValid(), error() says why it failed.
+    HeadlessContext(int width, int height, Backend backend = BACKEND_AUTO);
+    ~HeadlessContext();
+
+    bool isValid() const { return _backend != BACKEND_NONE; }
+    /// The backend in use, BACKEND_NONE if creation failed
+    Backend backend() const { return _backend; }
+    const std::string &error() const { return _error; }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    /// Makes the context current on the calling thread and binds its drawable,
+    /// projectM renders into whatever framebuffer is bound when a frame starts
+    bool makeCurrent();
+
+    /// Copies the drawable into rgba (width * height * 4 bytes, top row first)
+    bool readPixels(unsigned char *rgba);
+
+private:
+    HeadlessContext(const HeadlessContext &);
+    HeadlessContext &operator=(const HeadlessContext &);
+
+    bool createEGL();
+    bool createOSMesa();
+    bool createFramebuffer();
+    void destroy();
+
+    Backend _backend;
+    std::string _error;
+    int _width;
+    int _height;
+
+    // EGL handles, kept opaque so the header does not need the EGL headers
+    void *_eglDisplay;
+    void *_eglContext;
+    void *_eglSurface;
+
+    void *_osmesaContext;
+    std::vector<unsigned char> _osmesaBuffer;
+
+    // the drawable of a surfaceless EGL context, 0 when there is a default framebuffer
+    unsigned int _framebuffer;
+    unsigned int _renderbuffer;
+
+    std::vector<unsigned char> _row;
+};
+
+#endif /* HeadlessContext_hpp */
@@ -49,6 +49,8 @@ CustomShape::CustomShape ( int _id ) : Shape()
 
     this->id = _id;
 	this->per_frame_count = 0;
+	this->num_inst = 1;
+	this->instance = 0;
 
 	/* Start: Load custom shape parameters */
 	param = Param::new_param_float ( "r", P_FLAG_NONE, &this->r, NULL, 1.0, 0.0, 0.5 );
@@ -136,6 +138,16 @@ CustomShape::CustomShape ( int _id ) : Shape()
 	{
 		abort();
 	}
+	param = Param::new_param_int ( "num_inst", P_FLAG_NONE, &this->num_inst, 1024, 1, 1 );
+	if ( !ParamUtils::insert( param, &this->param_tree ) )
+	{
+		abort();
+	}
+	param = Param::new_param_float ( "instance", P_FLAG_READONLY, &this->instance, NULL, 1024, 0, 0.0 );
+	if ( !ParamUtils::insert( param, &this->param_tree ) )
+	{
+		abort();
+	}
 	param = Param::new_param_bool ( "additive", P_FLAG_NONE, &this->additive, 1, 0, 0 );
 	if ( !ParamUtils::insert( param, &this->param_tree ) )
 	{
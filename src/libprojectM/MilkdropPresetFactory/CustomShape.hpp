@@ -53,6 +53,11 @@ public:
 
     bool enabled;
 
+    /* Milkdrop 2 instancing: the per frame equations run num_inst times a frame,
+       with instance counting from 0 */
+    int num_inst;
+    float instance;
+
     /* stupid t variables */
     float t1;
     float t2;
@@ -50,6 +50,13 @@ public:
 
     /* Evaluates functions in prefix form */
     Expr *_optimize() override;
+    unsigned int _cost() override
+    {
+        unsigned int cost = 1;
+        for (int i = 0; i < num_args; i++)
+            cost += Expr::cost(expr_list[i]);
+        return cost;
+    }
     float eval(int mesh_i, int mesh_j) override;
     std::ostream& to_string(std::ostream &out) override;
 #if HAVE_LLVM
@@ -396,6 +403,10 @@ public:
         Expr::delete_expr(b);
         Expr::delete_expr(c);
     }
+    unsigned int _cost() override
+    {
+        return 2 + Expr::cost(a) + Expr::cost(b) + Expr::cost(c);
+    }
     float eval(int mesh_i, int mesh_j) override
     {
         float a_value = a->eval(mesh_i,mesh_j);
@@ -434,6 +445,10 @@ public:
     {
         Expr::delete_expr(expr);
     }
+    unsigned int _cost() override
+    {
+        return 1 + Expr::cost(expr);
+    }
     float eval(int mesh_i, int mesh_j) override
     {
         float value = expr->eval(mesh_i,mesh_j);
@@ -564,6 +579,12 @@ Expr *TreeExpr::_optimize()
     return this;
 }
 
+unsigned int TreeExpr::_cost()
+{
+    // a leaf has no operator, just its gen_expr
+    return (infix_op ? 1 : 0) + Expr::cost(gen_expr) + Expr::cost(left) + Expr::cost(right);
+}
+
 /* Evaluates an expression tree */
 float TreeExpr::eval ( int mesh_i, int mesh_j )
 {
@@ -919,6 +940,11 @@ public:
         return this;
     }
 
+    unsigned int _cost() override
+    {
+        return Expr::cost(rhs);
+    }
+
     float eval(int mesh_i, int mesh_j) override
     {
         float v = rhs->eval( mesh_i, mesh_j );
@@ -1022,6 +1048,13 @@ public:
         for (auto it=steps.begin() ; it<steps.end() ; it++)
             Expr::delete_expr(*it);
     }
+    unsigned int _cost() override
+    {
+        unsigned int cost = 0;
+        for (auto it=steps.begin() ; it<steps.end() ; it++)
+            cost += Expr::cost(*it);
+        return cost;
+    }
     float eval(int mesh_i, int mesh_j) override
     {
         float f=0.0f;
@@ -1113,6 +1146,27 @@ public:
         return true;
     }
 
+    bool cost()
+    {
+        Func *sin_fn = BuiltinFuncs::find_func("sin");
+        Param *PARAM = Param::createUser("x");
+
+        // sin(x + 2)
+        TreeExpr *a = TreeExpr::create(nullptr, PARAM, nullptr, nullptr);
+        TreeExpr *b = TreeExpr::create(nullptr, Expr::const_to_expr( 2.0 ), nullptr, nullptr);
+        Expr **expr_array = (Expr **)malloc(sizeof(Expr *));
+        expr_array[0] = TreeExpr::create(Eval::infix_add, nullptr, a, b);
+        Expr *x = Expr::prefun_to_expr(sin_fn, expr_array);
+        TEST(Expr::cost(x) == 2);
+        x = Expr::optimize(x);
+        TEST(Expr::cost(x) == 2);
+        Expr::delete_expr(x);
+        delete PARAM;
+
+        TEST(Expr::cost(nullptr) == 0);
+        return true;
+    }
+
 #if HAVE_LLVM
     bool jit()
     {
@@ -1213,6 +1267,7 @@ public:
         Eval::init_infix_ops();
         bool result = true;
         result &= optimize_constant_expr();
+        result &= cost();
 #if HAVE_LLVM
         result &= jit();
 #endif
@@ -1257,6 +1312,11 @@ public:
         return fn(mesh_i, mesh_j);
     }
 
+    unsigned int _cost() override
+    {
+        return Expr::cost(expr);
+    }
+
     ~JitExpr() override
     {
         Expr::delete_expr(expr);
@@ -104,10 +104,14 @@ public:
   static void delete_expr(Expr *expr) { if (nullptr != expr) expr->_delete_from_tree(); }
   static Expr *optimize(Expr *root);
   static Expr *jit(Expr *root, std::string name="Expr::jit");
+  /// The operators and function calls evaluating expr once goes through, a rough measure
+  /// of what it costs that tools use to compare presets
+  static unsigned int cost(Expr *expr) { return nullptr == expr ? 0 : expr->_cost(); }
 
 public: // but don't call these from outside Expr.cpp
 
   virtual Expr *_optimize() { return this; };
+  virtual unsigned int _cost() { return 0; };
 #if HAVE_LLVM
   static  llvm::Value *llvm(JitContext &jit, Expr *);
   virtual llvm::Value *_llvm(JitContext &jit) = 0;  //ONLY called by llvm()
@@ -154,6 +158,7 @@ public:
   ~TreeExpr() override;
   
   Expr *_optimize() override;
+  unsigned int _cost() override;
   float eval(int mesh_i, int mesh_j) override;
 #if HAVE_LLVM
   llvm::Value *_llvm(JitContext &jitx) override;
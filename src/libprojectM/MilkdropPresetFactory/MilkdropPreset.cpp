@@ -35,9 +35,11 @@
 #include "ParamUtils.hpp"
 #include "InitCondUtils.hpp"
 #include "fatal.h"
+#include "FileSystem.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
 #include "PresetFrameIO.hpp"
 
@@ -203,18 +205,44 @@ void MilkdropPreset::evalCustomShapePerFrameEquations()
 
   for (PresetOutputs::cshape_container::iterator pos = customShapes.begin(); pos != customShapes.end(); ++pos)
   {
-
-    std::map<std::string, InitCond*> & init_cond_tree2 = (*pos)->init_cond_tree;
-    for (std::map<std::string, InitCond*>::iterator _pos = init_cond_tree2.begin(); _pos != init_cond_tree2.end(); ++_pos)
+    CustomShape & shape = **pos;
+    std::map<std::string, InitCond*> & init_cond_tree2 = shape.init_cond_tree;
+    std::vector<PerFrameEqn*> & per_frame_eqn_tree2 = shape.per_frame_eqn_tree;
+
+    // every instance starts from the same t and q values, the renderer draws the
+    // collected instances in one go (see Shape::Draw)
+    float t[8] = { shape.t1, shape.t2, shape.t3, shape.t4, shape.t5, shape.t6, shape.t7, shape.t8 };
+    float q[NUM_Q_VARIABLES];
+    std::copy(shape.q, shape.q + NUM_Q_VARIABLES, q);
+
+    shape.instances.clear();
+    int count = 1;
+    for (int i = 0; i < count; i++)
     {
-      assert(_pos->second);
-      _pos->second->evaluate();
-    }
-
-    std::vector<PerFrameEqn*> & per_frame_eqn_tree2 = (*pos)->per_frame_eqn_tree;
-    for (std::vector<PerFrameEqn*>::iterator _pos = per_frame_eqn_tree2.begin(); _pos != per_frame_eqn_tree2.end(); ++_pos)
-    {
-      (*_pos)->evaluate();
+      if (i > 0)
+      {
+        shape.t1 = t[0]; shape.t2 = t[1]; shape.t3 = t[2]; shape.t4 = t[3];
+        shape.t5 = t[4]; shape.t6 = t[5]; shape.t7 = t[6]; shape.t8 = t[7];
+        std::copy(q, q + NUM_Q_VARIABLES, shape.q);
+      }
+
+      for (std::map<std::string, InitCond*>::iterator _pos = init_cond_tree2.begin(); _pos != init_cond_tree2.end(); ++_pos)
+      {
+        assert(_pos->second);
+        _pos->second->evaluate();
+      }
+
+      if (i == 0)
+        count = std::min(std::max(shape.num_inst, 1), 1024);
+      shape.instance = i;
+
+      for (std::vector<PerFrameEqn*>::iterator _pos = per_frame_eqn_tree2.begin(); _pos != per_frame_eqn_tree2.end(); ++_pos)
+      {
+        (*_pos)->evaluate();
+      }
+
+      if (count > 1)
+        shape.instances.push_back(shape.currentInstance());
     }
   }
 
@@ -462,6 +490,7 @@ int MilkdropPreset::readIn(std::istream & fs) {
 
   presetOutputs().compositeShader.programSource.clear();
   presetOutputs().warpShader.programSource.clear();
+  parseIssues.clear();
 
   /* Parse any comments (aka "[preset00]") */
   /* We don't do anything with this info so it's okay if it's missing */
@@ -491,6 +520,8 @@ int MilkdropPreset::readIn(std::istream & fs) {
     if (retval == PROJECTM_PARSE_ERROR)
     {
       // std::cerr << "[Preset::readIn()] parse error in file \"" << this->absoluteFilePath() << "\"" << std::endl;
+      ParseIssue issue = { ParseIssue::PARSE_ERROR, Parser::line_count, Parser::lastLinePrefix };
+      parseIssues.push_back(issue);
     }
   }
 
@@ -509,9 +540,9 @@ int MilkdropPreset::loadPresetFile(const std::string & pathname)
 {
 
 
-  /* Open the file corresponding to pathname */
-  std::ifstream fs(pathname.c_str());
-  if (!fs || fs.eof()) {
+  /* Read the file corresponding to pathname, it may be a member of a pack */
+  FileSystem::Contents contents;
+  if (!FileSystem::read(pathname, contents) || contents.size() == 0) {
 
     std::ostringstream oss;
     oss << "Problem reading file from path: \"" << pathname << "\"";
@@ -520,6 +551,7 @@ int MilkdropPreset::loadPresetFile(const std::string & pathname)
 
   }
 
+ std::istringstream fs(std::string(contents.data(), contents.size()));
  return readIn(fs);
 
 }
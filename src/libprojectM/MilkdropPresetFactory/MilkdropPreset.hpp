@@ -136,6 +136,24 @@ public:
   std::map<std::string,InitCond*>  init_cond_tree; /* initial conditions */
   std::map<std::string,Param*> user_param_tree; /* user parameter splay tree */
 
+  /// A line the parser gave up on or only half understood. The preset loads anyway,
+  /// such lines just do nothing, so nothing but tools look at these.
+  struct ParseIssue
+  {
+    enum Kind
+    {
+      PARSE_ERROR,        // the line did not parse
+      UNKNOWN_FUNCTION,   // a call to a function the parser does not know
+      UNKNOWN_PARAM       // an initial condition for a parameter that is not builtin
+    };
+
+    Kind kind;
+    unsigned int line;
+    std::string text;     // the function or parameter name, for parse errors the line's key or
+                          // the variable of the statement that failed
+  };
+  std::vector<ParseIssue> parseIssues;
+
 
   PresetOutputs & pipeline() { return _presetOutputs; } 
 
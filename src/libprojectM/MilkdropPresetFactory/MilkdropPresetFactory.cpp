@@ -208,14 +208,15 @@ PresetOutputs* MilkdropPresetFactory::createPresetOutputs(int gx, int gy)
 
 std::unique_ptr<Preset> MilkdropPresetFactory::allocate(const std::string & url, const std::string & name, const std::string & author) {
 
-    PresetOutputs *presetOutputs;
+    PresetOutputs *presetOutputs = nullptr;
     // use cached PresetOutputs if there is one, otherwise allocate
-    if (_presetOutputsCache)
     {
-        presetOutputs = _presetOutputsCache;
-        _presetOutputsCache = nullptr;
+#ifdef USE_THREADS
+        std::lock_guard<std::mutex> lock(_presetOutputsMutex);
+#endif
+        std::swap(presetOutputs, _presetOutputsCache);
     }
-    else
+    if (presetOutputs == nullptr)
     {
         presetOutputs = createPresetOutputs(gx,gy);
     }
@@ -233,9 +234,14 @@ std::unique_ptr<Preset> MilkdropPresetFactory::allocate(const std::string & url,
 void MilkdropPresetFactory::releasePreset(Preset *preset_)
 {
     MilkdropPreset *preset = (MilkdropPreset *)preset_;
+    PresetOutputs *presetOutputs = &preset->_presetOutputs;
     // return PresetOutputs to the cache
-    if (nullptr == _presetOutputsCache)
-        _presetOutputsCache = &preset->_presetOutputs;
-    else
-        delete &preset->_presetOutputs;
+    {
+#ifdef USE_THREADS
+        std::lock_guard<std::mutex> lock(_presetOutputsMutex);
+#endif
+        if (nullptr == _presetOutputsCache)
+            std::swap(presetOutputs, _presetOutputsCache);
+    }
+    delete presetOutputs;
 }
@@ -15,6 +15,10 @@
 
 #include <memory>
 #include "../PresetFactory.hpp"
+
+#ifdef USE_THREADS
+#include <mutex>
+#endif
 class DLLEXPORT PresetOutputs;
 class DLLEXPORT PresetInputs;
 
@@ -38,6 +42,10 @@ private:
 	int gx;
 	int gy;
 	PresetOutputs * _presetOutputsCache;
+#ifdef USE_THREADS
+	// presets are allocated on the prefetch thread and released on the render thread
+	std::mutex _presetOutputsMutex;
+#endif
 };
 
 #endif
@@ -436,14 +436,30 @@ int Parser::parse_line(std::istream &  fs, MilkdropPreset * preset)
     if (!fs)
       return PROJECTM_PARSE_ERROR;
 
+	// an empty value or nothing but a comment, there is nothing to parse. Shader lines keep
+	// theirs, comments are newlines in the program.
+	if (strncmp(eqn_string, WARP_STRING, WARP_STRING_LENGTH) && strncmp(eqn_string, COMPOSITE_STRING, COMPOSITE_STRING_LENGTH)) {
+		while (fs.peek() == ' ' || fs.peek() == '\t')
+			fs.get();
+		if (fs.peek() == '/') {
+			fs.get();
+			if (fs.peek() == '/') {
+				while (fs.peek() != '\n' && fs.peek() != '\r' && fs.peek() != EOF)
+					fs.get();
+			} else
+				fs.unget();
+		}
+	}
+
 //	char z = fs.get();
 	char tmpChar;
 	if ((tmpChar = fs.get()) == '\n') {
+		line_count++;
 		tokenWrapAroundEnabled = false;
-		return PROJECTM_PARSE_ERROR;
+		return PROJECTM_SUCCESS;
 	} else if (tmpChar == '\r') {
 		tokenWrapAroundEnabled = false;
-		return PROJECTM_PARSE_ERROR;
+		return PROJECTM_SUCCESS;
 	} else
 		fs.unget();
 
@@ -694,6 +710,11 @@ int Parser::parse_line(std::istream &  fs, MilkdropPreset * preset)
     }
 
     if (PARSE_DEBUG) printf("parse_line: found initial condition: name = \"%s\" (LINE %d)\n", eqn_string, line_count);
+    if (preset->builtinParams.find_builtin_param(std::string(eqn_string)) == NULL)
+    {
+      MilkdropPreset::ParseIssue issue = { MilkdropPreset::ParseIssue::UNKNOWN_PARAM, line_count, eqn_string };
+      preset->parseIssues.push_back(issue);
+    }
     /* Evaluate the initial condition */
     if ((init_cond = parse_init_cond(fs, eqn_string, preset)) == NULL)
     {
@@ -793,6 +814,8 @@ Expr * Parser::_parse_gen_expr ( std::istream &  fs, TreeExpr * tree_expr, Milkd
     if (*string != 0)
     {
       std::cerr << "token prefix is " << *string << std::endl;
+      MilkdropPreset::ParseIssue issue = { MilkdropPreset::ParseIssue::UNKNOWN_FUNCTION, line_count, string };
+      preset->parseIssues.push_back(issue);
       if (PARSE_DEBUG) printf("parse_gen_expr: implicit multiplication case unimplemented!\n");
       if (tree_expr)
         Expr::delete_expr(tree_expr);
@@ -2705,6 +2728,26 @@ public:
         return true;
     }
 
+    // empty and comment lines are fine, what the parser does not know is noted on the preset
+    bool test_issues()
+    {
+        preset->parseIssues.clear();
+        ss("per_frame_1=\nper_frame_2=  // nothing here\nper_frame_3=zoom = frobnicate(1);\nfmadeup=1\n");
+        int errors = 0, retval;
+        while ((retval = Parser::parse_line(is, preset)) != EOF)
+            if (retval == PROJECTM_PARSE_ERROR)
+                errors++;
+
+        TEST(errors > 0);
+        TEST(preset->parseIssues.size() == 2);
+        TEST(preset->parseIssues[0].kind == MilkdropPreset::ParseIssue::UNKNOWN_FUNCTION);
+        TEST(preset->parseIssues[0].text == "frobnicate");
+        TEST(preset->parseIssues[1].kind == MilkdropPreset::ParseIssue::UNKNOWN_PARAM);
+        TEST(preset->parseIssues[1].text == "fmadeup");
+        preset->parseIssues.clear();
+        return true;
+    }
+
 
     bool _test()
     {
@@ -2714,6 +2757,7 @@ public:
         success &= test_eqn();
         success &= test_lines();
         success &= test_params();
+        success &= test_issues();
         return success;
     }
 
@@ -27,12 +27,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "Common.hpp"
 #include "wipemalloc.h"
 #include "fftsg.h"
 #include "PCM.hpp"
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 
 // see https://github.com/projectM-visualizer/projectm/issues/161
@@ -88,10 +99,15 @@ public:
 };
 
 
-PCM::PCM() : start(0), newsamples(0)
+PCM::PCM() : start(0), newsamples(0), totalsamples(0), readoffset(0), presentationDelay(0),
+    anchorTime(-1.0), anchorSample(0), bandsSet(false), resampleRate(0), resamplePos(1.0), resampleStep(1.0), historyPos(0)
 {
     leveler = new AutoLevel();
 
+    // about 1.5 seconds per channel, room for output latency plus the analysis window
+    pcmL = (float *)wipemalloc(ringsamples * sizeof(float));
+    pcmR = (float *)wipemalloc(ringsamples * sizeof(float));
+
     //Allocate FFT workspace
     // per rdft() documentation
     //    length of ip >= 2+sqrt(n) and length of w == n/2
@@ -104,18 +120,22 @@ PCM::PCM() : start(0), newsamples(0)
     ip = (int *)wipemalloc(34 * sizeof(int));
     ip[0]=0;
 
-    memset(pcmL, 0, sizeof(pcmL));
-    memset(pcmR, 0, sizeof(pcmR));
     memset(freqL, 0, sizeof(freqL));
     memset(freqR, 0, sizeof(freqR));
     memset(spectrumL, 0, sizeof(spectrumL));
     memset(spectrumR, 0, sizeof(spectrumR));
+    memset(bandsL, 0, sizeof(bandsL));
+    memset(bandsR, 0, sizeof(bandsR));
+    memset(historyL, 0, sizeof(historyL));
+    memset(historyR, 0, sizeof(historyR));
 }
 
 
 PCM::~PCM()
 {
     delete leveler;
+    free(pcmL);
+    free(pcmR);
     free(w);
     free(ip);
 }
@@ -123,19 +143,118 @@ PCM::~PCM()
 #include <iostream>
 
 
-void PCM::addPCMfloat(const float *PCMdata, size_t samples)
+namespace {
+
+// accumulate sum(|x|) and max(|x|) over count samples
+#ifdef __SSE2__
+void absSumMax(const float *data, size_t count, float &sum, float &max)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vsum = _mm_setzero_ps();
+    __m128 vmax = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128 a = _mm_andnot_ps(sign, _mm_loadu_ps(data + i));
+        vsum = _mm_add_ps(vsum, a);
+        vmax = _mm_max_ps(vmax, a);
+    }
+    float s[4], m[4];
+    _mm_storeu_ps(s, vsum);
+    _mm_storeu_ps(m, vmax);
+    sum += (s[0] + s[1]) + (s[2] + s[3]);
+    max = fmaxf(max, fmaxf(fmaxf(m[0], m[1]), fmaxf(m[2], m[3])));
+    for ( ; i < count; i++)
+    {
+        sum += fabsf(data[i]);
+        max = fmaxf(max, fabsf(data[i]));
+    }
+}
+
+// split interleaved stereo into left and right, accumulating like absSumMax over both channels
+void deinterleave(const float *data, size_t count, float *left, float *right, float &sum, float &max)
 {
-    float a,sum=0,max=0;
-    for (size_t i=0; i<samples; i++)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vsum = _mm_setzero_ps();
+    __m128 vmax = _mm_setzero_ps();
+    size_t i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(data + i*2);        // l0 r0 l1 r1
+        __m128 b = _mm_loadu_ps(data + i*2 + 4);    // l2 r2 l3 r3
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+        a = _mm_andnot_ps(sign, a);
+        b = _mm_andnot_ps(sign, b);
+        vsum = _mm_add_ps(vsum, _mm_add_ps(a, b));
+        vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+    }
+    float s[4], m[4];
+    _mm_storeu_ps(s, vsum);
+    _mm_storeu_ps(m, vmax);
+    sum += (s[0] + s[1]) + (s[2] + s[3]);
+    max = fmaxf(max, fmaxf(fmaxf(m[0], m[1]), fmaxf(m[2], m[3])));
+    for ( ; i < count; i++)
     {
-        size_t j=(i+start)%maxsamples;
-        a=pcmL[j] = PCMdata[i];
-        pcmR[j] = PCMdata[i];
-        sum += fabs(a);
-        max = fmax(max,a);
+        float l = left[i] = data[i*2];
+        float r = right[i] = data[i*2+1];
+        sum += fabsf(l) + fabsf(r);
+        max = fmaxf(max, fmaxf(fabsf(l), fabsf(r)));
     }
-    start = (start+samples)%maxsamples;
+}
+#else
+void absSumMax(const float *data, size_t count, float &sum, float &max)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += fabsf(data[i]);
+        max = fmaxf(max, fabsf(data[i]));
+    }
+}
+
+void deinterleave(const float *data, size_t count, float *left, float *right, float &sum, float &max)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float l = left[i] = data[i*2];
+        float r = right[i] = data[i*2+1];
+        sum += fabsf(l) + fabsf(r);
+        max = fmaxf(max, fmaxf(fabsf(l), fabsf(r)));
+    }
+}
+#endif
+
+}
+
+
+// Hands a write of 'samples' new frames to writeRun(from, to, count) as at most two
+// contiguous runs: input index 'from' goes to ring position 'to'. Only the newest
+// ringsamples frames of an oversized write are kept.
+template <typename WriteRun>
+void PCM::_writeRuns(size_t samples, WriteRun writeRun)
+{
+    size_t skip = samples > ringsamples ? samples - ringsamples : 0;
+    size_t pos = (start + skip) % ringsamples;
+    size_t count = samples - skip;
+    size_t first = std::min(count, ringsamples - pos);
+    writeRun(skip, pos, first);
+    if (first < count)
+        writeRun(skip + first, (size_t)0, count - first);
+    start = (start + samples) % ringsamples;
     newsamples += samples;
+    totalsamples += samples;
+}
+
+
+void PCM::addPCMfloat(const float *PCMdata, size_t samples)
+{
+    float sum=0,max=0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
+    {
+        memcpy(pcmL + to, PCMdata + from, count * sizeof(float));
+        memcpy(pcmR + to, PCMdata + from, count * sizeof(float));
+        absSumMax(PCMdata + from, count, sum, max);
+    });
     level = leveler->updateLevel(samples, sum, max);
 }
 
@@ -144,70 +263,80 @@ void PCM::addPCMfloat(const float *PCMdata, size_t samples)
 void PCM::addPCMfloat_2ch(const float *PCMdata, size_t count)
 {
     size_t samples = count/2;
-    float a,b,sum=0,max=0;
-    for (size_t i=0; i<samples; i++)
-    {
-        size_t j=(start+i)%maxsamples;
-        a = pcmL[j] = PCMdata[i*2];
-        b = pcmR[j] = PCMdata[i*2+1];
-        sum += fabs(a) + fabs(b);
-        max = fmax(fmax(max,fabs(a)),fabs(b));
-    }
-    start = (start + samples) % maxsamples;
-    newsamples += samples;
+    float sum=0,max=0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t n)
+    {
+        deinterleave(PCMdata + from*2, n, pcmL + to, pcmR + to, sum, max);
+    });
     level = leveler->updateLevel(samples, sum/2, max);
 }
 
 
 void PCM::addPCM16Data(const short* pcm_data, size_t samples)
 {
-    float a, b, sum = 0, max = 0;
-    for (size_t i = 0; i < samples; ++i)
+    float sum = 0, max = 0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
     {
-        size_t j = (i + start) % maxsamples;
-        a = pcmL[j] = (pcm_data[i * 2 + 0] / 16384.0);
-        b = pcmR[j] = (pcm_data[i * 2 + 1] / 16384.0);
-        sum += fabs(a) + fabs(b);
-        max = fmax(fmax(max, a), b);
-    }
-    start = (start + samples) % maxsamples;
-    newsamples += samples;
+        const short *in = pcm_data + from * 2;
+        for (size_t i = 0; i < count; ++i)
+        {
+            float a = pcmL[to + i] = in[i * 2 + 0] / 16384.0f;
+            float b = pcmR[to + i] = in[i * 2 + 1] / 16384.0f;
+            sum += fabsf(a) + fabsf(b);
+            max = fmaxf(fmaxf(max, a), b);
+        }
+    });
     level = leveler->updateLevel(samples, sum/2, max);
 }
 
 
+void PCM::addPCMNormalized(const short* pcm_data, size_t samples)
+{
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
+    {
+        const short *in = pcm_data + from * 2;
+        for (size_t i = 0; i < count; ++i)
+        {
+            pcmL[to + i] = in[i * 2 + 0] / 16384.0f;
+            pcmR[to + i] = in[i * 2 + 1] / 16384.0f;
+        }
+    });
+    level = 1.0;
+}
+
+
 void PCM::addPCM16(const short PCMdata[2][512])
 {
-    const int samples=512;
-    float a,b,sum=0,max=0;
-    for (size_t i=0;i<samples;i++)
+    const size_t samples=512;
+    float sum=0,max=0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
     {
-		size_t j=(i+start) % maxsamples;
-        a=pcmL[j]=(PCMdata[0][i]/16384.0);
-        b=pcmR[j]=(PCMdata[1][i]/16384.0);
-        sum += fabs(a) + fabs(b);
-        max = fmax(fmax(max,a),b);
-    }
-	start = (start+samples) % maxsamples;
-    newsamples += samples;
+        for (size_t i=0; i<count; i++)
+        {
+            float a = pcmL[to+i] = PCMdata[0][from+i] / 16384.0f;
+            float b = pcmR[to+i] = PCMdata[1][from+i] / 16384.0f;
+            sum += fabsf(a) + fabsf(b);
+            max = fmaxf(fmaxf(max,a),b);
+        }
+    });
     level = leveler->updateLevel(samples, sum/2, max);
 }
 
 
 void PCM::addPCM8(const unsigned char PCMdata[2][1024])
 {
-    const int samples=1024;
-    float a,b,sum=0,max=0;
-    for (size_t i=0; i<samples; i++)
+    const size_t samples=1024;
+    float sum=0,max=0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
     {
-        size_t j= (i+start) % maxsamples;
-        a=pcmL[j]=(((float)PCMdata[0][i] - 128.0) / 64 );
-        b=pcmR[j]=(((float)PCMdata[1][i] - 128.0) / 64 );
-        sum += fabs(a) + fabs(b);
-        max = fmax(fmax(max,a),b);
-    }
-    start = (start + samples) % maxsamples;
-    newsamples += samples;
+        for (size_t i=0; i<count; i++)
+        {
+            float a = pcmL[to+i] = ((float)PCMdata[0][from+i] - 128.0f) / 64;
+            float b = pcmR[to+i] = ((float)PCMdata[1][from+i] - 128.0f) / 64;
+            sum += fabsf(a) + fabsf(b);
+            max = fmaxf(fmaxf(max,a),b);
+        }
+    });
     level = leveler->updateLevel(samples, sum/2, max);
 }
 
@@ -215,20 +344,249 @@ void PCM::addPCM8(const unsigned char PCMdata[2][1024])
 void PCM::addPCM8_512(const unsigned char PCMdata[2][512])
 {
     const size_t samples=512;
-    float a,b,sum=0,max=0;
-    for (size_t i=0; i<samples; i++)
-    {
-        size_t j = (i+start) % maxsamples;
-        a=pcmL[j]=(((float)PCMdata[0][i] - 128.0 ) / 64 );
-        b=pcmR[j]=(((float)PCMdata[1][i] - 128.0 ) / 64 );
-        sum += fabs(a) + fabs(b);
-        max = fmax(fmax(max,a),b);
-    }
-    start = (start + samples) % maxsamples;
-    newsamples += samples;
+    float sum=0,max=0;
+    _writeRuns(samples, [&](size_t from, size_t to, size_t count)
+    {
+        for (size_t i=0; i<count; i++)
+        {
+            float a = pcmL[to+i] = ((float)PCMdata[0][from+i] - 128.0f) / 64;
+            float b = pcmR[to+i] = ((float)PCMdata[1][from+i] - 128.0f) / 64;
+            sum += fabsf(a) + fabsf(b);
+            max = fmaxf(fmaxf(max,a),b);
+        }
+    });
     level = leveler->updateLevel(samples, sum/2, max);
 }
 
+namespace {
+
+// full scale of each sample format maps to [-1.0,1.0]
+inline float toFloat(float sample) { return sample; }
+inline float toFloat(int16_t sample) { return sample * (1.0f / 32768.0f); }
+inline float toFloat(int32_t sample) { return sample * (1.0f / 2147483648.0f); }
+inline float toFloat(uint8_t sample) { return (sample - 128) * (1.0f / 128.0f); }
+
+// the filter row h applied to both channels' windows, PCM_RESAMPLE_TAPS is a multiple of 4
+#ifdef __SSE2__
+inline void filterTaps(const float *h, const float *windowL, const float *windowR, float &outL, float &outR)
+{
+    __m128 accL = _mm_setzero_ps();
+    __m128 accR = _mm_setzero_ps();
+    for (int tap = 0; tap < PCM_RESAMPLE_TAPS; tap += 4)
+    {
+        __m128 taps = _mm_loadu_ps(h + tap);
+        accL = _mm_add_ps(accL, _mm_mul_ps(taps, _mm_loadu_ps(windowL + tap)));
+        accR = _mm_add_ps(accR, _mm_mul_ps(taps, _mm_loadu_ps(windowR + tap)));
+    }
+    float l[4], r[4];
+    _mm_storeu_ps(l, accL);
+    _mm_storeu_ps(r, accR);
+    outL = (l[0] + l[1]) + (l[2] + l[3]);
+    outR = (r[0] + r[1]) + (r[2] + r[3]);
+}
+#else
+inline void filterTaps(const float *h, const float *windowL, const float *windowR, float &outL, float &outR)
+{
+    outL = 0;
+    outR = 0;
+    for (int tap = 0; tap < PCM_RESAMPLE_TAPS; tap++)
+    {
+        outL += h[tap] * windowL[tap];
+        outR += h[tap] * windowR[tap];
+    }
+}
+#endif
+
+}
+
+
+void PCM::addPCM(const void *data, PCM_FORMAT format, unsigned channels, size_t frames,
+                 unsigned sampleRate, bool interleaved, double timestamp)
+{
+    if (channels == 0 || frames == 0)
+        return;
+
+    if (timestamp >= 0)
+    {
+        // the resampler delays its output by half the filter length
+        anchorSample = totalsamples;
+        anchorTime = timestamp - (sampleRate == analysisRate ? 0.0 : (PCM_RESAMPLE_TAPS/2.0) / sampleRate);
+    }
+
+    if (sampleRate != analysisRate && sampleRate != resampleRate)
+        _initResampler(sampleRate);
+
+    // one loop per format, nothing switches on the format per sample
+    const size_t before = totalsamples;
+    float sum = 0, max = 0;
+    switch (format)
+    {
+        case PCM_FORMAT_INT16:
+            _addFrames((const int16_t *)data, channels, frames, sampleRate, interleaved, sum, max);
+            break;
+        case PCM_FORMAT_INT32:
+            _addFrames((const int32_t *)data, channels, frames, sampleRate, interleaved, sum, max);
+            break;
+        case PCM_FORMAT_UINT8:
+            _addFrames((const uint8_t *)data, channels, frames, sampleRate, interleaved, sum, max);
+            break;
+        case PCM_FORMAT_FLOAT:
+        default:
+            _addFrames((const float *)data, channels, frames, sampleRate, interleaved, sum, max);
+            break;
+    }
+
+    const size_t samples = totalsamples - before;
+    if (samples > 0)
+        level = leveler->updateLevel(samples, sum/2, max);
+}
+
+
+template <typename T>
+void PCM::_addFrames(const T *data, unsigned channels, size_t frames, unsigned sampleRate, bool interleaved,
+                     float &sum, float &max)
+{
+    const float k3db = 0.70710678f;
+    // distance between frames, and between the channels of one frame
+    const size_t step = interleaved ? channels : 1;
+    const size_t stride = interleaved ? 1 : frames;
+
+    // downmixed a block at a time on the stack, then written to the ring in contiguous runs
+    float left[PCM_BLOCK], right[PCM_BLOCK];
+    for (size_t first = 0; first < frames; first += PCM_BLOCK)
+    {
+        const size_t count = std::min((size_t)PCM_BLOCK, frames - first);
+        const T *in = data + first * step;
+        if (channels == 1)
+        {
+            for (size_t i = 0; i < count; i++)
+                left[i] = right[i] = toFloat(in[i * step]);
+        }
+        else if (channels == 2)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                left[i] = toFloat(in[i * step]);
+                right[i] = toFloat(in[i * step + stride]);
+            }
+        }
+        else if (channels == 6 || channels == 8)
+        {
+            // 5.1: FL FR C LFE SL SR, 7.1: FL FR C LFE BL BR SL SR
+            // LFE is kept, dropping it would starve the bass detection
+            for (size_t i = 0; i < count; i++)
+            {
+                const T *frame = in + i * step;
+                const float c = (toFloat(frame[2*stride]) + toFloat(frame[3*stride])) * k3db;
+                left[i] = toFloat(frame[0]) + c + toFloat(frame[4*stride]) * k3db;
+                right[i] = toFloat(frame[stride]) + c + toFloat(frame[5*stride]) * k3db;
+            }
+            if (channels == 8)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    left[i] += toFloat(in[i * step + 6*stride]) * k3db;
+                    right[i] += toFloat(in[i * step + 7*stride]) * k3db;
+                }
+            }
+        }
+        else
+        {
+            const float scale = 2.0f / channels;
+            for (size_t i = 0; i < count; i++)
+            {
+                const T *frame = in + i * step;
+                float l = 0, r = 0;
+                for (unsigned c = 0; c < channels; c++)
+                    (c & 1 ? r : l) += toFloat(frame[c*stride]);
+                left[i] = l * scale;
+                right[i] = r * scale;
+            }
+        }
+
+        if (sampleRate == analysisRate)
+            _writeBlock(left, right, count, sum, max);
+        else
+            _resample(left, right, count, sum, max);
+    }
+}
+
+
+void PCM::_writeBlock(const float *left, const float *right, size_t count, float &sum, float &max)
+{
+    _writeRuns(count, [&](size_t from, size_t to, size_t run)
+    {
+        memcpy(pcmL + to, left + from, run * sizeof(float));
+        memcpy(pcmR + to, right + from, run * sizeof(float));
+        absSumMax(left + from, run, sum, max);
+        absSumMax(right + from, run, sum, max);
+    });
+}
+
+
+/*
+ * Windowed sinc polyphase filter. Each row is the filter for one fractional output
+ * position between the two centre taps, normalized to unity gain at DC.
+ * When downsampling the cutoff follows the output rate so nothing aliases into the FFT.
+ */
+void PCM::_initResampler(unsigned sampleRate)
+{
+    resampleRate = sampleRate;
+    resampleStep = (double)sampleRate / analysisRate;
+    resamplePos = 1.0;
+    historyPos = 0;
+    memset(historyL, 0, sizeof(historyL));
+    memset(historyR, 0, sizeof(historyR));
+
+    const double cutoff = 0.9 * fmin(1.0, (double)analysisRate / sampleRate);
+    const int centre = PCM_RESAMPLE_TAPS/2 - 1;
+    for (int phase = 0; phase < PCM_RESAMPLE_PHASES; phase++)
+    {
+        double total = 0;
+        double h[PCM_RESAMPLE_TAPS];
+        for (int tap = 0; tap < PCM_RESAMPLE_TAPS; tap++)
+        {
+            const double x = tap - centre - (double)phase / PCM_RESAMPLE_PHASES;
+            const double sinc = x == 0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            const double t = x / PCM_RESAMPLE_TAPS;
+            const double window = 0.42 + 0.5 * cos(2 * M_PI * t) + 0.08 * cos(4 * M_PI * t);
+            h[tap] = sinc * window;
+            total += h[tap];
+        }
+        for (int tap = 0; tap < PCM_RESAMPLE_TAPS; tap++)
+            filter[phase][tap] = h[tap] / total;
+    }
+}
+
+
+// push count input frames and emit every output sample that now has its full filter support
+void PCM::_resample(const float *left, const float *right, size_t count, float &sum, float &max)
+{
+    float outL[PCM_BLOCK], outR[PCM_BLOCK];
+    size_t out = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        historyL[historyPos] = historyL[historyPos + PCM_RESAMPLE_TAPS] = left[i];
+        historyR[historyPos] = historyR[historyPos + PCM_RESAMPLE_TAPS] = right[i];
+        historyPos = (historyPos + 1) % PCM_RESAMPLE_TAPS;
+
+        // the window is oldest..newest and contiguous
+        const float *windowL = historyL + historyPos;
+        const float *windowR = historyR + historyPos;
+        for (resamplePos -= 1.0; resamplePos < 1.0; resamplePos += resampleStep)
+        {
+            filterTaps(filter[(int)(resamplePos * PCM_RESAMPLE_PHASES)], windowL, windowR, outL[out], outR[out]);
+            if (++out == PCM_BLOCK)
+            {
+                _writeBlock(outL, outR, out, sum, max);
+                out = 0;
+            }
+        }
+    }
+    if (out > 0)
+        _writeBlock(outL, outR, out, sum, max);
+}
+
 
 // puts sound data requested at provided pointer
 //
@@ -300,9 +658,25 @@ void PCM::getPCM(float *data, CHANNEL channel, size_t samples, float smoothing)
 void PCM::getSpectrum(float *data, CHANNEL channel, size_t samples, float smoothing)
 {
     assert(channel == 0 || channel == 1);
-    _updateFFT();
 
     float *spectrum = channel == 0 ? spectrumL : spectrumR;
+    float replayed[FFT_LENGTH];
+    if (bandsSet)
+    {
+        const float *bands = channel == 0 ? bandsL : bandsR;
+        size_t lo = 0;
+        for (int band = 0; band < SPECTRUM_BANDS; band++)
+        {
+            size_t hi = _bandEnd(band, lo);
+            for (size_t bin = lo; bin < hi; bin++)
+                replayed[bin] = bands[band];
+            lo = hi;
+        }
+        spectrum = replayed;
+    }
+    else
+        _updateFFT();
+
     if (smoothing == 0)
     {
         size_t count = samples <= FFT_LENGTH ? samples : FFT_LENGTH;
@@ -327,6 +701,82 @@ void PCM::getSpectrum(float *data, CHANNEL channel, size_t samples, float smooth
     }
 }
 
+size_t PCM::_bandEnd(int band, size_t lo)
+{
+    size_t hi = band == SPECTRUM_BANDS - 1 ? FFT_LENGTH :
+                (size_t)pow((double)FFT_LENGTH, (band + 1.0) / SPECTRUM_BANDS);
+    return std::max(hi, lo + 1);
+}
+
+void PCM::spectrumBands(const float *spectrum, float *bands)
+{
+    size_t lo = 0;
+    for (int band = 0; band < SPECTRUM_BANDS; band++)
+    {
+        size_t hi = _bandEnd(band, lo);
+        float sum = 0;
+        for (size_t bin = lo; bin < hi; bin++)
+            sum += spectrum[bin];
+        bands[band] = sum / (hi - lo);
+        lo = hi;
+    }
+}
+
+void PCM::setSpectrumBands(const float *left, const float *right)
+{
+    memcpy(bandsL, left, sizeof(bandsL));
+    memcpy(bandsR, right, sizeof(bandsR));
+    bandsSet = true;
+}
+
+double PCM::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void PCM::setPresentationDelay(double seconds)
+{
+    presentationDelay = seconds > 0 ? seconds : 0;
+}
+
+
+void PCM::alignToTime(double displayTime)
+{
+    // the frame shows what is heard at displayTime, that audio was captured presentationDelay earlier
+    double lag = presentationDelay;
+    if (anchorTime >= 0)
+    {
+        const double newest = anchorTime + (double)(totalsamples - anchorSample) / analysisRate;
+        lag = newest - (displayTime - presentationDelay);
+    }
+
+    size_t offset = lag > 0 ? (size_t)(lag * analysisRate + 0.5) : 0;
+    offset = std::min(offset, ringsamples - maxsamples);
+    if (offset != readoffset)
+    {
+        readoffset = offset;
+        newsamples++;   // the analysis window moved, recompute the FFT
+    }
+}
+
+
+void PCM::getSpectrumAt(float *data, CHANNEL channel, size_t samples, size_t offset)
+{
+    assert(channel == 0 || channel == 1);
+    assert(offset + FFT_LENGTH*2 <= maxsamples);
+
+    double freq[FFT_LENGTH*2];
+    float spectrum[FFT_LENGTH];
+    _computeSpectrum(freq, spectrum, channel, offset);
+
+    size_t count = samples <= FFT_LENGTH ? samples : FFT_LENGTH;
+    for (size_t i = 0; i < count; i++)
+        data[i] = spectrum[i];
+    for (size_t i = count; i < samples; i++)
+        data[i] = 0;
+}
+
 void PCM::_updateFFT()
 {
     if (newsamples > 0)
@@ -342,11 +792,16 @@ void PCM::_updateFFT(size_t channel)
     assert(channel == 0 || channel == 1);
 
     double *freq = channel==0 ? freqL : freqR;
-    _copyPCM(freq, channel, FFT_LENGTH*2);
+    float *spectrum = channel==0 ? spectrumL : spectrumR;
+    _computeSpectrum(freq, spectrum, channel, 0);
+}
+
+void PCM::_computeSpectrum(double *freq, float *spectrum, size_t channel, size_t offset)
+{
+    _copyPCM(freq, channel, FFT_LENGTH*2, offset);
     rdft(FFT_LENGTH*2, 1, freq, ip, w);
 
     // compute magnitude data (m^2 actually)
-    float *spectrum = channel==0 ? spectrumL : spectrumR;
     for (size_t i=1 ; i<FFT_LENGTH ; i++)
     {
         double m2 = (freq[i * 2] * freq[i * 2] + freq[i * 2 + 1] * freq[i * 2 + 1]);
@@ -360,32 +815,39 @@ inline double constrain(double a, double mn, double mx)
     return a>mx ? mx : a<mn ? mn : a;
 }
 
-// pull data from circular buffer
+// reversed, scaled copy out of the ring in at most two runs that need no wrap checks
+template <typename T>
+void PCM::_copyRuns(T *to, const float *from, size_t count, size_t back, double volume)
+{
+    size_t pos = (start + ringsamples - back % ringsamples) % ringsamples;
+    if (pos == 0)
+        pos = ringsamples;
+    size_t first = std::min(count, pos);
+    const float *src = from + pos - 1;
+    for (size_t i = 0; i < first; i++)
+        to[i] = src[-(ptrdiff_t)i] * volume;
+    src = from + ringsamples - 1;
+    for (size_t i = first; i < count; i++)
+        to[i] = src[-(ptrdiff_t)(i - first)] * volume;
+}
+
+// pull data from circular buffer, newest first, starting readoffset samples back
 void PCM::_copyPCM(float *to, int channel, size_t count)
 {
     assert(channel == 0 || channel == 1);
     assert(count < maxsamples);
     const float *from = channel==0 ? pcmL : pcmR;
     const double volume = 1.0 / level;
-    for (size_t i=0, pos=start ; i<count ; i++)
-    {
-        if (pos==0)
-            pos = maxsamples;
-        to[i] = from[--pos] * volume;
-    }
+    _copyRuns(to, from, count, readoffset, volume);
 }
 
-void PCM::_copyPCM(double *to, int channel, size_t count)
+void PCM::_copyPCM(double *to, int channel, size_t count, size_t offset)
 {
     assert(channel == 0 || channel == 1);
+    assert(offset < maxsamples);
     const float *from = channel==0 ? pcmL : pcmR;
     const double volume = 1.0 / level;
-    for (size_t i=0, pos=start ; i<count ; i++)
-    {
-        if (pos==0)
-            pos = maxsamples;
-        to[i] = from[--pos] * volume;
-    }
+    _copyRuns(to, from, count, readoffset + offset, volume);
 }
 
 //Free stuff
@@ -479,6 +941,114 @@ public:
         return true;
 	}
 
+    /* addPCM: format conversion, downmix and resampling */
+    bool test_addpcm_generic()
+    {
+        const size_t frames = 600;
+
+        // int16 planar stereo
+        {
+            PCM pcm;
+            short *data = new short[frames*2];
+            for (size_t i = 0; i < frames; i++)
+            {
+                data[i] = (short)(i * 16);
+                data[frames + i] = (short)-(i * 16);
+            }
+            pcm.addPCM(data, PCM_FORMAT_INT16, 2, frames, PCM::analysisRate, false);
+            TEST(pcm.sampleCount() == frames);
+            float copy0[16], copy1[16];
+            pcm.level = 1.0;
+            pcm._copyPCM(copy0, 0, 16);
+            pcm._copyPCM(copy1, 1, 16);
+            for (size_t i = 0; i < 16; i++)
+            {
+                TEST(eq(copy0[i], (frames - 1 - i) * 16 / 32768.0f));
+                TEST(eq(copy0[i], -copy1[i]));
+            }
+            delete[] data;
+        }
+
+        // 5.1 float, only the centre channel set: both sides get it at -3dB
+        {
+            PCM pcm;
+            float *data = new float[frames*6];
+            for (size_t i = 0; i < frames*6; i++)
+                data[i] = (i % 6) == 2 ? 0.5f : 0.0f;
+            pcm.addPCM(data, PCM_FORMAT_FLOAT, 6, frames, PCM::analysisRate);
+            float copy0[16], copy1[16];
+            pcm.level = 1.0;
+            pcm._copyPCM(copy0, 0, 16);
+            pcm._copyPCM(copy1, 1, 16);
+            for (size_t i = 0; i < 16; i++)
+            {
+                TEST(eq(copy0[i], 0.5f * 0.70710678f));
+                TEST(eq(copy1[i], 0.5f * 0.70710678f));
+            }
+            delete[] data;
+        }
+
+        // 48kHz int32 mono is resampled, DC passes through unchanged
+        {
+            PCM pcm;
+            int *data = new int[frames];
+            for (size_t i = 0; i < frames; i++)
+                data[i] = 1 << 29;
+            for (size_t i = 0; i < 10; i++)
+                pcm.addPCM(data, PCM_FORMAT_INT32, 1, frames, 48000);
+            const size_t expected = frames * 10 * PCM::analysisRate / 48000;
+            TEST(pcm.sampleCount() + 2 >= expected && pcm.sampleCount() <= expected + 2);
+            float copy0[64];
+            pcm.level = 1.0;
+            pcm._copyPCM(copy0, 0, 64);
+            for (size_t i = 0; i < 64; i++)
+                TEST(eq(copy0[i], 0.25f));
+            delete[] data;
+        }
+
+        return true;
+    }
+
+    /* block writes and reads split correctly at the ring wrap point */
+    bool test_wrap()
+    {
+        PCM pcm;
+        const size_t samples = 1001;   // odd, so the SSE loops leave a scalar tail
+        float *data = new float[samples*2];
+        for (size_t i = 0; i < samples; i++)
+        {
+            data[i*2] = (float)i / samples;
+            data[i*2+1] = -(float)i / samples;
+        }
+        // the last write straddles the end of the ring
+        pcm.start = PCM::ringsamples - 300;
+        pcm.addPCMfloat_2ch(data, samples*2);
+        TEST(pcm.start == samples - 300);
+        TEST(eq(pcm.pcmL[PCM::ringsamples - 1], 299.0f / samples));
+        TEST(eq(pcm.pcmR[0], -300.0f / samples));
+
+        float copy0[1000], copy1[1000];
+        pcm.level = 1.0;
+        pcm._copyPCM(copy0, 0, 1000);
+        pcm._copyPCM(copy1, 1, 1000);
+        for (size_t i = 0; i < 1000; i++)
+        {
+            TEST(eq(copy0[i], (float)(samples - 1 - i) / samples));
+            TEST(eq(copy1[i], -copy0[i]));
+        }
+
+        // mono, a short write that wraps
+        pcm.start = PCM::ringsamples - 7;
+        pcm.addPCMfloat(data, 13);
+        pcm.level = 1.0;
+        pcm._copyPCM(copy0, 1, 13);
+        for (size_t i = 0; i < 13; i++)
+            TEST(eq(copy0[i], data[12 - i]));
+
+        delete[] data;
+        return true;
+    }
+
 	bool test_fft()
     {
         PCM pcm;
@@ -528,6 +1098,16 @@ public:
             for (size_t i=0 ; i<FFT_LENGTH-1 ; i++)
                 TEST(0==freq0[i]);
             TEST(freq0[FFT_LENGTH-1] > 100000);
+
+            // the hop analysis window with no offset matches the cached spectrum,
+            // and an offset window still sees the same stationary signal
+            pcm.getSpectrumAt(freq1, CHANNEL_0, FFT_LENGTH, 0);
+            for (size_t i = 0; i < FFT_LENGTH; i++)
+                TEST(eq(freq0[i], freq1[i]));
+            pcm.getSpectrumAt(freq1, CHANNEL_0, FFT_LENGTH, 2);
+            for (size_t i = 0; i < FFT_LENGTH; i++)
+                TEST(eq(freq0[i], freq1[i]));
+            TEST(pcm.sampleCount() == 2 * 1024 + 1024 * 2);
             free(freq0);
             free(freq1);
         }
@@ -536,10 +1116,46 @@ public:
         return true;
     }
 
+    /* presentation delay moves the analysis window back in time */
+    bool test_delay()
+    {
+        PCM pcm;
+        const size_t samples = 4096;
+        float *data = new float[samples];
+        for (size_t i = 0; i < samples; i++)
+            data[i] = (float)i / samples;
+        pcm.addPCMfloat(data, samples);
+        pcm.level = 1.0;
+
+        float copy[16];
+        pcm.setPresentationDelay(100.0 / PCM::analysisRate);
+        pcm.alignToTime(PCM::now());
+        pcm._copyPCM(copy, 0, 16);
+        for (size_t i = 0; i < 16; i++)
+            TEST(eq(copy[i], (float)(samples - 1 - 100 - i) / samples));
+
+        // timestamped: the newest sample was captured 50 samples before the display time,
+        // so the window only lags it by the remaining 50 samples of the delay
+        const double t = 1000.0;
+        pcm.addPCM(data, PCM_FORMAT_FLOAT, 1, samples, PCM::analysisRate, true,
+                   t - (double)samples / PCM::analysisRate);
+        pcm.level = 1.0;
+        pcm.alignToTime(t + 50.0 / PCM::analysisRate);
+        pcm._copyPCM(copy, 0, 16);
+        for (size_t i = 0; i < 16; i++)
+            TEST(eq(copy[i], (float)(samples - 1 - 50 - i) / samples));
+
+        delete[] data;
+        return true;
+    }
+
 	bool test() override
 	{
 		TEST(test_addpcm());
+		TEST(test_addpcm_generic());
+		TEST(test_wrap());
 		TEST(test_fft());
+		TEST(test_delay());
 		return true;
 	}
 };
@@ -36,6 +36,9 @@
 // FFT_LENGTH is number of magnitude values available from getSpectrum().
 // Internally this is generated using 2xFFT_LENGTH samples per channel.
 #define FFT_LENGTH 512
+
+// log spaced bands of PCM::spectrumBands(), the resolution feature tracks store the spectrum in
+#define SPECTRUM_BANDS 32
 class Test;
 class AutoLevel;
 
@@ -47,6 +50,22 @@ enum CHANNEL
     CHANNEL_1 = 1
 };
 
+/** Sample formats accepted by PCM::addPCM() */
+enum PCM_FORMAT
+{
+    PCM_FORMAT_FLOAT = 0,   // 32 bit float, nominal range [-1.0,1.0]
+    PCM_FORMAT_INT16 = 1,   // signed 16 bit
+    PCM_FORMAT_INT32 = 2,   // signed 32 bit
+    PCM_FORMAT_UINT8 = 3    // unsigned 8 bit, 128 is silence
+};
+
+// frames addPCM() downmixes (or resamples) on the stack before writing them to the ring
+#define PCM_BLOCK 256
+
+// taps and phases of the polyphase resampler used by addPCM()
+#define PCM_RESAMPLE_TAPS 16
+#define PCM_RESAMPLE_PHASES 128
+
 class 
 #ifdef WIN32 
 DLLEXPORT 
@@ -54,9 +73,15 @@ DLLEXPORT
 PCM
 {
 public:
-    /* maximum number of sound samples that are actually stored. */
+    /* maximum number of sound samples handed out by getPCM() and used for analysis. */
     static const size_t maxsamples=2048;
 
+    /* number of sound samples stored, enough to delay the analysis for presentation latency */
+    static const size_t ringsamples=65536;
+
+    /* sample rate the analysis (FFT, beat detection) assumes */
+    static const unsigned analysisRate=44100;
+
     PCM();
     ~PCM();
 
@@ -67,6 +92,35 @@ public:
     void addPCM8( const unsigned char [2][1024] );
     void addPCM8_512( const unsigned char [2][512] );
 
+    /** Like addPCM16Data, but the data is already level-normalized (1.0 == 16384) and
+     * auto-levelling is bypassed. Used to replay precomputed feature tracks. */
+    void addPCMNormalized( const short *pcm_data, size_t samples );
+
+    /**
+     * Generic entry point for any capture format.
+     * data holds 'frames' frames of 'channels' channels, either interleaved (LRLR...)
+     * or planar (all of channel 0, then all of channel 1, ...).
+     * Mono is copied to both channels, 5.1 (FL FR C LFE SL SR) and 7.1
+     * (FL FR C LFE BL BR SL SR) are downmixed to stereo, other layouts fold even
+     * channels left and odd channels right.
+     * Audio is resampled to analysisRate in the same pass as it is written into
+     * the sample buffer, no temporary buffers are allocated.
+     */
+    void addPCM( const void *data, PCM_FORMAT format, unsigned channels, size_t frames,
+                 unsigned sampleRate, bool interleaved = true, double timestamp = -1.0 );
+
+    /**
+     * Latency compensation.
+     * timestamp passed to addPCM() is the capture time of the first frame, in seconds on the
+     * PCM::now() clock. Each frame projectM calls alignToTime() with the expected display
+     * time and all analysis (getPCM, getSpectrum, beat detection) then uses the audio that
+     * is heard at that moment, presentationDelay seconds after it was captured.
+     * Without timestamps the newest sample is assumed to be captured at display time.
+     */
+    static double now();
+    void setPresentationDelay( double seconds );
+    void alignToTime( double displayTime );
+
     /**
      * PCM data
      * When smoothing=0 is copied directly from PCM buffers. smoothing=1.0 is almost a straight line.
@@ -80,22 +134,50 @@ public:
      */
     void getSpectrum(float *data, CHANNEL channel, size_t samples, float smoothing);
 
+    /** Spectrum of the FFT window ending 'offset' samples before the newest sample.
+     * Used for analysing audio in fixed hops rather than once per frame. The cached
+     * spectrum returned by getSpectrum() is not touched.
+     * offset is counted from the current analysis position (see alignToTime) and
+     * must be <= maxsamples - 2*FFT_LENGTH
+     */
+    void getSpectrumAt(float *data, CHANNEL channel, size_t samples, size_t offset);
+
+    /** Averages FFT_LENGTH magnitudes into SPECTRUM_BANDS log spaced bands */
+    static void spectrumBands(const float *spectrum, float *bands);
+
+    /** Makes getSpectrum() return these bands, each spread over the bins it averages,
+     * instead of the FFT of the samples, until clearSpectrumBands(). Used to replay
+     * the spectrum a feature track recorded. */
+    void setSpectrumBands(const float *left, const float *right);
+    void clearSpectrumBands() { bandsSet = false; }
+
+    /** Number of samples (per channel) up to the current analysis position, wraps on overflow */
+    size_t sampleCount() const { return totalsamples - readoffset; }
+
   	static Test* test();
 
 private:
     // mem-usage:
-    // pcmd 2x2048*4b    = 16K
+    // pcmd 2x65536*4b   = 512K
     // vdata 2x512x2*8b  = 16K
     // spectrum 2x512*4b = 4k
     // w = 512*8b        = 4k
 
-    // circular PCM buffer
+    // circular PCM buffer of ringsamples
     // adjust "volume" of PCM data as we go, this simplifies everything downstream...
     // normalize to range [-1.0,1.0]
-    float pcmL[maxsamples];
-    float pcmR[maxsamples];
+    float *pcmL;
+    float *pcmR;
     int start;
     size_t newsamples;
+    size_t totalsamples;
+
+    // analysis reads this many samples behind the newest one
+    size_t readoffset;
+    double presentationDelay;
+    // capture time of sample number anchorSample, negative when untimed
+    double anchorTime;
+    size_t anchorSample;
 
     // raw FFT data
     double freqL[FFT_LENGTH*2];
@@ -103,20 +185,53 @@ private:
     // magnitude data
     float spectrumL[FFT_LENGTH];
     float spectrumR[FFT_LENGTH];
+    // set by setSpectrumBands(), replaces the magnitude data in getSpectrum()
+    bool bandsSet;
+    float bandsL[SPECTRUM_BANDS];
+    float bandsR[SPECTRUM_BANDS];
 
     // for FFT library
     int *ip;
     double *w;
 
+    // resampler state for addPCM(), the history is written twice so the
+    // filter always reads PCM_RESAMPLE_TAPS contiguous samples
+    unsigned resampleRate;
+    double resamplePos;
+    double resampleStep;
+    size_t historyPos;
+    float historyL[PCM_RESAMPLE_TAPS*2];
+    float historyR[PCM_RESAMPLE_TAPS*2];
+    float filter[PCM_RESAMPLE_PHASES][PCM_RESAMPLE_TAPS];
+
+    // split a write of new samples at the ring wrap point
+    template <typename WriteRun>
+    void _writeRuns(size_t samples, WriteRun writeRun);
+
+    // downmix and write (or resample) frames of one sample format
+    template <typename T>
+    void _addFrames(const T *data, unsigned channels, size_t frames, unsigned sampleRate, bool interleaved,
+                    float &sum, float &max);
+
+    void _initResampler(unsigned sampleRate);
+    void _resample(const float *left, const float *right, size_t count, float &sum, float &max);
+    // write count new frames, accumulating sum(|x|) and max(|x|) over both channels
+    void _writeBlock(const float *left, const float *right, size_t count, float &sum, float &max);
+
     void freePCM();
 
-    // copy data out of the circular PCM buffer
+    // copy data out of the circular PCM buffer, skipping the newest 'offset' samples
     void _copyPCM(float *PCMdata, int channel, size_t count);
-    void _copyPCM(double *PCMdata, int channel, size_t count);
+    void _copyPCM(double *PCMdata, int channel, size_t count, size_t offset=0);
+    template <typename T>
+    void _copyRuns(T *to, const float *from, size_t count, size_t back, double volume);
 
     // update FFT data if new samples are available.
     void _updateFFT();
     void _updateFFT(size_t channel);
+    void _computeSpectrum(double *freq, float *spectrum, size_t channel, size_t offset);
+    // end of the bins band averages, lo is where it starts
+    static size_t _bandEnd(int band, size_t lo);
 
     friend class PCMTest;
 
@@ -0,0 +1,547 @@
+//
+//  PackFile.cpp
+//  libprojectM
+//
+
+#include "PackFile.hpp"
+#include "Common.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+#ifndef WIN32
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
+#endif
+
+// the copy of stb_image in SOIL2 inflates PNGs, deflated members go through it as well
+extern "C" int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
+
+namespace {
+
+const uint32_t LOCAL_HEADER = 0x04034b50;
+const uint32_t CENTRAL_HEADER = 0x02014b50;
+const uint32_t END_OF_DIRECTORY = 0x06054b50;
+
+const size_t LOCAL_HEADER_SIZE = 30;
+const size_t CENTRAL_HEADER_SIZE = 46;
+const size_t END_OF_DIRECTORY_SIZE = 22;
+
+// the most a deflate stream expands, a 258 byte match per two bits
+const uint64_t MAX_DEFLATE_RATIO = 1032;
+
+uint16_t get16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *) p;
+    return (uint16_t) (u[0] | (u[1] << 8));
+}
+
+uint32_t get32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *) p;
+    return (uint32_t) u[0] | ((uint32_t) u[1] << 8) | ((uint32_t) u[2] << 16) | ((uint32_t) u[3] << 24);
+}
+
+// zip stores local time the MS-DOS way
+int64_t dosTime(uint16_t date, uint16_t time)
+{
+    struct tm parts = tm();
+    parts.tm_year = ((date >> 9) & 0x7f) + 80;
+    parts.tm_mon = ((date >> 5) & 0x0f) - 1;
+    parts.tm_mday = date & 0x1f;
+    parts.tm_hour = (time >> 11) & 0x1f;
+    parts.tm_min = (time >> 5) & 0x3f;
+    parts.tm_sec = (time & 0x1f) * 2;
+    parts.tm_isdst = -1;
+    return (int64_t) mktime(&parts);
+}
+
+bool entryNameLess(const PackFile::Entry &a, const PackFile::Entry &b)
+{
+    return a.name < b.name;
+}
+
+}
+
+
+PackFile::PackFile() : _data(NULL), _size(0), _mapped(false), _fileSize(0), _fileMtime(0) {}
+
+PackFile::~PackFile()
+{
+    close();
+}
+
+bool PackFile::open(const std::string &path)
+{
+    close();
+
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        return false;
+    _fileSize = (uint64_t) info.st_size;
+    _fileMtime = (int64_t) info.st_mtime;
+
+#ifdef WIN32
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    _contents.resize((size_t) _fileSize);
+    if (!in || (!_contents.empty() && !in.read(&_contents[0], _contents.size())))
+    {
+        _contents.clear();
+        return false;
+    }
+    _data = _contents.empty() ? NULL : &_contents[0];
+    _size = _contents.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (_fileSize > 0)
+    {
+        void *mapping = mmap(NULL, (size_t) _fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            _data = (const char *) mapping;
+            _size = (size_t) _fileSize;
+            _mapped = true;
+        }
+    }
+    ::close(fd);
+    if (!_mapped)
+        return false;
+#endif
+
+    _path = path;
+    if (!readDirectory())
+    {
+        std::cerr << "[PackFile] " << path << " is not a zip archive projectM can read" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PackFile::close()
+{
+#ifndef WIN32
+    if (_mapped)
+        munmap((void *) _data, _size);
+#endif
+    _data = NULL;
+    _size = 0;
+    _mapped = false;
+    _contents.clear();
+    _entries.clear();
+    _path.clear();
+}
+
+const PackFile::Entry *PackFile::find(const std::string &name) const
+{
+    Entry key;
+    key.name = name;
+    std::replace(key.name.begin(), key.name.end(), '\\', '/');
+    while (!key.name.empty() && key.name[0] == '/')
+        key.name.erase(0, 1);
+
+    std::vector<Entry>::const_iterator it = std::lower_bound(_entries.begin(), _entries.end(), key, entryNameLess);
+    if (it == _entries.end() || it->name != key.name)
+        return NULL;
+    return &*it;
+}
+
+bool PackFile::read(const Entry &entry, const char *&data, size_t &size, std::vector<char> &buffer) const
+{
+    if (entry.offset + LOCAL_HEADER_SIZE > _size)
+        return false;
+    const char *header = _data + entry.offset;
+    if (get32(header) != LOCAL_HEADER)
+        return false;
+
+    // the local header may carry a different extra field than the central directory
+    uint64_t start = entry.offset + LOCAL_HEADER_SIZE + get16(header + 26) + get16(header + 28);
+    if (start + entry.compressedSize > _size)
+        return false;
+
+    if (entry.method == 0)
+    {
+        if (entry.compressedSize != entry.size)
+            return false;
+        data = _data + start;
+        size = entry.size;
+        return true;
+    }
+
+    if (entry.method == 8)
+    {
+        buffer.resize(entry.size);
+        if (entry.size > 0 && stbi_zlib_decode_noheader_buffer(&buffer[0], (int) entry.size, _data + start,
+                                                               (int) entry.compressedSize) != (int) entry.size)
+            return false;
+        data = buffer.empty() ? _data + start : &buffer[0];
+        size = buffer.size();
+        return true;
+    }
+
+    return false;
+}
+
+bool PackFile::isPackName(const std::string &path)
+{
+    if (path.size() < 4)
+        return false;
+    std::string extension = path.substr(path.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), tolower);
+    return extension == ".zip";
+}
+
+bool PackFile::readDirectory()
+{
+    _entries.clear();
+    if (_size < END_OF_DIRECTORY_SIZE)
+        return false;
+
+    // the end of central directory record is last, followed by a comment of up to 64k
+    const char *end = NULL;
+    size_t lowest = _size > END_OF_DIRECTORY_SIZE + 0xffff ? _size - END_OF_DIRECTORY_SIZE - 0xffff : 0;
+    for (size_t at = _size - END_OF_DIRECTORY_SIZE + 1; at-- > lowest;)
+    {
+        if (get32(_data + at) == END_OF_DIRECTORY)
+        {
+            end = _data + at;
+            break;
+        }
+    }
+    if (end == NULL)
+        return false;
+
+    uint16_t count = get16(end + 10);
+    uint32_t directorySize = get32(end + 12);
+    uint32_t directoryOffset = get32(end + 16);
+    if (directoryOffset == 0xffffffff || (uint64_t) directoryOffset + directorySize > _size)
+        return false;
+
+    const char *p = _data + directoryOffset;
+    const char *directoryEnd = p + directorySize;
+    _entries.reserve(count);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (p + CENTRAL_HEADER_SIZE > directoryEnd || get32(p) != CENTRAL_HEADER)
+            return false;
+
+        uint16_t flags = get16(p + 8);
+        size_t nameLength = get16(p + 28);
+        size_t skip = CENTRAL_HEADER_SIZE + nameLength + get16(p + 30) + get16(p + 32);
+        if (p + skip > directoryEnd)
+            return false;
+
+        Entry entry;
+        entry.name.assign(p + CENTRAL_HEADER_SIZE, nameLength);
+        entry.method = get16(p + 10);
+        entry.mtime = dosTime(get16(p + 14), get16(p + 12));
+        entry.compressedSize = get32(p + 20);
+        entry.size = get32(p + 24);
+        entry.offset = get32(p + 42);
+        p += skip;
+
+        // members are read whole into memory through an int sized inflate, a size no
+        // compressed stream of this length could produce is a corrupt or hostile archive
+        if (entry.size > INT_MAX || entry.compressedSize > INT_MAX
+            || (entry.method == 8 && entry.size > entry.compressedSize * MAX_DEFLATE_RATIO))
+            return false;
+
+        // directories, and encrypted members nothing here could read
+        if (entry.name.empty() || entry.name[entry.name.size() - 1] == '/' || (flags & 1))
+            continue;
+        _entries.push_back(entry);
+    }
+
+    std::sort(_entries.begin(), _entries.end(), entryNameLess);
+    return true;
+}
+
+
+
+// TESTS
+
+
+#include "TestRunner.hpp"
+
+#ifndef NDEBUG
+
+#include "FileScanner.hpp"
+#include "FileSystem.hpp"
+#include "PresetFactoryManager.hpp"
+#include "MilkdropPresetFactory/MilkdropPreset.hpp"
+
+#include <cstdio>
+#include <memory>
+
+#define TEST(cond) if (!verify(__FILE__ ": " #cond,cond)) return false
+
+struct PackFileTest : public Test
+{
+    PackFileTest() : Test("PackFileTest")
+    {}
+
+    static void put16(std::string &out, uint16_t value)
+    {
+        out.push_back((char) (value & 0xff));
+        out.push_back((char) (value >> 8));
+    }
+
+    static void put32(std::string &out, uint32_t value)
+    {
+        put16(out, (uint16_t) (value & 0xffff));
+        put16(out, (uint16_t) (value >> 16));
+    }
+
+    struct Member
+    {
+        std::string name;
+        std::string data;
+        uint16_t method;
+        uint32_t size;
+    };
+
+    // a zip archive as zip(1) writes one, without the checksums nothing here verifies
+    static std::string archive(const std::vector<Member> &members)
+    {
+        std::string out, directory;
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            const Member &member = members[i];
+            uint32_t offset = (uint32_t) out.size();
+            put32(out, LOCAL_HEADER);
+            put16(out, 20); put16(out, 0); put16(out, member.method);
+            put16(out, 0x6000); put16(out, 0x5021);          // 2020-01-01 12:00
+            put32(out, 0); put32(out, (uint32_t) member.data.size()); put32(out, member.size);
+            put16(out, (uint16_t) member.name.size()); put16(out, 4);
+            out += member.name;
+            out += "xxxx";
+            out += member.data;
+
+            put32(directory, CENTRAL_HEADER);
+            put16(directory, 20); put16(directory, 20); put16(directory, 0); put16(directory, member.method);
+            put16(directory, 0x6000); put16(directory, 0x5021);
+            put32(directory, 0); put32(directory, (uint32_t) member.data.size()); put32(directory, member.size);
+            put16(directory, (uint16_t) member.name.size()); put16(directory, 0); put16(directory, 0);
+            put16(directory, 0); put16(directory, 0); put32(directory, 0);
+            put32(directory, offset);
+            directory += member.name;
+        }
+
+        uint32_t directoryOffset = (uint32_t) out.size();
+        out += directory;
+        put32(out, END_OF_DIRECTORY);
+        put16(out, 0); put16(out, 0);
+        put16(out, (uint16_t) members.size()); put16(out, (uint16_t) members.size());
+        put32(out, (uint32_t) directory.size()); put32(out, directoryOffset);
+        put16(out, 7);
+        out += "comment";
+        return out;
+    }
+
+    static void use(PackFile &pack, const std::string &bytes)
+    {
+        pack._data = bytes.data();
+        pack._size = bytes.size();
+    }
+
+    bool test_read()
+    {
+        const std::string text = "per_frame_1=zoom = 1.01;\nper_frame_2=zoom = 1.01;\n";
+        // text, raw deflate
+        const unsigned char deflated[] = {
+            0x2b,0x48,0x2d,0x8a,0x4f,0x2b,0x4a,0xcc,0x4d,0x8d,0x37,0xb4,0xad,0xca,0xcf,0xcf,0x55,
+            0xb0,0x55,0x30,0xd4,0x33,0x30,0xb4,0xe6,0x2a,0x80,0x4b,0x18,0xa1,0x4a,0x00,0x00
+        };
+
+        std::vector<Member> members(4);
+        members[0].name = "Geiss/b.milk";
+        members[0].data = text;
+        members[0].method = 0;
+        members[1].name = "Geiss/";
+        members[1].method = 0;
+        members[2].name = "Geiss/a.milk";
+        members[2].data = std::string((const char *) deflated, sizeof(deflated));
+        members[2].method = 8;
+        members[3].name = "textures/clouds.jpg";
+        members[3].data = "jpeg";
+        members[3].method = 0;
+        for (size_t i = 0; i < members.size(); i++)
+            if (members[i].method == 0)
+                members[i].size = (uint32_t) members[i].data.size();
+        members[2].size = (uint32_t) text.size();
+
+        std::string bytes = archive(members);
+        PackFile pack;
+        use(pack, bytes);
+        TEST(pack.readDirectory());
+
+        // sorted, without the directory
+        TEST(pack.entries().size() == 3);
+        TEST(pack.entries()[0].name == "Geiss/a.milk");
+        TEST(pack.entries()[1].name == "Geiss/b.milk");
+        TEST(pack.find("Geiss\\b.milk") == &pack.entries()[1]);
+        TEST(pack.find("/textures/clouds.jpg") != NULL);
+        TEST(pack.find("Geiss") == NULL);
+
+        std::vector<char> buffer;
+        const char *data;
+        size_t size;
+        TEST(pack.read(*pack.find("Geiss/b.milk"), data, size, buffer));
+        TEST(std::string(data, size) == text);
+        TEST(data > bytes.data() && data < bytes.data() + bytes.size() && buffer.empty());
+
+        TEST(pack.read(*pack.find("Geiss/a.milk"), data, size, buffer));
+        TEST(std::string(data, size) == text);
+
+        time_t mtime = (time_t) pack.entries()[0].mtime;
+        struct tm parts = *localtime(&mtime);
+        TEST(parts.tm_year == 120 && parts.tm_mon == 0 && parts.tm_mday == 1 && parts.tm_hour == 12);
+        return true;
+    }
+
+    bool test_reject()
+    {
+        PackFile pack;
+        std::string bytes = "not a zip archive at all, just some text that is long enough";
+        use(pack, bytes);
+        TEST(!pack.readDirectory());
+
+        // a central directory that runs past the end
+        std::vector<Member> members(1);
+        members[0].name = "a.milk";
+        members[0].data = "zoom=1";
+        members[0].method = 0;
+        members[0].size = 6;
+        bytes = archive(members);
+        bytes[bytes.size() - 7 - 2 - 4 - 1] = (char) 0x7f;
+        use(pack, bytes);
+        TEST(!pack.readDirectory());
+
+        // sizes that would have read allocate gigabytes
+        members[0].size = 0x80000000u;
+        members[0].data = std::string(0x80000000u / MAX_DEFLATE_RATIO + 1, 'x');
+        members[0].method = 8;
+        bytes = archive(members);
+        use(pack, bytes);
+        TEST(!pack.readDirectory());
+        members[0].size = 0x40000000u;
+        members[0].data = "zoom=1";
+        bytes = archive(members);
+        use(pack, bytes);
+        TEST(!pack.readDirectory());
+        members[0].size = 6 * MAX_DEFLATE_RATIO;
+        bytes = archive(members);
+        use(pack, bytes);
+        TEST(pack.readDirectory());
+
+        TEST(PackFile::isPackName("/presets/Library.ZIP"));
+        TEST(!PackFile::isPackName("/presets/zip"));
+        TEST(!PackFile::isPackName("/presets/a.milk"));
+        return true;
+    }
+
+    // the same pack on disk, read through FileSystem, FileScanner and the preset factory
+    bool test_filesystem()
+    {
+        const std::string text = "[preset00]\nper_frame_1=zoom = 1.01;\nper_frame_2=rot = 0.02;\n";
+        std::vector<Member> members(2);
+        members[0].name = "Geiss/a.milk";
+        members[0].data = text;
+        members[1].name = "textures/clouds.jpg";
+        members[1].data = "jpeg";
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            members[i].method = 0;
+            members[i].size = (uint32_t) members[i].data.size();
+        }
+        const std::string bytes = archive(members);
+
+        const char *dir = getenv("TMPDIR");
+        if (dir == nullptr || *dir == 0)
+            dir = getenv("TEMP");
+        const std::string packPath = std::string(dir && *dir ? dir : ".") + "/PackFileTest.zip";
+        {
+            std::ofstream out(packPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        }
+
+        std::string split, member;
+        TEST(FileSystem::split(packPath + "/Geiss/a.milk", split, member));
+        TEST(split == packPath && member == "Geiss/a.milk");
+        TEST(FileSystem::split(packPath + "\\textures\\clouds.jpg", split, member));
+        TEST(split == packPath && member == "textures\\clouds.jpg");
+        TEST(!FileSystem::split(packPath + "/", split, member));
+        TEST(!FileSystem::split("/presets/Geiss/a.milk", split, member));
+
+        FileSystem::Contents contents;
+        TEST(FileSystem::read(packPath + "/Geiss/a.milk", contents));
+        TEST(std::string(contents.data(), contents.size()) == text);
+        TEST(!FileSystem::read(packPath + "/Geiss/b.milk", contents));
+        TEST(FileSystem::read(packPath, contents));
+        TEST(contents.size() == bytes.size());
+
+        // the pack itself is read into the buffer, the new owner keeps pointing at it
+        FileSystem::Contents moved(std::move(contents));
+        TEST(contents.data() == NULL && contents.size() == 0);
+        TEST(moved.size() == bytes.size() && std::equal(bytes.begin(), bytes.end(), moved.data()));
+        contents = std::move(moved);
+        TEST(contents.size() == bytes.size() && std::equal(bytes.begin(), bytes.end(), contents.data()));
+
+        uint64_t size;
+        int64_t mtime;
+        TEST(FileSystem::stat(packPath + "/textures/clouds.jpg", size, mtime));
+        TEST(size == 4);
+        TEST(FileSystem::exists(packPath + "/Geiss/a.milk"));
+        TEST(!FileSystem::exists(packPath + "/Geiss"));
+
+        std::vector<std::string> roots(1, packPath);
+        std::vector<std::string> extensions(1, ".milk");
+        std::vector<std::string> found;
+        FileScanner scanner(roots, extensions);
+        scanner.scan([&found](std::string &path, std::string &) { found.push_back(path); });
+        TEST(found.size() == 1 && found[0] == packPath + "/Geiss/a.milk");
+
+        PresetFactoryManager factories;
+        factories.initialize(8, 6);
+        std::unique_ptr<Preset> preset = factories.allocate(packPath + "/Geiss/a.milk", "a");
+        MilkdropPreset *milkdrop = dynamic_cast<MilkdropPreset *>(preset.get());
+        TEST(milkdrop != nullptr && milkdrop->per_frame_eqn_tree.size() == 2);
+
+        remove(packPath.c_str());
+        return true;
+    }
+
+    bool test() override
+    {
+        bool success = true;
+        success &= test_read();
+        success &= test_reject();
+        success &= test_filesystem();
+        return success;
+    }
+};
+
+Test* PackFile::test()
+{
+    return new PackFileTest();
+}
+
+#else
+
+Test* PackFile::test()
+{
+    return nullptr;
+}
+
+#endif
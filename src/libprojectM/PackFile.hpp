@@ -0,0 +1,83 @@
+//
+//  PackFile.hpp
+//  libprojectM
+//
+//  A zip archive of presets and textures, so a library ships as one file instead of
+//  thousands of small ones. The archive is memory mapped and its central directory read
+//  into a sorted index when it is opened; after that a member is a lookup and a pointer
+//  into the mapping, without another open or seek. Stored members are handed out in
+//  place, deflated ones are inflated on read, so packs are best built with `zip -0`.
+//  Zip64 and encrypted archives are not supported.
+//
+//  FileSystem resolves paths that run through a pack, like "presets.zip/Geiss/x.milk".
+//
+
+#ifndef PackFile_hpp
+#define PackFile_hpp
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class Test;
+
+class PackFile
+{
+public:
+    struct Entry
+    {
+        std::string name;           // path inside the pack, '/' separated
+        uint64_t offset;            // of the member's local header
+        uint32_t size;              // uncompressed
+        uint32_t compressedSize;
+        uint16_t method;            // 0 stored, 8 deflated
+        int64_t mtime;
+    };
+
+    PackFile();
+    ~PackFile();
+
+    /// Maps the archive at path and reads its central directory, false if it is no zip
+    bool open(const std::string &path);
+    void close();
+
+    const std::string &path() const { return _path; }
+
+    /// Size and mtime of the archive file when it was opened
+    uint64_t fileSize() const { return _fileSize; }
+    int64_t fileMtime() const { return _fileMtime; }
+
+    /// Every file in the pack, sorted by name
+    const std::vector<Entry> &entries() const { return _entries; }
+
+    /// The member called name, '/' or '\' separated, NULL when there is none
+    const Entry *find(const std::string &name) const;
+
+    /// The member's bytes. Stored members point into the mapping and leave buffer alone,
+    /// deflated ones are inflated into buffer.
+    bool read(const Entry &entry, const char *&data, size_t &size, std::vector<char> &buffer) const;
+
+    /// True for file names that are packs, those ending in .zip
+    static bool isPackName(const std::string &path);
+
+    static Test* test();
+
+private:
+    friend struct PackFileTest;
+
+    std::string _path;
+    const char *_data;
+    size_t _size;
+    bool _mapped;                   // _data is a mapping, otherwise it points into _contents
+    std::vector<char> _contents;
+    uint64_t _fileSize;
+    int64_t _fileMtime;
+    std::vector<Entry> _entries;
+
+    PackFile(const PackFile &);
+    PackFile &operator=(const PackFile &);
+
+    bool readDirectory();
+};
+
+#endif /* PackFile_hpp */
@@ -0,0 +1,589 @@
+//
+//  PresetCatalog.cpp
+//  libprojectM
+//
+
+#include "PresetCatalog.hpp"
+#include "FileSystem.hpp"
+#include "PackFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// bump when the layout below changes, older indexes are then ignored and rebuilt
+const char INDEX_MAGIC[4] = { 'P', 'M', 'I', 'X' };
+const uint32_t INDEX_VERSION = 1;
+const uint32_t INDEX_BYTE_ORDER = 0x01020304;
+
+template <class T>
+void put(std::ostream &out, T value)
+{
+    out.write((const char *) &value, sizeof(value));
+}
+
+void putString(std::ostream &out, const std::string &value)
+{
+    put<uint32_t>(out, (uint32_t) value.size());
+    out.write(value.data(), value.size());
+}
+
+template <class T>
+bool get(std::istream &in, T &value)
+{
+    return (bool) in.read((char *) &value, sizeof(value));
+}
+
+bool getString(std::istream &in, std::string &value)
+{
+    uint32_t size;
+    if (!get(in, size) || size > (1 << 20))
+        return false;
+    value.resize(size);
+    return size == 0 || (bool) in.read(&value[0], size);
+}
+
+std::string join(const std::string &directory, const std::string &name)
+{
+    // same as fts_path, no doubled separator after a root given with a trailing one
+    if (!directory.empty() && (directory[directory.size() - 1] == '/' || directory[directory.size() - 1] == PATH_SEPARATOR))
+        return directory + name;
+    return directory + PATH_SEPARATOR + name;
+}
+
+bool isIdentifier(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// samplers TextureManager provides itself, they are no files a preset depends on
+bool isBuiltinTexture(const std::string &name)
+{
+    static const char *builtins[] = {
+        "main", "blur1", "blur2", "blur3",
+        "noise_lq", "noise_lq_lite", "noise_mq", "noise_hq", "noisevol_lq", "noisevol_hq",
+        NULL
+    };
+    for (int i = 0; builtins[i] != NULL; i++)
+        if (name == builtins[i])
+            return true;
+    return false;
+}
+
+std::string lowercase(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), tolower);
+    return value;
+}
+
+}
+
+
+PresetCatalog::PresetCatalog(const std::vector<std::string> &extensions)
+    : _dirty(false), _scanStart(0), _full(false)
+{
+    setExtensions(extensions);
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void PresetCatalog::setExtensions(const std::vector<std::string> &extensions)
+{
+    std::vector<std::string> roots;
+    _extensions = extensions;
+    _filter = FileScanner(roots, _extensions);
+
+    // listings only hold the files the old extensions matched
+    _directories.clear();
+}
+
+bool PresetCatalog::load(const std::string &file)
+{
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    if (!in)
+        return false;
+    return read(in);
+}
+
+bool PresetCatalog::save(const std::string &file) const
+{
+    // unique to this process and call, so two instances saving one index don't share it
+    static std::atomic<unsigned> saves(0);
+    std::string temporary = file + "." + std::to_string((long)getpid()) + "-" + std::to_string(saves++) + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out || !write(out))
+        {
+            out.close();
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+#ifdef WIN32
+    // rename does not replace an existing file there
+    remove(file.c_str());
+#endif
+    if (rename(temporary.c_str(), file.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PresetCatalog::write(std::ostream &out) const
+{
+    out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put<uint32_t>(out, INDEX_VERSION);
+    put<uint32_t>(out, INDEX_BYTE_ORDER);
+
+    put<uint32_t>(out, (uint32_t) _directories.size());
+    for (std::map<std::string, Directory>::const_iterator it = _directories.begin(); it != _directories.end(); ++it)
+    {
+        putString(out, it->first);
+        put<int64_t>(out, it->second.mtime);
+        put<uint32_t>(out, (uint32_t) it->second.children.size());
+        for (size_t i = 0; i < it->second.children.size(); i++)
+        {
+            putString(out, it->second.children[i].name);
+            put<uint8_t>(out, it->second.children[i].directory ? 1 : 0);
+        }
+    }
+
+    put<uint32_t>(out, (uint32_t) _entries.size());
+    for (size_t i = 0; i < _entries.size(); i++)
+    {
+        const Entry &entry = _entries[i];
+        putString(out, entry.path);
+        putString(out, entry.name);
+        put<uint64_t>(out, entry.size);
+        put<int64_t>(out, entry.mtime);
+        put<uint64_t>(out, entry.hash);
+        put<uint8_t>(out, entry.status);
+        putString(out, entry.author);
+        put<int32_t>(out, entry.rating);
+        put<uint8_t>(out, (entry.hasWarpShader ? 1 : 0) | (entry.hasCompShader ? 2 : 0));
+        put<uint32_t>(out, (uint32_t) entry.textures.size());
+        for (size_t t = 0; t < entry.textures.size(); t++)
+            putString(out, entry.textures[t]);
+    }
+
+    return (bool) out;
+}
+
+bool PresetCatalog::read(std::istream &in)
+{
+    _directories.clear();
+    _entries.clear();
+    _dirty = true;
+
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t version, byteOrder, count;
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+        || !get(in, version) || version != INDEX_VERSION
+        || !get(in, byteOrder) || byteOrder != INDEX_BYTE_ORDER)
+        return false;
+
+    std::map<std::string, Directory> directories;
+    if (!get(in, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::string path;
+        Directory directory;
+        uint32_t children;
+        if (!getString(in, path) || !get(in, directory.mtime) || !get(in, children))
+            return false;
+        for (uint32_t c = 0; c < children; c++)
+        {
+            Child child;
+            uint8_t isDirectory;
+            if (!getString(in, child.name) || !get(in, isDirectory))
+                return false;
+            child.directory = isDirectory != 0;
+            directory.children.push_back(child);
+        }
+        directories[path].mtime = directory.mtime;
+        directories[path].children.swap(directory.children);
+    }
+
+    std::vector<Entry> entries;
+    if (!get(in, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Entry entry;
+        uint8_t flags;
+        int32_t rating;
+        uint32_t textures;
+        if (!getString(in, entry.path) || !getString(in, entry.name)
+            || !get(in, entry.size) || !get(in, entry.mtime) || !get(in, entry.hash)
+            || !get(in, entry.status) || !getString(in, entry.author)
+            || !get(in, rating) || !get(in, flags) || !get(in, textures))
+            return false;
+        entry.rating = rating;
+        entry.hasWarpShader = (flags & 1) != 0;
+        entry.hasCompShader = (flags & 2) != 0;
+        for (uint32_t t = 0; t < textures; t++)
+        {
+            std::string texture;
+            if (!getString(in, texture))
+                return false;
+            entry.textures.push_back(texture);
+        }
+        entries.push_back(entry);
+    }
+
+    _directories.swap(directories);
+    _entries.swap(entries);
+    _dirty = false;
+    return true;
+}
+
+
+void PresetCatalog::scan(const std::string &root, bool full)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _full = full;
+    _scanStart = (int64_t) time(NULL);
+
+    _oldDirectories.swap(_directories);
+    _directories.clear();
+    _oldEntries.clear();
+    for (size_t i = 0; i < _entries.size(); i++)
+        _oldEntries[_entries[i].path] = _entries[i];
+    size_t oldCount = _entries.size();
+    _entries.clear();
+
+    // a first scan or a full one lists every directory, do that in parallel up front
+    if (full || _oldDirectories.empty())
+    {
+        std::vector<std::string> roots(1, root);
+        FileScanner scanner(roots, _extensions);
+        scanner.scanDirectories([this](std::vector<FileScanner::Directory> &batch) {
+            for (size_t i = 0; i < batch.size(); i++)
+                _listed[batch[i].path].entries.swap(batch[i].entries);
+        });
+    }
+
+    scanDirectory(root);
+
+    // removed files or directories show up as a shorter catalog or a directory listed again
+    if (_entries.size() != oldCount || _stats.directoriesListed > 0 || _stats.filesParsed > 0
+        || _directories.size() != _oldDirectories.size())
+        _dirty = true;
+
+    _oldDirectories.clear();
+    _oldEntries.clear();
+    _listed.clear();
+}
+
+void PresetCatalog::scanDirectory(const std::string &path)
+{
+    // a pack is listed whole, its mtime stands for all of its members
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !(S_ISDIR(info.st_mode) || (S_ISREG(info.st_mode) && PackFile::isPackName(path))))
+        return;
+
+    // a symlink back to a directory above, fts skips these as FTS_DC
+    std::pair<uint64_t, uint64_t> identity((uint64_t) info.st_dev, (uint64_t) info.st_ino);
+    if (identity.second != 0 && std::find(_ancestors.begin(), _ancestors.end(), identity) != _ancestors.end())
+        return;
+
+    // a directory changed in the second we list it could change again unnoticed, those are
+    // stored with an mtime that never matches so the next scan lists them again
+    int64_t mtime = (int64_t) info.st_mtime;
+    if (mtime >= _scanStart - 1)
+        mtime = -1;
+
+    Directory &directory = _directories[path];
+    std::map<std::string, Directory>::iterator old = _oldDirectories.find(path);
+    bool changed = _full || old == _oldDirectories.end() || old->second.mtime == -1 || old->second.mtime != mtime;
+    if (changed)
+    {
+        listDirectory(path, directory);
+        _stats.directoriesListed++;
+    }
+    else
+    {
+        directory.children.swap(old->second.children);
+        _stats.directoriesReused++;
+    }
+    directory.mtime = mtime;
+
+    // copied, the recursion inserts into _directories
+    std::vector<Child> children(directory.children);
+    _ancestors.push_back(identity);
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        std::string childPath = join(path, children[i].name);
+        if (children[i].directory)
+            scanDirectory(childPath);
+        else
+            addFile(childPath, children[i].name, changed);
+    }
+    _ancestors.pop_back();
+}
+
+void PresetCatalog::listDirectory(const std::string &path, Directory &directory)
+{
+    FileScanner::Directory listing;
+    std::map<std::string, FileScanner::Directory>::iterator listed = _listed.find(path);
+    if (listed != _listed.end())
+        listing.entries.swap(listed->second.entries);
+    else
+        _filter.list(path, listing);
+    directory.children.swap(listing.entries);
+}
+
+void PresetCatalog::addFile(const std::string &path, const std::string &name, bool directoryChanged)
+{
+    std::map<std::string, Entry>::iterator old = _oldEntries.find(path);
+
+    // nothing was added, removed or renamed here, trust what we have
+    if (!directoryChanged && old != _oldEntries.end() && old->second.mtime != -1)
+    {
+        _entries.push_back(old->second);
+        _stats.filesReused++;
+        return;
+    }
+
+    uint64_t size;
+    int64_t mtime;
+    if (!FileSystem::stat(path, size, mtime))
+        return;
+
+    if (mtime >= _scanStart - 1)
+        mtime = -1;
+
+    if (old != _oldEntries.end() && mtime != -1 && old->second.mtime == mtime && old->second.size == size)
+    {
+        _entries.push_back(old->second);
+        _stats.filesReused++;
+        return;
+    }
+
+    Entry entry;
+    entry.path = path;
+    entry.name = _filter.extensionMatches(name.substr(name.find_last_of('/') + 1));
+    entry.size = size;
+    entry.mtime = mtime;
+    readFile(entry);
+    _entries.push_back(entry);
+    _stats.filesParsed++;
+}
+
+bool PresetCatalog::readFile(Entry &entry)
+{
+    FileSystem::Contents contents;
+    if (!FileSystem::read(entry.path, contents))
+    {
+        entry.status = STATUS_UNREADABLE;
+        return false;
+    }
+
+    std::string text(contents.data() ? contents.data() : "", contents.size());
+    entry.hash = hash(text.data(), text.size());
+    parse(text, entry);
+
+    // a name like "Author - Title" is the only place milkdrop presets record who made them
+    size_t dash = entry.name.find(" - ");
+    if (dash != std::string::npos && dash > 0)
+        entry.author = entry.name.substr(0, dash);
+    return true;
+}
+
+
+void PresetCatalog::parse(const std::string &text, Entry &entry)
+{
+    bool assignments = false;
+    entry.rating = 3;
+    entry.hasWarpShader = false;
+    entry.hasCompShader = false;
+    entry.textures.clear();
+
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+
+        size_t equals = text.find('=', start);
+        if (equals < end)
+        {
+            assignments = true;
+            std::string key = lowercase(text.substr(start, equals - start));
+
+            if (key == "frating")
+            {
+                float rating = (float) atof(text.c_str() + equals + 1);
+                entry.rating = (int) floor(rating + 0.5f);
+                entry.rating = std::max(0, std::min(5, entry.rating));
+            }
+            else if (key.compare(0, 5, "warp_") == 0 || key.compare(0, 5, "comp_") == 0)
+            {
+                if (key[0] == 'w')
+                    entry.hasWarpShader = true;
+                else
+                    entry.hasCompShader = true;
+
+                // samplers, minus their wrap and filter prefix
+                size_t sampler = equals;
+                while ((sampler = text.find("sampler_", sampler)) != std::string::npos && sampler < end)
+                {
+                    sampler += 8;
+                    size_t nameEnd = sampler;
+                    while (nameEnd < end && isIdentifier(text[nameEnd]))
+                        nameEnd++;
+                    std::string texture = lowercase(text.substr(sampler, nameEnd - sampler));
+                    if (texture.size() > 3 && texture[2] == '_' &&
+                        (texture.compare(0, 2, "fw") == 0 || texture.compare(0, 2, "fc") == 0 ||
+                         texture.compare(0, 2, "pw") == 0 || texture.compare(0, 2, "pc") == 0))
+                        texture = texture.substr(3);
+                    if (!texture.empty() && !isBuiltinTexture(texture) &&
+                        std::find(entry.textures.begin(), entry.textures.end(), texture) == entry.textures.end())
+                        entry.textures.push_back(texture);
+                    sampler = nameEnd;
+                }
+            }
+        }
+        start = end + 1;
+    }
+
+    entry.status = assignments ? STATUS_OK : STATUS_EMPTY;
+}
+
+uint64_t PresetCatalog::hash(const char *data, size_t size)
+{
+    uint64_t value = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        value ^= (unsigned char) data[i];
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+
+// TESTS
+
+
+#include "TestRunner.hpp"
+
+#ifndef NDEBUG
+
+#include <sstream>
+
+#define TEST(cond) if (!verify(__FILE__ ": " #cond,cond)) return false
+
+struct PresetCatalogTest : public Test
+{
+    PresetCatalogTest() : Test("PresetCatalogTest")
+    {}
+
+public:
+
+    bool test_parse()
+    {
+        PresetCatalog::Entry entry;
+        PresetCatalog::parse("[preset00]\r\n"
+                             "fRating=4.600000\r\n"
+                             "zoom=1.01\r\n"
+                             "warp_1=`shader_body { ret = tex2D(sampler_fw_main, uv).xyz;\r\n"
+                             "warp_2=`ret += tex2D(sampler_pc_Clouds2, uv).xyz * tex2D(sampler_noise_lq, uv).x; }\r\n"
+                             "comp_1=`sampler sampler_clouds2; float3 x = tex2D(sampler_blur1, uv).xyz;\r\n", entry);
+        TEST(entry.status == PresetCatalog::STATUS_OK);
+        TEST(entry.rating == 5);
+        TEST(entry.hasWarpShader);
+        TEST(entry.hasCompShader);
+        TEST(entry.textures.size() == 1);
+        TEST(entry.textures[0] == "clouds2");
+
+        PresetCatalog::parse("no presets here\n", entry);
+        TEST(entry.status == PresetCatalog::STATUS_EMPTY);
+        TEST(entry.rating == 3);
+        TEST(!entry.hasWarpShader && !entry.hasCompShader && entry.textures.empty());
+        return true;
+    }
+
+    bool test_roundtrip()
+    {
+        std::vector<std::string> extensions;
+        extensions.push_back(".milk");
+
+        PresetCatalog catalog(extensions);
+        PresetCatalog::Entry entry;
+        entry.path = "/presets/Author - Title.milk";
+        entry.name = "Author - Title";
+        entry.size = 1234;
+        entry.mtime = 1500000000;
+        entry.hash = PresetCatalog::hash("abc", 3);
+        entry.author = "Author";
+        entry.rating = 2;
+        entry.hasCompShader = true;
+        entry.textures.push_back("clouds2");
+        catalog._entries.push_back(entry);
+        catalog._directories["/presets"].mtime = 1500000001;
+        catalog._directories["/presets"].children.push_back(PresetCatalog::Child());
+        catalog._directories["/presets"].children[0].name = "Author - Title.milk";
+        catalog._directories["/presets"].children[0].directory = false;
+
+        std::stringstream stream;
+        TEST(catalog.write(stream));
+
+        PresetCatalog copy(extensions);
+        TEST(copy.read(stream));
+        TEST(copy.entries().size() == 1);
+        const PresetCatalog::Entry &read = copy.entries()[0];
+        TEST(read.path == entry.path && read.name == entry.name && read.author == entry.author);
+        TEST(read.size == 1234 && read.mtime == 1500000000 && read.hash == entry.hash);
+        TEST(read.rating == 2 && !read.hasWarpShader && read.hasCompShader);
+        TEST(read.textures.size() == 1 && read.textures[0] == "clouds2");
+        TEST(copy._directories.size() == 1);
+        TEST(copy._directories["/presets"].mtime == 1500000001);
+        TEST(copy._directories["/presets"].children.size() == 1);
+
+        // a truncated index is rejected as a whole
+        std::string bytes = stream.str();
+        std::stringstream truncated(bytes.substr(0, bytes.size() - 4));
+        TEST(!copy.read(truncated));
+        TEST(copy.entries().empty());
+        return true;
+    }
+
+    bool test() override
+    {
+        TEST(PresetCatalog::hash("", 0) == 14695981039346656037ULL);
+        TEST(test_parse());
+        TEST(test_roundtrip());
+        return true;
+    }
+};
+
+Test* PresetCatalog::test()
+{
+    return new PresetCatalogTest();
+}
+
+#else
+
+Test* PresetCatalog::test()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,128 @@
+//
+//  PresetCatalog.hpp
+//  libprojectM
+//
+//  What PresetLoader knows about a preset directory, kept between runs in a small binary
+//  index file. A rescan stats each directory and only lists the ones whose mtime changed,
+//  and only reads the preset files that are new or whose size or mtime changed. Everything
+//  else, including the metadata pulled out of the presets, comes from the index.
+//
+
+#ifndef PresetCatalog_hpp
+#define PresetCatalog_hpp
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "FileScanner.hpp"
+
+class Test;
+
+class PresetCatalog
+{
+public:
+    enum Status
+    {
+        STATUS_OK = 0,
+        STATUS_UNREADABLE,      // could not be opened or read
+        STATUS_EMPTY            // no key=value lines, not a preset
+    };
+
+    struct Entry
+    {
+        std::string path;
+        std::string name;       // file name without the preset extension, as FileScanner hands it out
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;          // FNV-1a of the file contents
+        unsigned char status;
+
+        std::string author;     // the "Author - Title" file name convention
+        int rating;             // fRating rounded, 3 when the preset has none
+        bool hasWarpShader;
+        bool hasCompShader;
+        std::vector<std::string> textures;  // user textures the shaders sample, without sampler_
+
+        Entry() : size(0), mtime(0), hash(0), status(STATUS_OK), rating(3),
+                  hasWarpShader(false), hasCompShader(false) {}
+    };
+
+    /// Statistics of the last scan
+    struct Stats
+    {
+        size_t directoriesListed;
+        size_t directoriesReused;
+        size_t filesParsed;
+        size_t filesReused;
+    };
+
+    explicit PresetCatalog(const std::vector<std::string> &extensions = std::vector<std::string>());
+
+    /// The preset file extensions to look for, the next scan lists every directory again
+    void setExtensions(const std::vector<std::string> &extensions);
+
+    /// Reads an index written by save(). A missing, foreign or damaged file leaves the catalog empty.
+    bool load(const std::string &file);
+
+    /// Writes the index next to file and renames it over, a crash never leaves half an index
+    bool save(const std::string &file) const;
+
+    /// Brings the catalog up to date with the presets under root, in the order FileScanner
+    /// lists them. Files edited in place leave their directory's mtime alone, full stats
+    /// every file to catch those too. With no index to go by, the whole tree is listed by
+    /// FileScanner's thread pool first.
+    void scan(const std::string &root, bool full = false);
+
+    /// True when the last scan changed anything that save() would write
+    bool dirty() const { return _dirty; }
+
+    const std::vector<Entry> &entries() const { return _entries; }
+    const Stats &stats() const { return _stats; }
+
+    /// Fills the metadata and status of entry from the preset text
+    static void parse(const std::string &text, Entry &entry);
+
+    static uint64_t hash(const char *data, size_t size);
+
+    bool write(std::ostream &out) const;
+    bool read(std::istream &in);
+
+    static Test* test();
+
+private:
+    friend struct PresetCatalogTest;
+
+    typedef FileScanner::Directory::Entry Child;
+
+    struct Directory
+    {
+        int64_t mtime;
+        std::vector<Child> children;   // sorted by name
+    };
+
+    std::vector<std::string> _extensions;
+    FileScanner _filter;
+
+    std::map<std::string, Directory> _directories;
+    std::vector<Entry> _entries;
+    Stats _stats;
+    bool _dirty;
+
+    // state of the scan in progress
+    std::map<std::string, Directory> _oldDirectories;
+    std::map<std::string, Entry> _oldEntries;
+    std::vector<std::pair<uint64_t, uint64_t> > _ancestors;
+    std::map<std::string, FileScanner::Directory> _listed;
+    int64_t _scanStart;
+    bool _full;
+
+    void scanDirectory(const std::string &path);
+    void listDirectory(const std::string &path, Directory &directory);
+    void addFile(const std::string &path, const std::string &name, bool directoryChanged);
+    bool readFile(Entry &entry);
+};
+
+#endif /* PresetCatalog_hpp */
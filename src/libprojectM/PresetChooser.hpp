@@ -233,15 +233,7 @@ inline PresetChooser::iterator PresetChooser::weightedRandom(bool hardCut) const
 	const PresetRatingType ratingType = hardCut || (!_softCutRatingsEnabled) ? 
 		HARD_CUT_RATING_TYPE : SOFT_CUT_RATING_TYPE;		
 
-	const std::size_t ratingsTypeIndex = static_cast<std::size_t>(ratingType);
-	
-	const std::vector<int> & weights = _presetLoader->getPresetRatings()[ratingsTypeIndex];
-
-	const std::size_t index = RandomNumberGenerators::weightedRandom
-		(weights,
-		 _presetLoader->getPresetRatingsSums()[ratingsTypeIndex]);
-	
-	return begin(index);
+	return begin(_presetLoader->weightedRandom(ratingType));
 }
 
 #endif
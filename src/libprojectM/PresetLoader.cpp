@@ -20,13 +20,11 @@
 #include "fatal.h"
 #include "Common.hpp"
 
-PresetLoader::PresetLoader (int gx, int gy, std::string dirname = std::string()) :_dirname ( dirname )
+PresetLoader::PresetLoader (int gx, int gy, std::string dirname, std::string indexFile) :_dirname ( dirname ), _indexFile ( indexFile ), _indexLoaded ( false )
 {
     _presetFactoryManager.initialize(gx,gy);
 
-    std::vector<std::string> dirs{_dirname};
-    std::vector<std::string> extensions = _presetFactoryManager.extensionsHandled();
-    fileScanner = FileScanner(dirs, extensions);
+    _catalog.setExtensions(_presetFactoryManager.extensionsHandled());
 
 	// Do one scan
 	if ( _dirname != std::string() )
@@ -42,7 +40,7 @@ void PresetLoader::setScanDirectory ( std::string dirname )
 	_dirname = dirname;
 }
 
-void PresetLoader::addScannedPresetFile(const std::string &path, const std::string &name) {
+void PresetLoader::addScannedPresetFile(const std::string &path, const std::string &name, const PresetCatalog::Entry *metadata) {
     auto ext = parseExtension(path);
     if (ext.empty())
         return;
@@ -57,22 +55,40 @@ void PresetLoader::addScannedPresetFile(const std::string &path, const std::stri
     
     _entries.push_back(path);
     _presetNames.push_back(name + ext);
+    _nameIndex.push_back(_presetNames.back());
+    _metadata.push_back(metadata);
 }
 
-void PresetLoader::rescan()
+void PresetLoader::rescan(bool full)
 {
 	// std::cerr << "Rescanning..." << std::endl;
     
     // Clear the directory entry collection
     clear();
 
+    // the index of the last run, then only what changed since is read from disk
+    if (!_indexLoaded && !_indexFile.empty())
+        _catalog.load(_indexFile);
+    _indexLoaded = true;
+
     // scan for presets
-    using namespace std::placeholders;
-    fileScanner.scan(std::bind(&PresetLoader::addScannedPresetFile, this, _1, _2));
+    _catalog.scan(_dirname, full);
+    if (_catalog.dirty() && !_indexFile.empty() && !_catalog.save(_indexFile))
+    {
+        // said once, later scans keep the index in memory only
+        std::cerr << "[PresetLoader] could not write the preset index " << _indexFile << ", not keeping one" << std::endl;
+        _indexFile.clear();
+    }
+
+    const std::vector<PresetCatalog::Entry> &found = _catalog.entries();
+    for (std::size_t i = 0; i < found.size(); i++)
+        addScannedPresetFile(found[i].path, found[i].name, &found[i]);
 
     // Give all presets equal rating of 3 - why 3? I don't know
     _ratings = std::vector<RatingList>(TOTAL_RATING_TYPES, RatingList( _presetNames.size(), 3 ));
     _ratingsSums = std::vector<int>(TOTAL_RATING_TYPES, 3 *_presetNames.size());
+    for (unsigned int i = 0; i < _ratings.size(); i++)
+        _ratingTrees[i].assign(_ratings[i]);
 
     assert ( _entries.size() == _presetNames.size() );
 }
@@ -100,6 +116,11 @@ std::unique_ptr<Preset> PresetLoader::loadPreset ( const std::string & url )  co
     return std::unique_ptr<Preset>();
 }
 
+std::unique_ptr<Preset> PresetLoader::loadPreset ( const std::string & url, const std::string & presetName )  const
+{
+	return _presetFactoryManager.allocate ( url, presetName );
+}
+
 void PresetLoader::setRating(PresetIndex index, int rating, const PresetRatingType ratingType)
 {
 	const unsigned int ratingTypeIndex = static_cast<unsigned int>(ratingType);
@@ -109,18 +130,28 @@ void PresetLoader::setRating(PresetIndex index, int rating, const PresetRatingTy
 
 	_ratings[ratingTypeIndex][index] = rating;
 	_ratingsSums[ratingType] += rating;
+	_ratingTrees[ratingTypeIndex].set(index, rating);
+}
+
+PresetIndex PresetLoader::weightedRandom(const PresetRatingType ratingType) const
+{
+	return RandomNumberGenerators::weightedRandom(_ratingTrees[ratingType]);
 }
 
 unsigned long PresetLoader::addPresetURL ( const std::string & url, const std::string & presetName, const std::vector<int> & ratings)
 {
 	_entries.push_back(url);
 	_presetNames.push_back ( presetName );
+	_nameIndex.push_back ( presetName );
+	_metadata.push_back ( NULL );
 
 	assert(ratings.size() == TOTAL_RATING_TYPES);
 	assert(ratings.size() == _ratings.size());
 
-    for (unsigned int i = 0; i < _ratings.size(); i++)
+    for (unsigned int i = 0; i < _ratings.size(); i++) {
 		_ratings[i].push_back(ratings[i]);
+		_ratingTrees[i].push_back(ratings[i]);
+	}
 
     for (unsigned int i = 0; i < ratings.size(); i++)
 		_ratingsSums[i] += ratings[i];
@@ -132,10 +163,13 @@ void PresetLoader::removePreset ( PresetIndex index )
 {
 	_entries.erase ( _entries.begin() + index );
 	_presetNames.erase ( _presetNames.begin() + index );
+	_nameIndex.erase ( index );
+	_metadata.erase ( _metadata.begin() + index );
 
     for (unsigned int i = 0; i < _ratingsSums.size(); i++) {
 		_ratingsSums[i] -= _ratings[i][index];
 		_ratings[i].erase ( _ratings[i].begin() + index );
+		_ratingTrees[i].erase ( index );
 	}
 }
 
@@ -149,6 +183,11 @@ const std::string & PresetLoader::getPresetName ( PresetIndex index ) const
 	return _presetNames[index];
 }
 
+const PresetCatalog::Entry * PresetLoader::getPresetMetadata ( PresetIndex index ) const
+{
+	return _metadata[index];
+}
+
 
 // Get vector of preset names
 const std::vector<std::string> &PresetLoader::getPresetNames() const
@@ -159,7 +198,7 @@ const std::vector<std::string> &PresetLoader::getPresetNames() const
 // Get the preset index given a name
 const unsigned int PresetLoader::getPresetIndex(std::string &name) const
 {
-	return find(_presetNames.begin(), _presetNames.end(), name) - _presetNames.begin();
+	return _nameIndex.find(name);
 }
 
 int PresetLoader::getPresetRating ( PresetIndex index, const PresetRatingType ratingType ) const
@@ -167,6 +206,12 @@ int PresetLoader::getPresetRating ( PresetIndex index, const PresetRatingType ra
 	return _ratings[ratingType][index];
 }
 
+std::size_t PresetLoader::searchPresets ( const std::string & query, std::size_t offset, std::size_t count,
+                                          std::vector<PresetNameIndex::Match> & page ) const
+{
+	return _nameIndex.search(query, offset, count, page);
+}
+
 const std::vector<RatingList> & PresetLoader::getPresetRatings () const
 {
 	return _ratings;
@@ -178,17 +223,156 @@ const std::vector<int> & PresetLoader::getPresetRatingsSums() const {
 
 void PresetLoader::setPresetName(PresetIndex index, std::string name) {
 	_presetNames[index] = name;
+	_nameIndex.rename ( index, name );
 }
 
 void PresetLoader::insertPresetURL ( PresetIndex index, const std::string & url, const std::string & presetName, const RatingList & ratings)
 {
 	_entries.insert ( _entries.begin() + index, url );
 	_presetNames.insert ( _presetNames.begin() + index, presetName );
+	_nameIndex.insert ( index, presetName );
+	_metadata.insert ( _metadata.begin() + index, NULL );
 
     for (unsigned int i = 0; i < _ratingsSums.size();i++) {
-		_ratingsSums[i] += _ratings[i][index];
+		_ratingsSums[i] += ratings[i];
 		_ratings[i].insert ( _ratings[i].begin() + index, ratings[i] );
+		_ratingTrees[i].insert ( index, ratings[i] );
 	}
 
 	assert ( _entries.size() == _presetNames.size() );
 }
+
+
+// TESTS
+
+
+#include "TestRunner.hpp"
+
+#ifndef NDEBUG
+
+#define TEST(cond) if (!verify(__FILE__ ": " #cond,cond)) return false
+
+struct PresetLoaderTest : public Test
+{
+    PresetLoaderTest() : Test("PresetLoaderTest")
+    {}
+
+public:
+
+    bool test_tree()
+    {
+        // every size up to a few levels of the tree, against a plain prefix sum
+        for (int size = 1; size <= 19; size++)
+        {
+            std::vector<int> weights;
+            for (int i = 0; i < size; i++)
+                weights.push_back((i * 7) % 5);
+
+            RandomNumberGenerators::WeightTree assigned(weights);
+            RandomNumberGenerators::WeightTree appended;
+            for (int i = 0; i < size; i++)
+                appended.push_back(weights[i]);
+
+            int64_t mass = 0;
+            for (int i = 0; i < size; i++)
+            {
+                for (int m = 0; m < weights[i]; m++, mass++)
+                {
+                    TEST(assigned.find(mass) == (std::size_t) i);
+                    TEST(appended.find(mass) == (std::size_t) i);
+                }
+            }
+            TEST(assigned.total() == mass);
+            TEST(appended.total() == mass);
+        }
+
+        RandomNumberGenerators::WeightTree tree(std::vector<int>(6, 1));
+        tree.set(0, 0);
+        tree.set(3, 4);
+        tree.set(5, -2);
+        TEST(tree.total() == 7);
+        TEST(tree.find(0) == 1);
+        TEST(tree.find(2) == 3);
+        TEST(tree.find(5) == 3);
+        TEST(tree.find(6) == 4);
+
+        tree.insert(0, 2);
+        tree.erase(6);
+        TEST(tree.size() == 6);
+        TEST(tree.total() == 9);
+        TEST(tree.find(1) == 0);
+        TEST(tree.find(2) == 2);
+        return true;
+    }
+
+    bool test_ratings()
+    {
+        PresetLoader loader(400, 400, "");
+        for (int i = 0; i < 8; i++)
+            loader.addPresetURL("idle://test.milk", "test", RatingList{3, 3});
+
+        // only the hard cut ratings count for hard cuts, and a rating of 0 never comes up
+        for (int i = 0; i < 8; i++)
+            loader.setRating(i, i == 5 ? 1 : 0, HARD_CUT_RATING_TYPE);
+        for (int n = 0; n < 32; n++)
+            TEST(loader.weightedRandom(HARD_CUT_RATING_TYPE) == 5);
+
+        loader.insertPresetURL(0, "idle://test.milk", "test", RatingList{0, 3});
+        loader.removePreset(3);
+        TEST(loader.getPresetRatingsSums()[HARD_CUT_RATING_TYPE] == 1);
+        TEST(loader.getPresetRatingsSums()[SOFT_CUT_RATING_TYPE] == 24);
+        for (int n = 0; n < 32; n++)
+            TEST(loader.weightedRandom(HARD_CUT_RATING_TYPE) == 5);
+
+        bool seen[8] = {};
+        for (int n = 0; n < 400; n++)
+            seen[loader.weightedRandom(SOFT_CUT_RATING_TYPE)] = true;
+        for (int i = 0; i < 8; i++)
+            TEST(seen[i]);
+        return true;
+    }
+
+    bool test_names()
+    {
+        PresetLoader loader(400, 400, "");
+        loader.addPresetURL("idle://a.milk", "a", RatingList{3, 3});
+        loader.addPresetURL("idle://b.milk", "b", RatingList{3, 3});
+
+        // the name index follows the playlist
+        std::string presetName = "b";
+        TEST(loader.getPresetIndex(presetName) == 1);
+        loader.insertPresetURL(0, "idle://c.milk", "c", RatingList{3, 3});
+        TEST(loader.getPresetIndex(presetName) == 2);
+        loader.removePreset(1);
+        loader.setPresetName(0, "d");
+        presetName = "d";
+        TEST(loader.getPresetIndex(presetName) == 0);
+
+        std::vector<PresetNameIndex::Match> page;
+        TEST(loader.searchPresets("B", 0, 10, page) == 1 && page[0].index == 1);
+        return true;
+    }
+
+    bool test() override
+    {
+        bool success = true;
+        success &= test_tree();
+        success &= test_ratings();
+        success &= test_names();
+        return success;
+    }
+};
+
+Test* PresetLoader::test()
+{
+    return new PresetLoaderTest();
+}
+
+#else
+
+Test* PresetLoader::test()
+{
+    return nullptr;
+}
+
+#endif
@@ -8,17 +8,21 @@
 #include <vector>
 #include <map>
 #include "PresetFactoryManager.hpp"
-#include "FileScanner.hpp"
+#include "PresetCatalog.hpp"
+#include "PresetNameIndex.hpp"
+#include "RandomNumberGenerators.hpp"
 
 class Preset;
 class PresetFactory;
+class Test;
 
 typedef std::size_t PresetIndex;
 
 class PresetLoader {
 	public:
-		/// Initializes the preset loader with the target directory specified
-		PresetLoader(int gx, int gy, std::string dirname);
+		/// Initializes the preset loader with the target directory specified. What is
+		/// known about the directory is kept in indexFile between runs, empty for none.
+		PresetLoader(int gx, int gy, std::string dirname, std::string indexFile = std::string());
 
 		~PresetLoader();
 
@@ -26,6 +30,8 @@ class PresetLoader {
 		/// was added to this loader
 		std::unique_ptr<Preset> loadPreset(PresetIndex index) const;
 		std::unique_ptr<Preset> loadPreset ( const std::string & url )  const;
+		/// Load a preset by url under the given name, touches nothing but the preset factories
+		std::unique_ptr<Preset> loadPreset ( const std::string & url, const std::string & presetName )  const;
 		/// Add a preset to the loader's collection.
 		/// \param url an url referencing the preset
 		/// \param presetName a name for the preset
@@ -42,8 +48,10 @@ class PresetLoader {
 
 		/// Clears all presets from the collection
 		inline void clear() {
-			_entries.clear(); _presetNames.clear();
+			_entries.clear(); _presetNames.clear(); _metadata.clear();
+			_nameIndex.clear();
 			_ratings = std::vector<RatingList>(TOTAL_RATING_TYPES, RatingList());
+			_ratingTrees = std::vector<RandomNumberGenerators::WeightTree>(TOTAL_RATING_TYPES);
 			clearRatingsSum();
  		}
 
@@ -61,6 +69,9 @@ class PresetLoader {
 		/// Sets the rating of a preset to a new value
 		void setRating(PresetIndex index, int rating, const PresetRatingType ratingType);
 
+		/// Draws a preset with a probability proportional to its rating of ratingType, O(log n)
+		PresetIndex weightedRandom(const PresetRatingType ratingType) const;
+
 		/// Get a preset rating given an index
 		int getPresetRating ( PresetIndex index, const PresetRatingType ratingType) const;
 
@@ -70,12 +81,20 @@ class PresetLoader {
 		/// Get a preset name given an index
 		const std::string & getPresetName ( PresetIndex index) const;
 
+		/// Get what the preset library index knows about a preset, NULL for urls that
+		/// were added by hand
+		const PresetCatalog::Entry * getPresetMetadata ( PresetIndex index) const;
+
 	    /// Get vector of preset names
 		const std::vector<std::string> & getPresetNames() const;
 
 		/// Get the preset index given a name
 		const unsigned int getPresetIndex(std::string &name) const;
 
+		/// Searches the preset names, see PresetNameIndex::search
+		std::size_t searchPresets(const std::string & query, std::size_t offset, std::size_t count,
+		                          std::vector<PresetNameIndex::Match> & page) const;
+
 		/// Returns the number of presets in the active directory
 		inline std::size_t size() const {
 			return _entries.size();
@@ -89,12 +108,15 @@ class PresetLoader {
 			return _dirname;
 		}
 
-		/// Rescans the active preset directory
-		void rescan();
+		/// Rescans the active preset directory. Only directories and presets that changed
+		/// since the last scan are read, full checks every preset file as well.
+		void rescan(bool full = false);
 		void setPresetName(PresetIndex index, std::string name);
 
+		static Test* test();
+
 	protected:
-        void addScannedPresetFile(const std::string &path, const std::string &name);
+        void addScannedPresetFile(const std::string &path, const std::string &name, const PresetCatalog::Entry *metadata = NULL);
 
 		std::string _dirname;
 		std::vector<int> _ratingsSums;
@@ -103,11 +125,19 @@ class PresetLoader {
 		// vector chosen for speed, but not great for reverse index lookups
 		std::vector<std::string> _entries;
 		std::vector<std::string> _presetNames;
+		// _presetNames indexed for lookups and search, built by rescan()
+		PresetNameIndex _nameIndex;
+		// into _catalog, NULL for presets added by url
+		std::vector<const PresetCatalog::Entry *> _metadata;
 
 		// Indexed by ratingType, preset position.
 		std::vector<RatingList> _ratings;
-    
-        FileScanner fileScanner;
+		// the same ratings, kept up to date for weightedRandom
+		std::vector<RandomNumberGenerators::WeightTree> _ratingTrees;
+
+		PresetCatalog _catalog;
+		std::string _indexFile;
+		bool _indexLoaded;
 };
 
 #endif
@@ -0,0 +1,398 @@
+//
+//  PresetNameIndex.cpp
+//  libprojectM
+//
+
+#include "PresetNameIndex.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+namespace {
+
+bool isWordCharacter(char c)
+{
+    return isalnum((unsigned char) c) != 0;
+}
+
+}
+
+
+void PresetNameIndex::clear()
+{
+    _names.clear();
+    _lowered.clear();
+    _order.clear();
+    _positions.clear();
+    _free.clear();
+    _trigrams.clear();
+    _exact.clear();
+}
+
+void PresetNameIndex::push_back(const std::string &name)
+{
+    uint32_t id = allocate(name);
+    _positions[id] = (uint32_t) _order.size();
+    _order.push_back(id);
+    add(id);
+}
+
+void PresetNameIndex::insert(std::size_t index, const std::string &name)
+{
+    if (index >= _order.size())
+    {
+        push_back(name);
+        return;
+    }
+
+    uint32_t id = allocate(name);
+    _order.insert(_order.begin() + index, id);
+    reposition(index);
+    add(id);
+}
+
+void PresetNameIndex::erase(std::size_t index)
+{
+    uint32_t id = _order[index];
+    remove(id);
+    _order.erase(_order.begin() + index);
+    reposition(index);
+
+    _names[id].clear();
+    _lowered[id].clear();
+    _free.push_back(id);
+}
+
+void PresetNameIndex::rename(std::size_t index, const std::string &name)
+{
+    uint32_t id = _order[index];
+    remove(id);
+    _names[id] = name;
+    _lowered[id] = lower(name);
+    add(id);
+}
+
+std::size_t PresetNameIndex::find(const std::string &name) const
+{
+    std::unordered_map<std::string, Postings>::const_iterator it = _exact.find(name);
+    if (it == _exact.end())
+        return _order.size();
+    uint32_t first = _positions[it->second.front()];
+    for (std::size_t i = 1; i < it->second.size(); i++)
+        first = std::min(first, _positions[it->second[i]]);
+    return first;
+}
+
+std::size_t PresetNameIndex::search(const std::string &query, std::size_t offset, std::size_t count,
+                                    std::vector<Match> &page) const
+{
+    page.clear();
+    const std::string needle = lower(query);
+    if (needle.empty())
+        return 0;
+
+    // playlist positions by kind
+    std::vector<uint32_t> found[MATCH_FUZZY];
+    auto classify = [&](uint32_t id) {
+        const std::string &name = _lowered[id];
+        std::size_t at = name.find(needle);
+        if (at == std::string::npos)
+            return false;
+        if (at == 0)
+        {
+            found[MATCH_PREFIX].push_back(_positions[id]);
+            return true;
+        }
+        for (; at != std::string::npos; at = name.find(needle, at + 1))
+        {
+            if (!isWordCharacter(name[at - 1]))
+            {
+                found[MATCH_WORD].push_back(_positions[id]);
+                return true;
+            }
+        }
+        found[MATCH_SUBSTRING].push_back(_positions[id]);
+        return true;
+    };
+
+    // ids of names already matched by substring, then the trigrams shared with the query
+    std::vector<uint16_t> shared;
+    std::vector<std::pair<int, uint32_t> > fuzzy;
+    const uint16_t MATCHED = UINT16_MAX;
+
+    if (needle.size() < 3)
+    {
+        // too short for a trigram, such queries are rare enough to go through every name
+        for (std::size_t i = 0; i < _order.size(); i++)
+            classify(_order[i]);
+    }
+    else
+    {
+        std::vector<uint32_t> grams;
+        trigrams(needle, grams);
+
+        // every trigram of a substring match is in its name, the rarest one has the fewest
+        // names to check
+        const Postings *rarest = NULL;
+        bool complete = true;
+        std::vector<const Postings *> lists;
+        for (size_t i = 0; i < grams.size(); i++)
+        {
+            std::unordered_map<uint32_t, Postings>::const_iterator it = _trigrams.find(grams[i]);
+            if (it == _trigrams.end())
+            {
+                complete = false;
+                continue;
+            }
+            lists.push_back(&it->second);
+            if (rarest == NULL || it->second.size() < rarest->size())
+                rarest = &it->second;
+        }
+
+        shared.assign(_names.size(), 0);
+        if (complete && rarest)
+        {
+            for (size_t i = 0; i < rarest->size(); i++)
+                if (classify((*rarest)[i]))
+                    shared[(*rarest)[i]] = MATCHED;
+        }
+
+        // trigrams in a good part of all names, like the extension, tell nothing apart and
+        // would make counting as slow as a scan
+        const size_t common = _order.size() < 64 ? _order.size() : _order.size() / 4;
+        size_t considered = grams.size();
+        std::vector<uint32_t> touched;
+        for (size_t i = 0; i < lists.size(); i++)
+        {
+            if (lists[i]->size() > common)
+            {
+                considered--;
+                continue;
+            }
+            for (size_t j = 0; j < lists[i]->size(); j++)
+            {
+                uint16_t &n = shared[(*lists[i])[j]];
+                if (n == MATCHED)
+                    continue;
+                if (n++ == 0)
+                    touched.push_back((*lists[i])[j]);
+            }
+        }
+
+        // two thirds of the trigrams that count, enough for a typo or two in a longer query
+        for (size_t i = 0; i < touched.size(); i++)
+        {
+            const size_t n = shared[touched[i]];
+            if (n >= 2 && n * 3 >= considered * 2)
+                fuzzy.push_back(std::make_pair(-(int) n, _positions[touched[i]]));
+        }
+        std::sort(fuzzy.begin(), fuzzy.end());
+
+        // the postings are in id order
+        for (int kind = MATCH_PREFIX; kind < MATCH_FUZZY; kind++)
+            std::sort(found[kind].begin(), found[kind].end());
+    }
+
+    std::size_t total = fuzzy.size();
+    for (int kind = MATCH_PREFIX; kind < MATCH_FUZZY; kind++)
+        total += found[kind].size();
+
+    std::size_t position = 0;
+    for (int kind = MATCH_PREFIX; kind <= MATCH_FUZZY && page.size() < count; kind++)
+    {
+        const std::size_t size = kind == MATCH_FUZZY ? fuzzy.size() : found[kind].size();
+        if (position + size <= offset)
+        {
+            position += size;
+            continue;
+        }
+        for (std::size_t i = offset > position ? offset - position : 0; i < size && page.size() < count; i++)
+        {
+            Match match;
+            match.index = kind == MATCH_FUZZY ? fuzzy[i].second : found[kind][i];
+            match.kind = (MatchKind) kind;
+            page.push_back(match);
+        }
+        position += size;
+    }
+    return total;
+}
+
+std::string PresetNameIndex::lower(const std::string &text)
+{
+    std::string lowered = text;
+    for (size_t i = 0; i < lowered.size(); i++)
+        lowered[i] = (char) tolower((unsigned char) lowered[i]);
+    return lowered;
+}
+
+void PresetNameIndex::trigrams(const std::string &lowered, std::vector<uint32_t> &grams)
+{
+    grams.clear();
+    for (size_t i = 0; i + 3 <= lowered.size(); i++)
+        grams.push_back(((uint32_t) (unsigned char) lowered[i] << 16) |
+                        ((uint32_t) (unsigned char) lowered[i + 1] << 8) |
+                        (uint32_t) (unsigned char) lowered[i + 2]);
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+}
+
+uint32_t PresetNameIndex::allocate(const std::string &name)
+{
+    if (!_free.empty())
+    {
+        uint32_t id = _free.back();
+        _free.pop_back();
+        _names[id] = name;
+        _lowered[id] = lower(name);
+        return id;
+    }
+    _names.push_back(name);
+    _lowered.push_back(lower(name));
+    _positions.push_back(0);
+    return (uint32_t) (_names.size() - 1);
+}
+
+void PresetNameIndex::add(uint32_t id)
+{
+    std::vector<uint32_t> grams;
+    trigrams(_lowered[id], grams);
+    for (size_t i = 0; i < grams.size(); i++)
+    {
+        Postings &postings = _trigrams[grams[i]];
+        postings.insert(std::lower_bound(postings.begin(), postings.end(), id), id);
+    }
+
+    Postings &postings = _exact[_names[id]];
+    postings.insert(std::lower_bound(postings.begin(), postings.end(), id), id);
+}
+
+void PresetNameIndex::remove(uint32_t id)
+{
+    std::vector<uint32_t> grams;
+    trigrams(_lowered[id], grams);
+    for (size_t i = 0; i < grams.size(); i++)
+    {
+        std::unordered_map<uint32_t, Postings>::iterator it = _trigrams.find(grams[i]);
+        it->second.erase(std::lower_bound(it->second.begin(), it->second.end(), id));
+        if (it->second.empty())
+            _trigrams.erase(it);
+    }
+
+    std::unordered_map<std::string, Postings>::iterator it = _exact.find(_names[id]);
+    it->second.erase(std::lower_bound(it->second.begin(), it->second.end(), id));
+    if (it->second.empty())
+        _exact.erase(it);
+}
+
+// the entries from position from on moved
+void PresetNameIndex::reposition(std::size_t from)
+{
+    for (std::size_t i = from; i < _order.size(); i++)
+        _positions[_order[i]] = (uint32_t) i;
+}
+
+
+
+// TESTS
+
+
+#include "TestRunner.hpp"
+
+#ifndef NDEBUG
+
+#define TEST(cond) if (!verify(__FILE__ ": " #cond,cond)) return false
+
+struct PresetNameIndexTest : public Test
+{
+    PresetNameIndexTest() : Test("PresetNameIndexTest")
+    {}
+
+public:
+
+    bool test_search()
+    {
+        PresetNameIndex index;
+        index.push_back("Geiss - Reaction Diffusion 2.milk");
+        index.push_back("EoS - glowsticks v2 02.milk");
+        index.push_back("Flexi - mindblob.milk");
+        index.push_back("Glowsticks Remix.milk");
+        index.push_back("Unchained - Rewop.milk");
+
+        std::vector<PresetNameIndex::Match> page;
+        TEST(index.search("GLOW", 0, 10, page) == 2);
+        TEST(page[0].index == 3 && page[0].kind == PresetNameIndex::MATCH_PREFIX);
+        TEST(page[1].index == 1 && page[1].kind == PresetNameIndex::MATCH_WORD);
+
+        TEST(index.search("ind", 0, 10, page) == 1);
+        TEST(page[0].index == 2 && page[0].kind == PresetNameIndex::MATCH_SUBSTRING);
+
+        // a typo still finds both, and paging goes on where the last page ended
+        TEST(index.search("glowstiks", 0, 1, page) == 2);
+        TEST(page.size() == 1 && page[0].kind == PresetNameIndex::MATCH_FUZZY);
+        std::size_t first = page[0].index;
+        TEST(index.search("glowstiks", 1, 1, page) == 2);
+        TEST(page.size() == 1 && page[0].index != first);
+
+        TEST(index.search("e", 0, 100, page) == 5);
+        TEST(index.search("zzz", 0, 10, page) == 0 && page.empty());
+        return true;
+    }
+
+    bool test_edit()
+    {
+        PresetNameIndex index;
+        index.push_back("a.milk");
+        index.push_back("b.milk");
+        index.push_back("c.milk");
+        index.insert(1, "inserted.milk");
+        TEST(index.find("inserted.milk") == 1);
+        TEST(index.find("c.milk") == 3);
+
+        index.erase(0);
+        TEST(index.find("a.milk") == index.size());
+        TEST(index.find("c.milk") == 2);
+
+        index.rename(1, "renamed.milk");
+        TEST(index.find("b.milk") == index.size());
+        TEST(index.find("renamed.milk") == 1);
+
+        std::vector<PresetNameIndex::Match> page;
+        TEST(index.search("inserted", 0, 10, page) == 1 && page[0].index == 0);
+        TEST(index.search("rename", 0, 10, page) == 1 && page[0].index == 1);
+        TEST(index.search(".milk", 0, 10, page) == 3);
+
+        // the erased entry's id comes back for a new name, results stay in playlist order
+        index.insert(0, "first.milk");
+        index.push_back("last.milk");
+        TEST(index.find("first.milk") == 0 && index.find("last.milk") == 4);
+        TEST(index.search(".milk", 0, 10, page) == 5);
+        for (std::size_t i = 0; i < page.size(); i++)
+            TEST(page[i].index == i);
+        TEST(index.search("milk", 0, 10, page) == 5 && page[0].index == 0 && page[4].index == 4);
+        return true;
+    }
+
+    bool test() override
+    {
+        bool success = true;
+        success &= test_search();
+        success &= test_edit();
+        return success;
+    }
+};
+
+Test* PresetNameIndex::test()
+{
+    return new PresetNameIndexTest();
+}
+
+#else
+
+Test* PresetNameIndex::test()
+{
+    return nullptr;
+}
+
+#endif
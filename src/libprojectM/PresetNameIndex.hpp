@@ -0,0 +1,83 @@
+//
+//  PresetNameIndex.hpp
+//  libprojectM
+//
+//  Preset names indexed by their trigrams, so looking a name up and searching as you
+//  type do not go through every name of the playlist. Searches are case insensitive
+//  and rank names starting with the query first, then names with a word starting with
+//  it, then names containing it anywhere, then names that share most of its trigrams,
+//  which catches typos. Entries are kept in playlist order, PresetLoader updates the
+//  index along with its preset lists.
+//
+
+#ifndef PresetNameIndex_hpp
+#define PresetNameIndex_hpp
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+class Test;
+
+class PresetNameIndex
+{
+public:
+    enum MatchKind
+    {
+        MATCH_PREFIX = 0,       // the name starts with the query
+        MATCH_WORD,             // a word of the name starts with it
+        MATCH_SUBSTRING,        // it is somewhere in the name
+        MATCH_FUZZY             // most of its trigrams are in the name
+    };
+
+    struct Match
+    {
+        std::size_t index;
+        MatchKind kind;
+    };
+
+    void clear();
+    void push_back(const std::string &name);
+
+    /// Only the postings of the name itself change. Insertions and removals in the middle
+    /// move the positions behind them, one pass over an array like the vector edits in
+    /// PresetLoader.
+    void insert(std::size_t index, const std::string &name);
+    void erase(std::size_t index);
+    void rename(std::size_t index, const std::string &name);
+
+    std::size_t size() const { return _order.size(); }
+
+    /// The first entry named exactly name, size() when there is none
+    std::size_t find(const std::string &name) const;
+
+    /// The matches for query, best first and in playlist order within a kind. Fills
+    /// page with at most count of them starting at offset and returns how many there are.
+    std::size_t search(const std::string &query, std::size_t offset, std::size_t count,
+                       std::vector<Match> &page) const;
+
+    static Test* test();
+
+private:
+    typedef std::vector<uint32_t> Postings;     // entry ids, sorted
+
+    // an entry keeps its id while the playlist moves it, the postings hold ids
+    std::vector<std::string> _names;            // by id
+    std::vector<std::string> _lowered;          // by id
+    std::vector<uint32_t> _order;               // ids in playlist order
+    std::vector<uint32_t> _positions;           // playlist position by id
+    std::vector<uint32_t> _free;                // ids of erased entries, reused first
+    std::unordered_map<uint32_t, Postings> _trigrams;
+    std::unordered_map<std::string, Postings> _exact;
+
+    static std::string lower(const std::string &text);
+    static void trigrams(const std::string &lowered, std::vector<uint32_t> &grams);
+
+    uint32_t allocate(const std::string &name);
+    void add(uint32_t id);
+    void remove(uint32_t id);
+    void reposition(std::size_t from);
+};
+
+#endif /* PresetNameIndex_hpp */
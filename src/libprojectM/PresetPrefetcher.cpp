@@ -0,0 +1,238 @@
+//
+//  PresetPrefetcher.cpp
+//  libprojectM
+//
+
+#include "PresetPrefetcher.hpp"
+#include "PresetLoader.hpp"
+#include "Preset.hpp"
+#include "Common.hpp"
+
+#include <algorithm>
+
+
+PresetPrefetcher::PresetPrefetcher(const PresetLoader &loader) : _loader(loader)
+#ifdef USE_THREADS
+    , _finished(false)
+#endif
+{
+    _stats.taken = 0;
+    _stats.waited = 0;
+#ifdef USE_THREADS
+    // one preset at a time is all the parser allows, and it leaves the other cores alone
+    _thread = std::thread(&PresetPrefetcher::work, this);
+#endif
+}
+
+PresetPrefetcher::~PresetPrefetcher()
+{
+#ifdef USE_THREADS
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    _thread.join();
+#endif
+}
+
+void PresetPrefetcher::request(const std::vector<PresetIndex> &indices)
+{
+#ifdef USE_THREADS
+    std::vector<std::unique_ptr<Preset> > garbage;
+    std::vector<std::shared_ptr<Job> > jobs;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        reap(garbage);
+
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            if (indices[i] >= _loader.size())
+                continue;
+            const std::string &url = _loader.getPresetURL(indices[i]);
+
+            // native presets are shared objects that may well set up GL while being built
+            const std::string extension = parseExtension(url);
+            if (extension != "milk" && extension != "prjm")
+                continue;
+
+            bool wanted = false;
+            for (size_t j = 0; j < jobs.size() && !wanted; j++)
+                wanted = jobs[j]->index == indices[i];
+            if (wanted)
+                continue;
+
+            std::shared_ptr<Job> job;
+            for (size_t j = 0; j < _jobs.size(); j++)
+            {
+                if (_jobs[j] && _jobs[j]->index == indices[i] && _jobs[j]->url == url)
+                {
+                    job.swap(_jobs[j]);
+                    break;
+                }
+            }
+            if (!job)
+            {
+                job = std::make_shared<Job>();
+                job->index = indices[i];
+                job->url = url;
+                job->name = _loader.getPresetName(indices[i]);
+            }
+            jobs.push_back(job);
+        }
+
+        for (size_t j = 0; j < _jobs.size(); j++)
+            drop(_jobs[j], garbage);
+        _jobs.swap(jobs);
+
+        // the queue follows the new order, jobs that were dropped expire in it
+        _queue.clear();
+        for (size_t j = 0; j < _jobs.size(); j++)
+            if (!_jobs[j]->started)
+                _queue.push_back(_jobs[j]);
+    }
+    _wake.notify_one();
+#endif
+}
+
+std::unique_ptr<Preset> PresetPrefetcher::take(PresetIndex index)
+{
+#ifdef USE_THREADS
+    std::vector<std::unique_ptr<Preset> > garbage;
+    std::unique_lock<std::mutex> lock(_mutex);
+    reap(garbage);
+
+    std::shared_ptr<Job> job;
+    for (size_t i = 0; i < _jobs.size(); i++)
+    {
+        if (_jobs[i]->index == index)
+        {
+            job = _jobs[i];
+            _jobs.erase(_jobs.begin() + i);
+            break;
+        }
+    }
+    if (!job)
+        return std::unique_ptr<Preset>();
+
+    // the caller builds it itself rather than wait for the presets queued before it,
+    // the worker skips it once the last reference is gone
+    if (!job->started || index >= _loader.size() || _loader.getPresetURL(index) != job->url)
+    {
+        drop(job, garbage);
+        return std::unique_ptr<Preset>();
+    }
+
+    if (!job->done)
+    {
+        _stats.waited++;
+        _built.wait(lock, [&job] { return job->done; });
+    }
+    if (job->preset)
+        _stats.taken++;
+    return std::move(job->preset);
+#else
+    return std::unique_ptr<Preset>();
+#endif
+}
+
+std::unique_ptr<Preset> PresetPrefetcher::load(PresetIndex index)
+{
+    std::string url = _loader.getPresetURL(index);
+    std::string name = _loader.getPresetName(index);
+#ifdef USE_THREADS
+    std::lock_guard<std::mutex> lock(_allocateMutex);
+#endif
+    return _loader.loadPreset(url, name);
+}
+
+void PresetPrefetcher::clear()
+{
+#ifdef USE_THREADS
+    std::vector<std::unique_ptr<Preset> > garbage;
+    std::lock_guard<std::mutex> lock(_mutex);
+    reap(garbage);
+    for (size_t i = 0; i < _jobs.size(); i++)
+        drop(_jobs[i], garbage);
+    _jobs.clear();
+    _queue.clear();
+#endif
+}
+
+PresetPrefetcher::Stats PresetPrefetcher::stats() const
+{
+#ifdef USE_THREADS
+    std::lock_guard<std::mutex> lock(_mutex);
+#endif
+    return _stats;
+}
+
+std::unique_ptr<Preset> PresetPrefetcher::allocate(const std::string &url, const std::string &name)
+{
+#ifdef USE_THREADS
+    std::lock_guard<std::mutex> lock(_allocateMutex);
+#endif
+    // a preset that fails here is loaded again on the switch, which reports the error
+    try {
+        return _loader.loadPreset(url, name);
+    } catch (...) {
+        return std::unique_ptr<Preset>();
+    }
+}
+
+#ifdef USE_THREADS
+// called with _mutex held, the presets in garbage are released by the caller after unlocking
+void PresetPrefetcher::drop(std::shared_ptr<Job> &job, std::vector<std::unique_ptr<Preset> > &garbage)
+{
+    if (!job)
+        return;
+    if (job->started && !job->done)
+        _orphans.push_back(job);
+    else if (job->preset)
+        garbage.push_back(std::move(job->preset));
+    job.reset();
+}
+
+void PresetPrefetcher::reap(std::vector<std::unique_ptr<Preset> > &garbage)
+{
+    for (size_t i = 0; i < _orphans.size();)
+    {
+        if (_orphans[i]->done)
+        {
+            if (_orphans[i]->preset)
+                garbage.push_back(std::move(_orphans[i]->preset));
+            _orphans.erase(_orphans.begin() + i);
+        }
+        else
+            i++;
+    }
+}
+
+void PresetPrefetcher::work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [this] { return _finished || !_queue.empty(); });
+        if (_finished)
+            return;
+
+        std::shared_ptr<Job> job = _queue.front().lock();
+        _queue.pop_front();
+        if (!job)
+            continue;
+
+        job->started = true;
+        lock.unlock();
+        std::unique_ptr<Preset> preset = allocate(job->url, job->name);
+        lock.lock();
+
+        // whoever dropped the job meanwhile kept it in _orphans, the preset is never last
+        // referenced from here
+        job->preset = std::move(preset);
+        job->done = true;
+        job.reset();
+        _built.notify_all();
+    }
+}
+#endif
@@ -0,0 +1,96 @@
+//
+//  PresetPrefetcher.hpp
+//  libprojectM
+//
+//  Builds the presets projectM is likely to switch to next on a background thread, so a
+//  switch hands over a preset that is already parsed instead of stalling the frame it
+//  happens on. Building a Milkdrop preset touches no GL, its render items create their
+//  buffers on the first draw. The parser keeps its state in statics, so every preset is
+//  built through here and only one is built at a time.
+//
+
+#ifndef PresetPrefetcher_hpp
+#define PresetPrefetcher_hpp
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+class Preset;
+class PresetLoader;
+
+typedef std::size_t PresetIndex;
+
+class PresetPrefetcher
+{
+public:
+    explicit PresetPrefetcher(const PresetLoader &loader);
+    ~PresetPrefetcher();
+
+    /// Keeps the presets at indices built ahead, the first one first. Presets that are
+    /// not asked for anymore are dropped. Built without threads nothing is built ahead.
+    void request(const std::vector<PresetIndex> &indices);
+
+    /// The preset at index if it was built ahead, waiting for it if it is being built
+    /// right now. NULL when it was not asked for, not started yet or failed to load.
+    std::unique_ptr<Preset> take(PresetIndex index);
+
+    /// Builds the preset at index on the calling thread
+    /// \throws PresetFactoryException like PresetLoader::loadPreset
+    std::unique_ptr<Preset> load(PresetIndex index);
+
+    /// Drops everything built ahead, the indices of the playlist changed
+    void clear();
+
+    /// How many switches take() served, and how many of those had to wait
+    struct Stats
+    {
+        size_t taken;
+        size_t waited;
+    };
+    Stats stats() const;
+
+private:
+    struct Job
+    {
+        PresetIndex index;
+        std::string url;
+        std::string name;
+        std::unique_ptr<Preset> preset;
+        bool started;
+        bool done;
+
+        Job() : index(0), started(false), done(false) {}
+    };
+
+    const PresetLoader &_loader;
+    Stats _stats;
+
+    std::unique_ptr<Preset> allocate(const std::string &url, const std::string &name);
+
+#ifdef USE_THREADS
+    std::vector<std::shared_ptr<Job> > _jobs;       // the presets asked for, in order
+    std::deque<std::weak_ptr<Job> > _queue;
+    // dropped while being built, released here once done so no preset dies on the worker
+    std::vector<std::shared_ptr<Job> > _orphans;
+    mutable std::mutex _mutex;
+    std::mutex _allocateMutex;
+    std::condition_variable _wake;
+    std::condition_variable _built;
+    bool _finished;
+    std::thread _thread;
+
+    void drop(std::shared_ptr<Job> &job, std::vector<std::unique_ptr<Preset> > &garbage);
+    void reap(std::vector<std::unique_ptr<Preset> > &garbage);
+    void work();
+#endif
+};
+
+#endif /* PresetPrefetcher_hpp */
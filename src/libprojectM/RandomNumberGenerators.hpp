@@ -4,6 +4,8 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#include <cstdlib>
+#include <stdint.h>
 
 #define WEIGHTED_RANDOM_DEBUG 0
 
@@ -117,5 +119,104 @@ inline std::size_t weightedRandom(const std::vector<int> & weights, unsigned int
 	return weights.size()-1;
 }
 
+/// Weights kept in a Fenwick tree, so changing a weight and drawing an index with
+/// probability proportional to its weight both take O(log n) instead of a pass over
+/// every weight. Negative weights count as 0, an index of weight 0 is never drawn.
+class WeightTree {
+public:
+	WeightTree() : _tree(1, 0), _total(0) {}
+	explicit WeightTree(const std::vector<int> & weights) { assign(weights); }
+
+	void assign(const std::vector<int> & weights) {
+		_weights.resize(weights.size());
+		_tree.assign(weights.size() + 1, 0);
+		_total = 0;
+		// every node adds itself to its parent once it is complete, O(n)
+		for (std::size_t i = 0; i < weights.size(); i++) {
+			_weights[i] = weights[i] > 0 ? weights[i] : 0;
+			_total += _weights[i];
+			const std::size_t node = i + 1;
+			_tree[node] += _weights[i];
+			const std::size_t parent = node + (node & (~node + 1));
+			if (parent < _tree.size())
+				_tree[parent] += _tree[node];
+		}
+	}
+
+	void push_back(int weight) {
+		weight = weight > 0 ? weight : 0;
+		_weights.push_back(weight);
+		_total += weight;
+		// the new node covers the weights after the last node it does not contain
+		const std::size_t node = _weights.size();
+		int64_t sum = weight;
+		for (std::size_t child = node - 1; child > node - (node & (~node + 1)); child -= child & (~child + 1))
+			sum += _tree[child];
+		_tree.push_back(sum);
+	}
+
+	void set(std::size_t index, int weight) {
+		weight = weight > 0 ? weight : 0;
+		const int64_t delta = weight - _weights[index];
+		_weights[index] = weight;
+		_total += delta;
+		for (std::size_t node = index + 1; node < _tree.size(); node += node & (~node + 1))
+			_tree[node] += delta;
+	}
+
+	/// Shifts the indices after index, which costs a rebuild like the vector insert does
+	void insert(std::size_t index, int weight) {
+		std::vector<int> weights(_weights);
+		weights.insert(weights.begin() + index, weight);
+		assign(weights);
+	}
+
+	void erase(std::size_t index) {
+		std::vector<int> weights(_weights);
+		weights.erase(weights.begin() + index);
+		assign(weights);
+	}
+
+	void clear() { assign(std::vector<int>()); }
+
+	std::size_t size() const { return _weights.size(); }
+	int64_t total() const { return _total; }
+
+	/// The index whose share of the total contains mass, 0 <= mass < total()
+	std::size_t find(int64_t mass) const {
+		std::size_t step = 1;
+		while (step * 2 < _tree.size())
+			step *= 2;
+
+		std::size_t node = 0;
+		for (; step > 0; step /= 2) {
+			if (node + step < _tree.size() && _tree[node + step] <= mass) {
+				node += step;
+				mass -= _tree[node];
+			}
+		}
+		return node;
+	}
+
+private:
+	std::vector<int> _weights;
+	std::vector<int64_t> _tree;     // 1 based, node i sums the weights (i - lowest bit of i, i]
+	int64_t _total;
+};
+
+/// Draws from weights in O(log n), uniformly when they are all 0
+inline std::size_t weightedRandom(const WeightTree & weights) {
+	assert(weights.size() > 0);
+
+	// RAND_MAX can be as small as 32767, fewer than the ratings of a big library add up to
+	uint64_t sample = rand();
+	if (weights.total() > RAND_MAX || static_cast<int64_t>(weights.size()) > RAND_MAX)
+		sample = sample * (static_cast<uint64_t>(RAND_MAX) + 1) + rand();
+
+	if (weights.total() <= 0)
+		return sample % weights.size();
+	return weights.find(sample % weights.total());
+}
+
 }
 #endif
@@ -28,6 +28,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <cstddef>
 
 #include "wipemalloc.h"
 
@@ -41,27 +42,15 @@ BeatDetect::BeatDetect(PCM *_pcm)
 {
     this->pcm=_pcm;
 
-    this->vol_instant=0;
-    this->vol_history=0;
-    for (unsigned y=0;y<BEAT_HISTORY_LENGTH;y++)
-        this->vol_buffer[y]=0;
-
-    this->beat_buffer_pos=0;
+    this->hop_size = 0;
+    this->analysed_samples = 0;
+    this->att_factor = .6f;
 
+    this->vol_instant=0;
     this->bass_instant = 0;
-    this->bass_history = 0;
-    for (unsigned y=0;y<BEAT_HISTORY_LENGTH;y++)
-        this->bass_buffer[y]=0;
-
     this->mid_instant = 0;
-    this->mid_history = 0;
-    for (unsigned y=0;y<BEAT_HISTORY_LENGTH;y++)
-        this->mid_buffer[y]=0;
-
     this->treb_instant = 0;
-    this->treb_history = 0;
-    for (unsigned y=0;y<BEAT_HISTORY_LENGTH;y++)
-        this->treb_buffer[y]=0;
+    resizeHistory(BEAT_HISTORY_LENGTH);
 
     this->treb = 0;
     this->mid = 0;
@@ -73,6 +62,8 @@ BeatDetect::BeatDetect(PCM *_pcm)
     this->bass_att = 0;
     this->vol_att = 0;
     this->vol = 0;
+    this->onset = 0;
+    std::fill(onset_bands, onset_bands + SPECTRUM_BANDS, 0.0f);
 }
 
 
@@ -82,6 +73,37 @@ BeatDetect::~BeatDetect()
 }
 
 
+void BeatDetect::resizeHistory(size_t length)
+{
+    beat_buffer_pos = 0;
+    bass_buffer.assign(length, 0);
+    mid_buffer.assign(length, 0);
+    treb_buffer.assign(length, 0);
+    vol_buffer.assign(length, 0);
+    bass_history = 0;
+    mid_history = 0;
+    treb_history = 0;
+    vol_history = 0;
+}
+
+
+void BeatDetect::setHopSize(unsigned hopSize, float samplerate, float historySeconds, float attackSeconds)
+{
+    hop_size = hopSize;
+    analysed_samples = pcm->sampleCount();
+    if (hop_size == 0)
+    {
+        att_factor = .6f;
+        resizeHistory(BEAT_HISTORY_LENGTH);
+        return;
+    }
+
+    const float hopSeconds = hop_size / samplerate;
+    att_factor = expf(-hopSeconds / attackSeconds);
+    resizeHistory(std::max<size_t>(1, (size_t)(historySeconds / hopSeconds + 0.5f)));
+}
+
+
 void BeatDetect::reset()
 {
     this->treb = 0;
@@ -93,19 +115,44 @@ void BeatDetect::reset()
     this->vol_att = 0;
     this->vol_old = 0;
     this->vol_instant=0;
+    this->onset = 0;
+    std::fill(onset_bands, onset_bands + SPECTRUM_BANDS, 0.0f);
 }
 
 
 void BeatDetect::detectFromSamples()
 {
     vol_old = vol;
+
+    float vdataL[FFT_LENGTH];
+    float vdataR[FFT_LENGTH];
+
+    if (hop_size > 0)
+    {
+        // Process every complete hop that arrived since the last frame. Hops that have
+        // already left the PCM buffer are dropped, this only happens at very low frame rates.
+        const size_t total = pcm->sampleCount();
+        const size_t maxOffset = PCM::maxsamples - FFT_LENGTH*2;
+        if ((ptrdiff_t)(total - analysed_samples) < 0)
+            analysed_samples = total;   // presentation delay grew, the analysis position moved back
+        if (total - analysed_samples > maxOffset + hop_size)
+            analysed_samples = total - (maxOffset + hop_size);
+        while (total - analysed_samples >= hop_size)
+        {
+            analysed_samples += hop_size;
+            const size_t offset = total - analysed_samples;
+            pcm->getSpectrumAt(vdataL, CHANNEL_0, FFT_LENGTH, offset);
+            pcm->getSpectrumAt(vdataR, CHANNEL_1, FFT_LENGTH, offset);
+            getBeatVals((float) PCM::analysisRate, FFT_LENGTH, vdataL, vdataR);
+        }
+        return;
+    }
+
     bass=0;
     mid=0;
     treb=0;
     vol=0;
 
-    float vdataL[FFT_LENGTH];
-    float vdataR[FFT_LENGTH];
     pcm->getSpectrum(vdataL, CHANNEL_0, FFT_LENGTH, 0.0);
     pcm->getSpectrum(vdataR, CHANNEL_1, FFT_LENGTH, 0.0);
 
@@ -121,32 +168,33 @@ void BeatDetect::getBeatVals( float samplerate, unsigned fft_length, float *vdat
 {
     assert(fft_length >= 256);
     unsigned ranges[4]  = {0, 3, 23, 255};
+    const float history_scale = 1.0f / bass_buffer.size();
 
     bass_instant=0;
     for (unsigned i=ranges[0] ; i<ranges[1] ; i++)
         bass_instant += vdataL[i] + vdataR[i];
-    bass_history -= bass_buffer[beat_buffer_pos] * (1.0/BEAT_HISTORY_LENGTH);
+    bass_history -= bass_buffer[beat_buffer_pos] * history_scale;
     bass_buffer[beat_buffer_pos] = bass_instant;
-    bass_history += bass_instant * (1.0/BEAT_HISTORY_LENGTH);
+    bass_history += bass_instant * history_scale;
 
     mid_instant=0;
     for (unsigned i=ranges[1] ; i<ranges[2] ; i++)
         mid_instant += vdataL[i] + vdataR[i];
-    mid_history -= mid_buffer[beat_buffer_pos] * (1.0/BEAT_HISTORY_LENGTH);
+    mid_history -= mid_buffer[beat_buffer_pos] * history_scale;
     mid_buffer[beat_buffer_pos] = mid_instant;
-    mid_history += mid_instant * (1.0/BEAT_HISTORY_LENGTH);
+    mid_history += mid_instant * history_scale;
 
     treb_instant = 0;
     for (unsigned i=ranges[2] ; i<ranges[3] ; i++)
         treb_instant += vdataL[i] + vdataR[i];
-    treb_history -= treb_buffer[beat_buffer_pos] * (1.0/BEAT_HISTORY_LENGTH);
+    treb_history -= treb_buffer[beat_buffer_pos] * history_scale;
     treb_buffer[beat_buffer_pos] = treb_instant;
-    treb_history += treb_instant * (1.0/BEAT_HISTORY_LENGTH);
+    treb_history += treb_instant * history_scale;
 
     vol_instant  = (bass_instant + mid_instant + treb_instant) / 3.0f;
-    vol_history -= (vol_buffer[beat_buffer_pos])* (1.0/BEAT_HISTORY_LENGTH);
+    vol_history -= (vol_buffer[beat_buffer_pos])* history_scale;
     vol_buffer[beat_buffer_pos] = vol_instant;
-    vol_history += vol_instant * (1.0/BEAT_HISTORY_LENGTH);
+    vol_history += vol_instant * history_scale;
 
 //    fprintf(stderr, "%6.3f %6.2f %6.3f\n", bass_history/vol_history, mid_history/vol_history, treb_history/vol_history);
     bass = bass_instant / fmax(0.0001, bass_history);
@@ -164,10 +212,10 @@ void BeatDetect::getBeatVals( float samplerate, unsigned fft_length, float *vdat
         bass = 0.0;
     }
 
-    treb_att = .6f * treb_att + .4f * treb;
-    mid_att  = .6f * mid_att + .4f * mid;
-    bass_att = .6f * bass_att + .4f * bass;
-    vol_att =  .6f * vol_att + .4f * vol;
+    treb_att = att_factor * treb_att + (1 - att_factor) * treb;
+    mid_att  = att_factor * mid_att + (1 - att_factor) * mid;
+    bass_att = att_factor * bass_att + (1 - att_factor) * bass;
+    vol_att =  att_factor * vol_att + (1 - att_factor) * vol;
 
     if (bass_att>100) bass_att=100;
     if (bass >100) bass=100;
@@ -178,8 +226,22 @@ void BeatDetect::getBeatVals( float samplerate, unsigned fft_length, float *vdat
     if (vol_att>100) vol_att=100;
     if (vol>100) vol=100;
 
+    float vdata[FFT_LENGTH];
+    float bands[SPECTRUM_BANDS];
+    for (unsigned i=0 ; i<FFT_LENGTH ; i++)
+        vdata[i] = vdataL[i] + vdataR[i];
+    PCM::spectrumBands(vdata, bands);
+    onset = 0;
+    for (int band=0 ; band<SPECTRUM_BANDS ; band++)
+    {
+        float flux = log1pf(bands[band]) - log1pf(onset_bands[band]);
+        if (flux > 0)
+            onset += flux / SPECTRUM_BANDS;
+        onset_bands[band] = bands[band];
+    }
+
     beat_buffer_pos++;
-    if (beat_buffer_pos>79)
+    if (beat_buffer_pos >= bass_buffer.size())
         beat_buffer_pos=0;
 }
 
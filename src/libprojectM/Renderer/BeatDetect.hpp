@@ -35,12 +35,18 @@
 #include "../dlldefs.h"
 #include <algorithm>
 #include <cmath>
+#include <vector>
 
 
 // this is the size of the buffer used to determine avg levels of the input audio
 // the actual time represented in the history depends on FPS
 #define BEAT_HISTORY_LENGTH 80
 
+// defaults for audio-time analysis, these match the per-frame behaviour at 35 fps
+// (80 frames of history, .6 attack factor per frame)
+#define BEAT_HISTORY_SECONDS 2.3f
+#define BEAT_ATTACK_SECONDS 0.056f
+
 class DLLEXPORT BeatDetect
 {
 	public:
@@ -58,6 +64,10 @@ class DLLEXPORT BeatDetect
 		float vol;
         float vol_att ;
 
+		// positive spectral flux of the last analysis, mean over the log spaced bands,
+		// peaks on note and drum onsets
+		float onset;
+
 		PCM *pcm;
 
 		/** Methods */
@@ -67,6 +77,16 @@ class DLLEXPORT BeatDetect
 		void detectFromSamples();
 		void getBeatVals( float samplerate, unsigned fft_length, float *vdataL, float *vdataR );
 
+		/**
+		 * Analyse audio in fixed hops of hopSize samples, independent of the frame rate.
+		 * Each call to detectFromSamples() then consumes all audio that arrived since the
+		 * previous frame and leaves the state of the most recent hop.
+		 * hopSize == 0 restores the legacy once-per-frame analysis.
+		 */
+		void setHopSize( unsigned hopSize, float samplerate = 44100.0f,
+		                 float historySeconds = BEAT_HISTORY_SECONDS, float attackSeconds = BEAT_ATTACK_SECONDS );
+		unsigned getHopSize() const { return hop_size; }
+
         // getPCMScale() was added to address https://github.com/projectM-visualizer/projectm/issues/161
         // Returning 1.0 results in using the raw PCM data, which can make the presets look pretty unresponsive
         // if the application volume is low.
@@ -76,22 +96,32 @@ class DLLEXPORT BeatDetect
         }
 
 	private:
-		int beat_buffer_pos;
-        float bass_buffer[BEAT_HISTORY_LENGTH];
+		void resizeHistory( size_t length );
+
+		// hop mode state, hop_size == 0 means one analysis per frame
+		unsigned hop_size;
+		size_t analysed_samples;
+		float att_factor;
+
+		size_t beat_buffer_pos;
+		std::vector<float> bass_buffer;
 		float bass_history;
         float bass_instant;
 
-		float mid_buffer[BEAT_HISTORY_LENGTH];
+		std::vector<float> mid_buffer;
         float mid_history;
 		float mid_instant;
 
-		float treb_buffer[BEAT_HISTORY_LENGTH];
+		std::vector<float> treb_buffer;
 		float treb_history;
 		float treb_instant;
 
-        float vol_buffer[BEAT_HISTORY_LENGTH];
+		std::vector<float> vol_buffer;
         float vol_history;
         float vol_instant;
+
+		// bands of the previous analysis, onset is the rise over them
+		float onset_bands[SPECTRUM_BANDS];
 };
 
 #endif /** !_BEAT_DETECT_H */
@@ -26,6 +26,9 @@ void Brighten::InitVertexAttrib() {
 
 void Brighten::Draw(RenderContext &context)
 {
+    if (m_vaoID == 0)
+        Init();
+
     glUseProgram(context.programID_v2f_c4f);
 
     glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
@@ -59,6 +62,9 @@ void Darken::InitVertexAttrib() {
 
 void Darken::Draw(RenderContext &context)
 {
+    if (m_vaoID == 0)
+        Init();
+
     glUseProgram(context.programID_v2f_c4f);
 
     glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
@@ -89,6 +95,8 @@ void Invert::InitVertexAttrib() {
 
 void Invert::Draw(RenderContext &context)
 {
+    if (m_vaoID == 0)
+        Init();
 
     glUseProgram(context.programID_v2f_c4f);
 
@@ -120,6 +128,9 @@ void Solarize::InitVertexAttrib() {
 
 void Solarize::Draw(RenderContext &context)
 {
+    if (m_vaoID == 0)
+        Init();
+
     glUseProgram(context.programID_v2f_c4f);
 
     glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
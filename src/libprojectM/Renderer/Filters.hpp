@@ -13,7 +13,6 @@
 class Brighten : public RenderItem
 {
 public:
-    Brighten(){ Init(); }
     void InitVertexAttrib();
 	void Draw(RenderContext &context);
 };
@@ -21,7 +20,6 @@ public:
 class Darken : public RenderItem
 {
 public:
-    Darken(){ Init(); }
     void InitVertexAttrib();
 	void Draw(RenderContext &context);
 };
@@ -29,7 +27,6 @@ public:
 class Invert : public RenderItem
 {
 public:
-    Invert(){ Init(); }
     void InitVertexAttrib();
 	void Draw(RenderContext &context);
 };
@@ -37,7 +34,6 @@ public:
 class Solarize : public RenderItem
 {
 public:
-    Solarize(){ Init(); }
     void InitVertexAttrib();
 	void Draw(RenderContext &context);
 };
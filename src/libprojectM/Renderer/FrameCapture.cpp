@@ -0,0 +1,104 @@
+//
+//  FrameCapture.cpp
+//  libprojectM
+//
+
+#include "FrameCapture.hpp"
+#include <cstring>
+
+
+FrameCapture::FrameCapture(const Callback &_callback, int buffers)
+    : callback(_callback), next(0), pending(0)
+{
+    slots.resize(buffers < 2 ? 2 : buffers);
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        glGenBuffers(1, &slots[i].buffer);
+        slots[i].size = 0;
+        slots[i].fence = 0;
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        if (slots[i].fence != 0)
+            glDeleteSync(slots[i].fence);
+        glDeleteBuffers(1, &slots[i].buffer);
+    }
+}
+
+void FrameCapture::capture(int x, int y, int width, int height, size_t frame, double time)
+{
+    // hand over what the GPU has finished, in order
+    while (pending > 0 && deliver(false))
+        ;
+
+    // the ring is full, the oldest frame has to be waited for
+    if (pending == slots.size())
+        deliver(true);
+
+    Slot &slot = slots[next];
+    size_t size = (size_t) width * height * 4;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.size != size)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        slot.size = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frame;
+    slot.time = time;
+
+    next = (next + 1) % slots.size();
+    pending++;
+}
+
+void FrameCapture::flush()
+{
+    while (pending > 0)
+        deliver(true);
+}
+
+bool FrameCapture::deliver(bool wait)
+{
+    Slot &slot = slots[(next + slots.size() - pending) % slots.size()];
+
+    if (!wait)
+    {
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+    pending--;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const unsigned char *mapped = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+    if (mapped == NULL)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return true;
+    }
+
+    // GL rows run bottom up, copying out also frees the buffer before the callback runs
+    size_t stride = (size_t) slot.width * 4;
+    pixels.resize(slot.size);
+    for (int row = 0; row < slot.height; row++)
+        memcpy(&pixels[row * stride], mapped + (slot.height - 1 - row) * stride, stride);
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    callback(&pixels[0], slot.width, slot.height, slot.frame, slot.time);
+    return true;
+}
@@ -0,0 +1,60 @@
+//
+//  FrameCapture.hpp
+//  libprojectM
+//
+//  Asynchronous frame readback. capture() queues a glReadPixels into one of N rotating
+//  GL_PIXEL_PACK_BUFFERs and returns without waiting for the GPU. A buffer is mapped
+//  once its fence has signalled, at the latest when the ring comes around to it again,
+//  so frames reach the callback in order, normally N - 1 frames after they were drawn.
+//
+
+#ifndef FrameCapture_hpp
+#define FrameCapture_hpp
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "projectM-opengl.h"
+
+class FrameCapture
+{
+public:
+    /// width * height RGBA pixels, top row first, only valid during the call
+    typedef std::function<void(const unsigned char *rgba, int width, int height, size_t frame, double time)> Callback;
+
+    FrameCapture(const Callback &callback, int buffers);
+    /// Frames still in flight are dropped, flush() first to keep them
+    ~FrameCapture();
+
+    /// Queues the readback of a rectangle of the bound read framebuffer
+    void capture(int x, int y, int width, int height, size_t frame, double time);
+
+    /// Hands over every frame still in flight, waiting for the GPU if needed
+    void flush();
+
+private:
+    struct Slot
+    {
+        GLuint buffer;
+        size_t size;
+        GLsync fence;
+        int width;
+        int height;
+        size_t frame;
+        double time;
+    };
+
+    FrameCapture(const FrameCapture &);
+    FrameCapture &operator=(const FrameCapture &);
+
+    /// Maps the oldest pending slot and calls back, wait=false gives up if the GPU is not done
+    bool deliver(bool wait);
+
+    Callback callback;
+    std::vector<Slot> slots;
+    size_t next;        // slot the next capture() reads into
+    size_t pending;     // slots with a readback in flight, the oldest is next - pending
+    std::vector<unsigned char> pixels;
+};
+
+#endif /* FrameCapture_hpp */
@@ -11,27 +11,19 @@
 #include "math.h"
 #include "BeatDetect.hpp"
 #include "ShaderEngine.hpp"
+#include "RenderBatch.hpp"
+#include <glm/matrix.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 MilkdropWaveform::MilkdropWaveform(): RenderItem(),
     x(0.5), y(0.5), r(1), g(0), b(0), a(1), mystery(0), mode(Line), additive(false), dots(false), thick(false),
     modulateAlphaByVolume(false), maximizeColors(false), scale(10), smoothing(0),
     modOpacityStart(0), modOpacityEnd(1), rot(0), samples(512), loop(false) {
-
-    Init();
 }
 
 MilkdropWaveform::~MilkdropWaveform() {
 }
 
-void MilkdropWaveform::InitVertexAttrib() {
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    glDisableVertexAttribArray(1);
-
-}
-
 
 void MilkdropWaveform::Draw(RenderContext &context)
 {
@@ -41,74 +33,66 @@ void MilkdropWaveform::Draw(RenderContext &context)
     WaveformMath(context);
 	assert(samples<=512);
 
-    for (int waveno=1 ; waveno<=(two_waves?2:1) ; waveno++)
-    {
-        glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
-
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * samples * 2, NULL, GL_DYNAMIC_DRAW);
-        if (waveno == 1)
-            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * samples * 2, wavearray, GL_DYNAMIC_DRAW);
-        else
-            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * samples * 2, wavearray2, GL_DYNAMIC_DRAW);
+    glm::mat4 mat_first_translation = glm::mat4(1.0);
+    mat_first_translation[3][0] = -0.5;
+    mat_first_translation[3][1] = -0.5;
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glm::mat4 mat_scale = glm::mat4(1.0);
+    mat_scale[0][0] = aspectScale;
 
-        glUseProgram(context.programID_v2f_c4f);
+    float s = glm::sin(glm::radians(-rot));
+    float c = glm::cos(glm::radians(-rot));
+    glm::mat4 mat_rotation = glm::mat4(c, -s, 0, 0,
+                                       s, c, 0, 0,
+                                       0, 0, 1, 0,
+                                       0, 0, 0, 1);
 
-        glm::mat4 mat_first_translation = glm::mat4(1.0);
-        mat_first_translation[3][0] = -0.5;
-        mat_first_translation[3][1] = -0.5;
+    glm::mat4 mat_second_translation = glm::mat4(1.0);
+    mat_second_translation[3][0] = 0.5;
+    mat_second_translation[3][1] = 0.5;
 
-        glm::mat4 mat_scale = glm::mat4(1.0);
-        mat_scale[0][0] = aspectScale;
+    glm::mat4 mat_vertex = context.mat_ortho;
+    mat_vertex = mat_first_translation * mat_vertex;
+    mat_vertex = mat_scale * mat_vertex;
+    mat_vertex = mat_rotation * mat_vertex;
+    mat_vertex = mat_second_translation * mat_vertex;
 
-        float s = glm::sin(glm::radians(-rot));
-        float c = glm::cos(glm::radians(-rot));
-        glm::mat4 mat_rotation = glm::mat4(c, -s, 0, 0,
-                                           s, c, 0, 0,
-                                           0, 0, 1, 0,
-                                           0, 0, 0, 1);
+    // the batch draws with mat_ortho, so the points go through the rest of mat_vertex here
+    const glm::mat4 mat_points = glm::inverse(context.mat_ortho) * mat_vertex;
 
-        glm::mat4 mat_second_translation = glm::mat4(1.0);
-        mat_second_translation[3][0] = 0.5;
-        mat_second_translation[3][1] = 0.5;
+    if (modulateAlphaByVolume) ModulateOpacityByVolume(context);
+    else temp_a = a;
+    float color[4];
+    MaximizeColors(context, color);
 
-        glm::mat4 mat_vertex = context.mat_ortho;
-        mat_vertex = mat_first_translation * mat_vertex;
-        mat_vertex = mat_scale * mat_vertex;
-        mat_vertex = mat_rotation * mat_vertex;
-        mat_vertex = mat_second_translation * mat_vertex;
-        glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(mat_vertex));
+    RenderBatch &batch = *context.batch;
 
-        if (modulateAlphaByVolume) ModulateOpacityByVolume(context);
-        else temp_a = a;
-        MaximizeColors(context);
+    //Additive wave drawing (vice overwrite)
+    if (additive == 1) batch.setBlend(GL_SRC_ALPHA, GL_ONE);
+    else batch.setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    batch.setUntextured();
 
-#ifndef GL_TRANSITION
-        if (dots == 1) glEnable(GL_LINE_STIPPLE);
-#endif
+    //Thick wave drawing
+    if (thick == 1) batch.setLineWidth((context.texsize < 512) ? 2 : 2 * context.texsize / 512);
+    else batch.setLineWidth((context.texsize < 512) ? 1 : context.texsize / 512);
 
-        //Thick wave drawing
-        if (thick == 1) glLineWidth((context.texsize < 512) ? 2 : 2 * context.texsize / 512);
-        else glLineWidth((context.texsize < 512) ? 1 : context.texsize / 512);
-
-        //Additive wave drawing (vice overwrite)
-        if (additive == 1)glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-        else glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        glBindVertexArray(m_vaoID);
-
-        if (loop)
-            glDrawArrays(GL_LINE_LOOP, 0, samples);
-        else
-            glDrawArrays(GL_LINE_STRIP, 0, samples);
+    for (int waveno=1 ; waveno<=(two_waves?2:1) ; waveno++)
+    {
+        const float (*wave)[2] = (waveno == 1) ? wavearray : wavearray2;
 
-        glBindVertexArray(0);
+        RenderBatch::Vertex *vertices = batch.draw(loop ? GL_LINE_LOOP : GL_LINE_STRIP, samples);
+        for (int i = 0; i < samples; i++)
+        {
+            glm::vec4 point = mat_points * glm::vec4(wave[i][0], wave[i][1], 0, 1);
+            vertices[i].x = point.x;
+            vertices[i].y = point.y;
+            vertices[i].r = color[0];
+            vertices[i].g = color[1];
+            vertices[i].b = color[2];
+            vertices[i].a = color[3];
+            vertices[i].u = vertices[i].v = 0;
+        }
     }
-
-#ifndef GL_TRANSITION
-		if(dots==1) glDisable(GL_LINE_STIPPLE);
-#endif
 }
 
 void MilkdropWaveform::ModulateOpacityByVolume(RenderContext &context)
@@ -126,7 +110,7 @@ void MilkdropWaveform::ModulateOpacityByVolume(RenderContext &context)
 
 }
 
-void MilkdropWaveform::MaximizeColors(RenderContext &context)
+void MilkdropWaveform::MaximizeColors(RenderContext &context, float color[4])
 {
 	float wave_r_switch=0, wave_g_switch=0, wave_b_switch=0;
 	//wave color brightening
@@ -178,12 +162,17 @@ void MilkdropWaveform::MaximizeColors(RenderContext &context)
 		}
 
 
-        glVertexAttrib4f(1, wave_r_switch, wave_g_switch, wave_b_switch, temp_a * masterAlpha);
+        color[0] = wave_r_switch;
+        color[1] = wave_g_switch;
+        color[2] = wave_b_switch;
 	}
 	else
 	{
-        glVertexAttrib4f(1, r, g, b, temp_a * masterAlpha);
+        color[0] = r;
+        color[1] = g;
+        color[2] = b;
 	}
+	color[3] = temp_a * masterAlpha;
 }
 
 
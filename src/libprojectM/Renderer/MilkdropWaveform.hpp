@@ -45,7 +45,6 @@ public:
 	MilkdropWaveform();
     ~MilkdropWaveform();
 	void Draw(RenderContext &context);
-    void InitVertexAttrib();
 
 	float modOpacityStart;
 	float modOpacityEnd;
@@ -60,7 +59,7 @@ private:
 	float wavearray[2048][2];
 	float wavearray2[2048][2];
 
-	void MaximizeColors(RenderContext &context);
+	void MaximizeColors(RenderContext &context, float color[4]);
 	void ModulateOpacityByVolume(RenderContext &context);
 	void WaveformMath(RenderContext &context);
 
@@ -6,65 +6,88 @@
  */
 
 #include "PerlinNoise.hpp"
-#include <iostream>
-#include <stdlib.h>
+#include <vector>
 
-PerlinNoise::PerlinNoise()
+
+namespace {
+
+inline float cubic_interp(float v0, float v1, float v2, float v3, float x)
 {
-    for (int x = 0; x < 256;x++) {
-        for (int y = 0; y < 256;y++) {
-            noise_lq[x][y][0] = noise(x , y);
-            noise_lq[x][y][1] = noise_lq[x][y][0];
-            noise_lq[x][y][2] = noise_lq[x][y][0];
-        }
-    }
+	float P = (v3 - v2) - (v0 - v1);
+	float Q = (v0 - v1) - P;
+	float R = v2 - v0;
 
-    for (int x = 0; x < 32;x++) {
-        for (int y = 0; y < 32;y++) {
-            noise_lq_lite[x][y][0] = noise(4*x,16*y);
-            noise_lq_lite[x][y][1] = noise_lq_lite[x][y][0];
-            noise_lq_lite[x][y][2] = noise_lq_lite[x][y][0];
-        }
-    }
+	return ((P * x + Q) * x + R) * x + v1;
+}
 
-    for (int x = 0; x < 256;x++) {
-        for (int y = 0; y < 256;y++) {
-            noise_mq[x][y][0] = InterpolatedNoise((float)x/(float)2.0,(float)y/(float)2.0);
-            noise_mq[x][y][1] = noise_mq[x][y][0];
-            noise_mq[x][y][2] = noise_mq[x][y][0];
-        }
-    }
+}
+
+
+const PerlinNoise & PerlinNoise::get()
+{
+	static const PerlinNoise instance;
+	return instance;
+}
 
+PerlinNoise::PerlinNoise()
+{
     for (int x = 0; x < 256;x++) {
         for (int y = 0; y < 256;y++) {
-            noise_hq[x][y][0] = InterpolatedNoise((float)x/(float)3.0,(float)y/(float)3.0);
-            noise_hq[x][y][1] = noise_hq[x][y][0];
-            noise_hq[x][y][2] = noise_hq[x][y][0];
+            store(noise_lq[x][y], noise(x , y));
         }
     }
 
     for (int x = 0; x < 32;x++) {
         for (int y = 0; y < 32;y++) {
-            for (int z = 0; z < 32;z++) {
-                noise_lq_vol[x][y][z][0] = noise(x,y,z);
-                noise_lq_vol[x][y][z][1] = noise_lq_vol[x][y][z][0];
-                noise_lq_vol[x][y][z][2] = noise_lq_vol[x][y][z][0];
-            }
+            store(noise_lq_lite[x][y], noise(4*x,16*y));
         }
     }
 
+    interpolated(noise_mq, 2);
+    interpolated(noise_hq, 3);
+
     for (int x = 0; x < 32;x++) {
         for (int y = 0; y < 32;y++) {
             for (int z = 0; z < 32;z++) {
-                noise_hq_vol[x][y][z][0] = noise(x,y,z);
-                noise_hq_vol[x][y][z][1] = noise_hq_vol[x][y][z][0];
-                noise_hq_vol[x][y][z][2] = noise_hq_vol[x][y][z][0];
+                store(noise_vol[x][y][z], noise(x,y,z));
             }
         }
     }
 }
 
-PerlinNoise::~PerlinNoise()
+// Bicubic interpolation of the lattice noise, zoomed in by divisor. The lattice is hashed
+// once up front, each texel then only does the five cubic_interp calls.
+void PerlinNoise::interpolated(unsigned char texture[256][256][4], int divisor)
 {
-	// TODO Auto-generated destructor stub
+	// lattice points -1 .. 255 / divisor + 2 in both directions
+	const int size = 255 / divisor + 4;
+	std::vector<float> lattice(size * size);
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+			lattice[y * size + x] = noise(x - 1, y - 1);
+
+	for (int x = 0; x < 256;x++) {
+		float fx = (float)x/(float)divisor;
+		int integer_X = int(fx);
+		float fractional_X = fx - integer_X;
+		const float *column = &lattice[integer_X];
+
+		for (int y = 0; y < 256;y++) {
+			float fy = (float)y/(float)divisor;
+			int integer_Y = int(fy);
+			float fractional_Y = fy - integer_Y;
+			const float *a = column + integer_Y * size;
+			const float *b = a + size;
+			const float *c = b + size;
+			const float *d = c + size;
+
+			float i0 = cubic_interp(a[0], a[1], a[2], a[3], fractional_X);
+			float i1 = cubic_interp(b[0], b[1], b[2], b[3], fractional_X);
+			// the third row has always started at integer_X rather than integer_X - 1
+			float i2 = cubic_interp(c[1], c[1], c[2], c[3], fractional_X);
+			float i3 = cubic_interp(d[0], d[1], d[2], d[3], fractional_X);
+
+			store(texture[x][y], cubic_interp(i0, i1, i2, i3, fractional_Y));
+		}
+	}
 }
@@ -8,163 +8,65 @@
 #ifndef PERLINNOISE_HPP_
 #define PERLINNOISE_HPP_
 
-#include <math.h>
-
+/* The noise textures presets sample, as grey RGBA8 with opaque alpha. They used to be
+generated as floats by every TextureManager and converted to 8 bits by the driver on
+upload, now they are generated once per process, already quantized, and shared by all
+projectM instances. RGBA uploads the same way on desktop GL and OpenGL ES.
+*/
 class PerlinNoise
 {
 public:
 
-    float noise_lq[256][256][3];
-    float noise_lq_lite[32][32][3];
-    float noise_mq[256][256][3];
-    float noise_hq[256][256][3];
-    float noise_lq_vol[32][32][32][3];
-    float noise_hq_vol[32][32][32][3];
-
+    unsigned char noise_lq[256][256][4];
+    unsigned char noise_lq_lite[32][32][4];
+    unsigned char noise_mq[256][256][4];
+    unsigned char noise_hq[256][256][4];
+    // noisevol_lq and noisevol_hq have always been the same texture
+    unsigned char noise_vol[32][32][32][4];
 
-	PerlinNoise();
-	virtual ~PerlinNoise();
+    /// The process wide instance, generated on first use
+    static const PerlinNoise & get();
 
 private:
 
-	static inline float noise( int x)
+	PerlinNoise();
+	PerlinNoise(const PerlinNoise &);
+	PerlinNoise & operator=(const PerlinNoise &);
+
+	// unsigned, so the wrap around of the hash is defined
+	static inline float noise(int x)
 	{
-	    x = (x<<13)^x;
-	    return (((x * (x * x * 15731 + 789221) + 1376312589) & 0x7fffffff) / 2147483648.0);
-	   }
+	    unsigned int n = (unsigned int) x;
+	    n = (n<<13)^n;
+	    return ((n * (n * n * 15731u + 789221u) + 1376312589u) & 0x7fffffffu) / 2147483648.0;
+	}
 
 	static inline float noise(int x, int y)
 	{
-		 int n = x + y * 57;
-		 return noise(n);
+		 return noise(x + y * 57);
 	}
 
 	static inline float noise(int x, int y, int z)
 	{
-		 int n = x + y * 57 + z * 141;
-		 return noise(n);
+		 return noise(x + y * 57 + z * 141);
 	}
 
-	static inline float cubic_interp(float v0, float v1, float v2, float v3, float x)
+	static inline unsigned char quantize(float value)
 	{
-		float P = (v3 - v2) - (v0 - v1);
-		float Q = (v0 - v1) - P;
-		float R = v2 - v0;
-
-		return P*pow(x,3) + Q * pow(x,2) + R*x + v1;
+		if (value <= 0)
+			return 0;
+		if (value >= 1)
+			return 255;
+		return (unsigned char) (value * 255 + 0.5f);
 	}
 
-	static inline float InterpolatedNoise(float x, float y)
+	static void store(unsigned char *texel, float value)
 	{
-		int integer_X = int(x);
-		float fractional_X = x - integer_X;
-
-		int integer_Y = int(y);
-		float fractional_Y = y - integer_Y;
-
-		float a0 = noise(integer_X - 1,      integer_Y - 1);
-		float a1 = noise(integer_X,          integer_Y - 1);
-		float a2 = noise(integer_X + 1,      integer_Y - 1);
-		float a3 = noise(integer_X + 2,      integer_Y - 1);
-
-		float x0 = noise(integer_X - 1,      integer_Y);
-		float x1 = noise(integer_X,          integer_Y);
-		float x2 = noise(integer_X + 1,      integer_Y);
-		float x3 = noise(integer_X + 2,      integer_Y);
-
-		float y0 = noise(integer_X + 0,   	 integer_Y + 1);
-		float y1 = noise(integer_X,     	 integer_Y + 1);
-		float y2 = noise(integer_X + 1, 	 integer_Y + 1);
-		float y3 = noise(integer_X + 2, 	 integer_Y + 1);
-
-		float b0 = noise(integer_X - 1,      integer_Y + 2);
-		float b1 = noise(integer_X,          integer_Y + 2);
-		float b2 = noise(integer_X + 1,      integer_Y + 2);
-		float b3 = noise(integer_X + 2,      integer_Y + 2);
-
-		float i0 = cubic_interp(a0 , a1, a2, a3, fractional_X);
-		float i1 = cubic_interp(x0 , x1, x2, x3, fractional_X);
-		float i2 = cubic_interp(y0 , y1, y2, y3, fractional_X);
-		float i3 = cubic_interp(b0 , b1, b2, b3, fractional_X);
-
-		return cubic_interp(i0, i1 , i2 , i3, fractional_Y);
-
+		texel[0] = texel[1] = texel[2] = quantize(value);
+		texel[3] = 255;
 	}
 
-	static inline float perlin_octave_3d(float x,float y, float z,int width, int seed, float period)
-		{
-		           float freq=1/(float)(period);
-
-		           int num=(int)(width*freq);
-		           int step_x=(int)(x*freq);
-		           int step_y=(int)(y*freq);
-		           int step_z=(int)(z*freq);
-		           float zone_x=x*freq-step_x;
-		           float zone_y=y*freq-step_y;
-		           float zone_z=z*freq-step_z;
-
-		           int boxB=step_x+step_y+step_z*num;
-		           int boxC=step_x+step_y+step_z*(num+1);
-		           int boxD=step_x+step_y+step_z*(num+2);
-		           int boxA=step_x+step_y+step_z*(num-1);
-
-		           float u,a,b,v,noisedata,box;
-
-		           box = boxA;
-		           noisedata=(box+seed);
-		           u=cubic_interp(noise(noisedata-num-1),noise(noisedata-num),noise(noisedata-num+1),noise(noisedata-num+2),zone_x);
-		           a=cubic_interp(noise(noisedata-1),noise(noisedata),noise(noisedata+1),noise(noisedata+2),zone_x);
-		           b=cubic_interp(noise(noisedata+num -1),noise(noisedata+num),noise(noisedata+1+num),noise(noisedata+2+num),zone_x);
-		           v=cubic_interp(noise(noisedata+2*num -1),noise(noisedata+2*num),noise(noisedata+1+2*num),noise(noisedata+2+2*num),zone_x);
-		           float A=cubic_interp(u,a,b,v,zone_y);
-
-		           box = boxB;
-		           noisedata=(box+seed);
-		           u=cubic_interp(noise(noisedata-num-1),noise(noisedata-num),noise(noisedata-num+1),noise(noisedata-num+2),zone_x);
-		           a=cubic_interp(noise(noisedata-1),noise(noisedata),noise(noisedata+1),noise(noisedata+2),zone_x);
-		           b=cubic_interp(noise(noisedata+num -1),noise(noisedata+num),noise(noisedata+1+num),noise(noisedata+2+num),zone_x);
-		           v=cubic_interp(noise(noisedata+2*num -1),noise(noisedata+2*num),noise(noisedata+1+2*num),noise(noisedata+2+2*num),zone_x);
-		           float B=cubic_interp(u,a,b,v,zone_y);
-
-		           box = boxC;
-		           noisedata=(box+seed);
-		           u=cubic_interp(noise(noisedata-num-1),noise(noisedata-num),noise(noisedata-num+1),noise(noisedata-num+2),zone_x);
-		           a=cubic_interp(noise(noisedata-1),noise(noisedata),noise(noisedata+1),noise(noisedata+2),zone_x);
-		           b=cubic_interp(noise(noisedata+num -1),noise(noisedata+num),noise(noisedata+1+num),noise(noisedata+2+num),zone_x);
-		           v=cubic_interp(noise(noisedata+2*num -1),noise(noisedata+2*num),noise(noisedata+1+2*num),noise(noisedata+2+2*num),zone_x);
-		           float C=cubic_interp(u,a,b,v,zone_y);
-
-		           box = boxD;
-		           noisedata=(box+seed);
-		           u=cubic_interp(noise(noisedata-num-1),noise(noisedata-num),noise(noisedata-num+1),noise(noisedata-num+2),zone_x);
-		           a=cubic_interp(noise(noisedata-1),noise(noisedata),noise(noisedata+1),noise(noisedata+2),zone_x);
-		           b=cubic_interp(noise(noisedata+num -1),noise(noisedata+num),noise(noisedata+1+num),noise(noisedata+2+num),zone_x);
-		           v=cubic_interp(noise(noisedata+2*num -1),noise(noisedata+2*num),noise(noisedata+1+2*num),noise(noisedata+2+2*num),zone_x);
-		           float D=cubic_interp(u,a,b,v,zone_y);
-
-		           float value =cubic_interp(A,B,C,D,zone_z);
-
-		           return value;
-		}
-
-
-	static inline float perlin_noise_3d(int x, int y, int z, int width, int octaves, int seed, float persistance, float basePeriod)
-		{
-			float p = persistance;
-			float val = 0.0;
-
-			for (int i = 0; i<octaves;i++)
-			{
-				val += perlin_octave_3d(x,y,z,width,seed,basePeriod) * p;
-
-				basePeriod *= 0.5;
-				p *= persistance;
-			}
-			return val;
-		}
-
-
-
+	static void interpolated(unsigned char texture[256][256][4], int divisor);
 };
 
 #endif /* PERLINNOISE_HPP_ */
@@ -0,0 +1,181 @@
+//
+//  RenderBatch.cpp
+//  libprojectM
+//
+
+#include "RenderBatch.hpp"
+#include "Renderable.hpp"
+#include <glm/gtc/type_ptr.hpp>
+
+
+RenderBatch::RenderBatch()
+{
+    current.blendSrc = GL_SRC_ALPHA;
+    current.blendDst = GL_ONE_MINUS_SRC_ALPHA;
+    current.textured = false;
+    current.texture = 0;
+    current.sampler = 0;
+    current.lineWidth = 1;
+    current.pointSize = 1;
+
+    glGenBuffers(1, &vbo);
+    glGenVertexArrays(1, &vao);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);                     // Positions
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(float)*2));     // Colors
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(float)*6));     // Textures
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+RenderBatch::~RenderBatch()
+{
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+}
+
+void RenderBatch::setBlend(GLenum src, GLenum dst)
+{
+    current.blendSrc = src;
+    current.blendDst = dst;
+}
+
+void RenderBatch::setUntextured()
+{
+    current.textured = false;
+    current.texture = 0;
+    current.sampler = 0;
+}
+
+void RenderBatch::setTexture(GLuint texture, GLuint sampler)
+{
+    current.textured = true;
+    current.texture = texture;
+    current.sampler = sampler;
+}
+
+void RenderBatch::setLineWidth(float width)
+{
+    current.lineWidth = width;
+}
+
+void RenderBatch::setPointSize(float size)
+{
+    current.pointSize = size;
+}
+
+RenderBatch::Vertex *RenderBatch::draw(GLenum mode, size_t count)
+{
+    Command command;
+    command.mode = mode;
+    command.state = current;
+    commands.push_back(command);
+    firsts.push_back(vertices.size());
+    counts.push_back(count);
+
+    vertices.resize(vertices.size() + count);
+    return &vertices[vertices.size() - count];
+}
+
+bool RenderBatch::isLines(GLenum mode)
+{
+    return mode == GL_LINES || mode == GL_LINE_STRIP || mode == GL_LINE_LOOP;
+}
+
+// line width only matters to lines and point size only to points
+bool RenderBatch::compatible(GLenum mode, const State &lhs, const State &rhs)
+{
+    return lhs.blendSrc == rhs.blendSrc && lhs.blendDst == rhs.blendDst &&
+           lhs.textured == rhs.textured && lhs.texture == rhs.texture && lhs.sampler == rhs.sampler &&
+           (!isLines(mode) || lhs.lineWidth == rhs.lineWidth) &&
+           (mode != GL_POINTS || lhs.pointSize == rhs.pointSize);
+}
+
+void RenderBatch::flush(const RenderContext &context)
+{
+    if (commands.empty())
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), &vertices[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glUseProgram(context.programID_v2f_c4f_t2f);
+    glUniformMatrix4fv(context.uniform_v2f_c4f_t2f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
+    glUniform1i(context.uniform_v2f_c4f_t2f_frag_texture_sampler, 0);
+    glUseProgram(context.programID_v2f_c4f);
+    glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(vao);
+
+    // only the state that changes between runs is set, the first run sets all of it
+    bool first = true;
+    bool textureSet = false;
+    bool lineWidthSet = false;
+    State applied = current;
+    for (size_t i = 0; i < commands.size(); )
+    {
+        const Command &command = commands[i];
+        size_t end = i + 1;
+        while (end < commands.size() && commands[end].mode == command.mode &&
+               compatible(command.mode, command.state, commands[end].state))
+            end++;
+
+        const State &state = command.state;
+        if (first || applied.blendSrc != state.blendSrc || applied.blendDst != state.blendDst)
+            glBlendFunc(state.blendSrc, state.blendDst);
+        if (first || applied.textured != state.textured)
+            glUseProgram(state.textured ? context.programID_v2f_c4f_t2f : context.programID_v2f_c4f);
+        if (state.textured && (!textureSet || applied.texture != state.texture || applied.sampler != state.sampler))
+        {
+            glBindTexture(GL_TEXTURE_2D, state.texture);
+            glBindSampler(0, state.sampler);
+            applied.texture = state.texture;
+            applied.sampler = state.sampler;
+            textureSet = true;
+        }
+        if (isLines(command.mode) && (!lineWidthSet || applied.lineWidth != state.lineWidth))
+        {
+            glLineWidth(state.lineWidth);
+            applied.lineWidth = state.lineWidth;
+            lineWidthSet = true;
+        }
+        if (command.mode == GL_POINTS && !state.textured)
+            glUniform1f(context.uniform_v2f_c4f_vertex_point_size, state.pointSize);
+        applied.blendSrc = state.blendSrc;
+        applied.blendDst = state.blendDst;
+        applied.textured = state.textured;
+
+#ifdef USE_GLES
+        for (size_t j = i; j < end; j++)
+            glDrawArrays(command.mode, firsts[j], counts[j]);
+#else
+        if (end - i == 1)
+            glDrawArrays(command.mode, firsts[i], counts[i]);
+        else
+            glMultiDrawArrays(command.mode, &firsts[i], &counts[i], end - i);
+#endif
+        i = end;
+        first = false;
+    }
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindSampler(0, 0);
+    glLineWidth(context.texsize < 512 ? 1 : context.texsize/512);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    vertices.clear();
+    commands.clear();
+    firsts.clear();
+    counts.clear();
+}
@@ -0,0 +1,81 @@
+//
+//  RenderBatch.hpp
+//  libprojectM
+//
+//  Frame-level geometry batcher for the pass 1 drawables (shapes, waves, borders,
+//  motion vectors). Draw() calls append their vertices here instead of talking to GL,
+//  flush() uploads everything into one streaming VBO and submits it in draw order,
+//  merging neighbouring draws that share GL state into a single glMultiDrawArrays.
+//  Draws are never reordered, the drawables blend over each other.
+//
+
+#ifndef RenderBatch_hpp
+#define RenderBatch_hpp
+
+#include <cstddef>
+#include <vector>
+#include "projectM-opengl.h"
+
+class RenderContext;
+
+class RenderBatch
+{
+public:
+    /// Vertex layout of both v2f_c4f (texture coordinates ignored) and v2f_c4f_t2f
+    struct Vertex
+    {
+        float x, y;
+        float r, g, b, a;
+        float u, v;
+    };
+
+    RenderBatch();
+    ~RenderBatch();
+
+    /// State for the following draws, mirroring the GL calls the drawables used to make
+    void setBlend(GLenum src, GLenum dst);
+    /// Untextured draws use v2f_c4f, textured ones v2f_c4f_t2f with texture on unit 0
+    void setUntextured();
+    void setTexture(GLuint texture, GLuint sampler);
+    void setLineWidth(float width);
+    void setPointSize(float size);
+
+    /// Adds a draw of count vertices and returns them to be filled in. The pointer
+    /// is only valid until the next draw() call.
+    Vertex *draw(GLenum mode, size_t count);
+
+    /// Submits all draws since the last flush and restores the default blend mode
+    void flush(const RenderContext &context);
+
+private:
+    struct State
+    {
+        GLenum blendSrc;
+        GLenum blendDst;
+        bool textured;
+        GLuint texture;
+        GLuint sampler;
+        float lineWidth;
+        float pointSize;
+    };
+
+    struct Command
+    {
+        GLenum mode;
+        State state;
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<Command> commands;
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    State current;
+
+    GLuint vbo;
+    GLuint vao;
+
+    static bool isLines(GLenum mode);
+    static bool compatible(GLenum mode, const State &lhs, const State &rhs);
+};
+
+#endif /* RenderBatch_hpp */
@@ -3,7 +3,9 @@
 #include "Renderable.hpp"
 #include "Texture.hpp"
 #include <math.h>
+#include <cstddef>
 #include "ShaderEngine.hpp"
+#include "RenderBatch.hpp"
 #include <glm/gtc/type_ptr.hpp>
 
 typedef float floatPair[2];
@@ -11,9 +13,9 @@ typedef float floatTriple[3];
 typedef float floatQuad[4];
 
 RenderContext::RenderContext()
-	: time(0),texsize(512), aspectRatio(1), aspectCorrect(false){};
+	: time(0),texsize(512), aspectRatio(1), aspectCorrect(false), batch(nullptr), programID_shape_instanced(0){};
 
-RenderItem::RenderItem():masterAlpha(1){}
+RenderItem::RenderItem():masterAlpha(1), m_vboID(0), m_vaoID(0){}
 
 void RenderItem::Init() {
     glGenVertexArrays(1, &m_vaoID);
@@ -28,26 +30,27 @@ void RenderItem::Init() {
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+// items that were never drawn have no buffers, those are created and destroyed without GL
 RenderItem::~RenderItem() {
-    glDeleteBuffers(1, &m_vboID);
-    glDeleteVertexArrays(1, &m_vaoID);
+    if (m_vaoID != 0) {
+        glDeleteBuffers(1, &m_vboID);
+        glDeleteVertexArrays(1, &m_vaoID);
+    }
 }
 
 
 DarkenCenter::DarkenCenter():RenderItem(){
-    Init();
 }
 
 MotionVectors::MotionVectors():RenderItem() {
-    Init();
 }
 
 Border::Border():RenderItem() {
-    Init();
 }
 
-void DarkenCenter::InitVertexAttrib() {
-    float points_colors[6][6] = {
+void DarkenCenter::Draw(RenderContext &context)
+{
+    const float points_colors[6][6] = {
         { 0.5,  0.5,      0, 0, 0, (3.0f/32.0f) * masterAlpha},
         { 0.45, 0.5,      0, 0, 0, 0},
         { 0.5,  0.45,     0, 0, 0, 0},
@@ -55,30 +58,21 @@ void DarkenCenter::InitVertexAttrib() {
         { 0.5,  0.55,     0, 0, 0, 0},
         { 0.45, 0.5,      0, 0, 0, 0}};
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float)*6, (void*)0); // points
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(float)*6, (void*)(sizeof(float)*2)); // colors
-
-    glBufferData(GL_ARRAY_BUFFER, sizeof(points_colors), points_colors, GL_STATIC_DRAW);
-
-}
-
-
-void DarkenCenter::Draw(RenderContext &context)
-	{
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    glUseProgram(context.programID_v2f_c4f);
-
-    glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
-
-    glBindVertexArray(m_vaoID);
-
-	glDrawArrays(GL_TRIANGLE_FAN,0,6);
-
-    glBindVertexArray(0);
+    context.batch->setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    context.batch->setUntextured();
+
+    RenderBatch::Vertex *vertices = context.batch->draw(GL_TRIANGLE_FAN, 6);
+    for (int i = 0; i < 6; i++)
+    {
+        RenderBatch::Vertex &vertex = vertices[i];
+        vertex.x = points_colors[i][0];
+        vertex.y = points_colors[i][1];
+        vertex.r = points_colors[i][2];
+        vertex.g = points_colors[i][3];
+        vertex.b = points_colors[i][4];
+        vertex.a = points_colors[i][5];
+        vertex.u = vertex.v = 0;
+    }
 }
 
 Shape::Shape():RenderItem()
@@ -111,210 +105,233 @@ Shape::Shape():RenderItem()
 	     border_g = 0.0; /* green color value */
 	     border_b = 0.0; /* blue color value */
 	     border_a = 0.0; /* alpha color value */
-
-
-    glGenVertexArrays(1, &m_vaoID_texture);
-    glGenBuffers(1, &m_vboID_texture);
-
-    glGenVertexArrays(1, &m_vaoID_not_texture);
-    glGenBuffers(1, &m_vboID_not_texture);
-
-    glBindVertexArray(m_vaoID_texture);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vboID_texture);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct_data), (void*)0);     // Positions
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct_data), (void*)(sizeof(float)*2));     // Colors
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(struct_data), (void*)(sizeof(float)*6)); // Textures
-
-    glBindVertexArray(m_vaoID_not_texture);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vboID_not_texture);
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(struct_data), (void*)0);   // points
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct_data), (void*)(sizeof(float)*2));     // Colors
-
-    Init();
 }
 
-Shape::~Shape() {
-    glDeleteBuffers(1, &m_vboID_texture);
-    glDeleteVertexArrays(1, &m_vaoID_texture);
 
-    glDeleteBuffers(1, &m_vboID_not_texture);
-    glDeleteVertexArrays(1, &m_vaoID_not_texture);
-}
-
-void Shape::InitVertexAttrib() {
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);   // points
-    glDisableVertexAttribArray(1);
+Shape::Instance Shape::currentInstance() const
+{
+	Instance instance;
+	instance.x = x;
+	instance.y = y;
+	instance.radius = radius;
+	instance.ang = ang;
+	instance.r = r;
+	instance.g = g;
+	instance.b = b;
+	instance.a = a;
+	instance.r2 = r2;
+	instance.g2 = g2;
+	instance.b2 = b2;
+	instance.a2 = a2;
+	instance.border_r = border_r;
+	instance.border_g = border_g;
+	instance.border_b = border_b;
+	instance.border_a = border_a;
+	instance.tex_ang = tex_ang;
+	instance.tex_zoom = tex_zoom;
+	instance.sides = sides;
+	instance.textured = textured;
+	instance.additive = additive;
+	instance.thickOutline = thickOutline;
+	return instance;
 }
 
-
 void Shape::Draw(RenderContext &context)
 {
+	if (instances.size() < 2)
+		DrawBatched(context, currentInstance());
+	else if (context.programID_shape_instanced == 0)
+	{
+		for (size_t i = 0; i < instances.size(); i++)
+			DrawBatched(context, instances[i]);
+	}
+	else
+		DrawInstanced(context);
+}
 
-	float xval, yval;
-	float t;
-
-	float temp_radius= radius*(.707*.707*.707*1.04);
-
-	//Additive Drawing or Overwrite
-	if ( additive==0)  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	else    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
-	xval= x;
-	yval= -(y-1);
-
-    struct_data *buffer_data = new struct_data[sides+2];
-
-	if ( textured)
+// Looks up the image (or main texture) of a textured shape, false if the image is missing
+bool Shape::lookupTexture(RenderContext &context, GLuint &texture, GLuint &sampler)
+{
+	if (imageUrl !="")
 	{
-		if (imageUrl !="")
+		TextureSamplerDesc tex = context.textureManager->getTexture(imageUrl, GL_CLAMP_TO_EDGE, GL_LINEAR);
+		if (tex.first == NULL)
 		{
-            TextureSamplerDesc tex = context.textureManager->getTexture(imageUrl, GL_CLAMP_TO_EDGE, GL_LINEAR);
-            if (tex.first != NULL)
-			{
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, tex.first->texID);
-                glBindSampler(0, tex.second->samplerID);
-
-				context.aspectRatio=1.0;
-			}
+			texture = sampler = 0;
+			return false;
 		}
-		else
-        {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, context.textureManager->getMainTexture()->texID);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        }
-
-		//Define the center point of the shape
-        buffer_data[0].color_r = r;
-        buffer_data[0].color_g = g;
-        buffer_data[0].color_b = b;
-        buffer_data[0].color_a = a * masterAlpha;
-        buffer_data[0].tex_x = 0.5;
-        buffer_data[0].tex_y = 0.5;
-        buffer_data[0].point_x = xval;
-        buffer_data[0].point_y = yval;
-
-		for ( int i=1;i< sides+2;i++)
-		{
-            buffer_data[i].color_r=r2;
-            buffer_data[i].color_g=g2;
-            buffer_data[i].color_b=b2;
-            buffer_data[i].color_a=a2 * masterAlpha;
+		texture = tex.first->texID;
+		sampler = tex.second->samplerID;
+		context.aspectRatio=1.0;
+	}
+	else
+	{
+		TextureSamplerDesc tex = context.textureManager->getTexture("main", GL_REPEAT, GL_LINEAR);
+		texture = tex.first->texID;
+		sampler = tex.second->samplerID;
+	}
+	return true;
+}
 
-		  t = (i-1)/(float) sides;
-            buffer_data[i].tex_x =0.5f + 0.5f*cosf(t*3.1415927f*2 +  tex_ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)/ tex_zoom;
-            buffer_data[i].tex_y =  0.5f + 0.5f*sinf(t*3.1415927f*2 +  tex_ang + 3.1415927f*0.25f)/ tex_zoom;
-            buffer_data[i].point_x=temp_radius*cosf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)+xval;
-            buffer_data[i].point_y=temp_radius*sinf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)+yval;
+void Shape::DrawBatched(RenderContext &context, const Instance &instance)
+{
 
-		}
+	float xval, yval;
+	float t;
 
-        glBindBuffer(GL_ARRAY_BUFFER, m_vboID_texture);
+	float temp_radius= instance.radius*(.707*.707*.707*1.04);
 
-        glBufferData(GL_ARRAY_BUFFER, sizeof(struct_data)*(sides+2), NULL, GL_DYNAMIC_DRAW);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(struct_data)*(sides+2), buffer_data, GL_DYNAMIC_DRAW);
+	RenderBatch &batch = *context.batch;
 
-        glUseProgram(context.programID_v2f_c4f_t2f);
+	//Additive Drawing or Overwrite
+	if ( instance.additive==0)  batch.setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	else    batch.setBlend(GL_SRC_ALPHA, GL_ONE);
 
-        glUniformMatrix4fv(context.uniform_v2f_c4f_t2f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
-        glUniform1i(context.uniform_v2f_c4f_t2f_frag_texture_sampler, 0);
+	xval= instance.x;
+	yval= -(instance.y-1);
 
-        glBindVertexArray(m_vaoID_texture);
-        glDrawArrays(GL_TRIANGLE_FAN, 0, sides+2);
-        glBindVertexArray(0);
+	if ( instance.textured)
+	{
+		GLuint texture, sampler;
+		lookupTexture(context, texture, sampler);
+		batch.setTexture(texture, sampler);
 	}
 	else
 	{//Untextured (use color values)
+        batch.setUntextured();
+	}
 
-	  //Define the center point of the shape
-        buffer_data[0].color_r=r;
-        buffer_data[0].color_g=g;
-        buffer_data[0].color_b=b;
-        buffer_data[0].color_a=a * masterAlpha;
-        buffer_data[0].point_x=xval;
-        buffer_data[0].point_y=yval;
-
+    RenderBatch::Vertex *buffer_data = batch.draw(GL_TRIANGLE_FAN, instance.sides+2);
 
-	  for ( int i=1;i< sides+2;i++)
-	    {
-            buffer_data[i].color_r=r2;
-            buffer_data[i].color_g=g2;
-            buffer_data[i].color_b=b2;
-            buffer_data[i].color_a=a2 * masterAlpha;
-	      t = (i-1)/(float) sides;
-            buffer_data[i].point_x=temp_radius*cosf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)+xval;
-            buffer_data[i].point_y=temp_radius*sinf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)+yval;
-	    }
+	//Define the center point of the shape
+    buffer_data[0].r = instance.r;
+    buffer_data[0].g = instance.g;
+    buffer_data[0].b = instance.b;
+    buffer_data[0].a = instance.a * masterAlpha;
+    buffer_data[0].u = 0.5;
+    buffer_data[0].v = 0.5;
+    buffer_data[0].x = xval;
+    buffer_data[0].y = yval;
 
-        glBindBuffer(GL_ARRAY_BUFFER, m_vboID_not_texture);
+	for ( int i=1;i< instance.sides+2;i++)
+	{
+        buffer_data[i].r=instance.r2;
+        buffer_data[i].g=instance.g2;
+        buffer_data[i].b=instance.b2;
+        buffer_data[i].a=instance.a2 * masterAlpha;
+
+		t = (i-1)/(float) instance.sides;
+        buffer_data[i].u =0.5f + 0.5f*cosf(t*3.1415927f*2 +  instance.tex_ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)/ instance.tex_zoom;
+        buffer_data[i].v =  0.5f + 0.5f*sinf(t*3.1415927f*2 +  instance.tex_ang + 3.1415927f*0.25f)/ instance.tex_zoom;
+        buffer_data[i].x=temp_radius*cosf(t*3.1415927f*2 +  instance.ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)+xval;
+        buffer_data[i].y=temp_radius*sinf(t*3.1415927f*2 +  instance.ang + 3.1415927f*0.25f)+yval;
+	}
 
-        glBufferData(GL_ARRAY_BUFFER, sizeof(struct_data)*(sides+2), NULL, GL_DYNAMIC_DRAW);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(struct_data)*(sides+2), buffer_data, GL_DYNAMIC_DRAW);
+	batch.setUntextured();
+	batch.setLineWidth(instance.thickOutline==1 ? (context.texsize < 512 ? 1 : 2*context.texsize/512)
+	                                            : (context.texsize < 512 ? 1 : context.texsize/512));
 
-        glUseProgram(context.programID_v2f_c4f);
+    RenderBatch::Vertex *points = batch.draw(GL_LINE_LOOP, instance.sides);
 
-        glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
+	for ( int i=0;i< instance.sides;i++)
+	{
+		t = (i-1)/(float) instance.sides;
+		points[i].x= temp_radius*cosf(t*3.1415927f*2 +  instance.ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)+xval;
+		points[i].y=  temp_radius*sinf(t*3.1415927f*2 +  instance.ang + 3.1415927f*0.25f)+yval;
+		points[i].r = instance.border_r;
+		points[i].g = instance.border_g;
+		points[i].b = instance.border_b;
+		points[i].a = instance.border_a * masterAlpha;
+		points[i].u = points[i].v = 0;
+	}
+}
 
-        glBindVertexArray(m_vaoID_not_texture);
-	  	glDrawArrays(GL_TRIANGLE_FAN,0,sides+2);
-        glBindVertexArray(0);
+void Shape::InitVertexAttrib()
+{
+	for (GLuint i = 0; i < 5; i++)
+	{
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
 	}
+}
 
+// All instances in one buffer, one glDrawArraysInstanced per run of instances that share
+// sides, blending, texturing and outline width (normally the whole shape). The vertex
+// shader builds a triangle per side for the fill and a quad per side for the outline, so
+// every instance still draws its outline over its own fill before the next instance.
+void Shape::DrawInstanced(RenderContext &context)
+{
+	// whatever was batched so far lies below this shape
+	context.batch->flush(context);
 
-	floatPair *points = new float[sides+1][2];
+	if (m_vaoID == 0)
+		Init();
 
-	for ( int i=0;i< sides;i++)
+	GLuint texture = 0, sampler = 0;
+	for (size_t i = 0; i < instances.size(); i++)
 	{
-		t = (i-1)/(float) sides;
-		points[i][0]= temp_radius*cosf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)*(context.aspectCorrect ? context.aspectRatio : 1.0)+xval;
-		points[i][1]=  temp_radius*sinf(t*3.1415927f*2 +  ang + 3.1415927f*0.25f)+yval;
+		if (instances[i].textured)
+		{
+			lookupTexture(context, texture, sampler);
+			break;
+		}
 	}
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
-
-    glBufferData(GL_ARRAY_BUFFER, sizeof(floatPair)*(sides), NULL, GL_DYNAMIC_DRAW);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(floatPair)*(sides), points, GL_DYNAMIC_DRAW);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glUseProgram(context.programID_v2f_c4f);
+	glUseProgram(context.programID_shape_instanced);
+	glUniformMatrix4fv(context.uniform_shape_instanced_vertex_transformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
+	glUniform1f(context.uniform_shape_instanced_aspect, context.aspectCorrect ? context.aspectRatio : 1.0);
+	glUniform1f(context.uniform_shape_instanced_master_alpha, masterAlpha);
+	glUniform1i(context.uniform_shape_instanced_texture_sampler, 0);
 
-    glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindSampler(0, sampler);
 
-    glVertexAttrib4f(1, border_r, border_g, border_b, border_a * masterAlpha);
+	glBindVertexArray(m_vaoID);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * instances.size(), &instances[0], GL_STREAM_DRAW);
 
-	if (thickOutline==1)  glLineWidth(context.texsize < 512 ? 1 : 2*context.texsize/512);
+	for (size_t first = 0; first < instances.size(); )
+	{
+		const Instance &run = instances[first];
+		bool border = run.border_a > 0;
+		size_t end = first + 1;
+		while (end < instances.size() && instances[end].sides == run.sides &&
+		       instances[end].textured == run.textured && instances[end].additive == run.additive &&
+		       instances[end].thickOutline == run.thickOutline)
+		{
+			border = border || instances[end].border_a > 0;
+			end++;
+		}
 
-    glBindVertexArray(m_vaoID);
-	glDrawArrays(GL_LINE_LOOP,0,sides);
-    glBindVertexArray(0);
+		float lineWidth = run.thickOutline ? (context.texsize < 512 ? 1 : 2*context.texsize/512)
+		                                   : (context.texsize < 512 ? 1 : context.texsize/512);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindSampler(0, 0);
+		glBlendFunc(GL_SRC_ALPHA, run.additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+		glUniform1i(context.uniform_shape_instanced_sides, run.sides);
+		glUniform1f(context.uniform_shape_instanced_textured, run.textured ? 1 : 0);
+		glUniform2f(context.uniform_shape_instanced_line_width, lineWidth / viewport[2], lineWidth / viewport[3]);
 
-	if (thickOutline==1)  glLineWidth(context.texsize < 512 ? 1 : context.texsize/512);
+		const char *base = (const char *)(sizeof(Instance) * first);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, x));
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, r));
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, r2));
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, border_r));
+		glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), base + offsetof(Instance, tex_ang));
 
-    delete[] buffer_data;
-	delete[] points;
-}
+		// the outlines are skipped when none of them is visible
+		glDrawArraysInstanced(GL_TRIANGLES, 0, (border ? 9 : 3) * run.sides, end - first);
+		first = end;
+	}
 
-void MotionVectors::InitVertexAttrib() {
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    glDisableVertexAttribArray(1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindSampler(0, 0);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void MotionVectors::Draw(RenderContext &context)
@@ -322,66 +339,33 @@ void MotionVectors::Draw(RenderContext &context)
 	float  intervalx=1.0/x_num;
 	float  intervaly=1.0/y_num;
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
 	if (x_num + y_num < 600)
 	{
 		int size = x_num * y_num ;
 
-		floatPair *points = new float[size][2];
+		context.batch->setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		context.batch->setUntextured();
+		context.batch->setPointSize(length);
+
+		RenderBatch::Vertex *points = context.batch->draw(GL_POINTS, size);
 
 		for (int x=0;x<(int)x_num;x++)
 		{
 			for(int y=0;y<(int)y_num;y++)
 			{
-                float lx, ly;
-				lx = x_offset+x*intervalx;
-				ly = y_offset+y*intervaly;
-
-				points[(x * (int)y_num) + y][0] = lx;
-				points[(x * (int)y_num) + y][1] = ly;
+				RenderBatch::Vertex &point = points[(x * (int)y_num) + y];
+				point.x = x_offset+x*intervalx;
+				point.y = y_offset+y*intervaly;
+				point.r = r;
+				point.g = g;
+				point.b = b;
+				point.a = a * masterAlpha;
+				point.u = point.v = 0;
 			}
 		}
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
-
-        glBufferData(GL_ARRAY_BUFFER, sizeof(floatPair) * size, NULL, GL_DYNAMIC_DRAW);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(floatPair) * size, points, GL_DYNAMIC_DRAW);
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        delete[] points;
-
-
-		glUseProgram(context.programID_v2f_c4f);
-
-        glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
-
-		#ifndef GL_TRANSITION
-        if (length <= 0.0) {
-            glPointSize(1.0);
-        } else {
-            glPointSize(length);
-        }
-        #endif
-
-        glUniform1f(context.uniform_v2f_c4f_vertex_point_size, length);
-		glVertexAttrib4f(1, r, g, b, a * masterAlpha);
-
-        glBindVertexArray(m_vaoID);
-
-		glDrawArrays(GL_POINTS,0,size);
-
-        glBindVertexArray(0);
 	  }
 }
 
-void Border::InitVertexAttrib() {
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    glDisableVertexAttribArray(1);
-}
-
 void Border::Draw(RenderContext &context)
 {
     //Draw Borders
@@ -405,33 +389,27 @@ void Border::Draw(RenderContext &context)
         of+iff,of,      of+iff,of+iff,
     };
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
-
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 40, NULL, GL_DYNAMIC_DRAW);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 40, points, GL_DYNAMIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glUseProgram(context.programID_v2f_c4f);
-
-    glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
-
-    glVertexAttrib4f(1, outer_r, outer_g, outer_b, outer_a * masterAlpha);
-
     //no additive drawing for borders
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    glBindVertexArray(m_vaoID);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 10);
-
-    glVertexAttrib4f(1, inner_r, inner_g, inner_b, inner_a * masterAlpha);
-
-    // 1st pass for inner
-    glDrawArrays(GL_TRIANGLE_STRIP, 10, 10);
-
-    // 2nd pass for inner
-    glDrawArrays(GL_TRIANGLE_STRIP, 10, 10);
-
-    glBindVertexArray(0);
+    context.batch->setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    context.batch->setUntextured();
+
+    // outer, then two passes for inner
+    for (int pass = 0; pass < 3; pass++)
+    {
+        const float *corners = points + (pass == 0 ? 0 : 20);
+        const float color[4] = { pass == 0 ? outer_r : inner_r, pass == 0 ? outer_g : inner_g,
+                                 pass == 0 ? outer_b : inner_b, (pass == 0 ? outer_a : inner_a) * masterAlpha };
+
+        RenderBatch::Vertex *vertices = context.batch->draw(GL_TRIANGLE_STRIP, 10);
+        for (int i = 0; i < 10; i++)
+        {
+            vertices[i].x = corners[i*2];
+            vertices[i].y = corners[i*2+1];
+            vertices[i].r = color[0];
+            vertices[i].g = color[1];
+            vertices[i].b = color[2];
+            vertices[i].a = color[3];
+            vertices[i].u = vertices[i].v = 0;
+        }
+    }
 }
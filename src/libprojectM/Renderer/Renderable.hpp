@@ -7,6 +7,7 @@
 #include <glm/mat4x4.hpp>
 
 class BeatDetect;
+class RenderBatch;
 
 
 class RenderContext
@@ -18,12 +19,21 @@ public:
 	bool aspectCorrect;
 	BeatDetect *beatDetect;
 	TextureManager *textureManager;
+	RenderBatch *batch;
     GLuint programID_v2f_c4f;
     GLuint programID_v2f_c4f_t2f;
     GLint uniform_v2f_c4f_vertex_tranformation;
     GLint uniform_v2f_c4f_vertex_point_size;
     GLint uniform_v2f_c4f_t2f_vertex_tranformation;
     GLint uniform_v2f_c4f_t2f_frag_texture_sampler;
+    GLuint programID_shape_instanced; // 0 when the GL version has no instancing
+    GLint uniform_shape_instanced_vertex_transformation;
+    GLint uniform_shape_instanced_sides;
+    GLint uniform_shape_instanced_aspect;
+    GLint uniform_shape_instanced_line_width;
+    GLint uniform_shape_instanced_master_alpha;
+    GLint uniform_shape_instanced_textured;
+    GLint uniform_shape_instanced_texture_sampler;
     glm::mat4 mat_ortho;
 
 	RenderContext();
@@ -36,10 +46,12 @@ public:
     ~RenderItem();
 
 	float masterAlpha;
-    virtual void InitVertexAttrib() = 0;
+    virtual void InitVertexAttrib() {}
 	virtual void Draw(RenderContext &context) = 0;
 
 protected:
+    // sets up m_vaoID/m_vboID, called from the first Draw so presets can be built off the
+    // render thread. Items drawing through context.batch have no buffers of their own
     virtual void Init();
 
     GLuint m_vboID;
@@ -52,7 +64,6 @@ class DarkenCenter : public RenderItem
 {
 public:
 	DarkenCenter();
-    void InitVertexAttrib();
 	void Draw(RenderContext &context);
 };
 
@@ -89,30 +100,34 @@ public:
     float border_b; /* blue color value */
     float border_a; /* alpha color value */
 
+    /// Everything a single copy of the shape needs to be drawn. The layout is also the
+    /// per-instance attribute buffer of the instanced draw.
+    struct Instance
+    {
+        float x, y, radius, ang;
+        float r, g, b, a;
+        float r2, g2, b2, a2;
+        float border_r, border_g, border_b, border_a;
+        float tex_ang, tex_zoom;
+        int sides;
+        bool textured;
+        bool additive;
+        bool thickOutline;
+    };
+
+    /// Filled by presets that draw the shape more than once (num_inst), empty otherwise
+    std::vector<Instance> instances;
 
     Shape();
-    ~Shape();
-    void InitVertexAttrib();
     virtual void Draw(RenderContext &context);
+    virtual void InitVertexAttrib();
 
-private:
+    Instance currentInstance() const;
 
-    struct struct_data {
-        float point_x;
-        float point_y;
-        float color_r;
-        float color_g;
-        float color_b;
-        float color_a;
-        float tex_x;
-        float tex_y;
-    };
-
-    GLuint m_vboID_texture;
-    GLuint m_vaoID_texture;
-
-    GLuint m_vboID_not_texture;
-    GLuint m_vaoID_not_texture;
+private:
+    bool lookupTexture(RenderContext &context, GLuint &texture, GLuint &sampler);
+    void DrawBatched(RenderContext &context, const Instance &instance);
+    void DrawInstanced(RenderContext &context);
 };
 
 class Text : RenderItem
@@ -132,7 +147,6 @@ public:
     float x_offset;
     float y_offset;
 
-    void InitVertexAttrib();
     void Draw(RenderContext &context);
     MotionVectors();
 };
@@ -152,7 +166,6 @@ public:
     float inner_b;
     float inner_a;
 
-    void InitVertexAttrib();
     void Draw(RenderContext &context);
     Border();
 };
@@ -162,7 +162,7 @@ bool Renderer::textHighlightable(bool highlightable) {
 
 Renderer::Renderer(int width, int height, int gx, int gy, BeatDetect* _beatDetect, std::string _presetURL,
                    std::string _titlefontURL, std::string _menufontURL, const std::string& datadir) :
-	mesh(gx, gy), m_presetName("None"), m_datadir(datadir), vw(width), vh(height),
+	mesh(gx, gy), currentPipe(NULL), pendingPipe(NULL), m_presetName("None"), m_datadir(datadir), vw(width), vh(height),
 	title_fontURL(_titlefontURL), menu_fontURL(_menufontURL), presetURL(_presetURL)
 {
 	this->totalframes = 1;
@@ -212,6 +212,9 @@ Renderer::Renderer(int width, int height, int gx, int gy, BeatDetect* _beatDetec
 	this->beatDetect = _beatDetect;
 
 	textureRenderToTexture = 0;
+	textureBudget = 0;
+	textureUploadBudget = 4 << 20;
+	outputFramebuffer = 0;
 
 	int size = (mesh.height - 1) * mesh.width * 4 * 2;
 	p = static_cast<float *>(wipemalloc(size * sizeof(float)));
@@ -243,6 +246,15 @@ Renderer::Renderer(int width, int height, int gx, int gy, BeatDetect* _beatDetec
 	renderContext.uniform_v2f_c4f_vertex_point_size = shaderEngine.uniform_v2f_c4f_vertex_point_size;
 	renderContext.uniform_v2f_c4f_t2f_vertex_tranformation = shaderEngine.uniform_v2f_c4f_t2f_vertex_tranformation;
 	renderContext.uniform_v2f_c4f_t2f_frag_texture_sampler = shaderEngine.uniform_v2f_c4f_t2f_frag_texture_sampler;
+	renderContext.programID_shape_instanced = shaderEngine.programID_shape_instanced;
+	renderContext.uniform_shape_instanced_vertex_transformation = shaderEngine.uniform_shape_instanced_vertex_transformation;
+	renderContext.uniform_shape_instanced_sides = shaderEngine.uniform_shape_instanced_sides;
+	renderContext.uniform_shape_instanced_aspect = shaderEngine.uniform_shape_instanced_aspect;
+	renderContext.uniform_shape_instanced_line_width = shaderEngine.uniform_shape_instanced_line_width;
+	renderContext.uniform_shape_instanced_textured = shaderEngine.uniform_shape_instanced_textured;
+	renderContext.uniform_shape_instanced_master_alpha = shaderEngine.uniform_shape_instanced_master_alpha;
+	renderContext.uniform_shape_instanced_texture_sampler = shaderEngine.uniform_shape_instanced_texture_sampler;
+	renderContext.batch = &renderBatch;
 
 	// Interpolation VAO/VBO's
 	glGenBuffers(1, &m_vbo_Interpolation);
@@ -324,9 +336,12 @@ Renderer::Renderer(int width, int height, int gx, int gy, BeatDetect* _beatDetec
 
 std::string Renderer::SetPipeline(Pipeline& pipeline)
 {
-	currentPipe = &pipeline;
-	shaderEngine.reset();
-	if (!shaderEngine.loadPresetShaders(pipeline, m_presetName))
+	pendingPipe = &pipeline;
+	bool ok = shaderEngine.loadPresetShaders(pipeline, m_presetName);
+
+	// cached programs are ready right away
+	PresetShadersReady();
+	if (!ok)
 	{
 		return "Shader compilation error";
 	}
@@ -334,6 +349,20 @@ std::string Renderer::SetPipeline(Pipeline& pipeline)
 	return std::string();
 }
 
+bool Renderer::PresetShadersReady()
+{
+	shaderEngine.updatePresetShaders();
+	if (shaderEngine.presetShadersPending())
+		return false;
+
+	if (pendingPipe != NULL)
+	{
+		currentPipe = pendingPipe;
+		pendingPipe = NULL;
+	}
+	return true;
+}
+
 void Renderer::ResetTextures()
 {
 	textureManager->Clear();
@@ -387,6 +416,8 @@ void Renderer::RenderItems(const Pipeline& pipeline, const PipelineContext& pipe
 	if (waveformList.size() >= 1) {
 		RenderTouch(pipeline,pipelineContext);
 	}
+
+	renderBatch.flush(renderContext);
 }
 
 void Renderer::RenderTouch(const Pipeline& pipeline, const PipelineContext& pipelineContext)
@@ -411,6 +442,9 @@ void Renderer::FinishPass1()
 	draw_title_to_texture();
 
 	textureManager->updateMainTexture();
+
+	// pass 2 draws wherever the caller pointed us
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
 }
 
 void Renderer::Pass2(const Pipeline& pipeline, const PipelineContext& pipelineContext)
@@ -429,7 +463,7 @@ void Renderer::Pass2(const Pipeline& pipeline, const PipelineContext& pipelineCo
 	else
 		glViewport(vstartx, vstarty, this->vw, this->vh);
 
-	if (shaderEngine.enableCompositeShader(currentPipe->compositeShader, pipeline, pipelineContext))
+	if (shaderEngine.enableCompositeShader(pipeline, pipelineContext))
 	{
 		CompositeShaderOutput(pipeline, pipelineContext);
 	}
@@ -471,8 +505,61 @@ void Renderer::RenderFrame(const Pipeline& pipeline,
 	Pass2(pipeline, pipelineContext);
 }
 
+void Renderer::setTextureBudget(size_t bytes)
+{
+	textureBudget = bytes;
+	if (textureManager)
+		textureManager->setTextureBudget(bytes);
+}
+
+void Renderer::setTextureUploadBudget(size_t bytes)
+{
+	textureUploadBudget = bytes;
+	if (textureManager)
+		textureManager->setUploadBudget(bytes);
+}
+
+void Renderer::startCapture(const FrameCapture::Callback &callback, int buffers)
+{
+	stopCapture();
+	frameCapture.reset(new FrameCapture(callback, buffers));
+}
+
+void Renderer::stopCapture()
+{
+	if (frameCapture)
+	{
+		frameCapture->flush();
+		frameCapture.reset();
+	}
+}
+
+void Renderer::captureFrame(size_t frame, double time)
+{
+	if (!frameCapture)
+		return;
+
+	GLint previousFramebuffer = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFramebuffer);
+
+	// the same rectangle Pass2() set its viewport to
+	if (textureRenderToTexture)
+		frameCapture->capture(0, 0, texsizeX, texsizeY, frame, time);
+	else
+		frameCapture->capture(vstartx, vstarty, vw, vh, frame, time);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFramebuffer);
+}
+
 void Renderer::RenderFrameOnlyPass1(const Pipeline& pipeline, const PipelineContext& pipelineContext)
 {
+	// pass 1 and the blur passes draw offscreen at texsizeX x texsizeY when the main
+	// framebuffer is available, otherwise into the caller's framebuffer as before
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &outputFramebuffer);
+	textureManager->bindMainTarget();
+	textureManager->nextFrame();
+
 	shaderEngine.RenderBlurTextures(pipeline, pipelineContext);
 
 	SetupPass1(pipeline, pipelineContext);
@@ -569,7 +656,7 @@ void Renderer::Interpolation(const Pipeline& pipeline, const PipelineContext& pi
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-	shaderEngine.enableWarpShader(currentPipe->warpShader, pipeline, pipelineContext, renderContext.mat_ortho);
+	shaderEngine.enableWarpShader(pipeline, pipelineContext, renderContext.mat_ortho);
 
 	glVertexAttrib4f(1, 1.0, 1.0, 1.0, pipeline.screenDecay);
 
@@ -589,6 +676,8 @@ void Renderer::Interpolation(const Pipeline& pipeline, const PipelineContext& pi
 
 Renderer::~Renderer()
 {
+	frameCapture.reset();
+
 	if (textureManager)
 		delete (textureManager);
 
@@ -640,11 +729,19 @@ void Renderer::reset(int w, int h)
 	{
 		delete textureManager;
 	}
-	textureManager = new TextureManager(presetURL, texsizeX, texsizeY, m_datadir);
+	textureManager = new TextureManager(presetURL, texsizeX, texsizeY, m_datadir, textureBudget);
+	textureManager->setUploadBudget(textureUploadBudget);
 
+	// the programs sampled the old texture manager, build them again for the pipeline
+	// that is being switched to, or the current one
 	shaderEngine.setParams(texsizeX, texsizeY, beatDetect, textureManager);
-	shaderEngine.reset();
-	shaderEngine.loadPresetShaders(*currentPipe, m_presetName);
+	if (pendingPipe == NULL)
+		pendingPipe = currentPipe;
+	if (pendingPipe != NULL)
+	{
+		shaderEngine.loadPresetShaders(*pendingPipe, m_presetName);
+		PresetShadersReady();
+	}
 
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -980,7 +1077,7 @@ void Renderer::CompositeOutput(const Pipeline& pipeline, const PipelineContext&
 
 	renderContext.mat_ortho = glm::ortho(-0.5f, 0.5f, -0.5f, 0.5f, -40.0f, 40.0f);
 
-	shaderEngine.enableCompositeShader(currentPipe->compositeShader, pipeline, pipelineContext);
+	shaderEngine.enableCompositeShader(pipeline, pipelineContext);
 
 	glUniformMatrix4fv(shaderEngine.uniform_v2f_c4f_t2f_vertex_tranformation, 1, GL_FALSE,
 	                   value_ptr(renderContext.mat_ortho));
@@ -11,10 +11,13 @@
 #include "Transformation.hpp"
 #include "MilkdropWaveform.hpp"
 #include "ShaderEngine.hpp"
+#include "RenderBatch.hpp"
+#include "FrameCapture.hpp"
 #include <iostream>
 #include <chrono>
 #include <ctime>
 #include <list>
+#include <memory>
 
 using namespace std::chrono;
 
@@ -130,10 +133,26 @@ public:
   void ResetTextures();
   void reset(int w, int h);
   GLuint initRenderToTexture();
+  void setShaderCacheDirectory(const std::string &dir) { shaderEngine.setShaderCacheDirectory(dir); }
+  /// GPU memory preset textures may take in bytes before the least recently used are dropped, 0 for no limit
+  void setTextureBudget(size_t bytes);
+  /// Bytes of decoded preset textures uploaded per frame, 0 for no limit
+  void setTextureUploadBudget(size_t bytes);
+
+  void startCapture(const FrameCapture::Callback &callback, int buffers);
+  void stopCapture();
+  bool isCapturing() const { return frameCapture.get() != nullptr; }
+  /// Queues the readback of the frame pass 2 just drew
+  void captureFrame(size_t frame, double time);
 
   bool timeCheck(const milliseconds currentTime, const milliseconds lastTime, const double difference);
 
+  /// Starts switching to pipeline, it replaces the current one once PresetShadersReady()
   std::string SetPipeline(Pipeline &pipeline);
+  /// Links what SetPipeline() started and switches to the pipeline together with its
+  /// shaders once they are done. Until then, and while it returns false, the previous
+  /// pipeline should keep being rendered.
+  bool PresetShadersReady();
 
   void setPresetName(const std::string& theValue)
   {
@@ -192,6 +211,7 @@ private:
   BeatDetect *beatDetect;
   TextureManager *textureManager;
   Pipeline* currentPipe;
+  Pipeline* pendingPipe;    // set by SetPipeline() until its shaders are linked
   TimeKeeper *timeKeeperFPS;
   TimeKeeper *timeKeeperToast;
 
@@ -206,6 +226,8 @@ private:
   RenderContext renderContext;
   //per pixel equation variables
   ShaderEngine shaderEngine;
+  // the pass 1 drawables append their geometry here, RenderItems() submits it
+  RenderBatch renderBatch;
   std::string m_presetName;
   std::string m_datadir;
   std::string m_fps;
@@ -271,6 +293,12 @@ private:
 int nearestPower2( int value );
 
   GLuint textureRenderToTexture;
+  size_t textureBudget;
+  size_t textureUploadBudget;
+  // framebuffer bound by the caller when the frame started, pass 2 renders into it
+  GLint outputFramebuffer;
+
+  std::unique_ptr<FrameCapture> frameCapture;
 
   void InitCompositeShaderVertex();
   float SquishToCenter(float x, float fExp);
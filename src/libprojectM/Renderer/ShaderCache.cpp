@@ -0,0 +1,247 @@
+//
+//  ShaderCache.cpp
+//  libprojectM
+//
+
+#include "ShaderCache.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool readFile(const std::string &path, std::vector<char> &contents)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    bool ok = size >= 0;
+    if (ok)
+    {
+        contents.resize(size);
+        ok = size == 0 || fread(contents.data(), size, 1, f) == 1;
+    }
+    fclose(f);
+    return ok;
+}
+
+// write next to the destination and rename, so concurrent readers never see half a file.
+// The temporary name is unique to this process and call, writers of the same key don't share it.
+bool writeFile(const std::string &path, const void *header, size_t headerSize, const void *data, size_t size)
+{
+    static std::atomic<unsigned> writes(0);
+    std::string temp = path + "." + std::to_string((long)getpid()) + "-" + std::to_string(writes++) + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (f == nullptr)
+        return false;
+    bool ok = (headerSize == 0 || fwrite(header, headerSize, 1, f) == 1) &&
+              (size == 0 || fwrite(data, size, 1, f) == 1);
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+    {
+#ifdef WIN32
+        remove(path.c_str());
+#endif
+        ok = rename(temp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+        remove(temp.c_str());
+    return ok;
+}
+
+struct BinaryHeader
+{
+    uint32_t magic;
+    uint32_t format;
+};
+
+const uint32_t kBinaryMagic = 0x42534d50;   // "PMSB"
+
+}
+
+
+ShaderCache::ShaderCache(size_t capacity) : _capacity(capacity < 2 ? 2 : capacity), _binaryFormats(-1) {}
+
+ShaderCache::~ShaderCache()
+{
+    clear();
+}
+
+void ShaderCache::setDirectory(const std::string &dir)
+{
+    _directory = dir;
+    if (_directory.empty())
+        return;
+#ifdef WIN32
+    _mkdir(_directory.c_str());
+#else
+    mkdir(_directory.c_str(), 0755);
+#endif
+    if (_directory[_directory.size() - 1] != '/')
+        _directory += '/';
+}
+
+std::string ShaderCache::key(const std::string &source)
+{
+    // 64 bit FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        hash ^= (unsigned char)source[i];
+        hash *= 1099511628211ULL;
+    }
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    return hex;
+}
+
+GLuint ShaderCache::find(const std::string &key)
+{
+    std::map<std::string, LruList::iterator>::iterator iter = _programs.find(key);
+    if (iter == _programs.end())
+        return 0;
+    _lru.splice(_lru.begin(), _lru, iter->second);
+    return iter->second->second;
+}
+
+void ShaderCache::insert(const std::string &key, GLuint program)
+{
+    std::map<std::string, LruList::iterator>::iterator iter = _programs.find(key);
+    if (iter != _programs.end())
+    {
+        if (iter->second->second != program)
+            glDeleteProgram(iter->second->second);
+        iter->second->second = program;
+        _lru.splice(_lru.begin(), _lru, iter->second);
+        return;
+    }
+
+    _lru.push_front(std::make_pair(key, program));
+    _programs[key] = _lru.begin();
+    while (_lru.size() > _capacity)
+    {
+        glDeleteProgram(_lru.back().second);
+        _programs.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+}
+
+void ShaderCache::clear()
+{
+    for (LruList::iterator iter = _lru.begin(); iter != _lru.end(); ++iter)
+        glDeleteProgram(iter->second);
+    _lru.clear();
+    _programs.clear();
+}
+
+bool ShaderCache::loadGlsl(const std::string &key, std::string &glsl) const
+{
+    if (_directory.empty())
+        return false;
+    std::vector<char> contents;
+    if (!readFile(_directory + key + ".glsl", contents) || contents.empty())
+        return false;
+    glsl.assign(contents.begin(), contents.end());
+    return true;
+}
+
+void ShaderCache::storeGlsl(const std::string &key, const std::string &glsl) const
+{
+    if (_directory.empty())
+        return;
+    if (!writeFile(_directory + key + ".glsl", nullptr, 0, glsl.data(), glsl.size()))
+        std::cerr << "[ShaderCache] cannot write to " << _directory << std::endl;
+}
+
+bool ShaderCache::binarySupported()
+{
+    if (_binaryFormats < 0)
+    {
+        // GL 4.1, ES 3.0 or GL_ARB_get_program_binary. Older contexts flag GL_INVALID_ENUM
+        // and leave the count at zero, so clear that error again.
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        while (glGetError() != GL_NO_ERROR) {}
+        _binaryFormats = formats;
+
+        std::string driver;
+        const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for (GLenum name : names)
+        {
+            const GLubyte *value = glGetString(name);
+            if (value)
+                driver += (const char *)value;
+            driver += '\n';
+        }
+        _driver = key(driver);
+    }
+    return _binaryFormats > 0;
+}
+
+std::string ShaderCache::binaryPath(const std::string &key) const
+{
+    return _directory + key + "-" + _driver + ".bin";
+}
+
+GLuint ShaderCache::loadBinary(const std::string &key)
+{
+    if (_directory.empty() || !binarySupported())
+        return 0;
+
+    std::vector<char> contents;
+    if (!readFile(binaryPath(key), contents) || contents.size() <= sizeof(BinaryHeader))
+        return 0;
+    BinaryHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    if (header.magic != kBinaryMagic)
+        return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, contents.data() + sizeof(header), contents.size() - sizeof(header));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE)
+    {
+        // driver updates invalidate binaries, the caller recompiles and stores a new one
+        glDeleteProgram(program);
+        while (glGetError() != GL_NO_ERROR) {}
+        return 0;
+    }
+    return program;
+}
+
+void ShaderCache::storeBinary(const std::string &key, GLuint program)
+{
+    if (_directory.empty() || !binarySupported())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return;
+
+    BinaryHeader header = {kBinaryMagic, format};
+    writeFile(binaryPath(key), &header, sizeof(header), binary.data(), written);
+}
@@ -0,0 +1,66 @@
+//
+//  ShaderCache.hpp
+//  libprojectM
+//
+//  Linked preset shader programs, keyed by a hash of everything that goes into
+//  the translated GLSL. Recent programs stay linked in memory (LRU bounded),
+//  and with a cache directory the translated GLSL and, where the driver exposes
+//  program binaries, the linked binary are kept on disk between runs:
+//
+//    <key>.glsl                  translated fragment shader
+//    <key>-<driver>.bin          glGetProgramBinary() output for one driver/renderer
+//
+//  projectM-shadercache fills a directory with the .glsl files of a whole preset
+//  tree ahead of time.
+//
+
+#ifndef ShaderCache_hpp
+#define ShaderCache_hpp
+
+#include <list>
+#include <map>
+#include <string>
+#include "projectM-opengl.h"
+
+class ShaderCache
+{
+public:
+    explicit ShaderCache(size_t capacity = 32);
+    ~ShaderCache();
+
+    /// Enables the disk cache in dir (created if missing), empty disables it
+    void setDirectory(const std::string &dir);
+    const std::string &directory() const { return _directory; }
+
+    /// Hex digest used as the cache key
+    static std::string key(const std::string &source);
+
+    /// Linked program for key, or 0. The cache owns the program, do not delete it.
+    GLuint find(const std::string &key);
+    /// Takes ownership of program, evicting (and deleting) the least recently used one when full
+    void insert(const std::string &key, GLuint program);
+    void clear();
+
+    bool loadGlsl(const std::string &key, std::string &glsl) const;
+    void storeGlsl(const std::string &key, const std::string &glsl) const;
+
+    /// Relinks a stored program binary, returns 0 if there is none or the driver rejects it
+    GLuint loadBinary(const std::string &key);
+    void storeBinary(const std::string &key, GLuint program);
+
+private:
+    typedef std::list<std::pair<std::string, GLuint> > LruList;
+
+    size_t _capacity;
+    LruList _lru;   // most recently used first
+    std::map<std::string, LruList::iterator> _programs;
+
+    std::string _directory;
+    std::string _driver;    // digest of GL_VENDOR/GL_RENDERER/GL_VERSION, empty until queried
+    int _binaryFormats;     // -1 until queried
+
+    bool binarySupported();
+    std::string binaryPath(const std::string &key) const;
+};
+
+#endif /* ShaderCache_hpp */
@@ -6,21 +6,62 @@
  */
 #include <fstream>
 #include <algorithm>
+#include <cstring>
 #include "ShaderEngine.hpp"
 #include "BeatDetect.hpp"
 #include "Texture.hpp"
-#include "HLSLParser.h"
 #include "GLSLGenerator.h"
 #include "StaticGlShaders.h"
 #include <glm/mat4x4.hpp> // glm::mat4
 #include <glm/gtc/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale, glm::perspective
 #include <glm/gtc/type_ptr.hpp>
-#include <set>
-#include <regex>
 
 #define FRAND ((rand() % 7381)/7380.0f)
 
-ShaderEngine::ShaderEngine() : presetCompShaderLoaded(false), presetWarpShaderLoaded(false)
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+
+// MilkDrop's blur weights, folded into pairs so each bilinear fetch reads two texels
+struct BlurKernel
+{
+    float c1[4];    // pass 1: w1..w4
+    float c2[4];    // pass 1: d1..d4
+    float w_div1;
+    float c5[4];    // pass 2: w1,w2,d1,d2
+    float w_div2;
+
+    BlurKernel()
+    {
+        const float w[8] = { 4.0f, 3.8f, 3.5f, 2.9f, 1.9f, 1.2f, 0.7f, 0.3f };  //<- user can specify these
+
+        // pass 1 (long horizontal pass)
+        c1[0] = w[0] + w[1];
+        c1[1] = w[2] + w[3];
+        c1[2] = w[4] + w[5];
+        c1[3] = w[6] + w[7];
+        c2[0] = 0 + 2*w[1]/c1[0];
+        c2[1] = 2 + 2*w[3]/c1[1];
+        c2[2] = 4 + 2*w[5]/c1[2];
+        c2[3] = 6 + 2*w[7]/c1[3];
+        w_div1 = 0.5f/(c1[0]+c1[1]+c1[2]+c1[3]);
+
+        // pass 2 (short vertical pass)
+        c5[0] = w[0]+w[1] + w[2]+w[3];
+        c5[1] = w[4]+w[5] + w[6]+w[7];
+        c5[2] = 0 + 2*((w[2]+w[3])/c5[0]);
+        c5[3] = 2 + 2*((w[6]+w[7])/c5[1]);
+        w_div2 = 1.0f/((c5[0]+c5[1])*2);
+    }
+};
+
+const BlurKernel kBlurKernel;
+
+}
+
+ShaderEngine::ShaderEngine() : beatDetect(nullptr), textureManager(nullptr), presetShadersStaged(false), parallelCompile(false), uboFrame(-1), uboPipeline(nullptr), translator(shaderCache)
 {
     std::shared_ptr<StaticGlShaders> static_gl_shaders = StaticGlShaders::Get();
 
@@ -31,6 +72,13 @@ ShaderEngine::ShaderEngine() : presetCompShaderLoaded(false), presetWarpShaderLo
         static_gl_shaders->GetV2fC4fT2fVertexShader(),
         static_gl_shaders->GetV2fC4fT2fFragmentShader(), "v2f_c4f_t2f");
 
+    programID_shape_instanced = 0;
+    std::string shapeInstancedVertexShader = static_gl_shaders->GetShapeInstancedVertexShader();
+    if (!shapeInstancedVertexShader.empty())
+        programID_shape_instanced = CompileShaderProgram(
+            shapeInstancedVertexShader,
+            static_gl_shaders->GetShapeInstancedFragmentShader(), "shape_instanced");
+
     programID_blur1 = CompileShaderProgram(
         static_gl_shaders->GetBlurVertexShader(),
         static_gl_shaders->GetBlur1FragmentShader(), "blur1");
@@ -43,6 +91,20 @@ ShaderEngine::ShaderEngine() : presetCompShaderLoaded(false), presetWarpShaderLo
     uniform_v2f_c4f_t2f_vertex_tranformation = glGetUniformLocation(programID_v2f_c4f_t2f, "vertex_transformation");
     uniform_v2f_c4f_t2f_frag_texture_sampler = glGetUniformLocation(programID_v2f_c4f_t2f, "texture_sampler");
 
+    uniform_shape_instanced_vertex_transformation = uniform_shape_instanced_sides = uniform_shape_instanced_aspect = -1;
+    uniform_shape_instanced_line_width = uniform_shape_instanced_textured = -1;
+    uniform_shape_instanced_master_alpha = uniform_shape_instanced_texture_sampler = -1;
+    if (programID_shape_instanced != 0)
+    {
+        uniform_shape_instanced_vertex_transformation = glGetUniformLocation(programID_shape_instanced, "vertex_transformation");
+        uniform_shape_instanced_sides = glGetUniformLocation(programID_shape_instanced, "sides");
+        uniform_shape_instanced_aspect = glGetUniformLocation(programID_shape_instanced, "aspect");
+        uniform_shape_instanced_line_width = glGetUniformLocation(programID_shape_instanced, "line_width");
+        uniform_shape_instanced_textured = glGetUniformLocation(programID_shape_instanced, "textured");
+        uniform_shape_instanced_master_alpha = glGetUniformLocation(programID_shape_instanced, "master_alpha");
+        uniform_shape_instanced_texture_sampler = glGetUniformLocation(programID_shape_instanced, "texture_sampler");
+    }
+
     uniform_blur1_sampler = glGetUniformLocation(programID_blur1, "texture_sampler");
     uniform_blur1_c0 = glGetUniformLocation(programID_blur1, "_c0");
     uniform_blur1_c1 = glGetUniformLocation(programID_blur1, "_c1");
@@ -54,6 +116,14 @@ ShaderEngine::ShaderEngine() : presetCompShaderLoaded(false), presetWarpShaderLo
     uniform_blur2_c5 = glGetUniformLocation(programID_blur2, "_c5");
     uniform_blur2_c6 = glGetUniformLocation(programID_blur2, "_c6");
 
+    // the blur kernels never change, only the per pass constants are set while rendering
+    glUseProgram(programID_blur1);
+    glUniform4fv(uniform_blur1_c1, 1, kBlurKernel.c1);
+    glUniform4fv(uniform_blur1_c2, 1, kBlurKernel.c2);
+    glUseProgram(programID_blur2);
+    glUniform4fv(uniform_blur2_c5, 1, kBlurKernel.c5);
+    glUseProgram(0);
+
     // Initialize Blur vao/vbo
     float pointsBlur[16] = {
         -1.0, -1.0,     0.0,    1.0,
@@ -77,18 +147,33 @@ ShaderEngine::ShaderEngine() : presetCompShaderLoaded(false), presetWarpShaderLo
 
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &uboPresetConstants);
+    glBindBuffer(GL_UNIFORM_BUFFER, uboPresetConstants);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(PresetConstants), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions && !parallelCompile; i++) {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        parallelCompile = name && (!strcmp(name, "GL_KHR_parallel_shader_compile") ||
+                                   !strcmp(name, "GL_ARB_parallel_shader_compile"));
+    }
 }
 
 ShaderEngine::~ShaderEngine()
 {
     glDeleteProgram(programID_v2f_c4f);
     glDeleteProgram(programID_v2f_c4f_t2f);
+    glDeleteProgram(programID_shape_instanced);
 
     glDeleteProgram(programID_blur1);
     glDeleteProgram(programID_blur2);
 
     glDeleteBuffers(1, &vboBlur);
     glDeleteVertexArrays(1, &vaoBlur);
+    glDeleteBuffers(1, &uboPresetConstants);
 
     disablePresetShaders();
 }
@@ -114,6 +199,10 @@ void ShaderEngine::setParams(const int _texsizeX, const int _texsizeY, BeatDetec
         TextureManager *_textureManager)
 {
     this->beatDetect = _beatDetect;
+
+    // the preset programs, and the ones on their way, sample the old manager's textures
+    if (_textureManager != textureManager)
+        disablePresetShaders();
     this->textureManager = _textureManager;
 
     aspectX = 1;
@@ -128,52 +217,12 @@ void ShaderEngine::setParams(const int _texsizeX, const int _texsizeY, BeatDetec
 }
 
 
-// compile a user-defined shader from a preset. returns program ID if successful.
-GLuint ShaderEngine::compilePresetShader(const PresentShaderType shaderType, Shader &pmShader, const std::string &shaderFilename) {
-    std::string program = pmShader.programSource;
-
-    if (program.length() <= 0)
-        return GL_FALSE;
-
-    // replace "}" with return statement (this can probably be optimized for the GLSL conversion...)
-    size_t found = program.rfind('}');
-    if (found != std::string::npos)
-    {
-        //std::cout << "last '}' found at: " << int(found) << std::endl;
-        program.replace(int(found), 1, "_return_value = float4(ret.xyz, 1.0);\n"
-                                       "}\n");
-    }
-    else
-        return GL_FALSE;
-
-    // replace shader_body with entry point function
-    found = program.find("shader_body");
-    if (found != std::string::npos)
-    {
-        //std::cout << "first 'shader_body' found at: " << int(found) << std::endl;
-        if (shaderType == PresentWarpShader) {
-            program.replace(int(found), 11, "void PS(float4 _vDiffuse : COLOR, float4 _uv : TEXCOORD0, float2 _rad_ang : TEXCOORD1, out float4 _return_value : COLOR)\n");
-
-        } else {
-            program.replace(int(found), 11, "void PS(float4 _vDiffuse : COLOR, float2 _uv : TEXCOORD0, float2 _rad_ang : TEXCOORD1, out float4 _return_value : COLOR)\n");
-
-        }
-    }
-    else
-        return GL_FALSE;
-
-    // replace "{" with some variable declarations
-    found = program.find('{',found);
-    if (found != std::string::npos)
-    {
-        //std::cout << "first '{' found at: " << int(found) << std::endl;
-        const char *progMain = \
-        "{\n"
-        "float3 ret = 0;\n";
-        program.replace(int(found), 1, progMain);
-    }
-    else
-        return GL_FALSE;
+// bind the samplers of a user-defined shader from a preset and build its complete
+// HLSL source. the texture lookups need GL, so this stays on the render thread.
+bool ShaderEngine::preparePresetShader(const PresentShaderType shaderType, Shader &pmShader, std::string &fullSource) {
+    std::string program;
+    if (!ShaderTranslator::presetProgram(shaderType == PresentWarpShader, pmShader.programSource, program))
+        return false;
 
     pmShader.textures.clear();
 
@@ -195,237 +244,121 @@ GLuint ShaderEngine::compilePresetShader(const PresentShaderType shaderType, Sha
 
 
     // set up texture samplers for all samplers references in the shader program
-    found = 0;
-    found = program.find("sampler_", found);
-    while (found != std::string::npos)
+    std::vector<std::string> samplers = ShaderTranslator::samplerNames(program);
+    for (std::vector<std::string>::const_iterator iter_names = samplers.begin(); iter_names != samplers.end(); ++iter_names)
     {
-        found += 8;
-        size_t end = program.find_first_of(" ;,\n\r)", found);
-
-        if (end != std::string::npos)
-        {
-            std::string sampler = program.substr((int) found, (int) end - found);
-            std::string lowerCaseName(sampler);
-            std::transform(lowerCaseName.begin(), lowerCaseName.end(), lowerCaseName.begin(), tolower);
+        const std::string &sampler = *iter_names;
 
-            TextureSamplerDesc texDesc = textureManager->getTexture(sampler, GL_REPEAT, GL_LINEAR);
-
-            if (texDesc.first == NULL)
-            {
-                if (lowerCaseName.substr(0, 4) == "rand" || lowerCaseName.substr(2, 5) == "_rand")
-                {
-                    texDesc = textureManager->getRandomTextureName(sampler);
-                }
-                else
-                {
-                    texDesc = textureManager->tryLoadingTexture(sampler);
-                }
-            }
+        TextureSamplerDesc texDesc = textureManager->getTexture(sampler, GL_REPEAT, GL_LINEAR);
 
-            if (texDesc.first == NULL)
+        if (texDesc.first == NULL)
+        {
+            if (ShaderTranslator::presetTexture(sampler).source == ShaderTranslator::TextureReference::Random)
             {
-                std::cerr << "Texture loading error for: " << sampler << std::endl;
+                texDesc = textureManager->getRandomTextureName(sampler);
             }
             else
             {
-                std::map<std::string, TextureSamplerDesc>::const_iterator iter = pmShader.textures.cbegin();
-                for ( ; iter != pmShader.textures.cend(); ++iter)
-                {
-                    if (iter->first == sampler)
-                        break;
-                }
-
-                if (iter == pmShader.textures.cend())
-                    pmShader.textures[sampler] = texDesc;
+                texDesc = textureManager->tryLoadingTexture(sampler);
             }
         }
 
-        found = program.find("sampler_", found);
-    }
-
-    textureManager->clearRandomTextures();
-
-    found = program.find("GetBlur3");
-    if (found != std::string::npos)
-    {
-        blur1_enabled = blur2_enabled = blur3_enabled = true;
-        pmShader.textures["blur3"] = textureManager->getTexture("blur3", GL_CLAMP_TO_EDGE, GL_LINEAR);
-        pmShader.textures["blur2"] = textureManager->getTexture("blur2", GL_CLAMP_TO_EDGE, GL_LINEAR);
-        pmShader.textures["blur1"] = textureManager->getTexture("blur1", GL_CLAMP_TO_EDGE, GL_LINEAR);
-    }
-    else
-    {
-        found = program.find("GetBlur2");
-        if (found != std::string::npos)
+        if (texDesc.first == NULL)
         {
-            blur1_enabled = blur2_enabled = true;
-            pmShader.textures["blur2"] = textureManager->getTexture("blur2", GL_CLAMP_TO_EDGE, GL_LINEAR);
-            pmShader.textures["blur1"] = textureManager->getTexture("blur1", GL_CLAMP_TO_EDGE, GL_LINEAR);
+            std::cerr << "Texture loading error for: " << sampler << std::endl;
         }
         else
         {
-            found = program.find("GetBlur1");
-            if (found != std::string::npos)
+            std::map<std::string, TextureSamplerDesc>::const_iterator iter = pmShader.textures.cbegin();
+            for ( ; iter != pmShader.textures.cend(); ++iter)
             {
-                blur1_enabled = true;
-                pmShader.textures["blur1"] = textureManager->getTexture("blur1", GL_CLAMP_TO_EDGE, GL_LINEAR);
+                if (iter->first == sampler)
+                    break;
             }
+
+            if (iter == pmShader.textures.cend())
+                pmShader.textures[sampler] = texDesc;
         }
     }
 
-    std::string fullSource;
-
-    // prepend our HLSL template to the actual program source
-    fullSource.append(StaticGlShaders::Get()->GetPresetShaderHeader());
+    textureManager->clearRandomTextures();
 
-    if (shaderType == PresentWarpShader) {
-        fullSource.append(  "#define rad _rad_ang.x\n"
-                            "#define ang _rad_ang.y\n"
-                            "#define uv _uv.xy\n"
-                            "#define uv_orig _uv.zw\n");
-    } else {
-        fullSource.append(  "#define rad _rad_ang.x\n"
-                            "#define ang _rad_ang.y\n"
-                            "#define uv _uv.xy\n"
-                            "#define uv_orig _uv.xy\n"
-                            "#define hue_shader _vDiffuse.xyz\n");
-    }
+    int blurLevel = ShaderTranslator::blurLevel(program);
+    if (blurLevel >= 3)
+        pmShader.textures["blur3"] = textureManager->getTexture("blur3", GL_CLAMP_TO_EDGE, GL_LINEAR);
+    if (blurLevel >= 2)
+        pmShader.textures["blur2"] = textureManager->getTexture("blur2", GL_CLAMP_TO_EDGE, GL_LINEAR);
+    if (blurLevel >= 1)
+        pmShader.textures["blur1"] = textureManager->getTexture("blur1", GL_CLAMP_TO_EDGE, GL_LINEAR);
 
+    fullSource = ShaderTranslator::presetSource(shaderType == PresentWarpShader,
+                                                StaticGlShaders::Get()->GetPresetShaderHeader(), program);
+    return true;
+}
 
-    fullSource.append(program);
 
-    std::string shaderTypeString;
-    switch(shaderType) {
-    case PresentWarpShader: shaderTypeString = "Warp"; break;
-    case PresentCompositeShader: shaderTypeString = "Comp"; break;
-    case PresentBlur1Shader: shaderTypeString = "Blur1"; break;
-    case PresentBlur2Shader: shaderTypeString = "Blur2"; break;
-    default:    shaderTypeString = "Other";
-    }
+namespace {
 
-    M4::GLSLGenerator generator;
-    M4::Allocator allocator;
+const char *kRotationNames[24] = {
+    "rot_s1", "rot_s2", "rot_s3", "rot_s4",
+    "rot_d1", "rot_d2", "rot_d3", "rot_d4",
+    "rot_f1", "rot_f2", "rot_f3", "rot_f4",
+    "rot_vf1", "rot_vf2", "rot_vf3", "rot_vf4",
+    "rot_uf1", "rot_uf2", "rot_uf3", "rot_uf4",
+    "rot_rand1", "rot_rand2", "rot_rand3", "rot_rand4"
+};
 
-    M4::HLSLTree tree( &allocator );
-    M4::HLSLParser parser(&allocator, &tree);
+// binding point of the PresetConstants block
+const GLuint kPresetConstantsBinding = 0;
 
-    // preprocess define macros
-    std::string sourcePreprocessed;
-    if (!parser.ApplyPreprocessor(shaderFilename.c_str(), fullSource.c_str(), fullSource.size(), sourcePreprocessed)) {
-        std::cerr << "Failed to preprocess HLSL(step1) " << shaderTypeString << " shader" << std::endl;
+inline void set4(float *v, float x, float y, float z, float w)
+{
+    v[0] = x; v[1] = y; v[2] = z; v[3] = w;
+}
 
-#if !DUMP_SHADERS_ON_ERROR
-        std::cerr << "Source: " << std::endl << fullSource << std::endl;
-#else
-        std::ofstream out("/tmp/shader_" + shaderTypeString + "_step1.txt");
-            out << fullSource;
-            out.close();
-#endif
-            return GL_FALSE;
-    }
+}
 
-    // Remove previous shader declarations
-    std::smatch matches;
-    while(std::regex_search(sourcePreprocessed, matches, std::regex("sampler(2D|3D|)(\\s+|\\().*"))) {
-        sourcePreprocessed.replace(matches.position(), matches.length(), "");
-    }
 
-    // Remove previous texsize declarations
-    while(std::regex_search(sourcePreprocessed, matches, std::regex("float4\\s+texsize_.*"))) {
-        sourcePreprocessed.replace(matches.position(), matches.length(), "");
+void ShaderEngine::resolvePresetUniforms(GLuint program, const std::map<std::string, TextureSamplerDesc> &textures, PresetUniforms &uniforms)
+{
+    uniforms.rand_frame = glGetUniformLocation(program, "rand_frame");
+    uniforms.rand_preset = glGetUniformLocation(program, "rand_preset");
+    for (int i=0; i < 14; i++)
+        uniforms.c[i] = glGetUniformLocation(program, ("_c" + std::to_string(i)).c_str());
+    for (int i=0; i < 8; i++) {
+        std::string varName = "_q";
+        varName.push_back('a' + i);
+        uniforms.q[i] = glGetUniformLocation(program, varName.c_str());
     }
-
-    // Declare samplers
-    std::set<std::string> texsizes;
-    std::map<std::string, TextureSamplerDesc>::const_iterator iter_samplers = pmShader.textures.cbegin();
-    for ( ; iter_samplers != pmShader.textures.cend(); ++iter_samplers)
-    {
-        Texture * texture = iter_samplers->second.first;
-
-        if (texture->type == GL_TEXTURE_3D) {
-            sourcePreprocessed.insert(0, "uniform sampler3D sampler_" + iter_samplers->first + ";\n");
-        } else {
-            sourcePreprocessed.insert(0, "uniform sampler2D sampler_" + iter_samplers->first + ";\n");
-        }
-
-        texsizes.insert(iter_samplers->first);
-        texsizes.insert(texture->name);
+    for (int i=0; i < 24; i++)
+        uniforms.rot[i] = glGetUniformLocation(program, kRotationNames[i]);
+    uniforms.vertex_transformation = glGetUniformLocation(program, "vertex_transformation");
+
+    uniforms.block = glGetUniformBlockIndex(program, "PresetConstants");
+    if (uniforms.block != GL_INVALID_INDEX) {
+        GLint size = 0;
+        glGetActiveUniformBlockiv(program, uniforms.block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        if (size != (GLint)sizeof(PresetConstants))
+            std::cerr << "PresetConstants block is " << size << " bytes, expected " << sizeof(PresetConstants) << std::endl;
+        glUniformBlockBinding(program, uniforms.block, kPresetConstantsBinding);
     }
 
-    // Declare texsizes
-    std::set<std::string>::const_iterator iter_texsizes = texsizes.cbegin();
-    for ( ; iter_texsizes != texsizes.cend(); ++iter_texsizes)
+    // samplers and texsizes unused by the program come back as -1 and are skipped
+    uniforms.samplers.clear();
+    uniforms.texsizes.clear();
+    for (std::map<std::string, TextureSamplerDesc>::const_iterator iter_samplers = textures.begin(); iter_samplers
+                    != textures.end(); ++iter_samplers)
     {
-        sourcePreprocessed.insert(0, "uniform float4 texsize_" + *iter_texsizes + ";\n");
-    }
-
-
-    // transpile from HLSL (aka preset shader aka directX shader) to GLSL (aka OpenGL shader lang)
-
-    // parse
-    if( !parser.Parse(shaderFilename.c_str(), sourcePreprocessed.c_str(), sourcePreprocessed.size()) ) {
-        std::cerr << "Failed to parse HLSL(step2) " << shaderTypeString << " shader" << std::endl;
-
-#if !DUMP_SHADERS_ON_ERROR
-        std::cerr << "Source: " << std::endl << sourcePreprocessed << std::endl;
-#else
-        std::ofstream out2("/tmp/shader_" + shaderTypeString + "_step2.txt");
-            out2 << sourcePreprocessed;
-            out2.close();
-#endif
-            return GL_FALSE;
-    }
-
-    // generate GLSL
-    if (!generator.Generate(&tree, M4::GLSLGenerator::Target_FragmentShader,
-                            StaticGlShaders::Get()->GetGlslGeneratorVersion(),
-                            "PS")) {
-        std::cerr << "Failed to transpile HLSL(step3) " << shaderTypeString << " shader to GLSL" << std::endl;
-#if !DUMP_SHADERS_ON_ERROR
-        std::cerr << "Source: " << std::endl << sourcePreprocessed << std::endl;
-#else
-        std::ofstream out2("/tmp/shader_" + shaderTypeString + "_step2.txt");
-            out2 << sourcePreprocessed;
-            out2.close();
-#endif
-        return GL_FALSE;
-    }
-
-    // now we have GLSL source for the preset shader program (hopefully it's
-    // valid!) copmile the preset shader fragment shader with the standard
-    // vertex shader and cross our fingers
-    GLuint ret = 0;
-    if (shaderType == PresentWarpShader) {
-        ret = CompileShaderProgram(
-            StaticGlShaders::Get()->GetPresetWarpVertexShader(),
-            generator.GetResult(), shaderTypeString);
-    } else {
-        ret = CompileShaderProgram(
-            StaticGlShaders::Get()->GetPresetCompVertexShader(),
-            generator.GetResult(), shaderTypeString);
+        const std::string &texName = iter_samplers->first;
+        const Texture * texture = iter_samplers->second.first;
+        uniforms.samplers[texName] = glGetUniformLocation(program, ("sampler_" + texName).c_str());
+        uniforms.texsizes[texName] = glGetUniformLocation(program, ("texsize_" + texName).c_str());
+        uniforms.texsizes[texture->name] = glGetUniformLocation(program, ("texsize_" + texture->name).c_str());
     }
-
-    if (ret != GL_FALSE) {
-#ifdef DEBUG
-        std::cerr << "Successful compilation of " << shaderTypeString << std::endl;
-#endif
-    } else {
-        std::cerr << "Compilation error (step3) of " << shaderTypeString << std::endl;
-
-#if !DUMP_SHADERS_ON_ERROR
-        std::cerr << "Source:" << std::endl << generator.GetResult() << std::endl;
-#else
-        std::ofstream out3("/tmp/shader_" + shaderTypeString + "_step3.txt");
-            out3 << generator.GetResult();
-            out3.close();
-#endif
-    }
-
-    return ret;
 }
 
 
-void ShaderEngine::SetupShaderVariables(GLuint program, const Pipeline &pipeline, const PipelineContext &context)
+void ShaderEngine::computePresetConstants(PresetConstants &constants, const Pipeline &pipeline, const PipelineContext &context)
 {
     // pass info from projectM to the shader uniforms
     // these are the inputs: http://www.geisswerks.com/milkdrop/milkdrop_preset_authoring.html#3f6
@@ -436,41 +369,44 @@ void ShaderEngine::SetupShaderVariables(GLuint program, const Pipeline &pipeline
     float mip_y = logf((float)texsizeX)/logf(2.0f);
     float mip_avg = 0.5f*(mip_x + mip_y);
 
-    glUniform4f(glGetUniformLocation(program, "rand_frame"), (rand() % 100) * .01, (rand() % 100) * .01, (rand()% 100) * .01, (rand() % 100) * .01);
-    glUniform4f(glGetUniformLocation(program, "rand_preset"), rand_preset[0], rand_preset[1], rand_preset[2], rand_preset[3]);
-
-    glUniform4f(glGetUniformLocation(program, "_c0"), aspectX, aspectY, 1 / aspectX, 1 / aspectY);
-    glUniform4f(glGetUniformLocation(program, "_c1"), 0.0, 0.0, 0.0, 0.0);
-    glUniform4f(glGetUniformLocation(program, "_c2"), time_since_preset_start_wrapped, context.fps,  context.frame, context.progress);
-    glUniform4f(glGetUniformLocation(program, "_c3"), beatDetect->bass/100, beatDetect->mid/100, beatDetect->treb/100, beatDetect->vol/100);
-    glUniform4f(glGetUniformLocation(program, "_c4"), beatDetect->bass_att/100, beatDetect->mid_att/100, beatDetect->treb_att/100, beatDetect->vol_att/100);
-    glUniform4f(glGetUniformLocation(program, "_c5"), pipeline.blur1x-pipeline.blur1n, pipeline.blur1n, pipeline.blur2x-pipeline.blur2n, pipeline.blur2n);
-    glUniform4f(glGetUniformLocation(program, "_c6"), pipeline.blur3x-pipeline.blur3n, pipeline.blur3n, pipeline.blur1n, pipeline.blur1x);
-    glUniform4f(glGetUniformLocation(program, "_c7"), texsizeX, texsizeY, 1 / (float) texsizeX, 1 / (float) texsizeY);
-
-    glUniform4f(glGetUniformLocation(program, "_c8"), 0.5f+0.5f*cosf(context.time* 0.329f+1.2f),
-                                                                      0.5f+0.5f*cosf(context.time* 1.293f+3.9f),
-                                                                      0.5f+0.5f*cosf(context.time* 5.070f+2.5f),
-                                                                      0.5f+0.5f*cosf(context.time*20.051f+5.4f));
-
-    glUniform4f(glGetUniformLocation(program, "_c9"), 0.5f+0.5f*sinf(context.time* 0.329f+1.2f),
-                                                                      0.5f+0.5f*sinf(context.time* 1.293f+3.9f),
-                                                                      0.5f+0.5f*sinf(context.time* 5.070f+2.5f),
-                                                                      0.5f+0.5f*sinf(context.time*20.051f+5.4f));
-
-    glUniform4f(glGetUniformLocation(program, "_c10"),  0.5f+0.5f*cosf(context.time*0.0050f+2.7f),
-                                                                        0.5f+0.5f*cosf(context.time*0.0085f+5.3f),
-                                                                        0.5f+0.5f*cosf(context.time*0.0133f+4.5f),
-                                                                        0.5f+0.5f*cosf(context.time*0.0217f+3.8f));
-
-    glUniform4f(glGetUniformLocation(program, "_c11"),  0.5f+0.5f*sinf(context.time*0.0050f+2.7f),
-                                                                        0.5f+0.5f*sinf(context.time*0.0085f+5.3f),
-                                                                        0.5f+0.5f*sinf(context.time*0.0133f+4.5f),
-                                                                        0.5f+0.5f*sinf(context.time*0.0217f+3.8f));
-
-    glUniform4f(glGetUniformLocation(program, "_c12"), mip_x, mip_y, mip_avg, 0 );
-    glUniform4f(glGetUniformLocation(program, "_c13"), pipeline.blur2n, pipeline.blur2x, pipeline.blur3n, pipeline.blur3x);
-
+    set4(constants.rand_frame, (rand() % 100) * .01, (rand() % 100) * .01, (rand()% 100) * .01, (rand() % 100) * .01);
+    set4(constants.rand_preset, rand_preset[0], rand_preset[1], rand_preset[2], rand_preset[3]);
+
+    set4(constants.c[0], aspectX, aspectY, 1 / aspectX, 1 / aspectY);
+    set4(constants.c[1], 0.0, 0.0, 0.0, 0.0);
+    set4(constants.c[2], time_since_preset_start_wrapped, context.fps,  context.frame, context.progress);
+    set4(constants.c[3], beatDetect->bass/100, beatDetect->mid/100, beatDetect->treb/100, beatDetect->vol/100);
+    set4(constants.c[4], beatDetect->bass_att/100, beatDetect->mid_att/100, beatDetect->treb_att/100, beatDetect->vol_att/100);
+    set4(constants.c[5], pipeline.blur1x-pipeline.blur1n, pipeline.blur1n, pipeline.blur2x-pipeline.blur2n, pipeline.blur2n);
+    set4(constants.c[6], pipeline.blur3x-pipeline.blur3n, pipeline.blur3n, pipeline.blur1n, pipeline.blur1x);
+    set4(constants.c[7], texsizeX, texsizeY, 1 / (float) texsizeX, 1 / (float) texsizeY);
+
+    set4(constants.c[8], 0.5f+0.5f*cosf(context.time* 0.329f+1.2f),
+                         0.5f+0.5f*cosf(context.time* 1.293f+3.9f),
+                         0.5f+0.5f*cosf(context.time* 5.070f+2.5f),
+                         0.5f+0.5f*cosf(context.time*20.051f+5.4f));
+
+    set4(constants.c[9], 0.5f+0.5f*sinf(context.time* 0.329f+1.2f),
+                         0.5f+0.5f*sinf(context.time* 1.293f+3.9f),
+                         0.5f+0.5f*sinf(context.time* 5.070f+2.5f),
+                         0.5f+0.5f*sinf(context.time*20.051f+5.4f));
+
+    set4(constants.c[10], 0.5f+0.5f*cosf(context.time*0.0050f+2.7f),
+                          0.5f+0.5f*cosf(context.time*0.0085f+5.3f),
+                          0.5f+0.5f*cosf(context.time*0.0133f+4.5f),
+                          0.5f+0.5f*cosf(context.time*0.0217f+3.8f));
+
+    set4(constants.c[11], 0.5f+0.5f*sinf(context.time*0.0050f+2.7f),
+                          0.5f+0.5f*sinf(context.time*0.0085f+5.3f),
+                          0.5f+0.5f*sinf(context.time*0.0133f+4.5f),
+                          0.5f+0.5f*sinf(context.time*0.0217f+3.8f));
+
+    set4(constants.c[12], mip_x, mip_y, mip_avg, 0 );
+    set4(constants.c[13], pipeline.blur2n, pipeline.blur2x, pipeline.blur3n, pipeline.blur3x);
+
+    // "_q[a-h]" values (_qa.x, _qa.y, _qa.z, _qa.w, _qb.x, _qb.y ... ) alias q[1-32]
+    for (int i=0; i < 8; i++)
+        set4(constants.q[i], pipeline.q[i*4], pipeline.q[i*4+1], pipeline.q[i*4+2], pipeline.q[i*4+3]);
 
     glm::mat4 temp_mat[24];
 
@@ -506,57 +442,61 @@ void ShaderEngine::SetupShaderVariables(GLuint program, const Pipeline &pipeline
         temp_mat[i] = my * temp_mat[i];
     }
 
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_s1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[0])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_s2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[1])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_s3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[2])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_s4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[3])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_d1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[4])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_d2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[5])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_d3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[6])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_d4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[7])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_f1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[8])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_f2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[9])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_f3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[10])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_f4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[11])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_vf1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[12])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_vf2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[13])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_vf3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[14])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_vf4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[15])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_uf1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[16])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_uf2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[17])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_uf3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[18])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_uf4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[19])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_rand1"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[20])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_rand2"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[21])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_rand3"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[22])));
-    glUniformMatrix3x4fv(glGetUniformLocation(program, "rot_rand4"), 1, GL_FALSE, glm::value_ptr(glm::mat3x4(temp_mat[23])));
-
-    // set program uniform "_q[a-h]" values (_qa.x, _qa.y, _qa.z, _qa.w, _qb.x, _qb.y ... ) alias q[1-32]
-    for (int i=0; i < 32; i+=4) {
-        std::string varName = "_q";
-        varName.push_back('a' + i/4);
-        glUniform4f(glGetUniformLocation(program, varName.c_str()), pipeline.q[i], pipeline.q[i+1], pipeline.q[i+2], pipeline.q[i+3]);
+    for (int i=0; i<24; i++)
+        memcpy(constants.rot[i], glm::value_ptr(glm::mat3x4(temp_mat[i])), sizeof(constants.rot[i]));
+}
+
+
+void ShaderEngine::SetupShaderVariables(const PresetUniforms &uniforms, const Pipeline &pipeline, const PipelineContext &context)
+{
+    if (uniforms.block != GL_INVALID_INDEX)
+    {
+        // warp and composite draw from the same buffer, fill it on the first use each frame
+        glBindBufferBase(GL_UNIFORM_BUFFER, kPresetConstantsBinding, uboPresetConstants);
+        if (uboFrame != context.frame || uboPipeline != &pipeline)
+        {
+            PresetConstants constants;
+            computePresetConstants(constants, pipeline, context);
+            glBindBuffer(GL_UNIFORM_BUFFER, uboPresetConstants);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(constants), &constants);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            uboFrame = context.frame;
+            uboPipeline = &pipeline;
+        }
+        return;
     }
+
+    PresetConstants constants;
+    computePresetConstants(constants, pipeline, context);
+
+    glUniform4fv(uniforms.rand_frame, 1, constants.rand_frame);
+    glUniform4fv(uniforms.rand_preset, 1, constants.rand_preset);
+    for (int i=0; i < 14; i++)
+        glUniform4fv(uniforms.c[i], 1, constants.c[i]);
+    for (int i=0; i < 8; i++)
+        glUniform4fv(uniforms.q[i], 1, constants.q[i]);
+    for (int i=0; i < 24; i++)
+        glUniformMatrix3x4fv(uniforms.rot[i], 1, GL_FALSE, constants.rot[i]);
 }
 
-void ShaderEngine::SetupTextures(GLuint program, const Shader &shader)
+void ShaderEngine::SetupTextures(const PresetProgram &preset)
 {
+    const PresetUniforms &uniforms = preset.uniforms;
 
     unsigned int texNum = 0;
     std::map<std::string, Texture*> texsizes;
 
     // Set samplers
-    for (std::map<std::string, TextureSamplerDesc>::const_iterator iter_samplers = shader.textures.begin(); iter_samplers
-                    != shader.textures.end(); ++iter_samplers)
+    for (std::map<std::string, TextureSamplerDesc>::const_iterator iter_samplers = preset.textures.begin(); iter_samplers
+                    != preset.textures.end(); ++iter_samplers)
     {
         std::string texName = iter_samplers->first;
         Texture * texture = iter_samplers->second.first;
         Sampler * sampler = iter_samplers->second.second;
-        std::string samplerName = "sampler_" + texName;
 
         // https://www.khronos.org/opengl/wiki/Sampler_(GLSL)#Binding_textures_to_samplers
-        GLint param = glGetUniformLocation(program, samplerName.c_str());
-        if (param < 0) {
+        std::map<std::string, GLint>::const_iterator param = uniforms.samplers.find(texName);
+        if (param == uniforms.samplers.end() || param->second < 0) {
             // unused uniform have been optimized out by glsl compiler
             continue;
         }
@@ -564,11 +504,12 @@ void ShaderEngine::SetupTextures(GLuint program, const Shader &shader)
         texsizes[texName] = texture;
         texsizes[texture->name] = texture;
 
+        textureManager->useTexture(texture);
         glActiveTexture(GL_TEXTURE0 + texNum);
         glBindTexture(texture->type, texture->texID);
         glBindSampler(texNum, sampler->samplerID);
 
-        glUniform1i(param, texNum);
+        glUniform1i(param->second, texNum);
         texNum++;
     }
 
@@ -579,10 +520,9 @@ void ShaderEngine::SetupTextures(GLuint program, const Shader &shader)
     {
         Texture * texture = iter_textures->second;
 
-        std::string texsizeName = "texsize_" + iter_textures->first;
-        GLint textSizeParam = glGetUniformLocation(program, texsizeName.c_str());
-        if (textSizeParam >= 0) {
-            glUniform4f(textSizeParam, texture->width, texture->height,
+        std::map<std::string, GLint>::const_iterator textSizeParam = uniforms.texsizes.find(iter_textures->first);
+        if (textSizeParam != uniforms.texsizes.end() && textSizeParam->second >= 0) {
+            glUniform4f(textSizeParam->second, texture->width, texture->height,
                             1 / (float) texture->width, 1 / (float) texture->height);
         } else {
             // unused uniform have been optimized out by glsl compiler
@@ -594,18 +534,11 @@ void ShaderEngine::SetupTextures(GLuint program, const Shader &shader)
 
 void ShaderEngine::RenderBlurTextures(const Pipeline &pipeline, const PipelineContext &pipelineContext)
 {
-    unsigned int passes = 0;
-    if (blur3_enabled) {
-        passes = 6;
-    } else if (blur2_enabled) {
-        passes = 4;
-    } else if (blur1_enabled) {
-        passes = 2;
-    } else {
+    // two passes per blur level the active programs sample
+    unsigned int passes = 2 * std::max(presetWarp.blurLevel, presetComp.blurLevel);
+    if (passes == 0)
         return;
-    }
 
-    const float w[8] = { 4.0f, 3.8f, 3.5f, 2.9f, 1.9f, 1.2f, 0.7f, 0.3f };  //<- user can specify these
     float edge_darken = pipeline.blur1ed;
     float blur_min[3], blur_max[3];
 
@@ -659,11 +592,18 @@ void ShaderEngine::RenderBlurTextures(const Pipeline &pipeline, const PipelineCo
     const std::vector<Texture*> & blurTextures = textureManager->getBlurTextures();
     const Texture * mainTexture = textureManager->getMainTexture();
 
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    bool direct = false;
+
     glBlendFunc(GL_ONE, GL_ZERO);
     glBindVertexArray(vaoBlur);
 
     for (unsigned int i=0; i<passes; i++)
     {
+        // each pass renders into its blur texture, the first one downsampling the main texture
+        direct = textureManager->bindBlurTarget(i);
+
         // set pixel shader
         if ((i%2) == 0) {
             glUseProgram(programID_blur1);
@@ -692,63 +632,45 @@ void ShaderEngine::RenderBlurTextures(const Pipeline &pipeline, const PipelineCo
         float fscale_now = fscale[i/2];
         float fbias_now  = fbias[i/2];
 
-        // set constants
+        // set constants, the kernel weights were set once in the constructor
         if (i%2==0)
         {
             // pass 1 (long horizontal pass)
             //-------------------------------------
-            const float w1 = w[0] + w[1];
-            const float w2 = w[2] + w[3];
-            const float w3 = w[4] + w[5];
-            const float w4 = w[6] + w[7];
-            const float d1 = 0 + 2*w[1]/w1;
-            const float d2 = 2 + 2*w[3]/w2;
-            const float d3 = 4 + 2*w[5]/w3;
-            const float d4 = 6 + 2*w[7]/w4;
-            const float w_div = 0.5f/(w1+w2+w3+w4);
-            //-------------------------------------
             //float4 _c0; // source texsize (.xy), and inverse (.zw)
-            //float4 _c1; // w1..w4
-            //float4 _c2; // d1..d4
             //float4 _c3; // scale, bias, w_div, 0
             //-------------------------------------
             glUniform4f(uniform_blur1_c0, srcw, srch, 1.0f/srcw, 1.0f/srch);
-            glUniform4f(uniform_blur1_c1, w1,w2,w3,w4);
-            glUniform4f(uniform_blur1_c2, d1,d2,d3,d4);
-            glUniform4f(uniform_blur1_c3, fscale_now, fbias_now, w_div, 0.0);
+            glUniform4f(uniform_blur1_c3, fscale_now, fbias_now, kBlurKernel.w_div1, 0.0);
         }
         else
         {
             // pass 2 (short vertical pass)
             //-------------------------------------
-            const float w1 = w[0]+w[1] + w[2]+w[3];
-            const float w2 = w[4]+w[5] + w[6]+w[7];
-            const float d1 = 0 + 2*((w[2]+w[3])/w1);
-            const float d2 = 2 + 2*((w[6]+w[7])/w2);
-            const float w_div = 1.0f/((w1+w2)*2);
-            //-------------------------------------
             //float4 _c0; // source texsize (.xy), and inverse (.zw)
-            //float4 _c5; // w1,w2,d1,d2
             //float4 _c6; // w_div, edge_darken_c1, edge_darken_c2, edge_darken_c3
             //-------------------------------------
             glUniform4f(uniform_blur2_c0, srcw, srch, 1.0f/srcw, 1.0f/srch);
-            glUniform4f(uniform_blur2_c5, w1,w2,d1,d2);
             // note: only do this first time; if you do it many times,
             // then the super-blurred levels will have big black lines along the top & left sides.
             if (i==1)
-                glUniform4f(uniform_blur2_c6, w_div, (1-edge_darken), edge_darken, 5.0f); //darken edges
+                glUniform4f(uniform_blur2_c6, kBlurKernel.w_div2, (1-edge_darken), edge_darken, 5.0f); //darken edges
             else
-                glUniform4f(uniform_blur2_c6, w_div, 1.0f, 0.0f, 5.0f); // don't darken
+                glUniform4f(uniform_blur2_c6, kBlurKernel.w_div2, 1.0f, 0.0f, 5.0f); // don't darken
         }
 
         // draw fullscreen quad
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-        // save to blur texture
-        glBindTexture(GL_TEXTURE_2D, blurTextures[i]->texID);
-        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, blurTextures[i]->width, blurTextures[i]->height);
+        // save to blur texture, unless it was drawn straight into it
+        if (!direct) {
+            glBindTexture(GL_TEXTURE_2D, blurTextures[i]->texID);
+            glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, blurTextures[i]->width, blurTextures[i]->height);
+        }
     }
 
+    if (direct)
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
     glBindVertexArray(0);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -758,6 +680,10 @@ void ShaderEngine::RenderBlurTextures(const Pipeline &pipeline, const PipelineCo
 bool ShaderEngine::linkProgram(GLuint programID) {
     glLinkProgram(programID);
 
+    return checkLinkStatus(programID);
+}
+
+bool ShaderEngine::checkLinkStatus(GLuint programID) {
     GLint program_linked;
     glGetProgramiv(programID, GL_LINK_STATUS, &program_linked);
     if (program_linked == GL_TRUE) {
@@ -780,64 +706,205 @@ bool ShaderEngine::loadPresetShaders(Pipeline &pipeline, const std::string & pre
 
     bool ok = true;
 
-    // blur programs
-    blur1_enabled = false;
-    blur2_enabled = false;
-    blur3_enabled = false;
-
     m_presetName = presetName;
 
-    // compile and link warp and composite shaders from pipeline
-    if (!pipeline.warpShader.programSource.empty()) {
-        programID_presetWarp = loadPresetShader(PresentWarpShader, pipeline.warpShader, pipeline.warpShaderFilename);
-        if (programID_presetWarp != GL_FALSE) {
-            uniform_vertex_transf_warp_shader = glGetUniformLocation(programID_presetWarp, "vertex_transformation");
-            presetWarpShaderLoaded = true;
-        } else {
-            ok = false;
-        }
+    // the warp and composite programs are staged together, the current preset keeps its
+    // own programs until both are linked and updatePresetShaders() switches them at once
+    if (!loadPresetShader(PresentWarpShader, pipeline.warpShader, pipeline.warpShaderFilename, pendingWarp))
+        ok = false;
+    if (!loadPresetShader(PresentCompositeShader, pipeline.compositeShader, pipeline.compositeShaderFilename, pendingComp))
+        ok = false;
+    presetShadersStaged = true;
+
+    // without a worker thread the translations are already done, so this links them
+    // (and reports their errors) before the new preset draws its first frame
+    if (!updatePresetShaders())
+        ok = false;
+
+    return ok;
+}
+
+bool ShaderEngine::loadPresetShader(const ShaderEngine::PresentShaderType shaderType, Shader &presetShader,
+                                    const std::string &shaderFilename, PendingProgram &pending) {
+    cancelPresetShader(pending);
+
+    // no shader of this kind, the fallback draws once the preset is switched to
+    if (presetShader.programSource.empty()) {
+        pending.ready = true;
+        return true;
     }
 
-    if (!pipeline.compositeShader.programSource.empty()) {
-        programID_presetComp = loadPresetShader(PresentCompositeShader, pipeline.compositeShader, pipeline.compositeShaderFilename);
-        if (programID_presetComp != GL_FALSE) {
-            presetCompShaderLoaded = true;
-        } else {
-            ok = false;
-        }
+    std::string fullSource;
+    if (!preparePresetShader(shaderType, presetShader, fullSource)) {
+        pending.ready = true;
+        return false;
+    }
+    pending.type = shaderType;
+    pending.preset.textures = presetShader.textures;
+
+    switch(shaderType) {
+    case PresentWarpShader: pending.typeString = "Warp"; break;
+    case PresentCompositeShader: pending.typeString = "Comp"; break;
+    case PresentBlur1Shader: pending.typeString = "Blur1"; break;
+    case PresentBlur2Shader: pending.typeString = "Blur2"; break;
+    default:    pending.typeString = "Other";
     }
 
-//    std::cout << "Preset composite shader active: " << presetCompShaderLoaded << ", preset warp shader active: " << presetWarpShaderLoaded << std::endl;
+    // the translation inputs double as the cache key, so programs are shared between
+    // presets with the same shader and the textures they resolve to
+    std::shared_ptr<ShaderTranslator::Job> job = std::make_shared<ShaderTranslator::Job>();
+    job->source.swap(fullSource);
+    for (std::map<std::string, TextureSamplerDesc>::const_iterator iter = presetShader.textures.cbegin(); iter != presetShader.textures.cend(); ++iter)
+        job->samplers.push_back(ShaderTranslator::Sampler(iter->first, iter->second.first->name, iter->second.first->type == GL_TEXTURE_3D));
+    job->filename = shaderFilename;
+    job->typeString = pending.typeString;
+    job->version = StaticGlShaders::Get()->GetGlslGeneratorVersion();
+    job->cacheKey = ShaderTranslator::cacheKey(*job);
+    pending.cacheKey = job->cacheKey;
+
+    GLuint cached = shaderCache.find(pending.cacheKey);
+    if (cached == 0) {
+        cached = shaderCache.loadBinary(pending.cacheKey);
+        if (cached != 0)
+            shaderCache.insert(pending.cacheKey, cached);
+    }
+    if (cached != 0) {
+        readyPresetShader(cached, pending);
+        return true;
+    }
+
+    // translate (or read the GLSL from the disk cache) off the render thread
+    pending.job = job;
+    translator.submit(job);
+
+    return true;
+}
 
+bool ShaderEngine::updatePresetShaders() {
+    if (!presetShadersStaged)
+        return true;
+
+    bool ok = updatePresetShader(pendingWarp);
+    if (!updatePresetShader(pendingComp))
+        ok = false;
+    if (!pendingWarp.ready || !pendingComp.ready)
+        return ok;
+
+    // both are linked (or given up on), the preset's programs and its random constants
+    // replace the previous preset's together
+    presetWarp = pendingWarp.preset;
+    presetComp = pendingComp.preset;
+    pendingWarp = PendingProgram();
+    pendingComp = PendingProgram();
+    presetShadersStaged = false;
+    reset();
     return ok;
 }
 
-GLuint ShaderEngine::loadPresetShader(const ShaderEngine::PresentShaderType shaderType, Shader &presetShader, std::string &shaderFilename) {
-    GLuint program = compilePresetShader(shaderType, presetShader, shaderFilename);
+bool ShaderEngine::updatePresetShader(PendingProgram &pending) {
+    if (pending.ready)
+        return true;
+
+    if (pending.job) {
+        if (!pending.job->done)
+            return true;
 
-    if (program == GL_FALSE) {
-        // failed to compile
-        return GL_FALSE;
+        std::shared_ptr<ShaderTranslator::Job> job = pending.job;
+        pending.job.reset();
+        if (!job->ok) {
+            failPresetShader(pending);
+            return false;
+        }
+
+        // now we have GLSL source for the preset shader program (hopefully it's
+        // valid!) compile the preset shader fragment shader with the standard
+        // vertex shader and cross our fingers
+        pending.glsl.swap(job->glsl);
+        pending.program = beginShaderProgram(
+            pending.type == PresentWarpShader ? StaticGlShaders::Get()->GetPresetWarpVertexShader()
+                                              : StaticGlShaders::Get()->GetPresetCompVertexShader(),
+            pending.glsl);
+    }
+
+    if (pending.program == 0) {
+        failPresetShader(pending);
+        return false;
+    }
+
+    if (parallelCompile) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (completed != GL_TRUE)
+            return true;
+    }
+
+    GLuint program = pending.program;
+    pending.program = 0;
+    if (!finishShaderProgram(program, pending.typeString)) {
+        std::cerr << "Compilation error (step3) of " << pending.typeString << std::endl;
+#if !DUMP_SHADERS_ON_ERROR
+        std::cerr << "Source:" << std::endl << pending.glsl << std::endl;
+#else
+        std::ofstream out3("/tmp/shader_" + pending.typeString + "_step3.txt");
+            out3 << pending.glsl;
+            out3.close();
+#endif
+        glDeleteProgram(program);
+        failPresetShader(pending);
+        return false;
     }
 
-    return program;
+#ifdef DEBUG
+    std::cerr << "Successful compilation of " << pending.typeString << std::endl;
+#endif
+    shaderCache.insert(pending.cacheKey, program);
+    shaderCache.storeBinary(pending.cacheKey, program);
+    readyPresetShader(program, pending);
+    return true;
+}
+
+void ShaderEngine::readyPresetShader(GLuint program, PendingProgram &pending) {
+    PresetProgram &preset = pending.preset;
+    preset.program = program;
+    resolvePresetUniforms(program, preset.textures, preset.uniforms);
+
+    // blur only as deep as the linked program still samples, the compiler drops
+    // blur lookups whose result goes unused
+    for (std::map<std::string, TextureSamplerDesc>::const_iterator iter = preset.textures.cbegin(); iter != preset.textures.cend(); ++iter) {
+        const std::string &texName = iter->second.first->name;
+        std::map<std::string, GLint>::const_iterator location = preset.uniforms.samplers.find(iter->first);
+        if (texName.size() == 5 && texName.compare(0, 4, "blur") == 0 &&
+            location != preset.uniforms.samplers.end() && location->second >= 0)
+            preset.blurLevel = std::max(preset.blurLevel, texName[4] - '0');
+    }
+    pending.ready = true;
 }
 
-// deactivate preset shaders
-void ShaderEngine::disablePresetShaders() {
-    if (presetCompShaderLoaded)
-        glDeleteProgram(programID_presetComp);
+// a shader that does not build leaves the fallback in its place
+void ShaderEngine::failPresetShader(PendingProgram &pending) {
+    cancelPresetShader(pending);
+    pending.ready = true;
+}
 
-    if (presetWarpShaderLoaded)
-        glDeleteProgram(programID_presetWarp);
+// forget a program that has not become active yet, a queued translation is skipped
+void ShaderEngine::cancelPresetShader(PendingProgram &pending) {
+    if (pending.program != 0)
+        glDeleteProgram(pending.program);
+    pending = PendingProgram();
+}
 
-    presetCompShaderLoaded = false;
-    presetWarpShaderLoaded = false;
+// deactivate preset shaders, the programs stay in shaderCache for the next time the preset is loaded
+void ShaderEngine::disablePresetShaders() {
+    cancelPresetShader(pendingWarp);
+    cancelPresetShader(pendingComp);
+    presetShadersStaged = false;
+    presetWarp = PresetProgram();
+    presetComp = PresetProgram();
 }
 
 void ShaderEngine::reset()
 {
-    disablePresetShaders();
+    uboFrame = -1;
     rand_preset[0] = FRAND;
     rand_preset[1] = FRAND;
     rand_preset[2] = FRAND;
@@ -866,6 +933,15 @@ void ShaderEngine::reset()
 }
 
 GLuint ShaderEngine::CompileShaderProgram(const std::string & VertexShaderCode, const std::string & FragmentShaderCode, const std::string & shaderTypeString){
+    GLuint programID = beginShaderProgram(VertexShaderCode, FragmentShaderCode);
+    if (!finishShaderProgram(programID, shaderTypeString)) {
+        glDeleteProgram(programID);
+        return GL_FALSE;
+    }
+    return programID;
+}
+
+GLuint ShaderEngine::beginShaderProgram(const std::string & VertexShaderCode, const std::string & FragmentShaderCode){
 
 #if defined(WIN32) && !defined(EYETUNE_WINRT)
 	GLenum err = glewInit();
@@ -875,43 +951,44 @@ GLuint ShaderEngine::CompileShaderProgram(const std::string & VertexShaderCode,
     GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
     GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-
     // Compile Vertex Shader
     char const * VertexSourcePointer = VertexShaderCode.c_str();
     glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
     glCompileShader(VertexShaderID);
-    if(!checkCompileStatus(VertexShaderID, "Vertex: " + shaderTypeString)) {
-        glDeleteShader(VertexShaderID);
-        glDeleteShader(FragmentShaderID);
-        return GL_FALSE;
-    }
-
 
     // Compile Fragment Shader
     char const * FragmentSourcePointer = FragmentShaderCode.c_str();
     glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
     glCompileShader(FragmentShaderID);
-    if(!checkCompileStatus(FragmentShaderID, "Fragment: " + shaderTypeString)) {
-        glDeleteShader(VertexShaderID);
-        glDeleteShader(FragmentShaderID);
-        return GL_FALSE;
-    }
 
-
-    // Link the program
+    // Link the program, status is only queried by finishShaderProgram() so
+    // drivers that compile in the background are not waited for here
     GLuint programID = glCreateProgram();
 
     glAttachShader(programID, VertexShaderID);
     glAttachShader(programID, FragmentShaderID);
-    bool linkOK = linkProgram(programID);
+    glLinkProgram(programID);
+
+    return programID;
+}
+
+bool ShaderEngine::finishShaderProgram(GLuint programID, const std::string & shaderTypeString){
+    GLuint shaders[2];
+    GLsizei count = 0;
+    glGetAttachedShaders(programID, 2, &count, shaders);
 
-    glDetachShader(programID, VertexShaderID);
-    glDetachShader(programID, FragmentShaderID);
+    bool compileOK = true;
+    for (GLsizei i = 0; i < count; i++) {
+        GLint type;
+        glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+        if (compileOK && !checkCompileStatus(shaders[i], (type == GL_VERTEX_SHADER ? "Vertex: " : "Fragment: ") + shaderTypeString))
+            compileOK = false;
 
-    glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+        glDetachShader(programID, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
 
-    return linkOK ? programID : GL_FALSE;
+    return compileOK && checkLinkStatus(programID);
 }
 
 void ShaderEngine::validateProgram(const GLuint programID) {
@@ -932,18 +1009,18 @@ void ShaderEngine::validateProgram(const GLuint programID) {
 
 // use the appropriate shader program for rendering the interpolation.
 // it will use the preset shader if available, otherwise the textured shader
-bool ShaderEngine::enableWarpShader(Shader &shader, const Pipeline &pipeline, const PipelineContext &pipelineContext, const glm::mat4 & mat_ortho) {
-    if (presetWarpShaderLoaded) {
-        glUseProgram(programID_presetWarp);
+bool ShaderEngine::enableWarpShader(const Pipeline &pipeline, const PipelineContext &pipelineContext, const glm::mat4 & mat_ortho) {
+    if (presetWarp.program != 0) {
+        glUseProgram(presetWarp.program);
 
-        SetupTextures(programID_presetWarp, shader);
+        SetupTextures(presetWarp);
 
-        SetupShaderVariables(programID_presetWarp, pipeline, pipelineContext);
+        SetupShaderVariables(presetWarp.uniforms, pipeline, pipelineContext);
 
-        glUniformMatrix4fv(uniform_vertex_transf_warp_shader, 1, GL_FALSE, glm::value_ptr(mat_ortho));
+        glUniformMatrix4fv(presetWarp.uniforms.vertex_transformation, 1, GL_FALSE, glm::value_ptr(mat_ortho));
 
 #if OGL_DEBUG
-        validateProgram(programID_presetWarp);
+        validateProgram(presetWarp.program);
 #endif
 
         return true;
@@ -957,16 +1034,16 @@ bool ShaderEngine::enableWarpShader(Shader &shader, const Pipeline &pipeline, co
     return false;
 }
 
-bool ShaderEngine::enableCompositeShader(Shader &shader, const Pipeline &pipeline, const PipelineContext &pipelineContext) {
-    if (presetCompShaderLoaded) {
-        glUseProgram(programID_presetComp);
+bool ShaderEngine::enableCompositeShader(const Pipeline &pipeline, const PipelineContext &pipelineContext) {
+    if (presetComp.program != 0) {
+        glUseProgram(presetComp.program);
 
-        SetupTextures(programID_presetComp, shader);
+        SetupTextures(presetComp);
 
-        SetupShaderVariables(programID_presetComp, pipeline, pipelineContext);
+        SetupShaderVariables(presetComp.uniforms, pipeline, pipelineContext);
 
 #if OGL_DEBUG
-        validateProgram(programID_presetComp);
+        validateProgram(presetComp.program);
 #endif
 
         return true;
@@ -20,8 +20,11 @@ class ShaderEngine;
 #include <cstdlib>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include "Shader.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderTranslator.hpp"
 #include <glm/vec3.hpp>
 
 
@@ -38,15 +41,29 @@ public:
 
     ShaderEngine();
     virtual ~ShaderEngine();
+    /// Starts loading the pipeline's preset shaders. Programs that are not cached yet are
+    /// translated in the background while the previous preset's programs keep drawing.
     bool loadPresetShaders(Pipeline &pipeline, const std::string &presetName);
-    bool enableWarpShader(Shader &shader, const Pipeline &pipeline, const PipelineContext &pipelineContext, const glm::mat4 & mat_ortho);
-    bool enableCompositeShader(Shader &shader, const Pipeline &pipeline, const PipelineContext &pipelineContext);
+    /// Links the programs whose translation has finished and, once both of the preset's are
+    /// linked, switches to them together. Call once per frame.
+    bool updatePresetShaders();
+    /// True from loadPresetShaders() until updatePresetShaders() switched to its programs,
+    /// the previous preset's pipeline should draw until then
+    bool presetShadersPending() const { return presetShadersStaged; }
+    bool enableWarpShader(const Pipeline &pipeline, const PipelineContext &pipelineContext, const glm::mat4 & mat_ortho);
+    bool enableCompositeShader(const Pipeline &pipeline, const PipelineContext &pipelineContext);
     void RenderBlurTextures(const Pipeline  &pipeline, const PipelineContext &pipelineContext);
     void setParams(const int _texsizeX, const int texsizeY, BeatDetect *beatDetect, TextureManager *_textureManager);
     void reset();
+    /// Keep translated preset shaders (and program binaries) in dir across runs, empty disables it
+    void setShaderCacheDirectory(const std::string &dir) { shaderCache.setDirectory(dir); }
 
     static GLuint CompileShaderProgram(const std::string & VertexShaderCode, const std::string & FragmentShaderCode, const std::string & shaderTypeString);
+    /// Compiles and links without waiting for the result, finishShaderProgram() collects it
+    static GLuint beginShaderProgram(const std::string & VertexShaderCode, const std::string & FragmentShaderCode);
+    static bool finishShaderProgram(GLuint programID, const std::string & shaderTypeString);
     static bool checkCompileStatus(GLuint shader, const std::string & shaderTitle);
+    static bool checkLinkStatus(GLuint programID);
     static bool linkProgram(GLuint programID);
 
 
@@ -58,6 +75,15 @@ public:
     GLint uniform_v2f_c4f_t2f_vertex_tranformation;
     GLint uniform_v2f_c4f_t2f_frag_texture_sampler;
 
+    GLuint programID_shape_instanced; // 0 without GLSL 3.30 / ES 3.00
+    GLint uniform_shape_instanced_vertex_transformation;
+    GLint uniform_shape_instanced_sides;
+    GLint uniform_shape_instanced_aspect;
+    GLint uniform_shape_instanced_line_width;
+    GLint uniform_shape_instanced_textured;
+    GLint uniform_shape_instanced_master_alpha;
+    GLint uniform_shape_instanced_texture_sampler;
+
     const static std::string v2f_c4f_vert;
     const static std::string v2f_c4f_frag;
     const static std::string v2f_c4f_t2f_vert;
@@ -70,17 +96,12 @@ private:
     float aspectY;
     BeatDetect *beatDetect;
     TextureManager *textureManager;
-    GLint uniform_vertex_transf_warp_shader;
 
     GLuint programID_warp_fallback;
     GLuint programID_comp_fallback;
     GLuint programID_blur1;
     GLuint programID_blur2;
 
-    bool blur1_enabled;
-    bool blur2_enabled;
-    bool blur3_enabled;
-
     GLint uniform_blur1_sampler;
     GLint uniform_blur1_c0;
     GLint uniform_blur1_c1;
@@ -95,26 +116,96 @@ private:
     GLuint vboBlur;
     GLuint vaoBlur;
 
+    // preset shader inputs, looked up once when the program is linked
+    struct PresetUniforms
+    {
+        GLint rand_frame;
+        GLint rand_preset;
+        GLint c[14];
+        GLint q[8];
+        GLint rot[24];
+        GLint vertex_transformation;
+        GLuint block;   // PresetConstants block index, GL_INVALID_INDEX with the GLSL 1.20 header
+        std::map<std::string, GLint> samplers;
+        std::map<std::string, GLint> texsizes;
+    };
+
+    // std140 image of the PresetConstants block in the GLSL 3.30 / ES 3.00 preset header
+    struct PresetConstants
+    {
+        float rand_frame[4];
+        float rand_preset[4];
+        float c[14][4];
+        float q[8][4];
+        float rot[24][12];  // mat3x4, three columns of four
+    };
+
+    // a linked preset program and what it reads. program is 0 when the preset has no
+    // shader of this kind, or it failed to build, and the fallback shader draws instead
+    struct PresetProgram
+    {
+        GLuint program;
+        int blurLevel;      // deepest blur texture the linked program samples, 0 for none
+        std::map<std::string, TextureSamplerDesc> textures;
+        PresetUniforms uniforms;
+
+        PresetProgram() : program(0), blurLevel(0) {}
+    };
+
+    // the next preset's program on its way to becoming a PresetProgram
+    struct PendingProgram
+    {
+        PresentShaderType type;
+        std::string typeString;
+        std::string cacheKey;
+        std::shared_ptr<ShaderTranslator::Job> job;    // set while translating
+        GLuint program;                                 // set while compiling and linking
+        std::string glsl;
+        PresetProgram preset;
+        bool ready;                                     // preset is linked, or the fallback if it failed
+
+        PendingProgram() : type(PresentWarpShader), program(0), ready(false) {}
+    };
+
+    PresetProgram presetWarp, presetComp;
+    PendingProgram pendingWarp, pendingComp;
+    bool presetShadersStaged;
+
+    // GL_KHR/ARB_parallel_shader_compile: links complete in the driver's threads and
+    // GL_COMPLETION_STATUS_KHR tells us when, without stalling the frame
+    bool parallelCompile;
+
+    // one buffer feeds both programs, uploaded once per frame
+    GLuint uboPresetConstants;
+    int uboFrame;
+    const Pipeline *uboPipeline;
+
     float rand_preset[4];
     glm::vec3 xlate[20];
     glm::vec3 rot_base[20];
     glm::vec3 rot_speed[20];
 
-    void SetupShaderVariables(GLuint program, const Pipeline &pipeline, const PipelineContext &pipelineContext);
-    void SetupTextures(GLuint program, const Shader &shader);
-    GLuint compilePresetShader(const ShaderEngine::PresentShaderType shaderType, Shader &shader, const std::string &shaderFilename);
+    void resolvePresetUniforms(GLuint program, const std::map<std::string, TextureSamplerDesc> &textures, PresetUniforms &uniforms);
+    void computePresetConstants(PresetConstants &constants, const Pipeline &pipeline, const PipelineContext &pipelineContext);
+    void SetupShaderVariables(const PresetUniforms &uniforms, const Pipeline &pipeline, const PipelineContext &pipelineContext);
+    void SetupTextures(const PresetProgram &preset);
+    bool preparePresetShader(const ShaderEngine::PresentShaderType shaderType, Shader &shader, std::string &fullSource);
 
     void disablePresetShaders();
-    GLuint loadPresetShader(const PresentShaderType shaderType, Shader &shader, std::string &shaderFilename);
+    bool loadPresetShader(const PresentShaderType shaderType, Shader &shader, const std::string &shaderFilename,
+                          PendingProgram &pending);
+    bool updatePresetShader(PendingProgram &pending);
+    void readyPresetShader(GLuint program, PendingProgram &pending);
+    void failPresetShader(PendingProgram &pending);
+    void cancelPresetShader(PendingProgram &pending);
 
     void deletePresetShader(Shader &shader);
     void validateProgram(const GLuint programID);
 
     
-    // programs generated from preset shader code
-    GLuint programID_presetComp, programID_presetWarp;
-
-    bool presetCompShaderLoaded, presetWarpShaderLoaded;
+    // programs generated from preset shader code are owned by shaderCache
+    ShaderCache shaderCache;
+    ShaderTranslator translator;
 
     std::string m_presetName;
 };
@@ -0,0 +1,347 @@
+//
+//  ShaderTranslator.cpp
+//  libprojectM
+//
+
+#include "ShaderTranslator.hpp"
+#include "HLSLParser.h"
+#include "GLSLGenerator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <set>
+
+namespace {
+
+// the wrap and filter prefix TextureManager::ExtractTextureSettings() strips
+std::string unqualifiedTexture(const std::string &name)
+{
+    std::string prefix(name.substr(0, 3));
+    std::transform(prefix.begin(), prefix.end(), prefix.begin(), tolower);
+    if (prefix == "fc_" || prefix == "fw_" || prefix == "pc_" || prefix == "pw_")
+        return name.substr(3);
+    return name;
+}
+
+}
+
+
+ShaderTranslator::ShaderTranslator(const ShaderCache &cache) : _cache(cache)
+#ifdef USE_THREADS
+    , _finished(false)
+#endif
+{
+#ifdef USE_THREADS
+    _thread = std::thread(&ShaderTranslator::work, this);
+#endif
+}
+
+ShaderTranslator::~ShaderTranslator()
+{
+#ifdef USE_THREADS
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+        _queue.clear();
+    }
+    _wake.notify_one();
+    _thread.join();
+#endif
+}
+
+void ShaderTranslator::submit(const std::shared_ptr<Job> &job)
+{
+#ifdef USE_THREADS
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(job);
+    }
+    _wake.notify_one();
+#else
+    run(*job);
+#endif
+}
+
+void ShaderTranslator::run(Job &job)
+{
+    if (job.cacheKey.empty() || !_cache.loadGlsl(job.cacheKey, job.glsl)) {
+        job.ok = translate(job.source, job.samplers, job.filename, job.typeString, job.version, job.glsl);
+        if (job.ok && !job.cacheKey.empty())
+            _cache.storeGlsl(job.cacheKey, job.glsl);
+    } else {
+        job.ok = true;
+    }
+    job.done = true;
+}
+
+#ifdef USE_THREADS
+void ShaderTranslator::work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [this] { return _finished || !_queue.empty(); });
+        if (_finished)
+            return;
+
+        // jobs whose preset was switched away from before we got to them are skipped
+        std::shared_ptr<Job> job = _queue.front().lock();
+        _queue.pop_front();
+        if (!job)
+            continue;
+
+        lock.unlock();
+        run(*job);
+        job.reset();
+        lock.lock();
+    }
+}
+#endif
+
+
+// HLSL -> GLSL for a preset shader whose source has been rewritten by ShaderEngine
+bool ShaderTranslator::translate(const std::string &fullSource, const std::vector<Sampler> &samplers,
+                                 const std::string &shaderFilename, const std::string &shaderTypeString,
+                                 int version, std::string &glsl) {
+    M4::GLSLGenerator generator;
+    M4::Allocator allocator;
+
+    M4::HLSLTree tree( &allocator );
+    M4::HLSLParser parser(&allocator, &tree);
+
+    // preprocess define macros
+    std::string sourcePreprocessed;
+    if (!parser.ApplyPreprocessor(shaderFilename.c_str(), fullSource.c_str(), fullSource.size(), sourcePreprocessed)) {
+        std::cerr << "Failed to preprocess HLSL(step1) " << shaderTypeString << " shader" << std::endl;
+
+#if !DUMP_SHADERS_ON_ERROR
+        std::cerr << "Source: " << std::endl << fullSource << std::endl;
+#else
+        std::ofstream out("/tmp/shader_" + shaderTypeString + "_step1.txt");
+            out << fullSource;
+            out.close();
+#endif
+            return false;
+    }
+
+    // Remove previous shader declarations
+    std::smatch matches;
+    while(std::regex_search(sourcePreprocessed, matches, std::regex("sampler(2D|3D|)(\\s+|\\().*"))) {
+        sourcePreprocessed.replace(matches.position(), matches.length(), "");
+    }
+
+    // Remove previous texsize declarations
+    while(std::regex_search(sourcePreprocessed, matches, std::regex("float4\\s+texsize_.*"))) {
+        sourcePreprocessed.replace(matches.position(), matches.length(), "");
+    }
+
+    // Declare samplers
+    std::set<std::string> texsizes;
+    std::vector<Sampler>::const_iterator iter_samplers = samplers.cbegin();
+    for ( ; iter_samplers != samplers.cend(); ++iter_samplers)
+    {
+        if (iter_samplers->volume) {
+            sourcePreprocessed.insert(0, "uniform sampler3D sampler_" + iter_samplers->name + ";\n");
+        } else {
+            sourcePreprocessed.insert(0, "uniform sampler2D sampler_" + iter_samplers->name + ";\n");
+        }
+
+        texsizes.insert(iter_samplers->name);
+        texsizes.insert(iter_samplers->textureName);
+    }
+
+    // Declare texsizes
+    std::set<std::string>::const_iterator iter_texsizes = texsizes.cbegin();
+    for ( ; iter_texsizes != texsizes.cend(); ++iter_texsizes)
+    {
+        sourcePreprocessed.insert(0, "uniform float4 texsize_" + *iter_texsizes + ";\n");
+    }
+
+
+    // transpile from HLSL (aka preset shader aka directX shader) to GLSL (aka OpenGL shader lang)
+
+    // parse
+    if( !parser.Parse(shaderFilename.c_str(), sourcePreprocessed.c_str(), sourcePreprocessed.size()) ) {
+        std::cerr << "Failed to parse HLSL(step2) " << shaderTypeString << " shader" << std::endl;
+
+#if !DUMP_SHADERS_ON_ERROR
+        std::cerr << "Source: " << std::endl << sourcePreprocessed << std::endl;
+#else
+        std::ofstream out2("/tmp/shader_" + shaderTypeString + "_step2.txt");
+            out2 << sourcePreprocessed;
+            out2.close();
+#endif
+            return false;
+    }
+
+    // generate GLSL
+    if (!generator.Generate(&tree, M4::GLSLGenerator::Target_FragmentShader,
+                            (M4::GLSLGenerator::Version)version, "PS")) {
+        std::cerr << "Failed to transpile HLSL(step3) " << shaderTypeString << " shader to GLSL" << std::endl;
+#if !DUMP_SHADERS_ON_ERROR
+        std::cerr << "Source: " << std::endl << sourcePreprocessed << std::endl;
+#else
+        std::ofstream out2("/tmp/shader_" + shaderTypeString + "_step2.txt");
+            out2 << sourcePreprocessed;
+            out2.close();
+#endif
+        return false;
+    }
+
+    glsl = generator.GetResult();
+    return true;
+}
+
+
+// rewrite a user-defined shader from a preset into a function the translator accepts
+bool ShaderTranslator::presetProgram(bool warp, const std::string &programSource, std::string &program) {
+    program = programSource;
+
+    if (program.length() <= 0)
+        return false;
+
+    // replace "}" with return statement (this can probably be optimized for the GLSL conversion...)
+    size_t found = program.rfind('}');
+    if (found != std::string::npos)
+    {
+        //std::cout << "last '}' found at: " << int(found) << std::endl;
+        program.replace(int(found), 1, "_return_value = float4(ret.xyz, 1.0);\n"
+                                       "}\n");
+    }
+    else
+        return false;
+
+    // replace shader_body with entry point function
+    found = program.find("shader_body");
+    if (found != std::string::npos)
+    {
+        //std::cout << "first 'shader_body' found at: " << int(found) << std::endl;
+        if (warp) {
+            program.replace(int(found), 11, "void PS(float4 _vDiffuse : COLOR, float4 _uv : TEXCOORD0, float2 _rad_ang : TEXCOORD1, out float4 _return_value : COLOR)\n");
+
+        } else {
+            program.replace(int(found), 11, "void PS(float4 _vDiffuse : COLOR, float2 _uv : TEXCOORD0, float2 _rad_ang : TEXCOORD1, out float4 _return_value : COLOR)\n");
+
+        }
+    }
+    else
+        return false;
+
+    // replace "{" with some variable declarations
+    found = program.find('{',found);
+    if (found != std::string::npos)
+    {
+        //std::cout << "first '{' found at: " << int(found) << std::endl;
+        const char *progMain = \
+        "{\n"
+        "float3 ret = 0;\n";
+        program.replace(int(found), 1, progMain);
+    }
+    else
+        return false;
+
+    return true;
+}
+
+std::vector<std::string> ShaderTranslator::samplerNames(const std::string &program) {
+    std::vector<std::string> samplers;
+
+    size_t found = program.find("sampler_");
+    while (found != std::string::npos)
+    {
+        found += 8;
+        size_t end = program.find_first_of(" ;,\n\r)", found);
+
+        if (end != std::string::npos)
+            samplers.push_back(program.substr(found, end - found));
+
+        found = program.find("sampler_", found);
+    }
+
+    return samplers;
+}
+
+int ShaderTranslator::blurLevel(const std::string &program) {
+    if (program.find("GetBlur3") != std::string::npos || program.find("_blur3") != std::string::npos)
+        return 3;
+    if (program.find("GetBlur2") != std::string::npos || program.find("_blur2") != std::string::npos)
+        return 2;
+    if (program.find("GetBlur1") != std::string::npos || program.find("_blur1") != std::string::npos)
+        return 1;
+    return 0;
+}
+
+std::string ShaderTranslator::presetSource(bool warp, const std::string &header, const std::string &program) {
+    // prepend our HLSL template to the actual program source
+    std::string fullSource = header;
+
+    if (warp) {
+        fullSource.append(  "#define rad _rad_ang.x\n"
+                            "#define ang _rad_ang.y\n"
+                            "#define uv _uv.xy\n"
+                            "#define uv_orig _uv.zw\n");
+    } else {
+        fullSource.append(  "#define rad _rad_ang.x\n"
+                            "#define ang _rad_ang.y\n"
+                            "#define uv _uv.xy\n"
+                            "#define uv_orig _uv.xy\n"
+                            "#define hue_shader _vDiffuse.xyz\n");
+    }
+
+
+    fullSource.append(program);
+    return fullSource;
+}
+
+// the key covers everything the GLSL depends on: the rewritten source, the declared
+// samplers (random textures resolve differently per load) and the target version
+std::string ShaderTranslator::cacheKey(const Job &job) {
+    std::string keySource = job.source;
+    keySource += "\n//" + job.typeString + " " + std::to_string(job.version);
+    for (std::vector<Sampler>::const_iterator iter = job.samplers.cbegin(); iter != job.samplers.cend(); ++iter)
+        keySource += "\n//" + iter->name + " " + iter->textureName + (iter->volume ? " 3D" : " 2D");
+    return ShaderCache::key(keySource);
+}
+
+ShaderTranslator::TextureReference ShaderTranslator::presetTexture(const std::string &samplerName) {
+    std::string lowerCaseName(samplerName);
+    std::transform(lowerCaseName.begin(), lowerCaseName.end(), lowerCaseName.begin(), tolower);
+
+    // TextureManager::getTexture() cuts the first extension found, then the prefix
+    std::string name = samplerName;
+    for (const std::string &ext : textureExtensions())
+    {
+        size_t found = lowerCaseName.find(ext);
+        if (found != std::string::npos)
+        {
+            name.erase(found, ext.size());
+            break;
+        }
+    }
+    name = unqualifiedTexture(name);
+
+    static const char *const builtins[] = {
+        "main", "noise_lq", "noise_lq_lite", "noise_mq", "noise_hq", "noisevol_lq", "noisevol_hq",
+        "blur1", "blur2", "blur3", "M", "headphones"
+    };
+    for (const char *builtin : builtins)
+        if (name == builtin)
+            return TextureReference(name, TextureReference::Builtin, name.compare(0, 8, "noisevol") == 0);
+
+    // TextureManager::getRandomTextureName() names it after the part before the first '_'
+    if (lowerCaseName.compare(0, 4, "rand") == 0
+        || (lowerCaseName.size() >= 7 && lowerCaseName.compare(2, 5, "_rand") == 0))
+    {
+        std::string random = unqualifiedTexture(samplerName);
+        return TextureReference(random.substr(0, random.find('_')), TextureReference::Random, false);
+    }
+
+    return TextureReference(name, TextureReference::File, false);
+}
+
+const std::vector<std::string> &ShaderTranslator::textureExtensions() {
+    static const std::vector<std::string> extensions = { ".jpg", ".dds", ".png", ".tga", ".bmp", ".dib" };
+    return extensions;
+}
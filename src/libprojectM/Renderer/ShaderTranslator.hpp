@@ -0,0 +1,123 @@
+//
+//  ShaderTranslator.hpp
+//  libprojectM
+//
+//  HLSL -> GLSL translation of preset shaders. translate() touches no GL state, so
+//  ShaderEngine hands it to a background thread as soon as a preset is selected and
+//  only compiles and links the result on the render thread once it is ready.
+//  The preset source helpers below are shared with the offline projectM-shadercache
+//  tool, so both produce the same cache keys.
+//
+
+#ifndef ShaderTranslator_hpp
+#define ShaderTranslator_hpp
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "ShaderCache.hpp"
+
+class ShaderTranslator
+{
+public:
+    /// A sampler the preset shader reads, as declared to the translated program
+    struct Sampler
+    {
+        std::string name;           // without the sampler_ prefix
+        std::string textureName;    // texsize_<textureName> is declared too
+        bool volume;                // sampler3D instead of sampler2D
+
+        Sampler(const std::string &_name, const std::string &_textureName, bool _volume)
+            : name(_name), textureName(_textureName), volume(_volume) {}
+    };
+
+    /// The texture TextureManager binds to a sampler, as far as it can be told without GL
+    struct TextureReference
+    {
+        enum Source
+        {
+            Builtin,                // one TextureManager always has: main, noise, blur, M, headphones
+            Random,                 // a random user texture, picked when the shader is loaded
+            File                    // an image named name plus one of textureExtensions()
+        };
+
+        std::string name;           // what the sampler's textureName is
+        Source source;
+        bool volume;
+
+        TextureReference(const std::string &_name, Source _source, bool _volume)
+            : name(_name), source(_source), volume(_volume) {}
+    };
+
+    /// One translation. Inputs are filled by the caller, glsl and ok are valid once done is set.
+    struct Job
+    {
+        std::string source;         // HLSL with the preset header prepended
+        std::vector<Sampler> samplers;
+        std::string filename;
+        std::string typeString;
+        int version;                // M4::GLSLGenerator::Version to generate
+        std::string cacheKey;       // looked up in / stored to the disk cache when not empty
+
+        std::string glsl;
+        bool ok;
+        std::atomic<bool> done;
+
+        Job() : version(0), ok(false), done(false) {}
+    };
+
+    /// The disk cache's directory must not change while jobs are queued
+    explicit ShaderTranslator(const ShaderCache &cache);
+    ~ShaderTranslator();
+
+    /// Queues job. Built without threads it is translated before this returns.
+    /// Dropping the last reference to a queued job cancels it.
+    void submit(const std::shared_ptr<Job> &job);
+
+    static bool translate(const std::string &source, const std::vector<Sampler> &samplers,
+                          const std::string &filename, const std::string &typeString,
+                          int version, std::string &glsl);
+
+    /// Turns a preset's warp or composite shader_body into the PS() entry point.
+    /// Returns false if the source has no shader_body block.
+    static bool presetProgram(bool warp, const std::string &programSource, std::string &program);
+    /// Names (without the sampler_ prefix) of the samplers program references, in order
+    static std::vector<std::string> samplerNames(const std::string &program);
+    /// Highest blur level program calls GetBlurN() for or samples directly, 0 for none
+    static int blurLevel(const std::string &program);
+    /// program below the preset shader header (matching version) and the uv/rad/ang defines
+    static std::string presetSource(bool warp, const std::string &header, const std::string &program);
+    /// ShaderCache key of the GLSL translating job produces; samplers must be sorted by name
+    static std::string cacheKey(const Job &job);
+    /// Which texture sampler_<samplerName> gets, following ShaderEngine's and TextureManager's
+    /// lookups: extension and fc_/fw_/pc_/pw_ prefix cut, builtins, then rand*, then files
+    static TextureReference presetTexture(const std::string &samplerName);
+    /// Image extensions TextureManager loads textures from, in the order it tries them
+    static const std::vector<std::string> &textureExtensions();
+
+private:
+    const ShaderCache &_cache;
+
+    void run(Job &job);
+
+#ifdef USE_THREADS
+    std::deque<std::weak_ptr<Job> > _queue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _finished;
+    std::thread _thread;
+
+    void work();
+#endif
+};
+
+#endif /* ShaderTranslator_hpp */
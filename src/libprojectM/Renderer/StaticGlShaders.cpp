@@ -471,82 +471,172 @@ void main(){
 }
 )";
 
-const std::string kPresetShaderHeaderGlsl330 = R"(
-#define  M_PI   3.14159265359
-#define  M_PI_2 6.28318530718
-#define  M_INV_PI_2  0.159154943091895
+// Instanced custom shapes. Each instance is sides fill triangles followed by sides
+// outline quads, built from gl_VertexID and the per instance attributes.
+const std::string kShapeInstancedVertexShaderGlsl330 = R"(
+layout(location = 0) in vec4 instance_position;     // x, y, rad, ang
+layout(location = 1) in vec4 instance_color;        // center
+layout(location = 2) in vec4 instance_color2;       // edge
+layout(location = 3) in vec4 instance_border_color;
+layout(location = 4) in vec2 instance_texture;      // tex_ang, tex_zoom
 
-uniform float4   rand_frame;    // random float4, updated each frame
-uniform float4   rand_preset;   // random float4, updated once per *preset*
-uniform float4   _c0;           // .xy: multiplier to use on UV's to paste
-                                // an image fullscreen, *aspect-aware*
-                                // .zw = inverse.
-uniform float4   _c1, _c2, _c3, _c4;
-uniform float4   _c5;           // .xy = scale, bias for reading blur1
-                                // .zw = scale, bias for reading blur2
-uniform float4   _c6;           // .xy = scale, bias for reading blur3
-                                // .zw = blur1_min, blur1_max
-uniform float4   _c7;           // .xy ~= float2(1024,768)
-                                // .zw ~= float2(1/1024.0, 1/768.0)
-uniform float4   _c8;           // .xyzw ~= 0.5 + 0.5 * cos(
-                                //   time * float4(~0.3, ~1.3, ~5, ~20))
-uniform float4   _c9;           // .xyzw ~= same, but using sin()
-uniform float4   _c10;          // .xyzw ~= 0.5 + 0.5 * cos(
-                                //   time * float4(~0.005, ~0.008, ~0.013,
-                                //                 ~0.022))
-uniform float4   _c11;          // .xyzw ~= same, but using sin()
-uniform float4   _c12;          // .xyz = mip info for main image
-                                // (.x=#across, .y=#down, .z=avg)
-                                // .w = unused
-uniform float4   _c13;          // .xy = blur2_min, blur2_max
-                                // .zw = blur3_min, blur3_max
-uniform float4   _qa;           // q vars bank 1 [q1-q4]
-uniform float4   _qb;           // q vars bank 2 [q5-q8]
-uniform float4   _qc;           // q vars ...
-uniform float4   _qd;           // q vars
-uniform float4   _qe;           // q vars
-uniform float4   _qf;           // q vars
-uniform float4   _qg;           // q vars
-uniform float4   _qh;           // q vars bank 8 [q29-q32]
+uniform mat4 vertex_transformation;
+uniform int sides;
+uniform float aspect;
+uniform vec2 line_width;    // half the outline width in clip space
+uniform float textured;
+uniform float master_alpha;
 
-// note: in general, don't use the current time w/the *dynamic* rotations!
+out vec4 fragment_color;
+out vec2 fragment_texture;
+out float fragment_textured;
 
-// four random, static rotations, randomized at preset load time.
-// minor translation component (<1).
-uniform float4x3 rot_s1;
-uniform float4x3 rot_s2;
-uniform float4x3 rot_s3;
-uniform float4x3 rot_s4;
+vec2 corner(int k, float angle){
+    float t = 6.28318530718 * float(k) / float(sides) + angle + 0.785398163;
+    return vec2(cos(t) * aspect, sin(t));
+}
 
-// four random, slowly changing rotations.
-uniform float4x3 rot_d1;
-uniform float4x3 rot_d2;
-uniform float4x3 rot_d3;
-uniform float4x3 rot_d4;
+void main(){
+    vec2 center = vec2(instance_position.x, 1.0 - instance_position.y);
+    float radius = instance_position.z * (0.707 * 0.707 * 0.707 * 1.04);
+
+    if (gl_VertexID < 3 * sides) {
+        int side = gl_VertexID / 3;
+        int vertex = gl_VertexID - side * 3;
+        vec2 position = center;
+        if (vertex == 0) {
+            fragment_color = instance_color;
+            fragment_texture = vec2(0.5, 0.5);
+        } else {
+            int k = side + vertex - 1;
+            position += radius * corner(k, instance_position.w);
+            fragment_color = instance_color2;
+            fragment_texture = vec2(0.5, 0.5) + 0.5 * corner(k, instance_texture.x) / instance_texture.y;
+        }
+        gl_Position = vertex_transformation * vec4(position, 0.0, 1.0);
+        fragment_textured = textured;
+    } else {
+        int index = gl_VertexID - 3 * sides;
+        int side = index / 6;
+        int vertex = index - side * 6;
+        int k = (vertex == 1 || vertex == 2 || vertex == 4) ? side + 1 : side;
+        float offset = (vertex == 2 || vertex == 4 || vertex == 5) ? 1.0 : -1.0;
+
+        vec4 start = vertex_transformation * vec4(center + radius * corner(side, instance_position.w), 0.0, 1.0);
+        vec4 end = vertex_transformation * vec4(center + radius * corner(side + 1, instance_position.w), 0.0, 1.0);
+        vec2 along = (end.xy - start.xy) / line_width;
+        float len = length(along);
+        vec2 normal = len > 0.0 ? vec2(-along.y, along.x) / len : vec2(0.0, 0.0);
+
+        gl_Position = (k == side ? start : end) + vec4(offset * normal * line_width, 0.0, 0.0);
+        fragment_color = instance_border_color;
+        fragment_texture = vec2(0.0, 0.0);
+        fragment_textured = 0.0;
+    }
+    fragment_color.a *= master_alpha;
+}
+)";
 
-// faster-changing.
-uniform float4x3 rot_f1;
-uniform float4x3 rot_f2;
-uniform float4x3 rot_f3;
-uniform float4x3 rot_f4;
+const std::string kShapeInstancedFragmentShaderGlsl330 = R"(
+precision mediump float;
 
-// very-fast-changing.
-uniform float4x3 rot_vf1;
-uniform float4x3 rot_vf2;
-uniform float4x3 rot_vf3;
-uniform float4x3 rot_vf4;
+in vec4 fragment_color;
+in vec2 fragment_texture;
+in float fragment_textured;
 
-// ultra-fast-changing.
-uniform float4x3 rot_uf1;
-uniform float4x3 rot_uf2;
-uniform float4x3 rot_uf3;
-uniform float4x3 rot_uf4;
+uniform sampler2D texture_sampler;
 
-// Random every frame.
-uniform float4x3 rot_rand1;
-uniform float4x3 rot_rand2;
-uniform float4x3 rot_rand3;
-uniform float4x3 rot_rand4;
+out vec4 color;
+
+void main(){
+    color = fragment_color * mix(vec4(1.0), texture(texture_sampler, fragment_texture), fragment_textured);
+}
+)";
+
+const std::string kPresetShaderHeaderGlsl330 = R"(
+#define  M_PI   3.14159265359
+#define  M_PI_2 6.28318530718
+#define  M_INV_PI_2  0.159154943091895
+
+// per frame constants, one std140 block shared by the warp and composite
+// programs (see ShaderEngine::PresetConstants for the matching layout)
+cbuffer PresetConstants
+{
+    float4   rand_frame;    // random float4, updated each frame
+    float4   rand_preset;   // random float4, updated once per *preset*
+    float4   _c0;           // .xy: multiplier to use on UV's to paste
+                            // an image fullscreen, *aspect-aware*
+                            // .zw = inverse.
+    float4   _c1;
+    float4   _c2;
+    float4   _c3;
+    float4   _c4;
+    float4   _c5;           // .xy = scale, bias for reading blur1
+                            // .zw = scale, bias for reading blur2
+    float4   _c6;           // .xy = scale, bias for reading blur3
+                            // .zw = blur1_min, blur1_max
+    float4   _c7;           // .xy ~= float2(1024,768)
+                            // .zw ~= float2(1/1024.0, 1/768.0)
+    float4   _c8;           // .xyzw ~= 0.5 + 0.5 * cos(
+                            //   time * float4(~0.3, ~1.3, ~5, ~20))
+    float4   _c9;           // .xyzw ~= same, but using sin()
+    float4   _c10;          // .xyzw ~= 0.5 + 0.5 * cos(
+                            //   time * float4(~0.005, ~0.008, ~0.013,
+                            //                 ~0.022))
+    float4   _c11;          // .xyzw ~= same, but using sin()
+    float4   _c12;          // .xyz = mip info for main image
+                            // (.x=#across, .y=#down, .z=avg)
+                            // .w = unused
+    float4   _c13;          // .xy = blur2_min, blur2_max
+                            // .zw = blur3_min, blur3_max
+    float4   _qa;           // q vars bank 1 [q1-q4]
+    float4   _qb;           // q vars bank 2 [q5-q8]
+    float4   _qc;           // q vars ...
+    float4   _qd;           // q vars
+    float4   _qe;           // q vars
+    float4   _qf;           // q vars
+    float4   _qg;           // q vars
+    float4   _qh;           // q vars bank 8 [q29-q32]
+
+    // note: in general, don't use the current time w/the *dynamic* rotations!
+
+    // four random, static rotations, randomized at preset load time.
+    // minor translation component (<1).
+    float4x3 rot_s1;
+    float4x3 rot_s2;
+    float4x3 rot_s3;
+    float4x3 rot_s4;
+
+    // four random, slowly changing rotations.
+    float4x3 rot_d1;
+    float4x3 rot_d2;
+    float4x3 rot_d3;
+    float4x3 rot_d4;
+
+    // faster-changing.
+    float4x3 rot_f1;
+    float4x3 rot_f2;
+    float4x3 rot_f3;
+    float4x3 rot_f4;
+
+    // very-fast-changing.
+    float4x3 rot_vf1;
+    float4x3 rot_vf2;
+    float4x3 rot_vf3;
+    float4x3 rot_vf4;
+
+    // ultra-fast-changing.
+    float4x3 rot_uf1;
+    float4x3 rot_uf2;
+    float4x3 rot_uf3;
+    float4x3 rot_uf4;
+
+    // Random every frame.
+    float4x3 rot_rand1;
+    float4x3 rot_rand2;
+    float4x3 rot_rand3;
+    float4x3 rot_rand4;
+};
 
 #define time     _c2.x
 #define fps      _c2.y
@@ -880,3 +970,24 @@ DECLARE_SHADER_ACCESSOR(BlurVertexShader);
 DECLARE_SHADER_ACCESSOR(Blur1FragmentShader);
 DECLARE_SHADER_ACCESSOR(Blur2FragmentShader);
 DECLARE_SHADER_ACCESSOR_NO_HEADER(PresetShaderHeader);
+
+// gl_VertexID and instanced draws need GLSL 3.30 / ES 3.00, older versions get no shader
+#define DECLARE_SHADER_ACCESSOR_GLSL330_ONLY(name)     \
+    std::string StaticGlShaders::Get##name() {         \
+        if (!use_gles_ && version_.major < 3) {        \
+            return std::string();                      \
+        }                                              \
+        return AddVersionHeader(k##name##Glsl330);     \
+    }
+
+DECLARE_SHADER_ACCESSOR_GLSL330_ONLY(ShapeInstancedVertexShader);
+DECLARE_SHADER_ACCESSOR_GLSL330_ONLY(ShapeInstancedFragmentShader);
+
+std::string StaticGlShaders::GetPresetShaderHeader(M4::GLSLGenerator::Version version) {
+    if (version == M4::GLSLGenerator::Version::Version_110 ||
+        version == M4::GLSLGenerator::Version::Version_120 ||
+        version == M4::GLSLGenerator::Version::Version_100_ES) {
+        return kPresetShaderHeaderGlsl120;
+    }
+    return kPresetShaderHeaderGlsl330;
+}
@@ -36,8 +36,15 @@ class StaticGlShaders {
     std::string GetBlurVertexShader();
     std::string GetBlur1FragmentShader();
     std::string GetBlur2FragmentShader();
+    // Empty when the GLSL version cannot do instancing.
+    std::string GetShapeInstancedVertexShader();
+    std::string GetShapeInstancedFragmentShader();
     std::string GetPresetShaderHeader();
 
+    // Returns the preset shader header for a GLSLGenerator version, without
+    // needing a GL context. Used by tools that translate presets offline.
+    static std::string GetPresetShaderHeader(M4::GLSLGenerator::Version version);
+
    private:
     // POD struct to store parsed GLSL version numbers.
     struct GlslVersion {
@@ -0,0 +1,112 @@
+//
+//  TextureLoader.cpp
+//  libprojectM
+//
+
+#include "TextureLoader.hpp"
+#include "SOIL2/SOIL2.h"
+#include "FileSystem.hpp"
+
+#include <cstring>
+
+
+TextureLoader::TextureLoader()
+#ifdef USE_THREADS
+    : _finished(false)
+#endif
+{
+#ifdef USE_THREADS
+    // decoding is the slow part of loading a texture, leave a core for rendering
+    unsigned int count = std::thread::hardware_concurrency();
+    count = count > 1 ? count - 1 : 1;
+    if (count > 4)
+        count = 4;
+    for (unsigned int i = 0; i < count; i++)
+        _threads.push_back(std::thread(&TextureLoader::work, this));
+#endif
+}
+
+TextureLoader::~TextureLoader()
+{
+#ifdef USE_THREADS
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = true;
+        _queue.clear();
+    }
+    _wake.notify_all();
+    for (size_t i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+#endif
+}
+
+void TextureLoader::submit(const std::shared_ptr<Job> &job)
+{
+#ifdef USE_THREADS
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(job);
+    }
+    _wake.notify_one();
+#else
+    run(*job);
+#endif
+}
+
+void TextureLoader::run(Job &job)
+{
+    job.ok = decode(job.path, job.pixels, job.width, job.height);
+    job.done = true;
+}
+
+#ifdef USE_THREADS
+void TextureLoader::work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _wake.wait(lock, [this] { return _finished || !_queue.empty(); });
+        if (_finished)
+            return;
+
+        // images of presets that were switched away from before we got to them are skipped
+        std::shared_ptr<Job> job = _queue.front().lock();
+        _queue.pop_front();
+        if (!job)
+            continue;
+
+        lock.unlock();
+        run(*job);
+        job.reset();
+        lock.lock();
+    }
+}
+#endif
+
+
+// the same pixels SOIL_load_OGL_texture(SOIL_FLAG_MULTIPLY_ALPHA) used to upload
+bool TextureLoader::decode(const std::string &path, std::vector<unsigned char> &pixels, int &width, int &height)
+{
+    // from a pack the image is decoded in place, without a copy
+    FileSystem::Contents contents;
+    if (!FileSystem::read(path, contents) || contents.size() == 0)
+        return false;
+
+    int channels;
+    unsigned char *data = SOIL_load_image_from_memory((const unsigned char *) contents.data(), (int) contents.size(),
+                                                      &width, &height, &channels, SOIL_LOAD_RGBA);
+    if (data == NULL)
+        return false;
+
+    size_t size = (size_t) width * height * 4;
+    pixels.resize(size);
+    memcpy(&pixels[0], data, size);
+    SOIL_free_image_data(data);
+
+    for (size_t i = 0; i < size; i += 4)
+    {
+        pixels[i+0] = (pixels[i+0] * pixels[i+3] + 128) >> 8;
+        pixels[i+1] = (pixels[i+1] * pixels[i+3] + 128) >> 8;
+        pixels[i+2] = (pixels[i+2] * pixels[i+3] + 128) >> 8;
+    }
+    return true;
+}
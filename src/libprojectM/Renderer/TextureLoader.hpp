@@ -0,0 +1,67 @@
+//
+//  TextureLoader.hpp
+//  libprojectM
+//
+//  Image decoding for preset textures. decode() touches no GL state, so TextureManager
+//  queues the images a preset asks for on a small pool of worker threads and uploads
+//  the decoded pixels on the render thread a few rows at a time, binding a placeholder
+//  until the whole image is on the GPU.
+//
+
+#ifndef TextureLoader_hpp
+#define TextureLoader_hpp
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+class TextureLoader
+{
+public:
+    /// One image. path is filled by the caller, the rest is valid once done is set.
+    struct Job
+    {
+        std::string path;
+
+        std::vector<unsigned char> pixels;  // RGBA, alpha premultiplied, top row first
+        int width;
+        int height;
+        bool ok;
+        std::atomic<bool> done;
+
+        Job() : width(0), height(0), ok(false), done(false) {}
+    };
+
+    TextureLoader();
+    ~TextureLoader();
+
+    /// Queues job. Built without threads it is decoded before this returns.
+    /// Dropping the last reference to a queued job cancels it.
+    void submit(const std::shared_ptr<Job> &job);
+
+    /// Decodes any image SOIL reads into premultiplied RGBA
+    static bool decode(const std::string &path, std::vector<unsigned char> &pixels, int &width, int &height);
+
+private:
+    void run(Job &job);
+
+#ifdef USE_THREADS
+    std::deque<std::weak_ptr<Job> > _queue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _finished;
+    std::vector<std::thread> _threads;
+
+    void work();
+#endif
+};
+
+#endif /* TextureLoader_hpp */
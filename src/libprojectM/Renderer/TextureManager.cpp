@@ -5,44 +5,35 @@
 #include "SOIL2/SOIL2.h"
 #include "TextureManager.hpp"
 #include "Common.hpp"
+#include "FileSystem.hpp"
 #include "IdleTextures.hpp"
 #include "Texture.hpp"
-
-/* OpenGL ES 2.0 cant handle converting textures fro GL_RGB to GL_RGBA via glTexImage2D
-http://docs.gl/es2/glTexImage2D
-
-This causes a GLError INVALID_OPERATION(0x502) whenever making a new Renderer or resizing it.
-
-So because of this, we switch to a PerlinNoiseWithAlpha class to generate the noise textures.
-*/
-#ifdef GL_ES_VERSION_2_0
-#include "PerlinNoiseWithAlpha.hpp"
-#define NOISE_INTERNAL_DATA_FORMAT GL_RGBA
-#else
 #include "PerlinNoise.hpp"
-#define NOISE_INTERNAL_DATA_FORMAT GL_RGB
-#endif
+#include "ShaderTranslator.hpp"
 
  
 #define NUM_BLUR_TEX    6
 
 
-TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX, const int texsizeY, std::string datadir):
-    presetsURL(_presetsURL) {
-        
-    extensions.push_back(".jpg");
-    extensions.push_back(".dds");
-    extensions.push_back(".png");
-    extensions.push_back(".tga");
-    extensions.push_back(".bmp");
-    extensions.push_back(".dib");
+TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX, const int texsizeY, std::string datadir,
+                               size_t _textureBudget):
+    presetsURL(_presetsURL), textureBudget(_textureBudget), uploadBudget(4 << 20), residentBytes(0), frame(0) {
+
+    // what user textures show while their image is loading
+    const unsigned char black[4] = { 0, 0, 0, 255 };
+    glGenTextures(1, &placeholder);
+    glBindTexture(GL_TEXTURE_2D, placeholder);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    extensions = ShaderTranslator::textureExtensions();
 
     std::vector<std::string> dirsToScan{datadir + "/presets", datadir + "/textures", _presetsURL};
     FileScanner fileScanner = FileScanner(dirsToScan, extensions);
 
-    // scan for textures
+    // scan for textures, they are loaded when a preset first uses them
     using namespace std::placeholders;
-    fileScanner.scan(std::bind(&TextureManager::loadTexture, this, _1, _2));
+    fileScanner.scan(std::bind(&TextureManager::indexTexture, this, _1, _2));
 
     Preload();
     // if not data directory specified from user code
@@ -62,6 +53,22 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     mainTexture->getSampler(GL_CLAMP_TO_EDGE, GL_NEAREST);
     textures["main"] = mainTexture;
 
+    // the caller's framebuffer (a headless context may have its own) stays bound
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+    mainTarget = new Texture("main", texsizeX, texsizeY, false);
+    glGenFramebuffers(1, &mainFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTarget->texID, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "[TextureManager] main framebuffer incomplete, falling back to copying the frame" << std::endl;
+        glDeleteFramebuffers(1, &mainFramebuffer);
+        mainFramebuffer = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
     // Initialize blur textures
     int w = texsizeX;
     int h = texsizeY;
@@ -94,16 +101,33 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
         blurTextures.push_back(textureBlur);
     }
 
-#ifdef GL_ES_VERSION_2_0
-    std::unique_ptr<PerlinNoiseWithAlpha> noise(new PerlinNoiseWithAlpha());
-#else
-    std::unique_ptr<PerlinNoise> noise(new PerlinNoise());
-#endif
+    if (mainFramebuffer)
+    {
+        blurFramebuffers.resize(blurTextures.size());
+        glGenFramebuffers(blurFramebuffers.size(), blurFramebuffers.data());
+        for (size_t i = 0; i < blurFramebuffers.size(); i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, blurTextures[i]->texID, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+                std::cerr << "[TextureManager] blur framebuffer incomplete, falling back to copying the blur passes" << std::endl;
+                glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+                glDeleteFramebuffers(blurFramebuffers.size(), blurFramebuffers.data());
+                blurFramebuffers.clear();
+                break;
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    }
+
+    // generated once per process, every instance uploads the same bytes
+    const PerlinNoise & noise = PerlinNoise::get();
 
     GLuint noise_texture_lq_lite;
     glGenTextures(1, &noise_texture_lq_lite);
     glBindTexture(GL_TEXTURE_2D, noise_texture_lq_lite);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0, NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT, noise->noise_lq_lite);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 32, 0, GL_RGBA, GL_UNSIGNED_BYTE, noise.noise_lq_lite);
     Texture * textureNoise_lq_lite = new Texture("noise_lq_lite", noise_texture_lq_lite, GL_TEXTURE_2D, 32, 32, false);
     textureNoise_lq_lite->getSampler(GL_REPEAT, GL_LINEAR);
     textures["noise_lq_lite"] = textureNoise_lq_lite;
@@ -111,7 +135,7 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     GLuint noise_texture_lq;
     glGenTextures(1, &noise_texture_lq);
     glBindTexture(GL_TEXTURE_2D, noise_texture_lq);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT, noise->noise_lq);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, noise.noise_lq);
     Texture * textureNoise_lq = new Texture("noise_lq", noise_texture_lq, GL_TEXTURE_2D, 256, 256, false);
     textureNoise_lq->getSampler(GL_REPEAT, GL_LINEAR);
     textures["noise_lq"] = textureNoise_lq;
@@ -119,7 +143,7 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     GLuint noise_texture_mq;
     glGenTextures(1, &noise_texture_mq);
     glBindTexture(GL_TEXTURE_2D, noise_texture_mq);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT, noise->noise_mq);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, noise.noise_mq);
     Texture * textureNoise_mq = new Texture("noise_mq", noise_texture_mq, GL_TEXTURE_2D, 256, 256, false);
     textureNoise_mq->getSampler(GL_REPEAT, GL_LINEAR);
     textures["noise_mq"] = textureNoise_mq;
@@ -127,7 +151,7 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     GLuint noise_texture_hq;
     glGenTextures(1, &noise_texture_hq);
     glBindTexture(GL_TEXTURE_2D, noise_texture_hq);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT, noise->noise_hq);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, noise.noise_hq);
     Texture * textureNoise_hq = new Texture("noise_hq", noise_texture_hq, GL_TEXTURE_2D, 256, 256, false);
     textureNoise_hq->getSampler(GL_REPEAT, GL_LINEAR);
     textures["noise_hq"] = textureNoise_hq;
@@ -135,7 +159,7 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     GLuint noise_texture_lq_vol;
     glGenTextures( 1, &noise_texture_lq_vol );
     glBindTexture( GL_TEXTURE_3D, noise_texture_lq_vol );
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, 32 ,32 ,32 ,0 ,NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT ,noise->noise_lq_vol);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, 32 ,32 ,32 ,0 ,GL_RGBA, GL_UNSIGNED_BYTE ,noise.noise_vol);
     Texture * textureNoise_lq_vol = new Texture("noisevol_lq", noise_texture_lq_vol, GL_TEXTURE_3D, 32, 32, false);
     textureNoise_lq_vol->getSampler(GL_REPEAT, GL_LINEAR);
     textures["noisevol_lq"] = textureNoise_lq_vol;
@@ -143,7 +167,7 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
     GLuint noise_texture_hq_vol;
     glGenTextures( 1, &noise_texture_hq_vol );
     glBindTexture( GL_TEXTURE_3D, noise_texture_hq_vol );
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, 32, 32, 32, 0, NOISE_INTERNAL_DATA_FORMAT, GL_FLOAT, noise->noise_hq_vol);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA, 32, 32, 32, 0, GL_RGBA, GL_UNSIGNED_BYTE, noise.noise_vol);
 
     Texture * textureNoise_hq_vol = new Texture("noisevol_hq", noise_texture_hq_vol, GL_TEXTURE_3D, 32, 32, false);
     textureNoise_hq_vol->getSampler(GL_REPEAT, GL_LINEAR);
@@ -154,6 +178,12 @@ TextureManager::TextureManager(const std::string _presetsURL, const int texsizeX
 TextureManager::~TextureManager()
 {
     Clear();
+    if (!blurFramebuffers.empty())
+        glDeleteFramebuffers(blurFramebuffers.size(), blurFramebuffers.data());
+    if (mainFramebuffer)
+        glDeleteFramebuffers(1, &mainFramebuffer);
+    delete mainTarget;
+    glDeleteTextures(1, &placeholder);
 }
 
 void TextureManager::Preload()
@@ -204,9 +234,29 @@ void TextureManager::Preload()
 void TextureManager::Clear()
 {
     for(std::map<std::string, Texture*>::const_iterator iter = textures.begin(); iter != textures.end(); iter++)
+    {
+        // the placeholder is shared, it goes with the manager
+        if (iter->second->texID == placeholder)
+            iter->second->texID = 0;
         delete(iter->second);
+    }
 
     textures.clear();
+
+    // the index survives, its textures load again when used
+    for (std::map<std::string, TextureFile>::iterator iter = textureFiles.begin(); iter != textureFiles.end(); ++iter)
+    {
+        TextureFile & file = iter->second;
+        if (file.upload != 0)
+            glDeleteTextures(1, &file.upload);
+        file.texture = NULL;
+        file.bytes = 0;
+        file.job.reset();
+        file.upload = 0;
+    }
+    fileTextures.clear();
+    loading.clear();
+    residentBytes = 0;
 }
 
 
@@ -231,7 +281,7 @@ TextureSamplerDesc TextureManager::getTexture(const std::string fullName, const
     }
 
     ExtractTextureSettings(fileName, wrap_mode, filter_mode, unqualifiedName);
-    if (textures.find(unqualifiedName) == textures.end())
+    if (!makeResident(unqualifiedName) || textures.find(unqualifiedName) == textures.end())
     {
         return TextureSamplerDesc(NULL, NULL);
     }
@@ -264,12 +314,13 @@ TextureSamplerDesc TextureManager::tryLoadingTexture(const std::string name)
         std::string filename = unqualifiedName + ext;
         std::string fullURL = presetsURL + PATH_SEPARATOR + filename;
 
-        texDesc = loadTexture(fullURL, name);
+        texDesc = loadTexture(fullURL, unqualifiedName);
 
         if (texDesc.first != NULL)
         {
             std::cerr << "Located texture " << name << std::endl;
-            break;
+            texDesc.second = texDesc.first->getSampler(wrap_mode, filter_mode);
+            return texDesc;
         }
     }
     
@@ -278,40 +329,194 @@ TextureSamplerDesc TextureManager::tryLoadingTexture(const std::string name)
     return texDesc;
 }
 
+void TextureManager::indexTexture(const std::string fileName, const std::string name)
+{
+    // a later directory overrides an earlier one, as when the scan loaded everything
+    std::map<std::string, TextureFile>::iterator iter = textureFiles.find(name);
+    if (iter != textureFiles.end())
+    {
+        if (iter->second.path != fileName)
+            iter->second.failed = false;
+        iter->second.path = fileName;
+        return;
+    }
+
+    TextureFile file;
+    file.path = fileName;
+    file.texture = NULL;
+    file.bytes = 0;
+    file.lastUsed = 0;
+    file.failed = false;
+    file.upload = 0;
+    file.uploadedRows = 0;
+    textureFiles[name] = file;
+}
+
 TextureSamplerDesc TextureManager::loadTexture(const std::string fileName, const std::string name)
 {
-    int width, height;
-//    std::cout << "Loading texture " << name << " at " << fileName << std::endl;
+    // the image is decoded in the background, here it only has to exist
+    if (!FileSystem::exists(fileName))
+        return TextureSamplerDesc(NULL, NULL);
 
-    unsigned int tex = SOIL_load_OGL_texture(
-                fileName.c_str(),
-                SOIL_LOAD_AUTO,
-                SOIL_CREATE_NEW_ID,
-                SOIL_FLAG_MULTIPLY_ALPHA
-                ,&width,&height);
+    indexTexture(fileName, name);
+    if (!makeResident(name))
+        return TextureSamplerDesc(NULL, NULL);
 
-    if (tex == 0)
+    Texture * texture = textureFiles[name].texture;
+    return TextureSamplerDesc(texture, texture->getSampler(GL_REPEAT, GL_LINEAR));
+}
+
+// Queues the image of a user texture for decoding if it is not on the GPU, false if it does
+// not decode. Names without an image (built in textures, main, blur) are always resident.
+bool TextureManager::makeResident(const std::string & name)
+{
+    std::map<std::string, TextureFile>::iterator iter = textureFiles.find(name);
+    if (iter == textureFiles.end())
+        return true;
+
+    TextureFile & file = iter->second;
+    file.lastUsed = frame;
+    if (file.failed)
+        return false;
+
+    if (file.texture == NULL)
     {
-        return TextureSamplerDesc(NULL, NULL);
+        GLint wrap_mode;
+        GLint filter_mode;
+        std::string unqualifiedName;
+
+        ExtractTextureSettings(name, wrap_mode, filter_mode, unqualifiedName);
+        file.texture = new Texture(unqualifiedName, placeholder, GL_TEXTURE_2D, 1, 1, true);
+        file.texture->getSampler(wrap_mode, filter_mode);
+
+        if (textures.find(name) != textures.end())
+            delete textures[name];
+        textures[name] = file.texture;
+        fileTextures[file.texture] = name;
     }
 
-    GLint wrap_mode;
-    GLint filter_mode;
-    std::string unqualifiedName;
+    if (file.bytes == 0 && !file.job)
+    {
+        file.job = std::make_shared<TextureLoader::Job>();
+        file.job->path = file.path;
+        loader.submit(file.job);
+        loading.push_back(name);
+    }
+    return true;
+}
 
-    ExtractTextureSettings(name, wrap_mode, filter_mode, unqualifiedName);
-    Texture * newTexture = new Texture(unqualifiedName, tex, GL_TEXTURE_2D, width, height, true);
-    Sampler * sampler = newTexture->getSampler(wrap_mode, filter_mode);
+void TextureManager::nextFrame()
+{
+    frame++;
+    uploadTextures();
+    evictTextures();
+}
+
+// Uploads decoded images, in the order they were asked for, until uploadBudget bytes went
+// to the GPU this frame. A large image is uploaded a band of rows at a time over several frames.
+void TextureManager::uploadTextures()
+{
+    size_t uploaded = 0;
+    for (size_t i = 0; i < loading.size(); )
+    {
+        if (uploadBudget != 0 && uploaded >= uploadBudget)
+            break;
+
+        TextureFile & file = textureFiles[loading[i]];
+        const TextureLoader::Job & job = *file.job;
+        if (!job.done)
+        {
+            i++;
+            continue;
+        }
+
+        if (!job.ok)
+        {
+            std::cerr << "[TextureManager] failed to load texture " << file.path << std::endl;
+            file.failed = true;
+            file.job.reset();
+            loading.erase(loading.begin() + i);
+            continue;
+        }
+
+        if (file.upload == 0)
+        {
+            glGenTextures(1, &file.upload);
+            glBindTexture(GL_TEXTURE_2D, file.upload);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, job.width, job.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            file.uploadedRows = 0;
+        }
+
+        size_t stride = (size_t) job.width * 4;
+        int rows = job.height - file.uploadedRows;
+        if (uploadBudget != 0)
+            rows = std::min(rows, std::max(1, (int) ((uploadBudget - uploaded) / stride)));
+
+        glBindTexture(GL_TEXTURE_2D, file.upload);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, file.uploadedRows, job.width, rows, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &job.pixels[file.uploadedRows * stride]);
+        file.uploadedRows += rows;
+        uploaded += rows * stride;
 
-    if (textures.find(name) != textures.end()) {
-        // found duplicate.. this could be optimized
-        delete textures[name];
+        if (file.uploadedRows < job.height)
+            break;
+
+        // complete, the texture leaves the placeholder. The path may have changed since it was evicted.
+        file.texture->texID = file.upload;
+        file.texture->width = job.width;
+        file.texture->height = job.height;
+        file.upload = 0;
+        file.bytes = (size_t) job.width * job.height * 4;
+        residentBytes += file.bytes;
+        file.job.reset();
+        loading.erase(loading.begin() + i);
     }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    textures[name] = newTexture;
-//    std::cout << "Loaded texture " << name << std::endl;
+// Drops the least recently used user textures until they fit the budget. Textures used in
+// this or the previous frame stay, a preset needing more than the budget gets it while it plays.
+void TextureManager::evictTextures()
+{
+    while (textureBudget != 0 && residentBytes > textureBudget)
+    {
+        TextureFile * oldest = NULL;
+        for (std::map<std::string, TextureFile>::iterator iter = textureFiles.begin(); iter != textureFiles.end(); ++iter)
+        {
+            TextureFile & file = iter->second;
+            if (file.bytes != 0 && file.lastUsed + 1 < frame && (oldest == NULL || file.lastUsed < oldest->lastUsed))
+                oldest = &file;
+        }
+        if (oldest == NULL)
+            return;
+
+        glDeleteTextures(1, &oldest->texture->texID);
+        oldest->texture->texID = placeholder;
+        residentBytes -= oldest->bytes;
+        oldest->bytes = 0;
+    }
+}
+
+void TextureManager::useTexture(Texture * texture)
+{
+    std::map<const Texture*, std::string>::const_iterator iter = fileTextures.find(texture);
+    if (iter == fileTextures.end())
+        return;
+
+    const TextureFile & file = textureFiles[iter->second];
+    if (!makeResident(iter->second))
+        return;
 
-    return TextureSamplerDesc(newTexture, sampler);
+    // a random copy follows its texture's GL name, which changes when it is uploaded
+    if (texture != file.texture)
+    {
+        texture->texID = file.texture->texID;
+        texture->width = file.texture->width;
+        texture->height = file.texture->height;
+    }
 }
 
 TextureSamplerDesc TextureManager::getRandomTextureName(std::string random_id)
@@ -334,18 +539,28 @@ TextureSamplerDesc TextureManager::getRandomTextureName(std::string random_id)
 
     for(std::map<std::string, Texture*>::const_iterator iter = textures.begin(); iter != textures.end(); iter++)
     {
-        if (iter->second->userTexture) {
+        if (iter->second->userTexture && textureFiles.find(iter->first) == textureFiles.end()) {
             if (textureNameFilter.empty() || iter->first.find(textureNameFilter) == 0)
                 user_texture_names.push_back(iter->first);
         }
     }
+    // textures in the library count whether or not they are loaded yet
+    for (std::map<std::string, TextureFile>::const_iterator iter = textureFiles.begin(); iter != textureFiles.end(); ++iter)
+    {
+        if (textureNameFilter.empty() || iter->first.find(textureNameFilter) == 0)
+            user_texture_names.push_back(iter->first);
+    }
 
     if (user_texture_names.size() > 0)
     {
         std::string random_name = user_texture_names[rand() % user_texture_names.size()];
+        if (!makeResident(random_name))
+            return TextureSamplerDesc(NULL, NULL);
         random_textures.push_back(random_id);
 
         Texture * randomTexture = new Texture(*textures[random_name]);
+        if (textureFiles.find(random_name) != textureFiles.end())
+            fileTextures[randomTexture] = random_name;
         Sampler * sampler = randomTexture->getSampler(wrap_mode, filter_mode);
         randomTexture->name = unqualifiedName;
         textures[random_id] = randomTexture;
@@ -413,8 +628,36 @@ const std::vector<Texture*> & TextureManager::getBlurTextures() const {
 }
 
 
+bool TextureManager::bindBlurTarget(size_t index)
+{
+    if (index >= blurFramebuffers.size())
+        return false;
+    glBindFramebuffer(GL_FRAMEBUFFER, blurFramebuffers[index]);
+    return true;
+}
+
+
+bool TextureManager::bindMainTarget()
+{
+    if (mainFramebuffer == 0)
+        return false;
+    glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+    return true;
+}
+
+
 void TextureManager::updateMainTexture()
 {
+    if (mainFramebuffer)
+    {
+        // the frame just rendered becomes the feedback texture, the old one the next target.
+        // Everything binds mainTexture->texID at draw time, so swapping the ids is enough.
+        std::swap(mainTexture->texID, mainTarget->texID);
+        glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mainTarget->texID, 0);
+        return;
+    }
+
     glBindTexture(GL_TEXTURE_2D, mainTexture->texID);
     glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, mainTexture->width, mainTexture->height);
     glBindTexture(GL_TEXTURE_2D, 0);
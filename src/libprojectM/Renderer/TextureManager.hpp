@@ -8,6 +8,7 @@
 #include "projectM-opengl.h"
 #include "Texture.hpp"
 #include "FileScanner.hpp"
+#include "TextureLoader.hpp"
 
 
 class TextureManager
@@ -15,25 +16,75 @@ class TextureManager
   std::string presetsURL;
   std::map<std::string, Texture*> textures;
   std::vector<Texture*> blurTextures;
+  // one per blur texture so the blur passes render straight into them, empty if FBOs are unusable
+  std::vector<GLuint> blurFramebuffers;
   Texture * mainTexture;
 
+  // pass 1 renders into mainTarget through mainFramebuffer while sampling mainTexture,
+  // updateMainTexture() then swaps the two. mainFramebuffer is 0 if FBOs are unusable.
+  Texture * mainTarget;
+  GLuint mainFramebuffer;
+
+  // user textures by name. The scan only records where they are, the image is decoded in
+  // the background the first time a preset uses it and uploaded by nextFrame(). Until then,
+  // and after it is evicted, its Texture (shaders hold the pointer) shows the placeholder.
+  struct TextureFile
+  {
+      std::string path;
+      Texture * texture;
+      size_t bytes;             // GPU memory while resident, 0 otherwise
+      unsigned long lastUsed;   // frame of the last use, for LRU eviction
+      bool failed;              // the image does not decode
+      std::shared_ptr<TextureLoader::Job> job;  // decode or upload in flight
+      GLuint upload;            // receives the decoded rows, replaces the placeholder when complete
+      int uploadedRows;
+  };
+  std::map<std::string, TextureFile> textureFiles;
+  // user textures and the random copies sharing their GL texture, by the name of their file
+  std::map<const Texture*, std::string> fileTextures;
+  // names with a job, in the order they were asked for
+  std::vector<std::string> loading;
+  TextureLoader loader;
+  GLuint placeholder;
+  size_t textureBudget;
+  size_t uploadBudget;
+  size_t residentBytes;
+  unsigned long frame;
+
   std::vector<std::string> random_textures;
-  TextureSamplerDesc loadTexture(const std::string name, const std::string imageUrl);
+  void indexTexture(const std::string fileName, const std::string name);
+  TextureSamplerDesc loadTexture(const std::string fileName, const std::string name);
+  bool makeResident(const std::string & name);
+  void uploadTextures();
+  void evictTextures();
   void ExtractTextureSettings(const std::string qualifiedName, GLint &_wrap_mode, GLint &_filter_mode, std::string & name);
   std::vector<std::string> extensions;
 
 public:
+  /// textureBudget is the GPU memory user textures may take in bytes, 0 for no limit
   TextureManager(std::string _presetsURL, const int texsizeX, const int texsizeY,
-                 std::string datadir = "");
+                 std::string datadir = "", size_t textureBudget = 0);
   ~TextureManager();
 
   void Clear();
   void Preload();
   TextureSamplerDesc tryLoadingTexture(const std::string name);
   TextureSamplerDesc getTexture(const std::string fullName, const GLenum defaultWrap, const GLenum defaultFilter);
+  /// Uploads texture again if it was evicted and marks it used this frame, call before binding it
+  void useTexture(Texture * texture);
+  void setTextureBudget(size_t bytes) { textureBudget = bytes; evictTextures(); }
+  /// Bytes of decoded images nextFrame() uploads per frame, 0 for no limit
+  void setUploadBudget(size_t bytes) { uploadBudget = bytes; }
+  /// Uploads decoded images within the upload budget and evicts what went unused if over
+  /// the texture budget. Call once per frame before rendering.
+  void nextFrame();
   const Texture * getMainTexture() const;
   const std::vector<Texture *> & getBlurTextures() const;
+  /// Binds the framebuffer of blur texture index, returns false when the pass has to be copied into it
+  bool bindBlurTarget(size_t index);
 
+  /// Binds the offscreen pass 1 target, returns false when pass 1 has to draw into the current framebuffer
+  bool bindMainTarget();
   void updateMainTexture();
 
   TextureSamplerDesc getRandomTextureName(std::string rand_name);
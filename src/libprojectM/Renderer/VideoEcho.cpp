@@ -11,7 +11,6 @@
 
 VideoEcho::VideoEcho(): a(0), zoom(1), orientation(Normal)
 {
-    Init();
 }
 
 VideoEcho::~VideoEcho()
@@ -30,6 +29,9 @@ void VideoEcho::InitVertexAttrib() {
 
 void VideoEcho::Draw(RenderContext &context)
 {
+		if (m_vaoID == 0)
+			Init();
+
 		int flipx=1, flipy=1;
 		switch (orientation)
 		{
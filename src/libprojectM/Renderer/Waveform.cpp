@@ -11,6 +11,7 @@
 #include <cmath>
 #include "BeatDetect.hpp"
 #include "ShaderEngine.hpp"
+#include "RenderBatch.hpp"
 #include <glm/gtc/type_ptr.hpp>
 #ifdef WIN32
 #include <functional>
@@ -29,16 +30,6 @@ Waveform::Waveform(int _samples)
 	scaling= 1; /* scale factor of waveform */
 	smoothing = 0; /* smooth factor of waveform */
 	sep = 0;
-
-    Init();
-}
-
-void Waveform::InitVertexAttrib() {
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ColoredPoint), (void*)0);    // points
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ColoredPoint), (void*)(sizeof(float)*2));    // colors
 }
 
 void Waveform::Draw(RenderContext &context)
@@ -78,54 +69,34 @@ void Waveform::Draw(RenderContext &context)
 		points[x] = PerPoint(points[x],waveContext);
 	}
 
-    std::vector<ColoredPoint> points_transf = points;
-
-    for (std::vector<ColoredPoint>::iterator iter = points_transf.begin(); iter != points_transf.end(); ++iter) {
-        (*iter).y = -( (*iter).y-1);
-        (*iter).a *= masterAlpha;
-    }
-
-    glBindBuffer(GL_ARRAY_BUFFER, m_vboID);
-
-    glBufferData(GL_ARRAY_BUFFER, sizeof(ColoredPoint) * samples_count, NULL, GL_DYNAMIC_DRAW);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(ColoredPoint) * samples_count, &points_transf[0], GL_DYNAMIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+	RenderBatch &batch = *context.batch;
 
-    glUseProgram(context.programID_v2f_c4f);
-
-    glUniformMatrix4fv(context.uniform_v2f_c4f_vertex_tranformation, 1, GL_FALSE, glm::value_ptr(context.mat_ortho));
-
-	if (additive)  glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-	else glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	if (additive)  batch.setBlend(GL_SRC_ALPHA, GL_ONE);
+	else batch.setBlend(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	batch.setUntextured();
 
 	if (thick)
 	{
-		glLineWidth(context.texsize <= 512 ? 2 : 2*context.texsize/512);
-
-#ifndef GL_TRANSITION
-		glPointSize(context.texsize <= 512 ? 2 : 2*context.texsize/512);
-#endif
-        glUniform1f(context.uniform_v2f_c4f_vertex_point_size, context.texsize <= 512 ? 2 : 2*context.texsize/512);
+		batch.setLineWidth(context.texsize <= 512 ? 2 : 2*context.texsize/512);
+		batch.setPointSize(context.texsize <= 512 ? 2 : 2*context.texsize/512);
+	}
+	else
+	{
+		batch.setLineWidth(context.texsize < 512 ? 1 : context.texsize/512);
+		batch.setPointSize(context.texsize <= 512 ? 1 : context.texsize/512);
 	}
-    else
-    {
-#ifndef GL_TRANSITION
-        glPointSize(context.texsize <= 512 ? 1 : context.texsize/512);
-#endif
-        glUniform1f(context.uniform_v2f_c4f_vertex_point_size, context.texsize <= 512 ? 1 : context.texsize/512);
-    }
-
-    glBindVertexArray(m_vaoID);
-
-    if (dots)	glDrawArrays(GL_POINTS,0,samples_count);
-    else  	glDrawArrays(GL_LINE_STRIP,0,samples_count);
-
-    glBindVertexArray(0);
-
-	glLineWidth(context.texsize < 512 ? 1 : context.texsize/512);
 
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	RenderBatch::Vertex *vertices = batch.draw(dots ? GL_POINTS : GL_LINE_STRIP, samples_count);
+	for (size_t x=0;x< samples_count;x++)
+	{
+		vertices[x].x = points[x].x;
+		vertices[x].y = -(points[x].y-1);
+		vertices[x].r = points[x].r;
+		vertices[x].g = points[x].g;
+		vertices[x].b = points[x].b;
+		vertices[x].a = points[x].a * masterAlpha;
+		vertices[x].u = vertices[x].v = 0;
+	}
 
 	delete[] value1;
 	delete[] value2;
@@ -53,7 +53,6 @@ public:
     int sep;  /* no idea what this is yet... */
 
     Waveform(int _samples);
-    void InitVertexAttrib();
     void Draw(RenderContext &context);
 
 private:
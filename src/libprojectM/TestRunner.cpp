@@ -6,6 +6,11 @@
 #include <MilkdropPresetFactory/Parser.hpp>
 #include <TestRunner.hpp>
 #include <MilkdropPresetFactory/Param.hpp>
+#include <PresetCatalog.hpp>
+#include <PresetLoader.hpp>
+#include <PresetNameIndex.hpp>
+#include <PackFile.hpp>
+#include <FeatureTrack.hpp>
 
 std::vector<Test *> TestRunner::tests;
 
@@ -20,6 +25,11 @@ bool TestRunner::run()
         tests.push_back(Parser::test());
         tests.push_back(Expr::test());
         tests.push_back(PCM::test());
+        tests.push_back(FeatureTrack::test());
+        tests.push_back(PresetCatalog::test());
+        tests.push_back(PresetLoader::test());
+        tests.push_back(PresetNameIndex::test());
+        tests.push_back(PackFile::test());
     }
 
     int count = 0;
@@ -36,6 +36,14 @@ TimeKeeper::TimeKeeper(double presetDuration, double smoothDuration, double hard
 
   }
 
+  void TimeKeeper::UpdateTimers(double currentTime)
+  {
+	_currentTime = currentTime;
+
+	_presetFrameA++;
+	_presetFrameB++;
+  }
+
   void TimeKeeper::StartPreset()
   {
     _isSmoothing = false;
@@ -17,6 +17,8 @@ public:
   TimeKeeper(double presetDuration, double smoothDuration, double hardcutDuration, double easterEgg);
 
   void UpdateTimers();
+  /// Advances to an externally supplied running time in seconds instead of the wall clock
+  void UpdateTimers(double currentTime);
 
   void StartPreset();
   void StartSmoothing();
@@ -47,13 +47,22 @@
 #include "PCM.hpp"                    //Sound data handler (buffering, FFT, etc.)
 
 #include <map>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#endif
 
 #include "Renderer.hpp"
 #include "PresetChooser.hpp"
+#include "PresetPrefetcher.hpp"
 #include "ConfigFile.h"
 #include "TextureManager.hpp"
+#include "ShaderCache.hpp"
 #include "TimeKeeper.hpp"
 #include "RenderItemMergeFunction.hpp"
+#include "FeatureTrack.hpp"
 
 #ifdef USE_THREADS
 #include "pthread.h"
@@ -70,6 +79,45 @@ pthread_mutex_t preset_mutex;
 
 namespace {
 constexpr int kMaxSwitchRetries = 10;
+
+bool makeDirectory(const std::string &dir)
+{
+#ifdef WIN32
+    return _mkdir(dir.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// presets-<hash of presetURL>.idx in the user's cache directory, $XDG_CACHE_HOME or ~/.cache
+// (%LOCALAPPDATA% on Windows) under projectM, one index per preset root. Empty when there is
+// no root or no cache directory, the index is then only kept in memory.
+std::string defaultPresetIndexFile(const std::string & presetURL)
+{
+    if (presetURL.empty())
+        return std::string();
+
+    std::string dir;
+#ifdef WIN32
+    const char *local = getenv("LOCALAPPDATA");
+    if (local != NULL && *local != 0)
+        dir = local;
+#else
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache != NULL && *cache == '/')
+        dir = cache;
+    else if (home != NULL && *home != 0)
+        dir = std::string(home) + PATH_SEPARATOR + ".cache";
+#endif
+    if (dir.empty() || !makeDirectory(dir))
+        return std::string();
+
+    dir += PATH_SEPARATOR + std::string("projectM");
+    if (!makeDirectory(dir))
+        return std::string();
+    return dir + PATH_SEPARATOR + "presets-" + ShaderCache::key(presetURL) + ".idx";
+}
 }
 
 projectM::~projectM()
@@ -83,6 +131,10 @@ projectM::~projectM()
     #endif
     std::cout << std::endl;
 #endif
+    // presets hand their outputs back to their factory, which destroyPresetTools() deletes
+    m_activePreset.reset();
+    m_activePreset2.reset();
+    m_pendingPreset.reset();
     destroyPresetTools();
 
     if ( renderer )
@@ -116,7 +168,7 @@ void projectM::projectM_resetTextures()
 
 projectM::projectM ( std::string config_file, int flags) :
         renderer ( 0 ), _pcm(0), beatDetect ( 0 ), _pipelineContext(new PipelineContext()), _pipelineContext2(new PipelineContext()), m_presetPos(0),
-        timeKeeper(NULL), m_flags(flags), _matcher(NULL), _merger(NULL)
+        m_presetPrefetcher(NULL), m_pendingHardCut(false), timeKeeper(NULL), m_featureTrackFrame(0), m_featureTrackAudioEnd(0), m_flags(flags), _matcher(NULL), _merger(NULL)
 {
     readConfig(config_file);
     projectM_reset();
@@ -126,7 +178,7 @@ projectM::projectM ( std::string config_file, int flags) :
 
 projectM::projectM(Settings settings, int flags):
         renderer ( 0 ), _pcm(0), beatDetect ( 0 ), _pipelineContext(new PipelineContext()), _pipelineContext2(new PipelineContext()), m_presetPos(0),
-        timeKeeper(NULL), m_flags(flags), _matcher(NULL), _merger(NULL)
+        m_presetPrefetcher(NULL), m_pendingHardCut(false), timeKeeper(NULL), m_featureTrackFrame(0), m_featureTrackAudioEnd(0), m_flags(flags), _matcher(NULL), _merger(NULL)
 {
     readSettings(settings);
     projectM_reset();
@@ -154,6 +206,13 @@ bool projectM::writeConfig(const std::string & configFile, const Settings & sett
     config.add("Easter Egg Parameter", settings.easterEgg);
     config.add("Shuffle Enabled", settings.shuffleEnabled);
     config.add("Soft Cut Ratings Enabled", settings.softCutRatingsEnabled);
+    config.add("Audio Hop Size", settings.audioHopSize);
+    config.add("Presentation Delay", settings.presentationDelay);
+    config.add("Shader Cache Directory", settings.shaderCacheDir);
+    config.add("Texture Budget", settings.textureBudget);
+    config.add("Texture Upload Budget", settings.textureUploadBudget);
+    config.add("Preset Index File", settings.presetIndexFile);
+    config.add("Preset Prefetch Count", settings.presetPrefetchCount);
     std::fstream file(configFile.c_str());
     if (file) {
         file << config;
@@ -231,6 +290,34 @@ void projectM::readConfig (const std::string & configFile )
     // Preset authors have developed their visualizations with the default of 1.0.
     _settings.beatSensitivity = config.read<float> ( "Beat Sensitivity", 1.0 );
 
+    // Audio Hop Size makes beat detection independent of the frame rate by analysing
+    // the audio in fixed steps of this many samples (512 is a good value). 0 analyses once per frame.
+    _settings.audioHopSize = config.read<int> ( "Audio Hop Size", 0 );
+
+    // Presentation Delay is the audio output latency in seconds (sound card, PA chain).
+    // Visuals are delayed by the same amount so they match what the audience hears.
+    _settings.presentationDelay = config.read<float> ( "Presentation Delay", 0.0 );
+
+    // Shader Cache Directory keeps translated preset shaders between runs, so presets
+    // seen before switch in without the HLSL translation and GLSL compile stall.
+    _settings.shaderCacheDir = config.read<string> ( "Shader Cache Directory", "" );
+
+    // Texture Budget caps the GPU memory of preset textures in megabytes. They load when first
+    // used and the least recently used ones are dropped, so big libraries start fast. 0 is no limit.
+    _settings.textureBudget = config.read<int> ( "Texture Budget", 256 );
+
+    // Texture Upload Budget is how many kilobytes of decoded texture images go to the GPU per
+    // frame. Images are decoded in the background, a placeholder shows until they are uploaded.
+    _settings.textureUploadBudget = config.read<int> ( "Texture Upload Budget", 4096 );
+
+    // Preset Index File remembers what is in the preset directory between runs, startup then
+    // only reads presets that were added or changed. Empty keeps it in the user's cache directory.
+    _settings.presetIndexFile = config.read<string> ( "Preset Index File", "" );
+
+    // Preset Prefetch Count is how many of the presets that may come next are built in the
+    // background, so switching does not hitch. 0 builds each preset when it is switched to.
+    _settings.presetPrefetchCount = config.read<int> ( "Preset Prefetch Count", 2 );
+
 
     projectM_init ( _settings.meshX, _settings.meshY, _settings.fps,
                 _settings.textureSize, _settings.windowWidth,_settings.windowHeight);
@@ -275,6 +362,13 @@ void projectM::readSettings (const Settings & settings )
     _settings.hardcutSensitivity = settings.hardcutSensitivity;
     
     _settings.beatSensitivity = settings.beatSensitivity;
+    _settings.audioHopSize = settings.audioHopSize;
+    _settings.presentationDelay = settings.presentationDelay;
+    _settings.shaderCacheDir = settings.shaderCacheDir;
+    _settings.textureBudget = settings.textureBudget;
+    _settings.textureUploadBudget = settings.textureUploadBudget;
+    _settings.presetIndexFile = settings.presetIndexFile;
+    _settings.presetPrefetchCount = settings.presetPrefetchCount;
     
     projectM_init ( _settings.meshX, _settings.meshY, _settings.fps,
                     _settings.textureSize, _settings.windowWidth,_settings.windowHeight);
@@ -347,7 +441,10 @@ Pipeline * projectM::renderFrameOnlyPass1(Pipeline *pPipeline) /*pPipeline is a
     int x, y;
 #endif
 
-    timeKeeper->UpdateTimers();
+    if (m_featureTrack)
+        timeKeeper->UpdateTimers((double)m_featureTrackFrame / m_featureTrack->fps());
+    else
+        timeKeeper->UpdateTimers();
 /*
     if (timeKeeper->IsSmoothing())
     {
@@ -366,12 +463,25 @@ Pipeline * projectM::renderFrameOnlyPass1(Pipeline *pPipeline) /*pPipeline is a
     pipelineContext().frame = timeKeeper->PresetFrameA();
     pipelineContext().progress = timeKeeper->PresetProgressA();
 
-    beatDetect->detectFromSamples();
+    if (m_featureTrack)
+    {
+        applyFeatureTrackFrame();
+    }
+    else
+    {
+        _pcm->alignToTime ( PCM::now() );
+        beatDetect->detectFromSamples();
+    }
 
     //m_activePreset->evaluateFrame();
 
-    //if the preset isn't locked and there are more presets
-    if ( renderer->noSwitch==false && !m_presetChooser->empty() )
+    // a preset switched to takes over once its shaders are linked, with its pipeline and
+    // programs together, until then the previous one keeps drawing with its own
+    if ( renderer->PresetShadersReady() && m_pendingPreset )
+        activatePreset(std::move(m_pendingPreset), m_pendingHardCut);
+
+    //if the preset isn't locked and there are more presets, and no switch is under way
+    if ( renderer->noSwitch==false && !m_presetChooser->empty() && !m_pendingPreset )
     {
         //if preset is done and we're not already switching
         if ( timeKeeper->PresetProgressA()>=1.0 && !timeKeeper->IsSmoothing())
@@ -502,6 +612,9 @@ void projectM::renderFrameEndOnSeparatePasses(Pipeline *pPipeline) {
     pPipeline->drawables.clear();
     }
   
+    if (renderer->isCapturing())
+        renderer->captureFrame(count, pipelineContext().time);
+
     count++;
 #ifndef WIN32
     /** Frame-rate limiter */
@@ -560,13 +673,19 @@ void projectM::projectM_init ( int gx, int gy, int fps, int texsize, int width,
     if (!_pcm)
         _pcm = new PCM();
     assert(pcm());
+    _pcm->setPresentationDelay ( _settings.presentationDelay );
     beatDetect = new BeatDetect ( _pcm );
+    if ( _settings.audioHopSize > 0 )
+        beatDetect->setHopSize ( _settings.audioHopSize );
 
     if ( _settings.fps > 0 )
         mspf= ( int ) ( 1000.0/ ( float ) _settings.fps );
     else mspf = 0;
 
     this->renderer = new Renderer ( width, height, gx, gy, beatDetect, settings().presetURL, settings().titleFontURL, settings().menuFontURL, settings().datadir );
+    renderer->setShaderCacheDirectory ( settings().shaderCacheDir );
+    renderer->setTextureBudget ( (size_t) std::max ( settings().textureBudget, 0 ) << 20 );
+    renderer->setTextureUploadBudget ( (size_t) std::max ( settings().textureUploadBudget, 0 ) << 10 );
 
     initPresetTools(gx, gy);
 
@@ -608,6 +727,70 @@ void projectM::projectM_resetengine()
 
 }
 
+bool projectM::loadFeatureTrack(const std::string & path)
+{
+    std::unique_ptr<FeatureTrack> track(new FeatureTrack());
+    if (!track->open(path))
+    {
+        std::cerr << "[projectM] failed to load feature track " << path << std::endl;
+        return false;
+    }
+    m_featureTrack = std::move(track);
+    m_featureTrackFrame = 0;
+    m_featureTrackAudioEnd = 0;
+    return true;
+}
+
+void projectM::unloadFeatureTrack()
+{
+    m_featureTrack.reset();
+    m_featureTrackFrame = 0;
+    m_featureTrackAudioEnd = 0;
+    _pcm->clearSpectrumBands();
+}
+
+void projectM::startCapture(const CaptureCallback & callback, int buffers)
+{
+    renderer->startCapture(callback, buffers);
+}
+
+void projectM::stopCapture()
+{
+    renderer->stopCapture();
+}
+
+bool projectM::isCapturing() const
+{
+    return renderer->isCapturing();
+}
+
+/* Feeds the next precomputed frame to the beat detector and PCM, the track holds its last frame once it ends.
+ * The spectrum comes from the track too, the audio is only there for the waveforms. */
+void projectM::applyFeatureTrackFrame()
+{
+    if (m_featureTrack->frameCount() == 0)
+        return;
+
+    size_t index = std::min(m_featureTrackFrame, m_featureTrack->frameCount() - 1);
+    const FeatureTrackFrame & frame = m_featureTrack->frame(index);
+    m_featureTrackFrame++;
+
+    beatDetect->vol_old = beatDetect->vol;
+    beatDetect->bass = frame.bass;
+    beatDetect->mid = frame.mid;
+    beatDetect->treb = frame.treb;
+    beatDetect->vol = frame.vol;
+    beatDetect->bass_att = frame.bass_att;
+    beatDetect->mid_att = frame.mid_att;
+    beatDetect->treb_att = frame.treb_att;
+    beatDetect->vol_att = frame.vol_att;
+    beatDetect->onset = frame.onset;
+    _pcm->setSpectrumBands(frame.bandsL, frame.bandsR);
+
+    // only the samples that arrived since the previous frame, a frame repeated past the end adds none
+    m_featureTrack->feedAudio(index, *_pcm, m_featureTrackAudioEnd);
+}
+
 /** Resets OpenGL state */
 void projectM::projectM_resetGL ( int w, int h )
 {
@@ -640,7 +823,11 @@ int projectM::initPresetTools(int gx, int gy)
 
     std::string url = (m_flags & FLAG_DISABLE_PLAYLIST_LOAD) ? std::string() : settings().presetURL;
 
-    if ( ( m_presetLoader = new PresetLoader ( gx, gy, url) ) == 0 )
+    std::string indexFile = settings().presetIndexFile;
+    if ( indexFile.empty() )
+        indexFile = defaultPresetIndexFile(url);
+
+    if ( ( m_presetLoader = new PresetLoader ( gx, gy, url, indexFile) ) == 0 )
     {
         m_presetLoader = 0;
         std::cerr << "[projectM] error allocating preset loader" << std::endl;
@@ -678,6 +865,9 @@ int projectM::initPresetTools(int gx, int gy)
 
     renderer->SetPipeline(m_activePreset->pipeline());
 
+    m_presetPrefetcher = new PresetPrefetcher(*m_presetLoader);
+    prefetchNextPresets();
+
     // Case where no valid presets exist in directory. Could also mean
     // playlist initialization was deferred
     if (m_presetChooser->empty())
@@ -706,6 +896,12 @@ int projectM::initPresetTools(int gx, int gy)
 
 void projectM::destroyPresetTools()
 {
+    // the presets it built ahead go back to the factories the loader owns
+    if ( m_presetPrefetcher )
+        delete ( m_presetPrefetcher );
+
+    m_presetPrefetcher = 0;
+    m_randomQueue.clear();
 
     if ( m_presetPos )
         delete ( m_presetPos );
@@ -739,6 +935,7 @@ void projectM::removePreset(unsigned int index) {
     size_t chooserIndex = **m_presetPos;
 
     m_presetLoader->removePreset(index);
+    invalidatePrefetchedPresets();
 
 
     // Case: no more presets, set iterator to end
@@ -798,19 +995,17 @@ void projectM::populatePresetMenu()
         if(isTextInputActive()) {
             // if a searchTerm is active, we will populate the preset menu with search terms instead of the page we are on.
             int h = 0;
-            std::string presetName = renderer->presetName();
-            int presetIndex = getSearchIndex(presetName);
-            for(unsigned int i = 0; i < getPlaylistSize(); i++) { // loop over all presets
-                if (caseInsensitiveSubstringFind(getPresetName(i), renderer->searchText()) != std::string::npos) { // if term matches
-                    if (h < renderer->textMenuPageSize) // limit to just one page, pagination is not needed.
-                    {
-                        h++;
-                        renderer->m_presetList.push_back({ h, getPresetName(i), "" }); // populate the renders preset list.
-                        if (h == presetIndex)
-                        {
-                            renderer->m_activePresetID = h;
-                        }
-                    }
+            unsigned int activeIndex;
+            bool active = selectedPresetIndex(activeIndex);
+            renderer->m_activePresetID = 0; // rows start at 1, none is highlighted unless the preset is found
+            std::vector<unsigned int> matches;
+            searchPresets(renderer->searchText(), 0, renderer->textMenuPageSize, matches); // limit to just one page, pagination is not needed.
+            for(unsigned int i = 0; i < matches.size(); i++) {
+                h++;
+                renderer->m_presetList.push_back({ h, getPresetName(matches[i]), "" }); // populate the renders preset list.
+                if (active && matches[i] == activeIndex) // the playing preset, by its playlist index
+                {
+                    renderer->m_activePresetID = h;
                 }
             }
         }
@@ -849,30 +1044,41 @@ bool projectM::startPresetTransition(bool hard_cut) {
     return false;
   }
 
-  if (hard_cut) {
-    m_activePreset = std::move(new_preset);
-    timeKeeper->StartPreset();
+  if (renderer->PresetShadersReady()) {
+    m_pendingPreset.reset();
+    activatePreset(std::move(new_preset), hard_cut);
   } else {
-    m_activePreset2 = std::move(new_preset);
-    timeKeeper->StartPreset();
-    timeKeeper->StartSmoothing();
+    m_pendingPreset = std::move(new_preset);
+    m_pendingHardCut = hard_cut;
   }
 
   presetSwitchedEvent(hard_cut, **m_presetPos);
   errorLoadingCurrentPreset = false;
 
   populatePresetMenu();
+  prefetchNextPresets();
 
   return true;
 }
 
+void projectM::activatePreset(std::unique_ptr<Preset> preset, bool hard_cut) {
+  if (hard_cut) {
+    m_activePreset = std::move(preset);
+    timeKeeper->StartPreset();
+  } else {
+    m_activePreset2 = std::move(preset);
+    timeKeeper->StartPreset();
+    timeKeeper->StartSmoothing();
+  }
+}
+
 void projectM::selectRandom(const bool hardCut) {
     if (m_presetChooser->empty())
         return;
     presetHistory.push_back(m_presetPos->lastIndex());
 
     for(int i = 0; i < kMaxSwitchRetries; ++i) {
-        *m_presetPos = m_presetChooser->weightedRandom(hardCut);
+        *m_presetPos = m_presetChooser->begin(nextRandomIndex(hardCut));
         if(startPresetTransition(hardCut)) {
             break;
         }
@@ -959,7 +1165,9 @@ std::unique_ptr<Preset> projectM::switchToCurrentPreset() {
   pthread_mutex_lock(&preset_mutex);
 #endif
   try {
-    new_preset = m_presetPos->allocate();
+    new_preset = m_presetPrefetcher->take(**m_presetPos);
+    if (new_preset == nullptr)
+      new_preset = m_presetPrefetcher->load(**m_presetPos);
   } catch (const PresetFactoryException &e) {
     std::cerr << "problem allocating target preset: " << e.message()
               << std::endl;
@@ -987,6 +1195,64 @@ std::unique_ptr<Preset> projectM::switchToCurrentPreset() {
   return new_preset;
 }
 
+/// The next random pick, drawn ahead by prefetchNextPresets() when it was for the same ratings
+std::size_t projectM::nextRandomIndex(bool hardCut) {
+    const PresetRatingType ratingType = hardCut || !settings().softCutRatingsEnabled ?
+        HARD_CUT_RATING_TYPE : SOFT_CUT_RATING_TYPE;
+
+    if (!m_randomQueue.empty() && m_randomQueue.front().second == ratingType &&
+        m_randomQueue.front().first < m_presetLoader->size()) {
+        std::size_t index = m_randomQueue.front().first;
+        m_randomQueue.pop_front();
+        return index;
+    }
+    m_randomQueue.clear();
+    return *m_presetChooser->weightedRandom(hardCut);
+}
+
+/// Asks for the presets the next switch is likely to go to: the following ones in
+/// playlist order, or when shuffling the one going forward again returns to and the
+/// next random picks of a timed switch.
+void projectM::prefetchNextPresets() {
+    std::vector<PresetIndex> next;
+    const std::size_t prefetchCount = settings().presetPrefetchCount > 0 ? settings().presetPrefetchCount : 0;
+    const std::size_t size = m_presetLoader->size();
+
+    if (prefetchCount > 0 && size > 0) {
+        if (settings().shuffleEnabled) {
+            if (!presetFuture.empty() && static_cast<std::size_t>(presetFuture.back()) < size)
+                next.push_back(presetFuture.back());
+
+            const PresetRatingType ratingType = settings().softCutRatingsEnabled ?
+                SOFT_CUT_RATING_TYPE : HARD_CUT_RATING_TYPE;
+            if (!m_randomQueue.empty() && m_randomQueue.front().second != ratingType)
+                m_randomQueue.clear();
+            while (next.size() + m_randomQueue.size() < prefetchCount)
+                m_randomQueue.push_back(std::make_pair(*m_presetChooser->weightedRandom(false), ratingType));
+            for (std::size_t i = 0; i < m_randomQueue.size() && next.size() < prefetchCount; i++)
+                next.push_back(m_randomQueue[i].first);
+        } else {
+            // from the idle preset, which sits at size, the playlist starts over
+            const std::size_t current = **m_presetPos;
+            std::size_t index = current;
+            while (next.size() < prefetchCount && next.size() < size) {
+                index = index + 1 < size ? index + 1 : 0;
+                if (index == current)
+                    break;
+                next.push_back(index);
+            }
+        }
+    }
+
+    m_presetPrefetcher->request(next);
+}
+
+/// The playlist changed under the presets built ahead and the random picks
+void projectM::invalidatePrefetchedPresets() {
+    m_presetPrefetcher->clear();
+    m_randomQueue.clear();
+}
+
 void projectM::setPresetLock ( bool isLocked )
 {
     renderer->noSwitch = isLocked;
@@ -1032,6 +1298,7 @@ std::string projectM::getPresetName ( unsigned int index ) const
 void projectM::clearPlaylist ( )
 {
     m_presetLoader->clear();
+    invalidatePrefetchedPresets();
     *m_presetPos = m_presetChooser->end();
 }
 
@@ -1061,6 +1328,9 @@ unsigned int projectM::getPlaylistSize() const
 
 void projectM::changePresetRating (unsigned int index, int rating, const PresetRatingType ratingType) {
     m_presetLoader->setRating(index, rating, ratingType);
+    // the random picks drawn ahead followed the old ratings
+    m_randomQueue.clear();
+    prefetchNextPresets();
     presetRatingChanged(index, rating, ratingType);
 }
 
@@ -1092,6 +1362,7 @@ void projectM::insertPresetURL(unsigned int index, const std::string & presetURL
     }
 
     m_presetLoader->insertPresetURL (index, presetURL, presetName, ratings);
+    invalidatePrefetchedPresets();
 
     if (atEndPosition)
         *m_presetPos = m_presetChooser->end();
@@ -1103,6 +1374,7 @@ void projectM::insertPresetURL(unsigned int index, const std::string & presetURL
 
 void projectM::changePresetName ( unsigned int index, std::string name ) {
     m_presetLoader->setPresetName(index, name);
+    invalidatePrefetchedPresets();
 }
 
 
@@ -1149,6 +1421,17 @@ unsigned int projectM::getPresetIndex(std::string& name) const
 	return m_presetLoader->getPresetIndex(name);
 }
 
+std::size_t projectM::searchPresets(const std::string & query, std::size_t offset, std::size_t limit,
+                                    std::vector<unsigned int> & indices) const
+{
+    std::vector<PresetNameIndex::Match> page;
+    std::size_t total = m_presetLoader->searchPresets(query, offset, limit, page);
+    indices.clear();
+    for (std::size_t i = 0; i < page.size(); i++)
+        indices.push_back(page[i].index);
+    return total;
+}
+
 // load preset based on name
 void projectM::selectPresetByName(std::string name, bool hardCut) {
 	unsigned int index = getPresetIndex(name);
@@ -74,15 +74,19 @@ class Renderer;
 class Preset;
 class PresetIterator;
 class PresetChooser;
+class PresetPrefetcher;
 class PresetLoader;
 class TimeKeeper;
 class Pipeline;
 class RenderItemMatcher;
 class MasterRenderItemMerge;
+class FeatureTrack;
 
 #include "Common.hpp"
 
 #include <memory>
+#include <functional>
+#include <deque>
 #ifdef WIN32
 #pragma warning (disable:4244)
 #pragma warning (disable:4305)
@@ -143,6 +147,28 @@ public:
         float easterEgg;
         bool shuffleEnabled;
         bool softCutRatingsEnabled;
+        /// Beat detection hop in samples. 0 analyses once per frame, otherwise audio is
+        /// analysed in fixed hops so the response does not depend on the frame rate.
+        int audioHopSize;
+        /// Seconds between audio reaching projectM and being heard, the analysed window is
+        /// delayed by this much so visuals line up with the speakers.
+        float presentationDelay;
+        /// Directory for translated preset shaders and program binaries, reused across runs.
+        /// Empty keeps the shader cache in memory only.
+        std::string shaderCacheDir;
+        /// Megabytes of GPU memory for preset textures. Textures load when a preset first
+        /// uses them and the least recently used are dropped beyond this. 0 for no limit.
+        int textureBudget;
+        /// Kilobytes of decoded texture images uploaded to the GPU per frame, so loading a
+        /// preset's textures does not stall a frame. 0 uploads everything at once.
+        int textureUploadBudget;
+        /// File the preset library index is kept in, so a restart only reads the presets that
+        /// changed. Empty puts it in $XDG_CACHE_HOME/projectM (~/.cache/projectM), one file per
+        /// presetURL, or keeps it in memory only when there is no such directory.
+        std::string presetIndexFile;
+        /// Presets built ahead on a background thread, the ones a switch is likely to go to
+        /// next, so the switch itself does not stall a frame. 0 builds them on the switch.
+        int presetPrefetchCount;
 
         Settings() :
             meshX(32),
@@ -160,7 +186,12 @@ public:
             aspectCorrection(true),
             easterEgg(0.0),
             shuffleEnabled(true),
-            softCutRatingsEnabled(false) {}
+            softCutRatingsEnabled(false),
+            audioHopSize(0),
+            presentationDelay(0.0),
+            textureBudget(256),
+            textureUploadBudget(4096),
+            presetPrefetchCount(2) {}
     };
 
   projectM(std::string config_file, int flags = FLAG_NONE);
@@ -235,6 +266,12 @@ public:
 
   unsigned int getPresetIndex(std::string &url) const;
 
+  /// Playlist indices of the presets whose names match query, best matches first and
+  /// typos forgiven. Fills indices with at most limit of them from offset on, so a
+  /// search UI can page through the results, and returns how many there are in all.
+  std::size_t searchPresets(const std::string & query, std::size_t offset, std::size_t limit,
+                            std::vector<unsigned int> & indices) const;
+
   /// Plays a preset immediately when given preset name
   void selectPresetByName(std::string name, bool hardCut = true);
 
@@ -306,6 +343,23 @@ public:
   inline PCM * pcm() {
 	  return _pcm;
   }
+
+  /// Replays a precomputed feature track (see FeatureTrack::analyze) instead of analysing live PCM.
+  /// Frame N of the render uses analysis frame N and running time N / track fps, so renders are reproducible.
+  bool loadFeatureTrack(const std::string & path);
+  void unloadFeatureTrack();
+
+  /// Receives a captured frame: width * height RGBA pixels, top row first, valid only during the call.
+  /// frame is the render frame counter and time the running time the frame was rendered with.
+  typedef std::function<void(const unsigned char *rgba, int width, int height, size_t frame, double time)> CaptureCallback;
+
+  /// Reads every rendered frame back through a ring of pixel buffer objects instead of a stalling glReadPixels.
+  /// Frames reach the callback in order from the rendering thread, up to buffers - 1 frames late.
+  void startCapture(const CaptureCallback & callback, int buffers = 3);
+  /// Hands over the frames still in flight and stops capturing. Needs the GL context current.
+  void stopCapture();
+  bool isCapturing() const;
+
   void *thread_func(void *vptr_args);
   PipelineContext & pipelineContext() { return *_pipelineContext; }
   PipelineContext & pipelineContext2() { return *_pipelineContext2; }
@@ -373,14 +427,34 @@ private:
   /// Provides accessor functions to choose presets
   PresetChooser * m_presetChooser;
 
+  /// Builds the presets likely to come next in the background
+  PresetPrefetcher * m_presetPrefetcher;
+
+  /// Random picks drawn ahead of time so their presets can be built ahead, with the
+  /// ratings each was drawn by
+  std::deque<std::pair<std::size_t, PresetRatingType> > m_randomQueue;
+  std::size_t nextRandomIndex(bool hardCut);
+  void prefetchNextPresets();
+  void invalidatePrefetchedPresets();
+
   /// Currently loaded preset
   std::unique_ptr<Preset> m_activePreset;
 
   /// Destination preset when smooth preset switching
   std::unique_ptr<Preset> m_activePreset2;
 
+  /// Preset switched to whose shaders are still being built, the active ones keep drawing until then
+  std::unique_ptr<Preset> m_pendingPreset;
+  bool m_pendingHardCut;
+
   TimeKeeper *timeKeeper;
 
+  /// Precomputed analysis replacing PCM/BeatDetect when loaded
+  std::unique_ptr<FeatureTrack> m_featureTrack;
+  size_t m_featureTrackFrame;
+  size_t m_featureTrackAudioEnd;   // audio frames of the track already in the PCM
+  void applyFeatureTrackFrame();
+
   int m_flags;
 
   RenderItemMatcher * _matcher;
@@ -393,6 +467,7 @@ private:
 
   std::unique_ptr<Preset> switchToCurrentPreset();
   bool startPresetTransition(bool hard_cut);
+  void activatePreset(std::unique_ptr<Preset> preset, bool hard_cut);
 
 
 
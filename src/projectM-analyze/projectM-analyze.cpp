@@ -0,0 +1,104 @@
+/**
+ * projectM -- Milkdrop-esque visualisation SDK
+ * Copyright (C)2020-2020 projectM Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * See 'LICENSE.txt' included within this release
+ *
+ */
+
+/*
+ * Offline audio analysis: writes a feature track that projectM::loadFeatureTrack()
+ * replays instead of analysing live PCM.
+ */
+
+#include <FeatureTrack.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static void usage(const char *argv0)
+{
+    std::cerr << "usage: " << argv0 << " [-f fps] [-r float|s16|s32|u8,channels,rate] input.wav output.pmft" << std::endl
+              << "  -f fps    analysis frames per second, must match the render frame rate (default 60)" << std::endl
+              << "  -r ...    input is headerless samples in the given format" << std::endl;
+}
+
+static bool parseRaw(const std::string &spec, FeatureTrack::RawFormat &raw)
+{
+    size_t comma1 = spec.find(',');
+    size_t comma2 = spec.find(',', comma1 + 1);
+    if (comma1 == std::string::npos || comma2 == std::string::npos)
+        return false;
+
+    std::string format = spec.substr(0, comma1);
+    if (format == "float")
+        raw.format = PCM_FORMAT_FLOAT;
+    else if (format == "s16")
+        raw.format = PCM_FORMAT_INT16;
+    else if (format == "s32")
+        raw.format = PCM_FORMAT_INT32;
+    else if (format == "u8")
+        raw.format = PCM_FORMAT_UINT8;
+    else
+        return false;
+
+    raw.channels = atoi(spec.substr(comma1 + 1, comma2 - comma1 - 1).c_str());
+    raw.sampleRate = atoi(spec.substr(comma2 + 1).c_str());
+    return raw.channels > 0 && raw.sampleRate > 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned fps = 60;
+    FeatureTrack::RawFormat raw;
+    bool isRaw = false;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (!strcmp(argv[arg], "-f") && arg + 1 < argc)
+            fps = atoi(argv[++arg]);
+        else if (!strcmp(argv[arg], "-r") && arg + 1 < argc && parseRaw(argv[arg + 1], raw))
+        {
+            isRaw = true;
+            arg++;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string error;
+    if (!FeatureTrack::analyze(argv[arg], argv[arg + 1], fps, error, isRaw ? &raw : nullptr))
+    {
+        std::cerr << argv[arg] << ": " << error << std::endl;
+        return 1;
+    }
+
+    FeatureTrack track;
+    if (!track.open(argv[arg + 1]))
+        return 1;
+    std::cout << argv[arg + 1] << ": " << track.frameCount() << " frames at " << track.fps() << " fps" << std::endl;
+    return 0;
+}
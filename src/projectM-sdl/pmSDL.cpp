@@ -37,31 +37,15 @@
 
 void projectMSDL::audioInputCallbackF32(void *userdata, unsigned char *stream, int len) {
     projectMSDL *app = (projectMSDL *) userdata;
-//    printf("\nLEN: %i\n", len);
-//    for (int i = 0; i < 64; i++)
-//        printf("%X ", stream[i]);
-    // stream is (i think) samples*channels floats (native byte order) of len BYTES
-    if (app->audioChannelsCount == 1)
-        app->pcm()->addPCMfloat((float *)stream, len/sizeof(float));
-    else if (app->audioChannelsCount == 2)
-        app->pcm()->addPCMfloat_2ch((float *)stream, len/sizeof(float));
-    else {
-        SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Multichannel audio not supported");
-        SDL_Quit();
-    }
+    // stream is frames*channels interleaved floats (native byte order) of len BYTES
+    size_t frames = len / (sizeof(float) * app->audioChannelsCount);
+    app->pcm()->addPCM(stream, PCM_FORMAT_FLOAT, app->audioChannelsCount, frames, app->audioSampleRate);
 }
 
 void projectMSDL::audioInputCallbackS16(void *userdata, unsigned char *stream, int len) {
-    //    printf("LEN: %i\n", len);
     projectMSDL *app = (projectMSDL *) userdata;
-    short pcm16[2][512];
-
-    for (int i = 0; i < 512; i++) {
-        for (int j = 0; j < app->audioChannelsCount; j++) {
-            pcm16[j][i] = stream[i+j];
-        }
-    }
-    app->pcm()->addPCM16(pcm16);
+    size_t frames = len / (sizeof(short) * app->audioChannelsCount);
+    app->pcm()->addPCM(stream, PCM_FORMAT_INT16, app->audioChannelsCount, frames, app->audioSampleRate);
 }
 
 int projectMSDL::toggleAudioInput() {
@@ -122,7 +106,9 @@ int projectMSDL::initAudioInput() {
     want.callback = projectMSDL::audioInputCallbackF32;
     want.userdata = this;
 
-    audioDeviceID = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(selectedAudioDevice, true), true, &want, &have, 0);
+    // PCM::addPCM() downmixes and resamples itself, so take whatever rate and layout the device prefers
+    audioDeviceID = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(selectedAudioDevice, true), true, &want, &have,
+                                        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
 
     if (audioDeviceID == 0) {
         SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Failed to open audio capture device: %s", SDL_GetError());
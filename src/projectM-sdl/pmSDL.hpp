@@ -134,7 +134,7 @@ private:
     unsigned int NumAudioDevices;
     unsigned int CurAudioDevice;
     unsigned short audioChannelsCount;
-    unsigned short audioSampleRate;
+    unsigned int audioSampleRate;
     unsigned short audioSampleCount;
     SDL_AudioFormat audioFormat;
     SDL_AudioDeviceID audioDeviceID;
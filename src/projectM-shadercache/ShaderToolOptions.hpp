@@ -0,0 +1,90 @@
+//
+//  ShaderToolOptions.hpp
+//  projectM-shadercache
+//
+//  The options projectM-shadercache and projectM-validate share: the GLSL version the
+//  devices generate and where presets' textures live, directories or packs. Samplers
+//  resolve through ShaderTranslator::presetTexture(), so both tools see a preset's
+//  textures the way ShaderEngine does.
+//
+
+#ifndef ShaderToolOptions_hpp
+#define ShaderToolOptions_hpp
+
+#include <Common.hpp>
+#include <FileSystem.hpp>
+#include <GLSLGenerator.h>
+#include <ShaderTranslator.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct ShaderToolOptions
+{
+    M4::GLSLGenerator::Version version;
+    std::vector<std::string> textureDirs;
+
+    ShaderToolOptions() : version(M4::GLSLGenerator::Version_330) {}
+
+    /// Usage lines of the options parse() takes
+    static const char *usage()
+    {
+        return "  -g ver    GLSL version the devices use, 330 (default), 300es or 120\n"
+               "  -t dir    where presets' textures live, repeatable (default: presetdir)\n";
+    }
+
+    /// Takes -g or -t at argv[arg] along with its value, false for anything else
+    bool parse(int argc, char **argv, int &arg)
+    {
+        if (arg + 1 >= argc)
+            return false;
+        if (!strcmp(argv[arg], "-t"))
+        {
+            textureDirs.push_back(argv[++arg]);
+            return true;
+        }
+        if (strcmp(argv[arg], "-g"))
+            return false;
+
+        const std::string name = argv[arg + 1];
+        if (name == "330")
+            version = M4::GLSLGenerator::Version_330;
+        else if (name == "300es")
+            version = M4::GLSLGenerator::Version_300_ES;
+        else if (name == "120")
+            version = M4::GLSLGenerator::Version_120;
+        else
+            return false;
+        arg++;
+        return true;
+    }
+
+    /// Without -t textures are looked for next to the presets
+    void setPresetDir(const std::string &presetDir)
+    {
+        if (textureDirs.empty())
+            textureDirs.push_back(presetDir);
+    }
+
+    /// Whether texture is an image TextureManager could load from one of textureDirs
+    bool textureExists(const std::string &texture) const
+    {
+        for (const std::string &dir : textureDirs)
+            for (const std::string &ext : ShaderTranslator::textureExtensions())
+                if (FileSystem::exists(dir + PATH_SEPARATOR + texture + ext))
+                    return true;
+        return false;
+    }
+
+    /// The sampler ShaderEngine declares for sampler_<name>. False when it is a file
+    /// texture that would fail to load, ShaderEngine then leaves the sampler out.
+    bool resolveSampler(const std::string &name, ShaderTranslator::Sampler &sampler) const
+    {
+        ShaderTranslator::TextureReference texture = ShaderTranslator::presetTexture(name);
+        sampler = ShaderTranslator::Sampler(name, texture.name, texture.volume);
+        return texture.source != ShaderTranslator::TextureReference::File || textureExists(texture.name);
+    }
+};
+
+#endif /* ShaderToolOptions_hpp */
@@ -0,0 +1,243 @@
+/**
+ * projectM -- Milkdrop-esque visualisation SDK
+ * Copyright (C)2020-2020 projectM Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * See 'LICENSE.txt' included within this release
+ *
+ */
+
+/*
+ * Offline preset shader translation: walks a preset tree and fills a shader cache
+ * directory with the GLSL of every warp and composite shader, keyed exactly as
+ * ShaderEngine keys them, so a device pointed at the directory ("Shader Cache
+ * Directory") skips HLSL translation. No GL context is needed.
+ */
+
+#include <FileScanner.hpp>
+#include <FileSystem.hpp>
+#include <ShaderCache.hpp>
+#include <ShaderTranslator.hpp>
+#include <StaticGlShaders.h>
+#include "ShaderToolOptions.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef USE_THREADS
+#include <thread>
+#endif
+
+namespace {
+
+struct Totals
+{
+    std::atomic<unsigned> translated;
+    std::atomic<unsigned> cached;
+    std::atomic<unsigned> failed;
+
+    Totals() : translated(0), cached(0), failed(0) {}
+};
+
+std::mutex outputMutex;
+
+void usage(const char *argv0)
+{
+    std::cerr << "usage: " << argv0 << " [-j jobs] [-g 330|300es|120] [-t texturedir]... presetdir cachedir" << std::endl
+              << "  -j jobs   translation threads (default: one per core)" << std::endl
+              << ShaderToolOptions::usage();
+}
+
+// the warp_N= / comp_N= lines of a .milk file, joined the way Parser::parse_string_block() does
+void readShaderBlocks(const std::string &path, std::string &warp, std::string &comp)
+{
+    // presets may sit in a pack
+    FileSystem::Contents contents;
+    if (!FileSystem::read(path, contents))
+        return;
+    std::istringstream file(std::string(contents.data(), contents.size()));
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::string *block = nullptr;
+        if (line.compare(0, 5, "warp_") == 0)
+            block = &warp;
+        else if (line.compare(0, 5, "comp_") == 0)
+            block = &comp;
+        size_t eq = line.find('=');
+        if (block == nullptr || eq == std::string::npos || eq + 1 >= line.size() || line[eq + 1] == '\r')
+            continue;
+
+        bool comment = false;
+        for (size_t i = eq + 1; i < line.size() && !comment; i++)
+        {
+            if (line[i] == '`')
+                continue;
+            comment = line[i] == '/' && i + 1 < line.size() && line[i + 1] == '/';
+            if (!comment)
+                block->push_back(line[i]);
+        }
+        if (comment || block->empty() || (*block)[block->size() - 1] != '\n')
+            block->push_back('\n');
+    }
+}
+
+void translateShader(const std::string &presetPath, bool warp, const std::string &programSource,
+                     const ShaderToolOptions &options, const ShaderCache &cache, Totals &totals)
+{
+    const char *typeString = warp ? "Warp" : "Comp";
+
+    std::string program;
+    if (!ShaderTranslator::presetProgram(warp, programSource, program))
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << presetPath << ": " << typeString << " shader has no shader_body" << std::endl;
+        totals.failed++;
+        return;
+    }
+
+    // the same sampler set ShaderEngine builds: builtins, referenced samplers, blur textures
+    std::map<std::string, ShaderTranslator::Sampler> samplers;
+    const char *const builtins[][2] = {
+        { "main", "main" }, { "fc_main", "main" }, { "pc_main", "main" }, { "fw_main", "main" }, { "pw_main", "main" },
+        { "noise_lq", "noise_lq" }, { "noise_lq_lite", "noise_lq_lite" }, { "noise_mq", "noise_mq" },
+        { "noise_hq", "noise_hq" }, { "noisevol_lq", "noisevol_lq" }, { "noisevol_hq", "noisevol_hq" }
+    };
+    for (const auto &builtin : builtins)
+        samplers.insert(std::make_pair(builtin[0], ShaderTranslator::Sampler(builtin[0], builtin[1], strncmp(builtin[0], "noisevol", 8) == 0)));
+
+    for (const std::string &name : ShaderTranslator::samplerNames(program))
+    {
+        ShaderTranslator::Sampler sampler("", "", false);
+        if (samplers.find(name) == samplers.end() && options.resolveSampler(name, sampler))
+            samplers.insert(std::make_pair(name, sampler));
+    }
+
+    int blurLevel = ShaderTranslator::blurLevel(program);
+    for (int level = 1; level <= blurLevel; level++)
+    {
+        std::string blur = "blur" + std::to_string(level);
+        samplers.erase(blur);
+        samplers.insert(std::make_pair(blur, ShaderTranslator::Sampler(blur, blur, false)));
+    }
+
+    ShaderTranslator::Job job;
+    job.source = ShaderTranslator::presetSource(warp, StaticGlShaders::GetPresetShaderHeader(options.version), program);
+    for (const auto &sampler : samplers)
+        job.samplers.push_back(sampler.second);
+    job.filename = presetPath;
+    job.typeString = typeString;
+    job.version = options.version;
+    const std::string key = ShaderTranslator::cacheKey(job);
+
+    std::string glsl;
+    if (cache.loadGlsl(key, glsl))
+    {
+        totals.cached++;
+        return;
+    }
+
+    if (!ShaderTranslator::translate(job.source, job.samplers, job.filename, job.typeString, job.version, glsl))
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << presetPath << ": " << typeString << " shader failed to translate" << std::endl;
+        totals.failed++;
+        return;
+    }
+
+    cache.storeGlsl(key, glsl);
+    totals.translated++;
+}
+
+void translatePreset(const std::string &path, const ShaderToolOptions &options, const ShaderCache &cache, Totals &totals)
+{
+    std::string warp, comp;
+    readShaderBlocks(path, warp, comp);
+    if (!warp.empty())
+        translateShader(path, true, warp, options, cache, totals);
+    if (!comp.empty())
+        translateShader(path, false, comp, options, cache, totals);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    ShaderToolOptions options;
+    unsigned jobs = 0;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (!strcmp(argv[arg], "-j") && arg + 1 < argc)
+            jobs = atoi(argv[++arg]);
+        else if (!options.parse(argc, argv, arg))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string presetDir = argv[arg];
+    options.setPresetDir(presetDir);
+
+    ShaderCache cache;
+    cache.setDirectory(argv[arg + 1]);
+
+    std::vector<std::string> roots(1, presetDir);
+    std::vector<std::string> extensions;
+    extensions.push_back(".milk");
+    extensions.push_back(".prjm");
+    std::vector<std::string> presets;
+    FileScanner scanner(roots, extensions);
+    scanner.scan([&presets](std::string &path, std::string &) { presets.push_back(path); });
+
+    Totals totals;
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i = next++; i < presets.size(); i = next++)
+            translatePreset(presets[i], options, cache, totals);
+    };
+
+#ifdef USE_THREADS
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < jobs; i++)
+        threads.push_back(std::thread(work));
+    work();
+    for (std::thread &thread : threads)
+        thread.join();
+#else
+    work();
+#endif
+
+    std::cout << presets.size() << " presets: " << totals.translated << " shaders translated, "
+              << totals.cached << " already cached, " << totals.failed << " failed" << std::endl;
+    return totals.failed ? 2 : 0;
+}
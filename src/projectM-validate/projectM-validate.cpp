@@ -0,0 +1,362 @@
+/**
+ * projectM -- Milkdrop-esque visualisation SDK
+ * Copyright (C)2020-2020 projectM Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * See 'LICENSE.txt' included within this release
+ *
+ */
+
+/*
+ * Preset library validation: loads every preset of a tree the way projectM does,
+ * without a GL context, and writes a JSON array with one object per preset. The
+ * tree and the texture directories may be .zip packs as well:
+ *
+ *   issues    lines the parser gave up on, calls to unknown functions and initial
+ *             conditions for parameters projectM does not have
+ *   shaders   whether the warp and composite shaders translate to GLSL
+ *   textures  every texture the shaders sample, and whether it would fail to load
+ *   cost      a static estimate of the work a frame takes: expression operators per
+ *             mesh vertex, per frame and per wave point, wave samples, shape
+ *             instances, and the blur level the shaders need
+ *   rating    1 to 5 from the estimate, cheapest highest, 0 when the preset failed
+ *             to load or a shader fails to translate
+ *
+ * The ratings are meant for PresetChooser's rating lists, so weighted random picks
+ * leave broken presets out and favour cheap ones on slow devices.
+ */
+
+#include <FileScanner.hpp>
+#include <FileSystem.hpp>
+#include <PresetFactoryManager.hpp>
+#include <Preset.hpp>
+#include <ShaderTranslator.hpp>
+#include <StaticGlShaders.h>
+#include <ShaderToolOptions.hpp>
+#include <MilkdropPresetFactory/MilkdropPreset.hpp>
+#include <MilkdropPresetFactory/CustomWave.hpp>
+#include <MilkdropPresetFactory/CustomShape.hpp>
+#include <MilkdropPresetFactory/PerPixelEqn.hpp>
+#include <MilkdropPresetFactory/PerPointEqn.hpp>
+#include <MilkdropPresetFactory/PerFrameEqn.hpp>
+#include <MilkdropPresetFactory/Expr.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options : public ShaderToolOptions
+{
+    int gx, gy;
+
+    Options() : gx(32), gy(24) {}
+};
+
+struct Cost
+{
+    unsigned long perPixelOps;      // per mesh vertex
+    unsigned long perFrameOps;      // preset, waves and shapes, shapes once per instance
+    unsigned long perPointOps;      // summed over the enabled waves
+    unsigned long waves;
+    unsigned long waveSamples;
+    unsigned long shapes;
+    unsigned long shapeInstances;
+    int blurLevel;
+
+    Cost() : perPixelOps(0), perFrameOps(0), perPointOps(0), waves(0), waveSamples(0),
+             shapes(0), shapeInstances(0), blurLevel(0) {}
+
+    /// expression operators evaluated per frame, the blur passes counted as a mesh each
+    unsigned long frameOps(const Options &options) const
+    {
+        unsigned long vertices = (unsigned long) (options.gx + 1) * (options.gy + 1);
+        return perPixelOps * vertices + perFrameOps + perPointOps + blurLevel * vertices;
+    }
+};
+
+struct Report
+{
+    std::string path;
+    std::string error;              // why the preset did not load, empty when it did
+    std::vector<MilkdropPreset::ParseIssue> issues;
+    std::vector<std::string> shaderErrors;
+    std::map<std::string, bool> textures;     // every texture the shaders sample, true when it is missing
+    Cost cost;
+};
+
+void usage(const char *argv0)
+{
+    std::cerr << "usage: " << argv0 << " [-m gx gy] [-g 330|300es|120] [-t texturedir]... presetdir report.json" << std::endl
+              << "  -m gx gy  per pixel mesh size the costs assume (default 32 24)" << std::endl
+              << ShaderToolOptions::usage();
+}
+
+void checkShader(bool warp, const std::string &programSource, const Options &options, Report &report)
+{
+    const char *typeString = warp ? "Warp" : "Comp";
+
+    std::string program;
+    if (!ShaderTranslator::presetProgram(warp, programSource, program))
+    {
+        report.shaderErrors.push_back(std::string(typeString) + " shader has no shader_body");
+        return;
+    }
+
+    // every sampler the program uses is declared, the missing textures are reported apart
+    std::vector<ShaderTranslator::Sampler> samplers;
+    std::set<std::string> declared;
+    const char *const builtins[] = { "main", "fc_main", "pc_main", "fw_main", "pw_main" };
+    for (const char *builtin : builtins)
+    {
+        samplers.push_back(ShaderTranslator::Sampler(builtin, "main", false));
+        declared.insert(builtin);
+    }
+    for (const std::string &name : ShaderTranslator::samplerNames(program))
+    {
+        ShaderTranslator::Sampler sampler("", "", false);
+        bool found = options.resolveSampler(name, sampler);
+        report.textures[sampler.textureName] |= !found;
+        if (declared.insert(name).second)
+            samplers.push_back(sampler);
+    }
+
+    int blurLevel = ShaderTranslator::blurLevel(program);
+    report.cost.blurLevel = std::max(report.cost.blurLevel, blurLevel);
+    for (int level = 1; level <= blurLevel; level++)
+    {
+        std::string blur = "blur" + std::to_string(level);
+        if (declared.insert(blur).second)
+            samplers.push_back(ShaderTranslator::Sampler(blur, blur, false));
+    }
+
+    std::string source = ShaderTranslator::presetSource(warp, StaticGlShaders::GetPresetShaderHeader(options.version), program);
+    std::string glsl;
+    if (!ShaderTranslator::translate(source, samplers, report.path, typeString, options.version, glsl))
+        report.shaderErrors.push_back(std::string(typeString) + " shader failed to translate");
+}
+
+void estimateCost(MilkdropPreset &preset, Cost &cost)
+{
+    for (const auto &eqn : preset.per_pixel_eqn_tree)
+        cost.perPixelOps += Expr::cost(eqn.second->assign_expr);
+    for (PerFrameEqn *eqn : preset.per_frame_eqn_tree)
+        cost.perFrameOps += Expr::cost(eqn->gen_expr);
+
+    for (CustomWave *wave : preset.customWaves)
+    {
+        // enabled and samples come from the initial conditions
+        wave->evalInitConds();
+        if (!wave->enabled)
+            continue;
+        cost.waves++;
+        cost.waveSamples += wave->samples;
+
+        unsigned long perPoint = 0;
+        for (PerPointEqn *eqn : wave->per_point_eqn_tree)
+            perPoint += Expr::cost(eqn->assign_expr);
+        cost.perPointOps += perPoint * wave->samples;
+        for (PerFrameEqn *eqn : wave->per_frame_eqn_tree)
+            cost.perFrameOps += Expr::cost(eqn->gen_expr);
+    }
+
+    for (CustomShape *shape : preset.customShapes)
+    {
+        shape->evalInitConds();
+        if (!shape->enabled)
+            continue;
+        cost.shapes++;
+        cost.shapeInstances += shape->num_inst;
+
+        unsigned long perFrame = 0;
+        for (PerFrameEqn *eqn : shape->per_frame_eqn_tree)
+            perFrame += Expr::cost(eqn->gen_expr);
+        cost.perFrameOps += perFrame * shape->num_inst;
+    }
+}
+
+Report validate(PresetFactoryManager &factories, const std::string &path, const std::string &name,
+                const Options &options)
+{
+    Report report;
+    report.path = path;
+
+    std::unique_ptr<Preset> preset;
+    try {
+        preset = factories.allocate(path, name);
+    } catch (const PresetFactoryException &e) {
+        report.error = e.message();
+        return report;
+    }
+    MilkdropPreset *milkdrop = dynamic_cast<MilkdropPreset *>(preset.get());
+    if (milkdrop == nullptr)
+    {
+        report.error = "not a Milkdrop preset";
+        return report;
+    }
+
+    report.issues = milkdrop->parseIssues;
+    estimateCost(*milkdrop, report.cost);
+
+    const PresetOutputs &outputs = milkdrop->presetOutputs();
+    if (!outputs.warpShader.programSource.empty())
+        checkShader(true, outputs.warpShader.programSource, options, report);
+    if (!outputs.compositeShader.programSource.empty())
+        checkShader(false, outputs.compositeShader.programSource, options, report);
+    return report;
+}
+
+int rating(const Report &report, const Options &options)
+{
+    if (!report.error.empty() || !report.shaderErrors.empty())
+        return 0;
+
+    // a default mesh of simple per pixel code is some 10k operators a frame
+    const unsigned long ops = report.cost.frameOps(options);
+    const unsigned long limits[] = { 20000, 80000, 320000, 1280000 };
+    int rating = 5;
+    for (unsigned long limit : limits)
+        if (ops > limit)
+            rating--;
+    return rating;
+}
+
+std::string quoted(const std::string &text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c == '\n')
+            out << "\\n";
+        else if ((unsigned char) c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+            out << escaped;
+        }
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+void writeReport(std::ostream &out, const Report &report, const Options &options)
+{
+    static const char *const kinds[] = { "parse error", "unknown function", "unknown param" };
+
+    out << "  {\n    \"path\": " << quoted(report.path) << ",\n";
+    if (!report.error.empty())
+        out << "    \"error\": " << quoted(report.error) << ",\n";
+
+    out << "    \"issues\": [";
+    for (size_t i = 0; i < report.issues.size(); i++)
+        out << (i ? ", " : "") << "{ \"kind\": \"" << kinds[report.issues[i].kind]
+            << "\", \"line\": " << report.issues[i].line << ", \"text\": " << quoted(report.issues[i].text) << " }";
+    out << "],\n    \"shaders\": [";
+    for (size_t i = 0; i < report.shaderErrors.size(); i++)
+        out << (i ? ", " : "") << quoted(report.shaderErrors[i]);
+    out << "],\n    \"textures\": [";
+    for (std::map<std::string, bool>::const_iterator it = report.textures.begin(); it != report.textures.end(); ++it)
+        out << (it != report.textures.begin() ? ", " : "") << "{ \"name\": " << quoted(it->first)
+            << ", \"missing\": " << (it->second ? "true" : "false") << " }";
+    out << "],\n";
+
+    const Cost &cost = report.cost;
+    out << "    \"cost\": { \"perPixelOps\": " << cost.perPixelOps << ", \"perFrameOps\": " << cost.perFrameOps
+        << ", \"perPointOps\": " << cost.perPointOps << ", \"waves\": " << cost.waves
+        << ", \"waveSamples\": " << cost.waveSamples << ", \"shapes\": " << cost.shapes
+        << ", \"shapeInstances\": " << cost.shapeInstances << ", \"blurLevel\": " << cost.blurLevel
+        << ", \"frameOps\": " << cost.frameOps(options) << " },\n";
+    out << "    \"rating\": " << rating(report, options) << "\n  }";
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (!strcmp(argv[arg], "-m") && arg + 2 < argc)
+        {
+            options.gx = atoi(argv[++arg]);
+            options.gy = atoi(argv[++arg]);
+        }
+        else if (!options.parse(argc, argv, arg))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2 || options.gx <= 0 || options.gy <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string presetDir = argv[arg];
+    options.setPresetDir(presetDir);
+
+    std::vector<std::string> roots(1, presetDir);
+    std::vector<std::string> extensions;
+    extensions.push_back(".milk");
+    extensions.push_back(".prjm");
+    std::vector<std::pair<std::string, std::string> > presets;
+    FileScanner scanner(roots, extensions);
+    scanner.scan([&presets](std::string &path, std::string &name) { presets.push_back(std::make_pair(path, name)); });
+    std::sort(presets.begin(), presets.end());
+
+    // the parser keeps its state in statics, presets are loaded one at a time
+    PresetFactoryManager factories;
+    factories.initialize(options.gx, options.gy);
+
+    // the library and the shader translator log on stdout, the report goes to a file
+    std::ofstream out(argv[arg + 1], std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "cannot write " << argv[arg + 1] << std::endl;
+        return 1;
+    }
+
+    unsigned failed = 0;
+    out << "[\n";
+    for (size_t i = 0; i < presets.size(); i++)
+    {
+        Report report = validate(factories, presets[i].first, presets[i].second, options);
+        if (rating(report, options) == 0)
+            failed++;
+        writeReport(out, report, options);
+        out << (i + 1 < presets.size() ? ",\n" : "\n");
+    }
+    out << "]" << std::endl;
+
+    std::cout << presets.size() << " presets, " << failed << " failed" << std::endl;
+    return failed ? 2 : 0;
+}